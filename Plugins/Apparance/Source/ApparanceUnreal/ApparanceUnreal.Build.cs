@@ -52,8 +52,22 @@ public class ApparanceUnreal : ModuleRules
 				"Engine",
 				"Slate",
 				"SlateCore",
+				"RenderCore",
+				"RHI",
 			}
 			);		
+
+		//direct physics body creation (heightfield collision)
+		if(Target.Version.MajorVersion >= 5)
+		{
+			PrivateDependencyModuleNames.AddRange(
+				new string[]
+				{
+					"PhysicsCore",
+					"Chaos",
+				}
+				);
+		}
 		
 		DynamicallyLoadedModuleNames.AddRange(
 			new string[]
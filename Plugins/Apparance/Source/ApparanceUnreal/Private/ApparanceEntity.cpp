@@ -30,11 +30,19 @@ PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
 #include "Materials/Material.h"
 #include "Materials/MaterialInstanceDynamic.h"
 #include "Engine/BlueprintGeneratedClass.h"
+#include "Hash/CityHash.h"
 
 // module
 #include "ApparanceUnreal.h"
+#include "ApparanceEngineSetup.h"
 #include "EntityRendering.h"
 #include "Geometry.h"
+#include "GeometryConversion.h"
+#include "ApparanceMeshComponent.h"
+#include "GeometryDeduplication.h"
+#include "GeometryCollision.h"
+#include "CollisionCache.h"
+#include "ApparanceHeightfieldComponent.h"
 #include "ApparanceEntityPreset.h"
 #include "ApparanceParametersComponent.h"
 #include "PhysicsEngine/BodySetup.h"
@@ -42,6 +50,7 @@ PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
 #include "Utility/ApparanceUtility.h"
 #include "Geometry/ApparanceRootComponent.h"
 #include "Support/SmartEditingState.h"
+#include "ApparanceInstancePool.h"
 
 #define LOCTEXT_NAMESPACE "ApparanceUnreal"
 
@@ -1307,13 +1316,29 @@ void AApparanceEntity::SetShown( bool is_shown )
 
 		//apply to components
 		RootComponent->SetVisibility( is_shown, true );
+
+		//and instances shared with other entities
+		UApparanceInstancePool* ppool = GetInstancePool();
+		for(const TPair<int, TArray<int>>& it : PooledInstances)
+		{
+			for(int handle : it.Value)
+			{
+				if(ppool)
+				{
+					ppool->SetInstancesVisible( handle, is_shown );
+				}
+			}
+		}
 		
 		//except for any collision		
-		for(TMap<int, TWeakObjectPtr<class UProceduralMeshComponent>>::TIterator It( CollisionCache ); It; ++It)
+		for(TMap<int, FCollisionCacheEntry>::TIterator It( CollisionCache ); It; ++It)
 		{
-			if(It.Value().IsValid())
+			for(const TWeakObjectPtr<UPrimitiveComponent>& pcomp : It.Value().Collision)
 			{
-				It.Value()->SetVisibility( false, false );
+				if(pcomp.IsValid())
+				{
+					pcomp->SetVisibility( false, false );
+				}
 			}
 		}
 	}
@@ -1458,6 +1483,21 @@ bool AApparanceEntity::FindFirstFrame( Apparance::Frame& frame_out, bool& worlds
 	return found;
 }
 
+// collision mode to use for a tier, most specific override wins (tier, entity, project)
+//
+EApparanceCollisionMode AApparanceEntity::GetCollisionMode( int tier_index ) const
+{
+	if(DetailTierCollisionModes.IsValidIndex( tier_index ) && DetailTierCollisionModes[tier_index] != EApparanceCollisionMode::Default)
+	{
+		return DetailTierCollisionModes[tier_index];
+	}
+	if(CollisionMode != EApparanceCollisionMode::Default)
+	{
+		return CollisionMode;
+	}
+	return UApparanceEngineSetup::GetCollisionMode();
+}
+
 // has this entity had a component of a particular type added procedurally?
 //
 bool AApparanceEntity::HasComponentOfType(const UClass* pcomponent_class) const
@@ -1877,8 +1917,11 @@ void AApparanceEntity::ValidateFrame( Apparance::Frame& frame )
 
 
 // find out if visual or collision geometry needed?
+// chunk_index: only consider parts in this spatial chunk (-1 for all)
+// geometry_collides: whether the geometry component can carry collision itself (if not, separate collision component is needed)
+// collision_mode: None means collision materials are ignored
 //
-void AssessGeometry( AApparanceEntity* pactor, Apparance::Host::IGeometry* geometry, int tier_index, bool& geometry_present, bool& collision_present )
+void AssessGeometry( AApparanceEntity* pactor, Apparance::Host::IGeometry* geometry, int tier_index, int chunk_index, bool geometry_collides, EApparanceCollisionMode collision_mode, bool& geometry_present, bool& collision_present )
 {
 	FEntityRendering* pentityrendering = pactor->GetEntityRendering();
 	geometry_present = false;
@@ -1890,10 +1933,15 @@ void AssessGeometry( AApparanceEntity* pactor, Apparance::Host::IGeometry* geome
 	for(int i = 0; i < parts.Num(); i++)
 	{
 		FApparanceGeometryPart* part = parts[i];
+		if(chunk_index >= 0 && part->GetChunkIndex() != chunk_index)
+		{
+			continue;
+		}
 
 		//material info
 		bool want_collision = false;
 		class UMaterialInterface* material_instance = pentityrendering->GetMaterial( part->Material, part->Parameters, part->Textures, tier_index, &want_collision );
+		want_collision &= collision_mode != EApparanceCollisionMode::None;
 
 		//geometry	
 		if(want_collision && !material_instance)
@@ -1909,7 +1957,14 @@ void AssessGeometry( AApparanceEntity* pactor, Apparance::Host::IGeometry* geome
 		{
 			//geometry, possibley collision
 			geometry_present = true;
-			collision_present = want_collision;
+			if(geometry_collides)
+			{
+				collision_present = want_collision;
+			}
+			else
+			{
+				collision_present |= want_collision;
+			}
 			if(collision_present) //both, don't need to keep checking
 			{
 				break;
@@ -1929,42 +1984,117 @@ extern int nGenLogCollisionVertices;
 #endif
 
 
+// mesh data for a part into a component section, either prepared on the synth thread or converted now
+// the data is moved into the component rather than copied, collision flag is only set on the component's section
+//
+static void SetMeshSection( UProceduralMeshComponent* pmc, int section_index, FApparanceGeometryPart* part, bool want_collision )
+{
+	FProcMeshSection section;
+	if(!part->TakePreparedSection( section ))
+	{
+		ApparanceBuildMeshSection( part, section, want_collision );
+	}
+	section.bEnableCollision = want_collision;
+	ApparanceMoveMeshSection( pmc, section_index, MoveTemp( section ) );
+}
+
+// identity of a component's collision sections, from the content hashes of the parts they were set from (sections are indexed as parts)
+// 0 if any part wasn't hashed, the collision cache hashes the triangles itself then
+//
+static uint64 CalcCollisionContentKey( UProceduralMeshComponent* pmc, Apparance::Host::IGeometry* geometry )
+{
+	const TArray<class FApparanceGeometryPart*>& parts = ((FApparanceGeometry*)geometry)->GetParts();
+	uint64 key = 0;
+	const int num_sections = pmc->GetNumSections();
+	for(int s = 0; s < num_sections; s++)
+	{
+		const FProcMeshSection* psection = pmc->GetProcMeshSection( s );
+		if(psection && psection->bEnableCollision)
+		{
+			const uint64 hash = parts.IsValidIndex( s ) ? parts[s]->GetContentHash() : 0;
+			if(!hash)
+			{
+				return 0;
+			}
+			key = CityHash128to64( Uint128_64( key + s, hash ) );
+		}
+	}
+	return key;
+}
+
 // set up from geometry content
 // tier is needed for corrent material instance setup and tracking
+// chunk is the spatial chunk to take parts from (-1 for all)
+// collision other than complex is built as simple shapes into collision_hulls instead of collision sections
+// height grid parts are extracted into heightfields in heightfield mode (where supported)
+// returns true if sections or hulls were added for the collision component (caller to update its collision once all are added)
 //
-void SetGeometry(UProceduralMeshComponent* pmc_geometry, UProceduralMeshComponent* pmc_collision, Apparance::Host::IGeometry* geometry, int tier_index)
+bool SetGeometry(UMeshComponent* pgeometry, UProceduralMeshComponent* pmc_collision, Apparance::Host::IGeometry* geometry, int tier_index, int chunk_index, EApparanceCollisionMode collision_mode, TArray<TArray<FVector>>& collision_hulls, TArray<FApparanceHeightfieldData>& heightfields)
 {
-	AApparanceEntity* pactor = CastChecked<AApparanceEntity>( pmc_geometry?pmc_geometry->GetOwner():pmc_collision->GetOwner() );
+	AApparanceEntity* pactor = CastChecked<AApparanceEntity>( pgeometry?pgeometry->GetOwner():pmc_collision->GetOwner() );
 	FEntityRendering* pentityrendering = pactor->GetEntityRendering();
+	UProceduralMeshComponent* pmc_geometry = Cast<UProceduralMeshComponent>( pgeometry );
+	UApparanceMeshComponent* pamc_geometry = Cast<UApparanceMeshComponent>( pgeometry );
 
 	//convert parts to meshes
 	FApparanceGeometry* pgeom = (FApparanceGeometry*)geometry;	//upcast to known internal type
 	const TArray<class FApparanceGeometryPart*>& parts = pgeom->GetParts();
+	bool collision_sections_added = false;
+	bool geometry_collision_added = false;
 	for (int i = 0; i < parts.Num(); i++)
 	{
 		FApparanceGeometryPart* part = parts[i];		
 
-		//conversion
-		int num_v = part->Positions.Num();
-		TArray<FColor> int_colours;
-		int_colours.AddZeroed( num_v );
-		TArray<FProcMeshTangent> tangents;
-		tangents.AddZeroed( num_v );
-		for (int v = 0; v < num_v ; v++)
+		//skip parts that were never populated, or are for other components
+		if(!part->HasPositions() || !part->HasIndices())
 		{
-			//3D space transform
-			part->Positions[v] = UNREALHANDEDNESS_FROM_APPARANCEHANDEDNESS(part->Positions[v]);
-			part->Normals[v] = UNREALHANDEDNESS_FROM_APPARANCEHANDEDNESS(part->Normals[v]);
-
-			//type conversions
-			tangents[v].TangentX = UNREALHANDEDNESS_FROM_APPARANCEHANDEDNESS( part->Tangents[v] );
-			tangents[v].bFlipTangentY = true;	//apparance maps bottom up?
-			int_colours[v] = part->Colours[v].QuantizeRound();
+			continue;
+		}
+		if(chunk_index >= 0 && part->GetChunkIndex() != chunk_index)
+		{
+			continue;
 		}
 
 		//material info
 		bool want_collision = false;
 		class UMaterialInterface* material_instance = pentityrendering->GetMaterial( part->Material, part->Parameters, part->Textures, tier_index, &want_collision );
+		want_collision &= collision_mode != EApparanceCollisionMode::None;
+		int num_v = part->GetVertexCount();
+
+		//terrain, heightfield if it's a regular grid, otherwise complex
+		if(want_collision && collision_mode == EApparanceCollisionMode::Heightfield)
+		{
+			FApparanceHeightfieldData heightfield;
+			if(APPARANCE_HEIGHTFIELD_COLLISION && ApparanceBuildHeightfield( part, heightfield ))
+			{
+				heightfields.Add( MoveTemp( heightfield ) );
+				GENLOG_INC( nGenLogCollisionParts )
+				want_collision = false;
+				if(!material_instance)
+				{
+					continue;
+				}
+			}
+		}
+		//simplified collision, shapes derived from the part instead of cooking its triangles
+		else if(want_collision && collision_mode != EApparanceCollisionMode::Complex)
+		{
+			if(pmc_collision)
+			{
+				ApparanceBuildSimpleCollision( part, collision_mode, UApparanceEngineSetup::GetCollisionVoxelResolution(), collision_hulls );
+				collision_sections_added = true;
+				GENLOG_INC( nGenLogCollisionParts )
+			}
+			else
+			{
+				UE_LOG( LogApparance, Warning, TEXT( "SetGeometry inconsistent collision presence logic in %s" ), *pactor->GetName() );
+			}
+			want_collision = false;
+			if(!material_instance)
+			{
+				continue;
+			}
+		}
 
 		//geometry	
 		if(want_collision && !material_instance)
@@ -1972,10 +2102,11 @@ void SetGeometry(UProceduralMeshComponent* pmc_geometry, UProceduralMeshComponen
 			//just collision? doesn't render
 			if(pmc_collision)
 			{
-				pmc_collision->CreateMeshSection( i, part->Positions, part->Triangles, part->Normals, part->UVs[0], part->UVs[1], part->UVs[2], part->UVs[2/*only three available*/], int_colours, tangents, true );
+				SetMeshSection( pmc_collision, i, part, true );
+				collision_sections_added = true;
 				GENLOG_ACC( nGenLogCollisionVertices, num_v )
 				GENLOG_INC( nGenLogCollisionParts )
-				GENLOG_ACC( nGenLogCollisionTriangles, part->Triangles.Num() / 3 )
+				GENLOG_ACC( nGenLogCollisionTriangles, part->GetTriangleCount() )
 			}
 			else
 			{
@@ -1987,25 +2118,59 @@ void SetGeometry(UProceduralMeshComponent* pmc_geometry, UProceduralMeshComponen
 			if(pmc_geometry)
 			{
 				//geometry, maybe collision
-				pmc_geometry->CreateMeshSection( i, part->Positions, part->Triangles, part->Normals, part->UVs[0], part->UVs[1], part->UVs[2], part->UVs[2/*only three available*/], int_colours, tangents, want_collision );
+				SetMeshSection( pmc_geometry, i, part, want_collision );
+				geometry_collision_added |= want_collision;
 				GENLOG_INC( nGenLogParts )
 				GENLOG_ACC( nGenLogVertices, num_v )
-				GENLOG_ACC( nGenLogTriangles, part->Triangles.Num() / 3 )
+				GENLOG_ACC( nGenLogTriangles, part->GetTriangleCount() )
 				if(want_collision)
 				{
 					GENLOG_INC( nGenLogCollisionParts )
 					GENLOG_ACC( nGenLogCollisionVertices, num_v )
-					GENLOG_ACC( nGenLogCollisionTriangles, part->Triangles.Num() / 3 )
+					GENLOG_ACC( nGenLogCollisionTriangles, part->GetTriangleCount() )
 				}
 				//materials
 				pmc_geometry->SetMaterial( i, material_instance );
 			}
+			else if(pamc_geometry)
+			{
+				//geometry, render only (shared with identical geometry elsewhere if hashed)
+				pamc_geometry->SetSection( i, g_ApparanceGeometryDeduplication.Acquire( part ) );
+				pamc_geometry->SetMaterial( i, material_instance );
+				GENLOG_INC( nGenLogParts )
+				GENLOG_ACC( nGenLogVertices, num_v )
+				GENLOG_ACC( nGenLogTriangles, part->GetTriangleCount() )
+
+				//collision goes separately
+				if(want_collision)
+				{
+					if(pmc_collision)
+					{
+						SetMeshSection( pmc_collision, i, part, true );
+						collision_sections_added = true;
+						GENLOG_INC( nGenLogCollisionParts )
+						GENLOG_ACC( nGenLogCollisionVertices, num_v )
+						GENLOG_ACC( nGenLogCollisionTriangles, part->GetTriangleCount() )
+					}
+					else
+					{
+						UE_LOG( LogApparance, Warning, TEXT( "SetGeometry inconsistent collision presence logic in %s" ), *pactor->GetName() );
+					}
+				}
+			}
 			else
 			{
 				UE_LOG( LogApparance, Warning, TEXT( "SetGeometry inconsistent geometry presence logic in %s" ), *pactor->GetName() );
 			}
 		}
 	}
+
+	//SetProcMeshSection doesn't rebuild collision itself, need explicit update
+	if(geometry_collision_added)
+	{
+		g_ApparanceCollisionCache.UpdateCollision( pmc_geometry, nullptr, CalcCollisionContentKey( pmc_geometry, geometry ) );
+	}
+	return collision_sections_added;
 }
 
 //start of geometry update phase
@@ -2016,102 +2181,66 @@ void AApparanceEntity::BeginGeometryUpdate()
 }
 
 //end of geometry update phase
-void AApparanceEntity::EndGeometryUpdate(int tier_index)
+void AApparanceEntity::EndGeometryUpdate(int geometry_id, int tier_index)
 {
-	if (tier_index >= 0)	//workaround to avoid instance mesh thrashing by editing content changes (we don't currently distinguish between main, tiers, or editor content))
-	{
 	//update instanced static meshes with accumulated mesh state
-		if (bUseMeshInstancing)
+	if (bUseMeshInstancing)
 	{
-		for (int i = 0; i < InstanceMeshCache.Num(); i++)
-		{
-			//for each mesh
-			FInstancedMeshCacheEntry& cache_entry = InstanceMeshCache[i];
-			UInstancedStaticMeshComponent* pismc = cache_entry.InstancedMeshes.Get();
-			TArray<FTransform>* pending = cache_entry.PendingInstances.Get();
-			if (pismc)
-			{
-				//change required?
-				int num_current = pismc->GetInstanceCount();
-				int num_needed = pending ? pending->Num() : 0;
-				int to_add = num_needed - num_current;
-				int to_remove = -to_add;
-				
-				//resize
-					if (to_add > 0)
-				{
-					//add
-#if UE_VERSION_AT_LEAST(5,1,0)
-						pismc->PreAllocateInstancesMemory(to_add);
-					TArray<FTransform> adding;
-						adding.AddDefaulted(to_add);
-						pismc->AddInstances(adding, false, false);
-#else
-					while (num_current < num_needed)
-					{
-						pismc->AddInstance(FTransform());
-						num_current++;
-					}
-#endif
-				}
-					else if (to_remove > 0)
-				{
-					if (num_needed == 0)
-					{
-						pismc->ClearInstances();
-					}
-					else
-					{
-						//shrink
-#if UE_VERSION_AT_LEAST(5,1,0)
-						TArray<int32> removing;
-							for (int idx = num_current - 1; idx >= num_needed; idx--)
-						{
-								removing.Add(idx);
-						}
-							pismc->RemoveInstances(removing);
-#else
-							while (num_current > num_needed)
-						{
-							num_current--;
-								pismc->RemoveInstance(num_current);
-						}
-#endif
-					}
-				}
-				
-				//apply transforms, in bulk
-				const auto* transforms = pending;
-				if(!transforms) //protect against previously dumped list
-				{
-					static TArray<FTransform> empty;
-					transforms = &empty;
-				}
-				if (pending)
-				{				
-					pismc->BatchUpdateInstancesTransforms(0, *transforms, false, true, true/*teleport to avoid blur*/);
-				}
-
-				//done with them now, dump
-				cache_entry.PendingInstances.Reset();
-			}
-		}
+		PlaceInstancedMeshes( geometry_id );
 	}
 	else
 	{
 		//not using, ensure any prev use is cleared out
 		RemoveAllInstancedMeshes();
 	}
-	}
 
 	//fire completion event (for BPs)
 	ReceiveGenerationComplete();
 }
 
+// place instances pending for a piece of geometry
+// only its instances are touched (others may still be part way through being added)
+//
+void AApparanceEntity::PlaceInstancedMeshes(int geometry_id)
+{
+	for (int i = 0; i < InstanceMeshCache.Num(); i++)
+	{
+		//for each mesh, place the geometry's instances
+		FInstancedMeshCacheEntry& cache_entry = InstanceMeshCache[i];
+		TArray<FTransform> pending;
+		if (cache_entry.PendingInstances.RemoveAndCopyValue( geometry_id, pending ))
+		{
+			cache_entry.PlaceInstances( geometry_id, pending );
+		}
+	}
+
+	//shared instances, by mesh
+	TMap<TWeakObjectPtr<UStaticMesh>, TArray<FTransform>> pooled;
+	UApparanceInstancePool* ppool = GetInstancePool();
+	if (PooledPendingInstances.RemoveAndCopyValue( geometry_id, pooled ) && ppool)
+	{
+		const FName collision_profile = GetDefault<UInstancedStaticMeshComponent>()->GetCollisionProfileName();
+		for (const TPair<TWeakObjectPtr<UStaticMesh>, TArray<FTransform>>& it : pooled)
+		{
+			int handle = ppool->AddInstances( it.Key.Get(), TArray<UMaterialInterface*>(), collision_profile, it.Value );
+			if (handle)
+			{
+				PooledInstances.FindOrAdd( geometry_id ).Add( handle );
+				if (!bShown)
+				{
+					ppool->SetInstancesVisible( handle, false );
+				}
+			}
+		}
+	}
+}
+
 // entity rendering geometry access
-class UProceduralMeshComponent* AApparanceEntity::AddGeometry(Apparance::Host::IGeometry* geometry, int tier_index, FVector unreal_offset, UProceduralMeshComponent*& pcollision_mesh_out )
+// one geometry component per spatial chunk the geometry occupies (null for chunks with nothing to render), plus any separate collision (mesh, and heightfields)
+void AApparanceEntity::AddGeometry(Apparance::Host::IGeometry* geometry, int tier_index, FVector unreal_offset, TArray<UMeshComponent*>& geometry_out, TArray<UPrimitiveComponent*>& collision_out )
 {
 	FApparanceGeometry* pag = (FApparanceGeometry*)geometry;	//upcast to known internal type
+	const int chunk_count = pag->GetChunkCount();
 
 	//create container for this geometry
 	FName geometry_name = NAME_None;
@@ -2122,15 +2251,40 @@ class UProceduralMeshComponent* AApparanceEntity::AddGeometry(Apparance::Host::I
 	collision_name = FName( "ProceduralCollision", tier_index );
 #endif
 
+	//render only geometry component?
+	const bool use_mesh_component = UApparanceEngineSetup::GetUseApparanceMeshComponent();
+	//only complex collision can be carried by the geometry component itself
+	const EApparanceCollisionMode collision_mode = GetCollisionMode( tier_index );
+	const bool geometry_collides = !use_mesh_component && collision_mode == EApparanceCollisionMode::Complex;
+
 	//pre-scan to work out what component(s) we may need
 	bool geometry_present, collision_present;
-	AssessGeometry( this, geometry, tier_index, geometry_present, collision_present );
+	AssessGeometry( this, geometry, tier_index, -1, geometry_collides, collision_mode, geometry_present, collision_present );
 
-	UProceduralMeshComponent* pgeometry = nullptr;
-	if(geometry_present)
+	//geometry per chunk
+	geometry_out.Reset();
+	geometry_out.SetNumZeroed( chunk_count );
+	for(int c = 0; geometry_present && c < chunk_count; c++)
 	{
-		pgeometry = NewObject<UProceduralMeshComponent>( this, geometry_name, RF_Transient | RF_DuplicateTransient);
-		check( pgeometry );
+		bool chunk_geometry_present = geometry_present;
+		if(chunk_count > 1)
+		{
+			bool chunk_collision_present;
+			AssessGeometry( this, geometry, tier_index, c, geometry_collides, collision_mode, chunk_geometry_present, chunk_collision_present );
+		}
+		if(chunk_geometry_present)
+		{
+			const FName chunk_name = c == 0 ? geometry_name : NAME_None;	//extra chunks get unique names
+			if(use_mesh_component)
+			{
+				geometry_out[c] = NewObject<UApparanceMeshComponent>( this, chunk_name, RF_Transient | RF_DuplicateTransient);
+			}
+			else
+			{
+				geometry_out[c] = NewObject<UProceduralMeshComponent>( this, chunk_name, RF_Transient | RF_DuplicateTransient);
+			}
+			check( geometry_out[c] );
+		}
 	}
 	UProceduralMeshComponent* pcollision = nullptr;
 	if(collision_present)
@@ -2142,13 +2296,20 @@ class UProceduralMeshComponent* AApparanceEntity::AddGeometry(Apparance::Host::I
 
 	//disable (costly) overlaps and synchronous physics calcs during setup
 	bool geom_does_overlaps = false;
-	if(pgeometry)
+	for(UMeshComponent* pgeometry : geometry_out)
 	{
-		pgeometry->bUseAsyncCooking = true; //dynamic content, we can accept delay instead of hitching game thread
-		geom_does_overlaps = pgeometry->GetGenerateOverlapEvents();
-		pgeometry->SetGenerateOverlapEvents( false );
-		//but provide collision info (when adding sections)
-		pgeometry->BodyInstance.UseExternalCollisionProfile(CollisionSetup); //needed in case geom is used for collision as well
+		if(pgeometry)
+		{
+			geom_does_overlaps = pgeometry->GetGenerateOverlapEvents();
+			pgeometry->SetGenerateOverlapEvents( false );
+			UProceduralMeshComponent* pmc_geometry = Cast<UProceduralMeshComponent>( pgeometry );
+			if(pmc_geometry)
+			{
+				pmc_geometry->bUseAsyncCooking = true; //dynamic content, we can accept delay instead of hitching game thread
+				//but provide collision info (when adding sections)
+				pmc_geometry->BodyInstance.UseExternalCollisionProfile(CollisionSetup); //needed in case geom is used for collision as well
+			}
+		}
 	}
 	bool coll_does_overlaps = false;
 	if(pcollision)
@@ -2162,39 +2323,79 @@ class UProceduralMeshComponent* AApparanceEntity::AddGeometry(Apparance::Host::I
 
 	//geometry
 	LOG_ENTITY_EVENTS( LogApparance, Display, TEXT( "ADD GEOMETRY" ) );
-	if(pgeometry || pcollision)
+	bool collision_sections_added = false;
+	TArray<TArray<FVector>> collision_hulls;
+	TArray<FApparanceHeightfieldData> heightfields;
+	for(int c = 0; c < chunk_count; c++)
+	{
+		if(geometry_out[c] || pcollision)
+		{
+			collision_sections_added |= SetGeometry( geometry_out[c], pcollision, geometry, tier_index, chunk_count > 1 ? c : -1, collision_mode, collision_hulls, heightfields );
+		}
+	}
+	if(collision_sections_added)
+	{
+		//simple shapes only, no triangle mesh to cook
+		const bool simple_collision = collision_mode != EApparanceCollisionMode::Complex && collision_mode != EApparanceCollisionMode::Heightfield;
+		pcollision->bUseComplexAsSimpleCollision = !simple_collision;
+		//SetProcMeshSection doesn't rebuild collision itself, need explicit update (reusing previously cooked data if possible)
+		g_ApparanceCollisionCache.UpdateCollision( pcollision, simple_collision ? &collision_hulls : nullptr, CalcCollisionContentKey( pcollision, geometry ) );
+	}
+	else if(pcollision)
+	{
+		//all went to heightfields
+		pcollision->DestroyComponent();
+		pcollision = nullptr;
+	}
+
+	//all separate collision
+	collision_out.Reset();
+	if(pcollision)
 	{
-		check( geometry_present == !!pgeometry );
-		check( collision_present == !!pcollision );
-		SetGeometry( pgeometry, pcollision, geometry, tier_index );
+		collision_out.Add( pcollision );
+	}
+	for(FApparanceHeightfieldData& heightfield : heightfields)
+	{
+		UApparanceHeightfieldComponent* pheightfield = NewObject<UApparanceHeightfieldComponent>( this, NAME_None, RF_Transient | RF_DuplicateTransient );
+		pheightfield->BodyInstance.UseExternalCollisionProfile( CollisionSetup );
+		pheightfield->SetGenerateOverlapEvents( false );
+		pheightfield->SetHeightfield( MoveTemp( heightfield ) );
+		collision_out.Add( pheightfield );
 	}
 
 	//transform/etc
 	FAttachmentTransformRules KeepRelativeTransformWeld( EAttachmentRule::KeepRelative, true );
-	if(pgeometry)
+	for(UMeshComponent* pgeometry : geometry_out)
 	{
+		if(pgeometry)
+		{
 #if defined(PROCEDURAL_MESH_COMPONENT_SUPPORTS_FULL_PRECISION_UV_PROPERTY) //custom build needed to support this fix
-		pgeometry->bUseFullPrecisionUVs = true;	//fix distortion on very thin/long triangles (such as generated by polygon clipper on curves)
+			UProceduralMeshComponent* pmc_geometry = Cast<UProceduralMeshComponent>( pgeometry );
+			if(pmc_geometry)
+			{
+				pmc_geometry->bUseFullPrecisionUVs = true;	//fix distortion on very thin/long triangles (such as generated by polygon clipper on curves)
+			}
 #endif
-		pgeometry->SetRelativeLocation( unreal_offset );
-		pgeometry->SetRelativeScale3D( UNREALSCALE_FROM_APPARANCESCALE3( FVector::OneVector ) );
-		pgeometry->AttachToComponent( GetRootComponent(), KeepRelativeTransformWeld );
-		pgeometry->SetVisibility( bShown, true );
-		if(FApparanceUnrealModule::GetModule()->IsGameRunning())
-		{
-			pgeometry->SetMobility( RootComponent->Mobility );
+			pgeometry->SetRelativeLocation( unreal_offset );
+			pgeometry->SetRelativeScale3D( UNREALSCALE_FROM_APPARANCESCALE3( FVector::OneVector ) );
+			pgeometry->AttachToComponent( GetRootComponent(), KeepRelativeTransformWeld );
+			pgeometry->SetVisibility( bShown, true );
+			if(FApparanceUnrealModule::GetModule()->IsGameRunning())
+			{
+				pgeometry->SetMobility( RootComponent->Mobility );
+			}
 		}
 	}
-	if(pcollision)
+	for(UPrimitiveComponent* pcollision_component : collision_out)
 	{
-		pcollision->SetRelativeLocation( unreal_offset );
-		pcollision->SetRelativeScale3D( UNREALSCALE_FROM_APPARANCESCALE3( FVector::OneVector ) );
-		pcollision->AttachToComponent( GetRootComponent(), KeepRelativeTransformWeld );
-		pcollision->SetVisibility( false, true );	//collision not rendered
-		pcollision->CanCharacterStepUpOn = ECB_Yes;
+		pcollision_component->SetRelativeLocation( unreal_offset );
+		pcollision_component->SetRelativeScale3D( UNREALSCALE_FROM_APPARANCESCALE3( FVector::OneVector ) );
+		pcollision_component->AttachToComponent( GetRootComponent(), KeepRelativeTransformWeld );
+		pcollision_component->SetVisibility( false, true );	//collision not rendered
+		pcollision_component->CanCharacterStepUpOn = ECB_Yes;
 		if(FApparanceUnrealModule::GetModule()->IsGameRunning())
 		{
-			pcollision->SetMobility( RootComponent->Mobility );
+			pcollision_component->SetMobility( RootComponent->Mobility );
 		}
 	}
 
@@ -2210,23 +2411,29 @@ class UProceduralMeshComponent* AApparanceEntity::AddGeometry(Apparance::Host::I
 		//now register (after all the messing about above)
 		// * prevents double proxy creation
 		// * prevents movement/scale artifacts triggering motion blur fx
-		if(pgeometry)
+		for(UMeshComponent* pgeometry : geometry_out)
 		{
-			pgeometry->RegisterComponent();
+			if(pgeometry)
+			{
+				pgeometry->RegisterComponent();
+			}
 		}
-		if(pcollision)
+		for(UPrimitiveComponent* pcollision_component : collision_out)
 		{
-			pcollision->RegisterComponent();
+			pcollision_component->RegisterComponent();
 		}
 	}
 
-	if(pgeometry)
+	for(UMeshComponent* pgeometry : geometry_out)
 	{
-		pgeometry->SetGenerateOverlapEvents( geom_does_overlaps );
+		if(pgeometry)
+		{
+			pgeometry->SetGenerateOverlapEvents( geom_does_overlaps );
+		}
 	}
-	if(pcollision)
+	for(UPrimitiveComponent* pcollision_component : collision_out)
 	{
-		pcollision->SetGenerateOverlapEvents( coll_does_overlaps );
+		pcollision_component->SetGenerateOverlapEvents( coll_does_overlaps );
 	}
 
 #if APPARANCE_DEFERRED_REMOVAL
@@ -2234,29 +2441,60 @@ class UProceduralMeshComponent* AApparanceEntity::AddGeometry(Apparance::Host::I
 	ClearDeferredRemovals();
 #endif
 
-	if(pgeometry && pgeometry->SceneProxy)
-	{
-//		UE_LOG( LogApparance, Display, TEXT( "                    Scene Proxy %p" ), pcomponent->SceneProxy );
-	}
 	if(pcollision && pcollision->SceneProxy)
 	{
 //		UE_LOG( LogApparance, Display, TEXT( "                    Scene Proxy %p" ), pcomponent->SceneProxy );
 	}
 
-	if(pgeometry)
+	for(UMeshComponent* pgeometry : geometry_out)
 	{
-		ProceduralComponents.AddUnique( pgeometry );
+		if(pgeometry)
+		{
+			ProceduralComponents.AddUnique( pgeometry );
+		}
 	}
-	if(pcollision)
+	for(UPrimitiveComponent* pcollision_component : collision_out)
 	{
-		ProceduralComponents.AddUnique( pcollision );
+		ProceduralComponents.AddUnique( pcollision_component );
 	}
-	pcollision_mesh_out = pcollision;
-	return pgeometry;
 }
 
+// host component for geometry merged by material (sections added later)
+//
+class UProceduralMeshComponent* AApparanceEntity::AddMergedGeometry( int tier_index )
+{
+	FName merged_name = NAME_None;
+#if WITH_EDITOR
+	//need to disambiguate name by tier to avoid re-use between tiers (same name means same object in Unreal)
+	merged_name = FName( "MergedGeometry", tier_index );
+#endif
+	UProceduralMeshComponent* pmerged = NewObject<UProceduralMeshComponent>( this, merged_name, RF_Transient | RF_DuplicateTransient );
+	check( pmerged );
+
+	//sections will carry their own collision flags
+	pmerged->bUseAsyncCooking = true; //dynamic content, we can accept delay instead of hitching game thread
+	pmerged->BodyInstance.UseExternalCollisionProfile( CollisionSetup );
+#if defined(PROCEDURAL_MESH_COMPONENT_SUPPORTS_FULL_PRECISION_UV_PROPERTY) //custom build needed to support this fix
+	pmerged->bUseFullPrecisionUVs = true;	//fix distortion on very thin/long triangles (such as generated by polygon clipper on curves)
+#endif
 
-void AApparanceEntity::RemoveGeometry(class UProceduralMeshComponent* pcomponent)
+	//transform/etc, geometry is offset into component space when merged
+	FAttachmentTransformRules KeepRelativeTransformWeld( EAttachmentRule::KeepRelative, true );
+	pmerged->SetRelativeScale3D( UNREALSCALE_FROM_APPARANCESCALE3( FVector::OneVector ) );
+	pmerged->AttachToComponent( GetRootComponent(), KeepRelativeTransformWeld );
+	pmerged->SetVisibility( bShown, true );
+	pmerged->CanCharacterStepUpOn = ECB_Yes;
+	if(FApparanceUnrealModule::GetModule()->IsGameRunning())
+	{
+		pmerged->SetMobility( RootComponent->Mobility );
+	}
+	pmerged->RegisterComponent();
+
+	ProceduralComponents.AddUnique( pmerged );
+	return pmerged;
+}
+
+void AApparanceEntity::RemoveGeometry(class UPrimitiveComponent* pcomponent)
 {
 	if(pcomponent)
 	{
@@ -2268,7 +2506,7 @@ void AApparanceEntity::RemoveGeometry(class UProceduralMeshComponent* pcomponent
 	}
 }
 
-void AApparanceEntity::RemoveGeometryInternal( class UProceduralMeshComponent* pcomponent )
+void AApparanceEntity::RemoveGeometryInternal( class UPrimitiveComponent* pcomponent )
 {
 	//UE_LOG( LogApparance, Display, TEXT( "********** Destroy PMC %p (entity %p)" ), pcomponent, this );
 	if(pcomponent->SceneProxy)
@@ -2396,34 +2634,37 @@ class UStaticMeshComponent* AApparanceEntity::AddMesh( UStaticMesh* psource, FMa
 	return pmesh;
 }
 
-static int meshHandleGenerator = 0;
 static TSet<UStaticMesh*> once_only;
 
 // entity rendering instanced mesh access
-FMeshInstanceHandle AApparanceEntity::AddInstancedMesh(UStaticMesh* psource, FMatrix& local_placement)
+// instances are pended per geometry id and placed together at the end of the update
+FMeshInstanceHandle AApparanceEntity::AddInstancedMesh(int geometry_id, UStaticMesh* psource, FMatrix& local_placement)
 {
 	FMeshInstanceHandle mesh_handle;
 
+	//shared with other entities? (pend in world space)
+	if (psource && UseInstancePool())
+	{
+		TArray<FTransform>& pending = PooledPendingInstances.FindOrAdd( geometry_id ).FindOrAdd( psource );
+		mesh_handle.MeshType = INDEX_NONE;
+		mesh_handle.InstanceIndex = pending.Add( FTransform( local_placement ) * GetRootComponent()->GetComponentTransform() );
+		return mesh_handle;
+	}
+
 	if (psource)
 	{
 		//find instanced mesh for this mesh
 		int cache_index = 0;
-		FInstancedMeshCacheEntry cache_entry;
 		const int* pcache_index = InstancedMeshCacheLookup.Find(psource);
 		if (pcache_index)
 		{
 			//refer to existing
 			cache_index = *pcache_index;
-			cache_entry = InstanceMeshCache[cache_index];
-			if (!cache_entry.PendingInstances)
-			{
-				 cache_entry.PendingInstances = MakeShareable( new TArray<FTransform>() );
-				 InstanceMeshCache[cache_index] = cache_entry;
-			}
 		}
 		else
 		{
 			//create on demand
+			FInstancedMeshCacheEntry cache_entry;
 			cache_entry.Mesh = psource;
 			UInstancedStaticMeshComponent* pism = NewObject<UInstancedStaticMeshComponent>(this, NAME_None, RF_Transient | RF_DuplicateTransient);
 
@@ -2458,7 +2699,6 @@ FMeshInstanceHandle AApparanceEntity::AddInstancedMesh(UStaticMesh* psource, FMa
 			//record
 			cache_entry.InstancedMeshes = pism;
 			cache_index = InstanceMeshCache.Num();
-			cache_entry.PendingInstances = MakeShareable( new TArray<FTransform>() );
 			InstanceMeshCache.Add(cache_entry);
 			InstancedMeshCacheLookup.Add(psource, cache_index);
 
@@ -2467,29 +2707,132 @@ FMeshInstanceHandle AApparanceEntity::AddInstancedMesh(UStaticMesh* psource, FMa
 		mesh_handle.MeshType = cache_index;
 
 		//add entry for it
+		FInstancedMeshCacheEntry& cache_entry = InstanceMeshCache[cache_index];
 		if (cache_entry.InstancedMeshes.IsValid())
 		{
-			//add (pend)
-			cache_entry.PendingInstances->Add( FTransform( local_placement ) );
-			mesh_handle.InstanceIndex = meshHandleGenerator;
-			meshHandleGenerator++;
+			//add (pend), index within the geometry's instances
+			TArray<FTransform>& pending = cache_entry.PendingInstances.FindOrAdd( geometry_id );
+			mesh_handle.InstanceIndex = pending.Add( FTransform( local_placement ) );
 		}
 	}
 
 	return mesh_handle;
 }
 
-void AApparanceEntity::RemoveInstancedMesh(FMeshInstanceHandle mesh_handle)
+// all instances of a piece of geometry
+//
+void AApparanceEntity::RemoveInstancedMeshes(int geometry_id)
 {
-#if false //only one, is recyled
-	//find instanced mesh for this mesh
-	FInstancedMeshCacheEntry& cache_entry = InstanceMeshCache[mesh_handle.MeshType];
-	if (cache_entry.InstancedMeshes && cache_entry.InstancedMeshes->GetInstanceCount()>0)	//(clear only once)
+	for (int i = 0; i < InstanceMeshCache.Num(); i++)
 	{
-		//request to remove any removes all (because we can't rely on the indices to remain consistent as they are removed)		
-		cache_entry.InstancedMeshes->ClearInstances();
+		FInstancedMeshCacheEntry& cache_entry = InstanceMeshCache[i];
+		cache_entry.PendingInstances.Remove( geometry_id );
+		cache_entry.FreeInstances( geometry_id );
 	}
-#endif
+
+	//shared
+	PooledPendingInstances.Remove( geometry_id );
+	TArray<int> handles;
+	UApparanceInstancePool* ppool = GetInstancePool();
+	if (PooledInstances.RemoveAndCopyValue( geometry_id, handles ) && ppool)
+	{
+		for (int handle : handles)
+		{
+			ppool->RemoveInstances( handle );
+		}
+	}
+}
+
+// remove the instances of one mesh a piece of geometry has (placed or pending), for placing some other way
+//
+void AApparanceEntity::TakeInstancedMeshes(int geometry_id, UStaticMesh* pmesh, TArray<FTransform>& local_placements_out)
+{
+	//own
+	if (const int* pcache_index = InstancedMeshCacheLookup.Find( pmesh ))
+	{
+		FInstancedMeshCacheEntry& cache_entry = InstanceMeshCache[*pcache_index];
+		TArray<FTransform> pending;
+		if (cache_entry.PendingInstances.RemoveAndCopyValue( geometry_id, pending ))
+		{
+			local_placements_out.Append( pending );
+		}
+		cache_entry.TakeInstances( geometry_id, local_placements_out );
+	}
+
+	//shared (world space)
+	const FTransform root_transform = GetRootComponent()->GetComponentTransform();
+	if (TMap<TWeakObjectPtr<UStaticMesh>, TArray<FTransform>>* ppooled_pending = PooledPendingInstances.Find( geometry_id ))
+	{
+		TArray<FTransform> pending;
+		if (ppooled_pending->RemoveAndCopyValue( pmesh, pending ))
+		{
+			for (const FTransform& transform : pending)
+			{
+				local_placements_out.Add( transform.GetRelativeTransform( root_transform ) );
+			}
+		}
+	}
+	TArray<int>* phandles = PooledInstances.Find( geometry_id );
+	UApparanceInstancePool* ppool = GetInstancePool();
+	if (phandles && ppool)
+	{
+		for (int i = phandles->Num() - 1; i >= 0; i--)
+		{
+			const int handle = (*phandles)[i];
+			if (ppool->GetMesh( handle ) == pmesh)
+			{
+				TArray<FTransform> placed;
+				ppool->GetInstances( handle, placed );
+				for (const FTransform& transform : placed)
+				{
+					local_placements_out.Add( transform.GetRelativeTransform( root_transform ) );
+				}
+				ppool->RemoveInstances( handle );
+				phandles->RemoveAtSwap( i );
+			}
+		}
+	}
+}
+
+// show/hide all instances of a piece of geometry
+//
+void AApparanceEntity::SetInstancedMeshVisibility(int geometry_id, bool visible)
+{
+	for (int i = 0; i < InstanceMeshCache.Num(); i++)
+	{
+		InstanceMeshCache[i].SetInstancesVisible( geometry_id, visible );
+	}
+
+	//shared
+	const TArray<int>* phandles = PooledInstances.Find( geometry_id );
+	UApparanceInstancePool* ppool = GetInstancePool();
+	if (phandles && ppool)
+	{
+		for (int handle : *phandles)
+		{
+			ppool->SetInstancesVisible( handle, visible && bShown );
+		}
+	}
+}
+
+// place instanced meshes in components shared with other entities?
+// only in-game, for content that won't move (pooled instances don't follow the entity)
+//
+bool AApparanceEntity::UseInstancePool() const
+{
+	return UApparanceEngineSetup::GetShareInstancedMeshes()
+		&& FApparanceUnrealModule::GetModule()->IsGameRunning()
+		&& GetRootComponent()
+		&& GetRootComponent()->Mobility != EComponentMobility::Movable
+		&& GetInstancePool() != nullptr;
+}
+
+// shared instanced meshes of our world
+//
+UApparanceInstancePool* AApparanceEntity::GetInstancePool() const
+{
+	UWorld* pworld = GetWorld();
+	return pworld ? pworld->GetSubsystem<UApparanceInstancePool>() : nullptr;
 }
 
 // proper clearout of ISMC
@@ -2509,12 +2852,271 @@ void AApparanceEntity::RemoveAllInstancedMeshes()
 	}
 	InstanceMeshCache.Empty();
 
+	//shared instances
+	UApparanceInstancePool* ppool = GetInstancePool();
+	for (const TPair<int, TArray<int>>& it : PooledInstances)
+	{
+		for (int handle : it.Value)
+		{
+			if (ppool)
+			{
+				ppool->RemoveInstances( handle );
+			}
+		}
+	}
+	PooledInstances.Empty();
+	PooledPendingInstances.Empty();
+
 	//other tracking structures
 	InstancedMeshCacheLookup.Empty();
 	InstanceCache.Empty();
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+// FInstancedMeshCacheEntry
+
+// place a geometry id's instances, re-using a free run if one is big enough
+//
+void FInstancedMeshCacheEntry::PlaceInstances( int geometry_id, const TArray<FTransform>& transforms )
+{
+	UInstancedStaticMeshComponent* pismc = InstancedMeshes.Get();
+	if (!pismc || transforms.Num() == 0)
+	{
+		return;
+	}
+
+	//adding to existing? (re-placed together, to keep them in one run)
+	TArray<FTransform> combined;
+	bool hidden = false;
+	if (const FInstanceRange* pexisting = Ranges.Find( geometry_id ))
+	{
+		hidden = pexisting->bHidden;
+		combined.Append( Transforms.GetData() + pexisting->Start, pexisting->Count );
+		combined.Append( transforms );
+		FreeInstances( geometry_id );
+	}
+	const TArray<FTransform>& placing = combined.Num() > 0 ? combined : transforms;
+
+	//smallest free run it fits in
+	const int count = placing.Num();
+	int best = -1;
+	for (int i = 0; i < FreeRanges.Num(); i++)
+	{
+		if (FreeRanges[i].Count >= count && (best == -1 || FreeRanges[i].Count < FreeRanges[best].Count))
+		{
+			best = i;
+		}
+	}
+
+	FInstanceRange range;
+	range.Count = count;
+	range.bHidden = hidden;
+	if (best != -1)
+	{
+		//re-use, rest of run stays free
+		FInstanceRange& free_range = FreeRanges[best];
+		range.Start = free_range.Start;
+		free_range.Start += count;
+		free_range.Count -= count;
+		if (free_range.Count == 0)
+		{
+			FreeRanges.RemoveAt( best );
+		}
+		for (int i = 0; i < count; i++)
+		{
+			Transforms[range.Start + i] = placing[i];
+		}
+		WriteInstances( range.Start, count, hidden );
+	}
+	else
+	{
+		//append
+		range.Start = Transforms.Num();
+		Transforms.Append( placing );
+#if UE_VERSION_AT_LEAST(5,1,0)
+		pismc->PreAllocateInstancesMemory( count );
+		pismc->AddInstances( placing, false, false );
+#else
+		for (const FTransform& transform : placing)
+		{
+			pismc->AddInstance( transform );
+		}
+#endif
+		if (hidden)
+		{
+			WriteInstances( range.Start, count, true );
+		}
+	}
+	Ranges.Add( geometry_id, range );
+}
+
+// drop a geometry id's instances, returning their placements
+//
+void FInstancedMeshCacheEntry::TakeInstances( int geometry_id, TArray<FTransform>& transforms_out )
+{
+	if (const FInstanceRange* prange = Ranges.Find( geometry_id ))
+	{
+		transforms_out.Append( Transforms.GetData() + prange->Start, prange->Count );
+		FreeInstances( geometry_id );
+	}
+}
+
+// drop a geometry id's instances
+// the last run of instances is swapped into the gap when it fits so the component can shrink, otherwise the gap is hidden and kept for re-use
+//
+void FInstancedMeshCacheEntry::FreeInstances( int geometry_id )
+{
+	FInstanceRange range;
+	if (!Ranges.RemoveAndCopyValue( geometry_id, range ))
+	{
+		return;
+	}
+
+	//last run
+	int last_id = 0;
+	const FInstanceRange* plast = nullptr;
+	for (const TPair<int, FInstanceRange>& it : Ranges)
+	{
+		if (!plast || it.Value.Start > plast->Start)
+		{
+			plast = &it.Value;
+			last_id = it.Key;
+		}
+	}
+
+	//swap-remove
+	TArray<FInstanceRange> freed;
+	if (plast && plast->Start > range.Start && plast->Count <= range.Count && plast->End() == Transforms.Num())
+	{
+		FInstanceRange& last = Ranges[last_id];
+		const FInstanceRange moved_from = last;
+		for (int i = 0; i < last.Count; i++)
+		{
+			Transforms[range.Start + i] = Transforms[moved_from.Start + i];
+		}
+		last.Start = range.Start;
+		WriteInstances( last.Start, last.Count, last.bHidden );
+
+		//rest of gap, and the end, now free
+		FInstanceRange rest;
+		rest.Start = range.Start + moved_from.Count;
+		rest.Count = range.Count - moved_from.Count;
+		freed.Add( rest );
+		freed.Add( moved_from );
+	}
+	else
+	{
+		freed.Add( range );
+	}
+	for (const FInstanceRange& free_range : freed)
+	{
+		AddFreeRange( free_range );
+	}
+	TrimFreeRanges();
+
+	//hide whatever is still in the component
+	for (const FInstanceRange& free_range : freed)
+	{
+		const int count = FMath::Min( free_range.End(), Transforms.Num() ) - free_range.Start;
+		WriteInstances( free_range.Start, count, true );
+	}
+}
+
+// show/hide a geometry id's instances
+//
+void FInstancedMeshCacheEntry::SetInstancesVisible( int geometry_id, bool visible )
+{
+	FInstanceRange* prange = Ranges.Find( geometry_id );
+	if (prange && prange->bHidden == visible)
+	{
+		prange->bHidden = !visible;
+		WriteInstances( prange->Start, prange->Count, prange->bHidden );
+	}
+}
+
+// record unused run, merging with neighbours
+//
+void FInstancedMeshCacheEntry::AddFreeRange( FInstanceRange range )
+{
+	if (range.Count <= 0)
+	{
+		return;
+	}
+	range.bHidden = true;
+	FreeRanges.Add( range );
+	FreeRanges.Sort( []( const FInstanceRange& a, const FInstanceRange& b ) { return a.Start < b.Start; } );
+	for (int i = FreeRanges.Num() - 1; i > 0; i--)
+	{
+		if (FreeRanges[i - 1].End() == FreeRanges[i].Start)
+		{
+			FreeRanges[i - 1].Count += FreeRanges[i].Count;
+			FreeRanges.RemoveAt( i );
+		}
+	}
+}
+
+// shrink component when the end of it is unused
+//
+void FInstancedMeshCacheEntry::TrimFreeRanges()
+{
+	UInstancedStaticMeshComponent* pismc = InstancedMeshes.Get();
+	while (FreeRanges.Num() > 0 && FreeRanges.Last().End() == Transforms.Num())
+	{
+		const int num_current = Transforms.Num();
+		const int num_needed = FreeRanges.Last().Start;
+		if (pismc && pismc->GetInstanceCount() == num_current)
+		{
+			if (num_needed == 0)
+			{
+				pismc->ClearInstances();
+			}
+			else
+			{
+				//remove from the end, nothing else moves
+#if UE_VERSION_AT_LEAST(5,1,0)
+				TArray<int32> removing;
+				for (int idx = num_current - 1; idx >= num_needed; idx--)
+				{
+					removing.Add( idx );
+				}
+				pismc->RemoveInstances( removing );
+#else
+				for (int idx = num_current - 1; idx >= num_needed; idx--)
+				{
+					pismc->RemoveInstance( idx );
+				}
+#endif
+			}
+		}
+		Transforms.SetNum( num_needed );
+		FreeRanges.Pop();
+	}
+}
+
+// update a run of component instances from their placements (hidden ones collapsed in place, which also drops their physics bodies)
+//
+void FInstancedMeshCacheEntry::WriteInstances( int start, int count, bool hidden )
+{
+	UInstancedStaticMeshComponent* pismc = InstancedMeshes.Get();
+	if (!pismc || count <= 0 || start + count > pismc->GetInstanceCount())
+	{
+		return;
+	}
+
+	TArray<FTransform> transforms;
+	transforms.Append( Transforms.GetData() + start, count );
+	if (hidden)
+	{
+		for (FTransform& transform : transforms)
+		{
+			transform.SetScale3D( FVector::ZeroVector );
+		}
+	}
+	pismc->BatchUpdateInstancesTransforms( start, transforms, false, true, true/*teleport to avoid blur*/ );
+}
+
+
 
 void AApparanceEntity::RemoveMesh(class UStaticMeshComponent* pcomponent)
 {
@@ -2843,30 +3445,36 @@ FString AApparanceEntity::Debug_GetStructure() const
 
 	lines.Add( FString::Printf( TEXT("-------- APPARANCE --------") ) );	
 	//caches
-	//TMap<int, class UProceduralMeshComponent*> GeometryCache;
+	//TMap<int, FGeometryCacheEntry> GeometryCache;
 	lines.Add( FString::Printf( TEXT("Geometry Cache (%i):"), GeometryCache.Num() ) );
 	for (auto It = GeometryCache.CreateConstIterator(); It; ++It)
 	{
 		int id = It.Key();
-		UProceduralMeshComponent* p = It.Value().Get();
-		lines.Add( FString::Printf( TEXT("\t#%i : %s [%p] %s"), id, p?(*p->GetReadableName()):TEXT("null"), (void*)p, *DescribeObjectFlags(p) ) );
+		for (const TWeakObjectPtr<UMeshComponent>& pcomp : It.Value().Geometry)
+		{
+			UMeshComponent* p = pcomp.Get();
+			lines.Add( FString::Printf( TEXT("\t#%i : %s [%p] %s"), id, p?(*p->GetReadableName()):TEXT("null"), (void*)p, *DescribeObjectFlags(p) ) );
+		}
 	}
-	//TMap<int, class UProceduralMeshComponent*> CollisionCache;
+	//TMap<int, FCollisionCacheEntry> CollisionCache;
 	lines.Add( FString::Printf( TEXT( "Collision Cache (%i):" ), CollisionCache.Num() ) );
 	for(auto It = CollisionCache.CreateConstIterator(); It; ++It)
 	{
 		int id = It.Key();
-		UProceduralMeshComponent* p = It.Value().Get();
-		lines.Add( FString::Printf( TEXT( "\t#%i : %s [%p] %s" ), id, p ? (*p->GetReadableName()) : TEXT( "null" ), (void*)p, *DescribeObjectFlags( p ) ) );
+		for(const TWeakObjectPtr<UPrimitiveComponent>& pcomp : It.Value().Collision)
+		{
+			UPrimitiveComponent* p = pcomp.Get();
+			lines.Add( FString::Printf( TEXT( "\t#%i : %s [%p] %s" ), id, p ? (*p->GetReadableName()) : TEXT( "null" ), (void*)p, *DescribeObjectFlags( p ) ) );
+		}
 	}
-	//TMap<int, class UMaterialInstanceDynamic*> MaterialCache;
+	//TMap<uint64, class UMaterialInstanceDynamic*> MaterialCache;
 	lines.Add( FString::Printf( TEXT("Material Cache (%i):"), MaterialCache.Num() ) );
 	for (auto It = MaterialCache.CreateConstIterator(); It; ++It)
 	{
-		int id = It.Key();
+		uint64 id = It.Key();
 		UMaterialInstanceDynamic* p = It.Value().Get();
 		UMaterial* pmat = p?p->GetMaterial():nullptr;
-		lines.Add( FString::Printf( TEXT("\t#%i : %s (%s) [%p] %s"), id, p?(*p->GetFullName()):TEXT("null"), pmat?(*pmat->GetFullName()):TEXT("null"), (void*)p, *DescribeObjectFlags(p) ) );
+		lines.Add( FString::Printf( TEXT("\t#%llx : %s (%s) [%p] %s"), id, p?(*p->GetFullName()):TEXT("null"), pmat?(*pmat->GetFullName()):TEXT("null"), (void*)p, *DescribeObjectFlags(p) ) );
 	}
 	//TMap<int, FMeshCacheEntry> MeshCache;
 	lines.Add( FString::Printf( TEXT("Mesh Cache (%i):"), MeshCache.Num() ) );
@@ -2937,8 +3545,17 @@ FString AApparanceEntity::Debug_GetStructure() const
 	{
 		UStaticMesh* pm = InstanceMeshCache[i].Mesh.Get();
 		UInstancedStaticMeshComponent* pim = InstanceMeshCache[i].InstancedMeshes.Get();
-		int pending = InstanceMeshCache[i].PendingInstances.IsValid()?InstanceMeshCache[i].PendingInstances->Num():0;
-		lines.Add( FString::Printf( TEXT("\t%i : %s (%s) (%i pending) [%p] %s"), i, pim?(*pim->GetReadableName()):TEXT("null"), pm?(*pm->GetFullName()):TEXT("null"), pending, (void*)pim, *DescribeObjectFlags(pim) ) );
+		int pending = 0;
+		for (const TPair<int, TArray<FTransform>>& it : InstanceMeshCache[i].PendingInstances)
+		{
+			pending += it.Value.Num();
+		}
+		int free_instances = 0;
+		for (const FInstanceRange& range : InstanceMeshCache[i].FreeRanges)
+		{
+			free_instances += range.Count;
+		}
+		lines.Add( FString::Printf( TEXT("\t%i : %s (%s) (%i pending, %i geometry, %i free) [%p] %s"), i, pim?(*pim->GetReadableName()):TEXT("null"), pm?(*pm->GetFullName()):TEXT("null"), pending, InstanceMeshCache[i].Ranges.Num(), free_instances, (void*)pim, *DescribeObjectFlags(pim) ) );
 	}
 	//TMap<class UStaticMesh*, int> InstancedMeshCacheLookup;
 	lines.Add( FString::Printf( TEXT("Mesh Cache Lookup (%i):"), InstancedMeshCacheLookup.Num() ) );
@@ -2989,7 +3606,7 @@ FString AApparanceEntity::Debug_GetStructure() const
 				for (auto It = ptier->Components.CreateConstIterator(); It; ++It)
 				{
 					int id = It.Key();
-					UProceduralMeshComponent* p = It.Value().Get();
+					UMeshComponent* p = It.Value().Get();
 					lines.Add( FString::Printf( TEXT("\t\t\t#%i: %s [%p] %s"), id, p?(*p->GetReadableName()):TEXT("null"), (void*)p, *DescribeObjectFlags(p) ) );
 				}
 			}
@@ -20,11 +20,16 @@ PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
 #include "Interfaces/IPluginManager.h"
 #include "Misc/Paths.h"
 #include "EngineUtils.h"
+#include "Components/SceneComponent.h"
 
 //module
 #include "LoggingService.h"
 #include "GeometryFactory.h"
+#include "GeometryDeduplication.h"
+#include "MaterialCache.h"
+#include "CollisionCache.h"
 #include "AssetDatabase.h"
+#include "FrameBudget.h"
 #include "ApparanceEngineSetup.h"
 #include "ApparanceEntity.h"
 #include "ApparanceUnrealEditorAPI.h"
@@ -49,7 +54,11 @@ bool IsValidChecked( UObject* p ) { check( p );  return !p->IsPendingKill(); }
 // GLOBAL STATE
 FLoggingService g_ApparanceLogger;
 FGeometryFactory g_ApparanceGeometryFactory;
+FGeometryDeduplication g_ApparanceGeometryDeduplication;
+FMaterialCache g_ApparanceMaterialCache;
+FCollisionCache g_ApparanceCollisionCache;
 FAssetDatabase g_ApparanceAssetDatabase;
+FFrameBudget g_ApparanceFrameBudget;
 FText g_ProductName;
 
 // CLASS STATE
@@ -202,6 +211,16 @@ bool FApparanceUnrealModule::InitSynthesis()
 	cparams.SynthesiserCount = UApparanceEngineSetup::GetThreadCount();
 	cparams.BufferSizeMB = UApparanceEngineSetup::GetBufferSize();
 	cparams.LiveEditing = UApparanceEngineSetup::GetEnableLiveEditing();
+
+	//geometry handling
+	g_ApparanceGeometryFactory.SetPrepareMeshSections( UApparanceEngineSetup::GetPrepareGeometryOnSynthesisThread() );
+	g_ApparanceGeometryFactory.SetOptimiseGeometry( UApparanceEngineSetup::GetOptimiseGeometry() );
+	g_ApparanceGeometryFactory.SetPartLimits( UApparanceEngineSetup::GetGeometryVertexLimit(), UApparanceEngineSetup::GetGeometryIndexLimit() );
+	g_ApparanceGeometryFactory.SetChunkSize( UApparanceEngineSetup::GetGeometryChunkSize() );
+	g_ApparanceGeometryFactory.SetHashGeometry( UApparanceEngineSetup::GetDeduplicateGeometry() && UApparanceEngineSetup::GetUseApparanceMeshComponent() );
+	g_ApparanceMaterialCache.Init();
+	g_ApparanceCollisionCache.Init( UApparanceEngineSetup::GetCacheCollision(), UApparanceEngineSetup::GetCollisionCacheMemoryLimit(), UApparanceEngineSetup::GetCollisionCacheDiskLimit() );
+	g_ApparanceFrameBudget.Init( UApparanceEngineSetup::GetFrameBudget(), UApparanceEngineSetup::GetTargetFrameRate() );
 	
 	//start synthesis
 	g_ApparanceLogger.LogMessage("Configuring Apparance Synthesis Engine");
@@ -312,6 +331,12 @@ void FApparanceUnrealModule::ShutdownModule()
 
 	//done with Apparance
 	Apparance::Engine::Stop();
+
+	//release recycled geometry
+	g_ApparanceGeometryFactory.EmptyPools();
+	g_ApparanceGeometryDeduplication.Empty();
+	g_ApparanceMaterialCache.Shutdown();
+	g_ApparanceCollisionCache.Shutdown();
 }
 
 
@@ -327,6 +352,9 @@ bool FApparanceUnrealModule::Tick( float DeltaTime )
 		StartupModuleDeferred();
 	}
 
+	//main thread work allowance
+	g_ApparanceFrameBudget.BeginFrame( DeltaTime );
+
 	//smart editing
 	for (TMap<UWorld*, USmartEditingState*>::TIterator It(m_EditingStates); It; ++It)	
 	{
@@ -343,6 +371,9 @@ bool FApparanceUnrealModule::Tick( float DeltaTime )
 	//adb updates
 	GetAssetDatabase()->Tick();
 
+	//collision cache captures and disk access
+	g_ApparanceCollisionCache.Tick();
+
 	//debug/tests
 	Apparance_TickTimeslicedGeometryHandling();
 	Apparance_TickGenLog();
@@ -393,6 +424,9 @@ void FApparanceUnrealModule::Editor_NotifyEntityProcedureTypeChanged( Apparance:
 //
 void FApparanceUnrealModule::Editor_NotifyAssetDatabaseChanged()
 {
+	//rebuilds mustn't pick up material instances made before the change
+	g_ApparanceMaterialCache.Invalidate();
+
 	//editing systems needs to know
 	if(m_pEditorModule)
 	{
@@ -707,6 +741,53 @@ void FApparanceUnrealModule::HandleRemoveWorld( class UWorld* world )
 }
 
 
+// extra view to generate content detail for, e.g. a scene capture used for a minimap or security camera
+//
+void FApparanceUnrealModule::RegisterDetailView( USceneComponent* pview )
+{
+	if(pview)
+	{
+		m_DetailViews.AddUnique( pview );
+	}
+}
+
+// view no longer needs content detail
+//
+void FApparanceUnrealModule::UnregisterDetailView( USceneComponent* pview )
+{
+	m_DetailViews.Remove( pview );
+}
+
+// all the places content in a world is being viewed from
+//
+void FApparanceUnrealModule::GetViewLocations( UWorld* world, TArray<FVector>& locations_out )
+{
+	locations_out.Reset();
+	if(!world)
+	{
+		return;
+	}
+
+	//rendered (all viewports, i.e. split-screen)
+	locations_out.Append( world->ViewLocationsRenderedLastFrame );
+
+	//registered
+	for(int i = m_DetailViews.Num() - 1; i >= 0; i--)
+	{
+		USceneComponent* pview = m_DetailViews[i].Get();
+		if(!pview)
+		{
+			//gone
+			m_DetailViews.RemoveAtSwap( i );
+		}
+		else if(pview->GetWorld() == world)
+		{
+			locations_out.Add( pview->GetComponentLocation() );
+		}
+	}
+}
+
+
 // new smart editing state tracker needed for a world
 //
 USmartEditingState* FApparanceUnrealModule::CreateSmartEditingState( UWorld* world )
@@ -1641,6 +1641,23 @@ void UApparanceBlueprintLibrary::SetTimeslice( float MaxMilliseconds )
 #endif
 }
 
+void UApparanceBlueprintLibrary::SetLoading( bool Loading )
+{
+#if TIMESLICE_GEOMETRY_ADD_REMOVE
+	Apparance_SetLoading( Loading );
+#endif
+}
+
+void UApparanceBlueprintLibrary::RegisterDetailView( USceneComponent* View )
+{
+	FApparanceUnrealModule::GetModule()->RegisterDetailView( View );
+}
+
+void UApparanceBlueprintLibrary::UnregisterDetailView( USceneComponent* View )
+{
+	FApparanceUnrealModule::GetModule()->UnregisterDetailView( View );
+}
+
 static int nPrevPendingCount = 0;
 static int nPendingCounterAdd = 0;
 static int nPendingCounterDone = 0;
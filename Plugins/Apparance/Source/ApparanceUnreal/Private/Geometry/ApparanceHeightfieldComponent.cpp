@@ -0,0 +1,204 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_ApparanceHeightfieldComponent 0
+#if APPARANCE_DEBUGGING_HELP_ApparanceHeightfieldComponent
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "ApparanceHeightfieldComponent.h"
+
+// unreal
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#if APPARANCE_HEIGHTFIELD_COLLISION
+#include "Chaos/HeightField.h"
+#include "Chaos/ParticleHandle.h"
+#include "PhysicsProxy/SingleParticlePhysicsProxy.h"
+#include "Physics/PhysicsFiltering.h"
+#include "Physics/PhysicsInterfaceCore.h"
+#include "Physics/Experimental/PhysScene_Chaos.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#endif
+
+// module
+#include "ApparanceUnreal.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_CYCLE_STAT( TEXT( "Create Heightfield Body" ), STAT_CreateHeightfieldBody, STATGROUP_Apparance );
+
+
+//////////////////////////////////////////////////////////////////////////
+// UApparanceHeightfieldComponent
+
+UApparanceHeightfieldComponent::UApparanceHeightfieldComponent()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	SetVisibility( false );
+	SetHiddenInGame( true );
+	CanCharacterStepUpOn = ECB_Yes;
+}
+
+// take ownership of grid, physics is rebuilt if already present
+//
+void UApparanceHeightfieldComponent::SetHeightfield( FApparanceHeightfieldData&& heightfield )
+{
+	Heightfield = MoveTemp( heightfield );
+	UpdateBounds();
+	if(IsPhysicsStateCreated())
+	{
+		RecreatePhysicsState();
+	}
+}
+
+// only with something to collide with
+//
+bool UApparanceHeightfieldComponent::ShouldCreatePhysicsState() const
+{
+	return Heightfield.Heights.Num() > 0 && Super::ShouldCreatePhysicsState();
+}
+
+// own body creation, the body setup based physics of primitive components has no heightfield support
+//
+void UApparanceHeightfieldComponent::OnCreatePhysicsState()
+{
+	USceneComponent::OnCreatePhysicsState();	//skip primitive component body setup handling
+#if APPARANCE_HEIGHTFIELD_COLLISION
+	SCOPE_CYCLE_COUNTER( STAT_CreateHeightfieldBody );
+
+	UWorld* pworld = GetWorld();
+	FPhysScene* pphys_scene = pworld ? pworld->GetPhysicsScene() : nullptr;
+	if(!pphys_scene || BodyInstance.IsValidBodyInstance() || Heightfield.Heights.Num() == 0)
+	{
+		return;
+	}
+
+	//bodies aren't scaled, bake component scale into the shape, and grid origin into the body
+	const FTransform component_transform = GetComponentTransform();
+	const FVector scale = component_transform.GetScale3D();
+	FTransform body_transform( component_transform.GetRotation(), component_transform.TransformPosition( Heightfield.Origin ) );
+
+	//shape
+	TArray<Chaos::FReal> heights;
+	heights.SetNumUninitialized( Heightfield.Heights.Num() );
+	for(int i = 0; i < heights.Num(); i++)
+	{
+		heights[i] = Heightfield.Heights[i];
+	}
+	TArray<uint8> material_indices;
+	material_indices.Add( 0 );
+	const Chaos::FVec3 shape_scale( Heightfield.SpacingX * scale.X, Heightfield.SpacingY * scale.Y, scale.Z );
+#if UE_VERSION_AT_LEAST(5,4,0)
+	Chaos::FImplicitObjectPtr pheightfield( new Chaos::FHeightField( MoveTemp( heights ), MoveTemp( material_indices ), Heightfield.NumY, Heightfield.NumX, shape_scale ) );
+#else
+	TUniquePtr<Chaos::FImplicitObject> pheightfield = MakeUnique<Chaos::FHeightField>( MoveTemp( heights ), MoveTemp( material_indices ), Heightfield.NumY, Heightfield.NumX, shape_scale );
+#endif
+
+	//static body
+	FActorCreationParams params;
+	params.InitialTM = body_transform;
+	params.bQueryOnly = false;
+	params.bStatic = true;
+	params.Scene = pphys_scene;
+	FPhysicsActorHandle phys_handle;
+	FPhysicsInterface::CreateActor( params, phys_handle );
+	Chaos::FRigidBodyHandle_External& body_external = phys_handle->GetGameThreadAPI();
+	body_external.SetGeometry( MoveTemp( pheightfield ) );
+
+	//filtering/material, on the shape created for the geometry
+	FCollisionFilterData query_filter_data, sim_filter_data;
+	CreateShapeFilterData( GetCollisionObjectType(), FMaskFilter( 0 ), GetOwner() ? GetOwner()->GetUniqueID() : 0, GetCollisionResponseToChannels(), GetUniqueID(), 0, query_filter_data, sim_filter_data, false, false, true );
+	query_filter_data.Word3 |= (EPDF_SimpleCollision | EPDF_ComplexCollision);
+	sim_filter_data.Word3 |= (EPDF_SimpleCollision | EPDF_ComplexCollision);
+	UPhysicalMaterial* pphysical_material = BodyInstance.GetSimplePhysicalMaterial();
+	TArray<Chaos::FMaterialHandle> materials;
+	materials.Add( pphysical_material->GetPhysicsMaterial() );
+	const Chaos::FRigidTransform3 shape_bounds_transform( body_transform.GetLocation(), body_transform.GetRotation() );
+	for(const auto& shape : body_external.ShapesArray())
+	{
+		shape->SetQueryData( query_filter_data );
+		shape->SetSimData( sim_filter_data );
+		shape->SetMaterials( materials );
+		shape->UpdateShapeBounds( shape_bounds_transform );
+	}
+
+	//hook up to us
+	BodyInstance.PhysicsUserData = FPhysicsUserData( &BodyInstance );
+	BodyInstance.OwnerComponent = this;
+	BodyInstance.ActorHandle = phys_handle;
+	body_external.SetUserData( &BodyInstance.PhysicsUserData );
+
+	//into the scene
+	TArray<FPhysicsActorHandle> actors;
+	actors.Add( phys_handle );
+	FPhysicsCommand::ExecuteWrite( pphys_scene, [&]()
+	{
+		pphys_scene->AddActorsToScene_AssumesLocked( actors, true );
+	} );
+	pphys_scene->AddToComponentMaps( this, phys_handle );
+#endif
+}
+
+// body removal (primitive component terminates it)
+//
+void UApparanceHeightfieldComponent::OnDestroyPhysicsState()
+{
+#if APPARANCE_HEIGHTFIELD_COLLISION
+	UWorld* pworld = GetWorld();
+	FPhysScene* pphys_scene = pworld ? pworld->GetPhysicsScene() : nullptr;
+	if(pphys_scene && FPhysicsInterface::IsValid( BodyInstance.ActorHandle ))
+	{
+		pphys_scene->RemoveFromComponentMaps( BodyInstance.ActorHandle );
+	}
+#endif
+	Super::OnDestroyPhysicsState();
+}
+
+// extent of the grid
+//
+FBoxSphereBounds UApparanceHeightfieldComponent::CalcBounds( const FTransform& LocalToWorld ) const
+{
+	FBox local_box( ForceInit );
+	if(Heightfield.Heights.Num() > 0)
+	{
+		float min_height = Heightfield.Heights[0];
+		float max_height = Heightfield.Heights[0];
+		for(float height : Heightfield.Heights)
+		{
+			min_height = FMath::Min( min_height, height );
+			max_height = FMath::Max( max_height, height );
+		}
+		local_box += Heightfield.Origin + FVector( 0, 0, min_height );
+		local_box += Heightfield.Origin + FVector( (Heightfield.NumX - 1) * Heightfield.SpacingX, (Heightfield.NumY - 1) * Heightfield.SpacingY, max_height );
+	}
+	else
+	{
+		local_box += FVector::ZeroVector;
+	}
+	return FBoxSphereBounds( local_box.TransformBy( LocalToWorld ) );
+}
+
+// scale is baked into the shape, so any move needs a rebuild
+//
+void UApparanceHeightfieldComponent::OnUpdateTransform( EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport )
+{
+	USceneComponent::OnUpdateTransform( UpdateTransformFlags, Teleport );	//skip body transform update
+	if(IsPhysicsStateCreated())
+	{
+		RecreatePhysicsState();
+	}
+}
+
+
+#if APPARANCE_DEBUGGING_HELP_ApparanceHeightfieldComponent
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
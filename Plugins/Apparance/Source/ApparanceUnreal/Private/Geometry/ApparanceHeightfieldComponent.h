@@ -0,0 +1,51 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+//unreal
+#include "Components/PrimitiveComponent.h"
+
+//module
+#include "ApparanceUnrealVersioning.h"
+#include "GeometryCollision.h"
+
+// auto (last)
+#include "ApparanceHeightfieldComponent.generated.h"
+
+//runtime heightfield shapes need direct Chaos body creation (otherwise height grids fall back to trimesh collision)
+#define APPARANCE_HEIGHTFIELD_COLLISION UE_VERSION_AT_LEAST(5,0,0)
+
+
+// Apparance Heightfield Component
+// Collision only component for generated regular grid terrain, cheaper to build, store, and query than a trimesh
+// NOTE: not rendered, the terrain geometry is displayed by the usual geometry components
+//
+UCLASS()
+class APPARANCEUNREAL_API UApparanceHeightfieldComponent
+	: public UPrimitiveComponent
+{
+	GENERATED_BODY()
+
+	//grid, local space
+	FApparanceHeightfieldData Heightfield;
+
+public:
+	UApparanceHeightfieldComponent();
+
+	//content
+	void SetHeightfield( FApparanceHeightfieldData&& heightfield );
+
+	//UActorComponent
+	virtual bool ShouldCreatePhysicsState() const override;
+	virtual void OnCreatePhysicsState() override;
+	virtual void OnDestroyPhysicsState() override;
+	//USceneComponent
+	virtual FBoxSphereBounds CalcBounds( const FTransform& LocalToWorld ) const override;
+	virtual void OnUpdateTransform( EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport ) override;
+};
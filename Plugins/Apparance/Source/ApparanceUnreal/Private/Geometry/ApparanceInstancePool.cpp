@@ -0,0 +1,401 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_ApparanceInstancePool 0
+#if APPARANCE_DEBUGGING_HELP_ApparanceInstancePool
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "ApparanceInstancePool.h"
+
+// unreal
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/UObjectIterator.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "ApparanceUnrealVersioning.h"
+#include "ApparanceEngineSetup.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_DWORD_ACCUMULATOR_STAT( TEXT( "Pooled Instance Components" ), STAT_PooledInstanceComponents, STATGROUP_Apparance );
+DECLARE_DWORD_ACCUMULATOR_STAT( TEXT( "Pooled Instance Groups" ), STAT_PooledInstanceGroups, STATGROUP_Apparance );
+
+
+//////////////////////////////////////////////////////////////////////////
+// UApparanceInstancePool
+
+UApparanceInstancePool::UApparanceInstancePool()
+	: Host( nullptr )
+	, NextHandle( 1 )
+{
+}
+
+// world going away, components go with the host
+//
+void UApparanceInstancePool::Deinitialize()
+{
+	DEC_DWORD_STAT_BY( STAT_PooledInstanceComponents, Components.Num() - FreeComponents.Num() );
+	DEC_DWORD_STAT_BY( STAT_PooledInstanceGroups, Handles.Num() );
+	if(IsValid( Host ) && !Host->GetWorld()->bIsTearingDown)
+	{
+		Host->Destroy();
+	}
+	Host = nullptr;
+	Components.Empty();
+	ComponentLookup.Empty();
+	ComponentKeys.Empty();
+	EmptyComponents.Empty();
+	FreeComponents.Empty();
+	Handles.Empty();
+	OutdatedComponents.Empty();
+	AutoInstanceCounts.Empty();
+
+	Super::Deinitialize();
+}
+
+// only while there are trees to rebuild or empty components to release
+//
+bool UApparanceInstancePool::IsTickable() const
+{
+	return (OutdatedComponents.Num() > 0 || EmptyComponents.Num() > 0) && !HasAnyFlags( RF_ClassDefaultObject );
+}
+
+// kick off async tree builds for components changed this frame, release components that have stayed empty
+//
+void UApparanceInstancePool::Tick( float DeltaTime )
+{
+	for(int index : OutdatedComponents)
+	{
+		UHierarchicalInstancedStaticMeshComponent* phism = Cast<UHierarchicalInstancedStaticMeshComponent>( Components[index].InstancedMeshes.Get() );
+		if(phism)
+		{
+			phism->BuildTreeIfOutdated( true/*async*/, false );
+		}
+	}
+	OutdatedComponents.Reset();
+
+	//long empty
+	const double now = FPlatformTime::Seconds();
+	for(auto It = EmptyComponents.CreateIterator(); It; ++It)
+	{
+		if(now - It.Value() >= INSTANCE_POOL_RECYCLE_DELAY)
+		{
+			ReleaseComponent( It.Key() );
+			It.RemoveCurrent();
+		}
+	}
+}
+
+TStatId UApparanceInstancePool::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT( UApparanceInstancePool, STATGROUP_Apparance );
+}
+
+// place a group of instances, split between components by spatial bucket
+//
+int UApparanceInstancePool::AddInstances( UStaticMesh* pmesh, const TArray<UMaterialInterface*>& materials, FName collision_profile, const TArray<FTransform>& transforms )
+{
+	if(!pmesh || transforms.Num() == 0)
+	{
+		return 0;
+	}
+
+	//by bucket
+	TMap<FIntVector, TArray<FTransform>> buckets;
+	for(const FTransform& transform : transforms)
+	{
+		buckets.FindOrAdd( GetBucket( transform.GetLocation() ) ).Add( transform );
+	}
+
+	//place
+	FInstancePoolKey key;
+	key.Mesh = pmesh;
+	for(UMaterialInterface* pmaterial : materials)
+	{
+		key.Materials.Add( pmaterial );
+	}
+	key.CollisionProfile = collision_profile;
+	const int handle = NextHandle++;
+	TArray<int>& component_indices = Handles.Add( handle );
+	for(const TPair<FIntVector, TArray<FTransform>>& bucket : buckets)
+	{
+		key.Bucket = bucket.Key;
+		const int index = FindOrAddComponent( key );
+		if(index != INDEX_NONE)
+		{
+			Components[index].PlaceInstances( handle, bucket.Value );
+			component_indices.Add( index );
+			OutdatedComponents.Add( index );
+			EmptyComponents.Remove( index );
+		}
+	}
+	INC_DWORD_STAT( STAT_PooledInstanceGroups );
+	return handle;
+}
+
+// drop a group of instances
+//
+void UApparanceInstancePool::RemoveInstances( int handle )
+{
+	TArray<int> component_indices;
+	if(Handles.RemoveAndCopyValue( handle, component_indices ))
+	{
+		const double now = FPlatformTime::Seconds();
+		for(int index : component_indices)
+		{
+			Components[index].FreeInstances( handle );
+			OutdatedComponents.Add( index );
+			if(Components[index].Ranges.Num() == 0)
+			{
+				EmptyComponents.Add( index, now );
+			}
+		}
+		DEC_DWORD_STAT( STAT_PooledInstanceGroups );
+	}
+}
+
+// show/hide a group of instances
+//
+void UApparanceInstancePool::SetInstancesVisible( int handle, bool visible )
+{
+	if(const TArray<int>* pcomponent_indices = Handles.Find( handle ))
+	{
+		for(int index : *pcomponent_indices)
+		{
+			Components[index].SetInstancesVisible( handle, visible );
+			OutdatedComponents.Add( index );
+		}
+	}
+}
+
+// mesh a group of instances is of
+//
+UStaticMesh* UApparanceInstancePool::GetMesh( int handle ) const
+{
+	const TArray<int>* pcomponent_indices = Handles.Find( handle );
+	return (pcomponent_indices && pcomponent_indices->Num() > 0) ? Components[(*pcomponent_indices)[0]].Mesh.Get() : nullptr;
+}
+
+// placements of a group of instances (world space)
+//
+void UApparanceInstancePool::GetInstances( int handle, TArray<FTransform>& transforms_out ) const
+{
+	if(const TArray<int>* pcomponent_indices = Handles.Find( handle ))
+	{
+		for(int index : *pcomponent_indices)
+		{
+			const FInstancedMeshCacheEntry& entry = Components[index];
+			if(const FInstanceRange* prange = entry.Ranges.Find( handle ))
+			{
+				transforms_out.Append( entry.Transforms.GetData() + prange->Start, prange->Count );
+			}
+		}
+	}
+}
+
+// track placements of an automatically instanced mesh across all entities, returns the new total
+//
+int UApparanceInstancePool::AdjustAutoInstanceCount( UStaticMesh* pmesh, int delta )
+{
+	if(!pmesh)
+	{
+		return 0;
+	}
+	int& count = AutoInstanceCounts.FindOrAdd( pmesh );
+	count += delta;
+	const int total = count;
+	if(total <= 0)
+	{
+		AutoInstanceCounts.Remove( pmesh );
+	}
+	return total;
+}
+
+// number of components hosting pooled instances
+//
+int UApparanceInstancePool::GetComponentCount() const
+{
+	int count = 0;
+	for(const FInstancedMeshCacheEntry& entry : Components)
+	{
+		if(entry.InstancedMeshes.IsValid())
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+// number of instances in use
+//
+int UApparanceInstancePool::GetInstanceCount() const
+{
+	int count = 0;
+	for(const FInstancedMeshCacheEntry& entry : Components)
+	{
+		for(const TPair<int, FInstanceRange>& range : entry.Ranges)
+		{
+			count += range.Value.Count;
+		}
+	}
+	return count;
+}
+
+// component for instances of a kind, created on demand
+//
+int UApparanceInstancePool::FindOrAddComponent( const FInstancePoolKey& key )
+{
+	if(const int* pindex = ComponentLookup.Find( key ))
+	{
+		return *pindex;
+	}
+
+	//host, created on first use (not possible during subsystem init)
+	UWorld* pworld = GetWorld();
+	if(!IsValid( Host ))
+	{
+		FActorSpawnParameters asp;
+		asp.ObjectFlags = RF_Transient;
+		Host = pworld ? pworld->SpawnActor<AActor>( AActor::StaticClass(), FTransform::Identity, asp ) : nullptr;
+		if(!Host)
+		{
+			return INDEX_NONE;
+		}
+		USceneComponent* proot = NewObject<USceneComponent>( Host, NAME_None, RF_Transient );
+		proot->SetMobility( EComponentMobility::Static );
+		Host->SetRootComponent( proot );
+		proot->RegisterComponent();
+#if WITH_EDITOR
+		Host->SetActorLabel( TEXT( "ApparanceInstancePool" ) );
+#endif
+	}
+
+	//create
+	UStaticMesh* pmesh = key.Mesh.Get();
+	UHierarchicalInstancedStaticMeshComponent* phism = NewObject<UHierarchicalInstancedStaticMeshComponent>( Host, NAME_None, RF_Transient | RF_DuplicateTransient );
+	phism->bAutoRebuildTreeOnInstanceChanges = false;	//(built async, once per frame)
+
+	//disable (costly) overlaps during setup
+	bool does_overlaps = phism->GetGenerateOverlapEvents();
+	phism->SetGenerateOverlapEvents( false );
+
+	phism->SetMobility( EComponentMobility::Static );
+	phism->RegisterComponent();
+	phism->SetStaticMesh( pmesh );
+	for(int i = 0; i < key.Materials.Num(); i++)
+	{
+		phism->SetMaterial( i, key.Materials[i].Get() );
+	}
+	phism->SetCollisionProfileName( key.CollisionProfile );
+
+#if UE_VERSION_AT_LEAST(5,1,0)
+	bool need_collision_query = pmesh && pmesh->IsNavigationRelevant(); //optim by completely disabling physics for e.g. foliage
+	phism->GetBodyInstance()->SetCollisionEnabled( need_collision_query ? ECollisionEnabled::QueryOnly : ECollisionEnabled::NoCollision );
+#endif
+
+	phism->AttachToComponent( Host->GetRootComponent(), FAttachmentTransformRules::KeepRelativeTransform );
+	phism->SetGenerateOverlapEvents( does_overlaps );
+	//navmesh support of instanced meshes needs this
+	phism->bNavigationRelevant = true;
+
+	//record (reusing a released slot if there is one)
+	FInstancedMeshCacheEntry entry;
+	entry.Mesh = pmesh;
+	entry.InstancedMeshes = phism;
+	int index;
+	if(FreeComponents.Num() > 0)
+	{
+		index = FreeComponents.Pop();
+		Components[index] = entry;
+		ComponentKeys[index] = key;
+	}
+	else
+	{
+		index = Components.Add( entry );
+		ComponentKeys.Add( key );
+	}
+	ComponentLookup.Add( key, index );
+	INC_DWORD_STAT( STAT_PooledInstanceComponents );
+	return index;
+}
+
+// done with a component that has no instances left, its slot is reused
+//
+void UApparanceInstancePool::ReleaseComponent( int index )
+{
+	FInstancedMeshCacheEntry& entry = Components[index];
+	if(entry.Ranges.Num() > 0)
+	{
+		return;
+	}
+	if(UInstancedStaticMeshComponent* pcomponent = entry.InstancedMeshes.Get())
+	{
+		pcomponent->DestroyComponent();
+	}
+	ComponentLookup.Remove( ComponentKeys[index] );
+	ComponentKeys[index] = FInstancePoolKey();
+	Components[index] = FInstancedMeshCacheEntry();
+	OutdatedComponents.Remove( index );
+	FreeComponents.Add( index );
+	DEC_DWORD_STAT( STAT_PooledInstanceComponents );
+}
+
+// spatial bucket a world location falls in
+//
+FIntVector UApparanceInstancePool::GetBucket( const FVector& location ) const
+{
+	const float bucket_size = UApparanceEngineSetup::GetInstancePoolBucketSize();
+	if(bucket_size <= 0)
+	{
+		return FIntVector::ZeroValue;
+	}
+	return FIntVector(
+		FMath::FloorToInt( location.X / bucket_size ),
+		FMath::FloorToInt( location.Y / bucket_size ),
+		FMath::FloorToInt( location.Z / bucket_size ) );
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// reporting
+
+/// <summary>
+/// log how many components and instances are pooled in each world
+/// </summary>
+static void ReportInstancePool( const TArray<FString>& args )
+{
+	for(TObjectIterator<UApparanceInstancePool> It; It; ++It)
+	{
+		UApparanceInstancePool* ppool = *It;
+		UWorld* pworld = ppool->GetWorld();
+		if(!pworld || ppool->HasAnyFlags( RF_ClassDefaultObject ))
+		{
+			continue;
+		}
+		UE_LOG( LogApparance, Display, TEXT( "Instance pool (%s): %i instances in %i groups, on %i components" ), *pworld->GetName(), ppool->GetInstanceCount(), ppool->GetHandleCount(), ppool->GetComponentCount() );
+	}
+}
+
+static FAutoConsoleCommand GApparanceReportInstancePoolCommand(
+	TEXT( "Apparance.ReportInstancePool" ),
+	TEXT( "Log how many instanced mesh components and instances are shared between the entities of each world." ),
+	FConsoleCommandWithArgsDelegate::CreateStatic( &ReportInstancePool ) );
+
+
+#if APPARANCE_DEBUGGING_HELP_ApparanceInstancePool
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
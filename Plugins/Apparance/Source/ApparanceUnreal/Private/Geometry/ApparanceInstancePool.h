@@ -0,0 +1,121 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+//unreal
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "Engine/EngineTypes.h"
+
+//module
+#include "ApparanceEntity.h"
+
+// auto (last)
+#include "ApparanceInstancePool.generated.h"
+
+#define INSTANCE_POOL_RECYCLE_DELAY 5.0	//(s) components left empty this long are released, so brief gaps (rebuilds) don't churn them
+
+
+// what pooled instances can share a component on
+//
+struct FInstancePoolKey
+{
+	TWeakObjectPtr<class UStaticMesh> Mesh;
+	TArray<TWeakObjectPtr<class UMaterialInterface>> Materials;	//overrides (empty for mesh defaults)
+	FName CollisionProfile;
+	FIntVector Bucket;	//spatial, so components stay cullable
+
+	bool operator==( const FInstancePoolKey& other ) const
+	{
+		return Mesh == other.Mesh && Materials == other.Materials && CollisionProfile == other.CollisionProfile && Bucket == other.Bucket;
+	}
+	friend uint32 GetTypeHash( const FInstancePoolKey& key )
+	{
+		uint32 hash = HashCombine( GetTypeHash( key.Mesh ), GetTypeHash( key.CollisionProfile ) );
+		hash = HashCombine( hash, GetTypeHash( key.Bucket ) );
+		for(const TWeakObjectPtr<class UMaterialInterface>& pmaterial : key.Materials)
+		{
+			hash = HashCombine( hash, GetTypeHash( pmaterial ) );
+		}
+		return hash;
+	}
+};
+
+
+// Apparance Instance Pool
+// Hierarchical instanced mesh components shared by all the entities of a world, so repeated meshes are drawn together instead of per entity
+// Components are per mesh, material overrides, collision profile, and spatial bucket, instances are placed in world space and handed out in groups by handle
+// Cluster trees are rebuilt asynchronously, once per frame, for components changed in it
+// Components left without instances are released after a while, their slots reused for new ones
+//
+UCLASS()
+class UApparanceInstancePool
+	: public UWorldSubsystem
+	, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+	//owner of the pooled components
+	UPROPERTY( Transient )
+	class AActor* Host;
+
+	//pooled components, instances tracked by handle
+	UPROPERTY( Transient )
+	TArray<FInstancedMeshCacheEntry> Components;
+	TMap<FInstancePoolKey, int> ComponentLookup;
+	TArray<FInstancePoolKey> ComponentKeys;	//(parallel to Components)
+
+	//components with no instances left, by when they emptied, and released slots to reuse
+	TMap<int, double> EmptyComponents;
+	TArray<int> FreeComponents;
+
+	//components each handle has instances in
+	TMap<int, TArray<int>> Handles;
+	int NextHandle;
+
+	//changed this frame, need tree rebuild
+	TSet<int> OutdatedComponents;
+
+	//placements of automatically instanced meshes, by all entities (see EApparanceInstancingMode::Auto)
+	TMap<TWeakObjectPtr<class UStaticMesh>, int> AutoInstanceCounts;
+
+public:
+	UApparanceInstancePool();
+
+	//USubsystem
+	virtual void Deinitialize() override;
+
+	//FTickableGameObject
+	virtual void Tick( float DeltaTime ) override;
+	virtual bool IsTickable() const override;
+	virtual bool IsTickableInEditor() const override { return true; }
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+
+	//instances, world space, returns handle for the group (0 if none placed)
+	int AddInstances( class UStaticMesh* pmesh, const TArray<class UMaterialInterface*>& materials, FName collision_profile, const TArray<FTransform>& transforms );
+	void RemoveInstances( int handle );
+	void SetInstancesVisible( int handle, bool visible );
+	class UStaticMesh* GetMesh( int handle ) const;
+	void GetInstances( int handle, TArray<FTransform>& transforms_out ) const;
+
+	//automatic instancing decided world wide, returns new total for the mesh
+	int AdjustAutoInstanceCount( class UStaticMesh* pmesh, int delta );
+
+	//info
+	int GetComponentCount() const;
+	int GetInstanceCount() const;
+	int GetHandleCount() const { return Handles.Num(); }
+
+private:
+	int FindOrAddComponent( const FInstancePoolKey& key );
+	void ReleaseComponent( int index );
+	FIntVector GetBucket( const FVector& location ) const;
+};
@@ -0,0 +1,402 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_ApparanceMeshComponent 0
+#if APPARANCE_DEBUGGING_HELP_ApparanceMeshComponent
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "ApparanceMeshComponent.h"
+
+// unreal
+#include "PrimitiveSceneProxy.h"
+#include "MaterialShared.h"
+#include "RenderingThread.h"
+#include "Materials/Material.h"
+#include "Engine/Engine.h"
+#include "SceneManagement.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_CYCLE_STAT( TEXT( "Create Mesh Proxy" ), STAT_ApparanceMesh_CreateSceneProxy, STATGROUP_Apparance );
+DECLARE_CYCLE_STAT( TEXT( "Create Mesh Render Data" ), STAT_ApparanceMesh_CreateRenderData, STATGROUP_Apparance );
+DECLARE_MEMORY_STAT( TEXT( "Mesh Render Data" ), STAT_ApparanceMesh_RenderDataMemory, STATGROUP_Apparance );
+DECLARE_MEMORY_STAT( TEXT( "Mesh Render Data Shared" ), STAT_ApparanceMesh_SharedMemory, STATGROUP_Apparance );
+
+
+//////////////////////////////////////////////////////////////////////////
+// FApparanceMeshRenderData
+
+FApparanceMeshRenderData::FApparanceMeshRenderData( ERHIFeatureLevel::Type feature_level )
+	: IndexBuffer( false )
+	, VertexFactory( feature_level, "FApparanceMeshRenderData" )
+	, NumVertices( 0 )
+	, NumIndices( 0 )
+	, Bounds( ForceInit )
+	, ResourceSize( 0 )
+	, ContentHash( 0 )
+	, Users( 0 )
+{
+}
+
+// build GPU buffers from section streams (no CPU copy kept once uploaded)
+// NOTE: section streams are consumed as they are copied
+//
+FApparanceMeshRenderDataPtr FApparanceMeshRenderData::Create( FApparanceMeshSectionData&& section_data, uint64 content_hash )
+{
+	SCOPE_CYCLE_COUNTER( STAT_ApparanceMesh_CreateRenderData );
+
+	FApparanceMeshRenderData* prender_data = new FApparanceMeshRenderData( GMaxRHIFeatureLevel );
+	const int32 num_v = section_data.GetNumVertices();
+	prender_data->NumVertices = num_v;
+	prender_data->NumIndices = section_data.Indices.Num();
+	prender_data->Bounds = section_data.Bounds;
+	prender_data->ContentHash = content_hash;
+
+	if(!section_data.IsEmpty())
+	{
+		//approximate GPU footprint
+		const bool has_colours = section_data.Colours.Num() == num_v;
+		prender_data->ResourceSize = section_data.Positions.Num() * sizeof( FApparanceMeshVector )
+			+ section_data.Tangents.Num() * sizeof( FPackedNormal )
+			+ section_data.TexCoords.Num() * sizeof( FApparanceMeshUV )
+			+ (has_colours ? num_v * sizeof( FColor ) : 0);
+
+		//vertex streams, straight copies of the section data
+		//each source stream is freed as soon as it's copied, so only one is ever held twice
+		FStaticMeshVertexBuffers& vertex_buffers = prender_data->VertexBuffers;
+		vertex_buffers.PositionVertexBuffer.Init( section_data.Positions, false );
+		section_data.Positions.Empty();
+		vertex_buffers.StaticMeshVertexBuffer.SetUseFullPrecisionUVs( true );	//avoid distortion on very thin/long triangles
+		vertex_buffers.StaticMeshVertexBuffer.Init( num_v, section_data.NumTexCoords, false );
+		FMemory::Memcpy( vertex_buffers.StaticMeshVertexBuffer.GetTangentData(), section_data.Tangents.GetData(), section_data.Tangents.Num() * sizeof( FPackedNormal ) );
+		section_data.Tangents.Empty();
+		FMemory::Memcpy( vertex_buffers.StaticMeshVertexBuffer.GetTexCoordData(), section_data.TexCoords.GetData(), section_data.TexCoords.Num() * sizeof( FApparanceMeshUV ) );
+		section_data.TexCoords.Empty();
+		if(has_colours)
+		{
+			vertex_buffers.ColorVertexBuffer.InitFromColorArray( section_data.Colours.GetData(), num_v, sizeof( FColor ), false );
+		}
+		section_data.Colours.Empty();
+
+		//indices, 16-bit where they fit
+		prender_data->IndexBuffer.SetIndices( section_data.Indices, EIndexBufferStride::AutoDetect );
+		section_data.Indices.Empty();
+		prender_data->ResourceSize += prender_data->NumIndices * (prender_data->IndexBuffer.Is32Bit() ? sizeof( uint32 ) : sizeof( uint16 ));
+
+		//upload
+		BeginInitResource( &vertex_buffers.PositionVertexBuffer );
+		BeginInitResource( &vertex_buffers.StaticMeshVertexBuffer );
+		BeginInitResource( &vertex_buffers.ColorVertexBuffer );
+		vertex_buffers.InitModelVF( &prender_data->VertexFactory );
+		BeginInitResource( &prender_data->VertexFactory );
+		BeginInitResource( &prender_data->IndexBuffer );
+	}
+	INC_MEMORY_STAT_BY( STAT_ApparanceMesh_RenderDataMemory, prender_data->ResourceSize );
+
+	return FApparanceMeshRenderDataPtr( MakeShareable( prender_data, &FApparanceMeshRenderData::Destroy ) );
+}
+
+// another component is drawing this
+//
+void FApparanceMeshRenderData::AddUser()
+{
+	if(Users > 0)
+	{
+		INC_MEMORY_STAT_BY( STAT_ApparanceMesh_SharedMemory, ResourceSize );
+	}
+	Users++;
+}
+
+// a component has stopped drawing this
+//
+void FApparanceMeshRenderData::RemoveUser()
+{
+	check( Users > 0 );
+	Users--;
+	if(Users > 0)
+	{
+		DEC_MEMORY_STAT_BY( STAT_ApparanceMesh_SharedMemory, ResourceSize );
+	}
+}
+
+// render thread
+//
+void FApparanceMeshRenderData::ReleaseResources()
+{
+	VertexBuffers.PositionVertexBuffer.ReleaseResource();
+	VertexBuffers.StaticMeshVertexBuffer.ReleaseResource();
+	VertexBuffers.ColorVertexBuffer.ReleaseResource();
+	IndexBuffer.ReleaseResource();
+	VertexFactory.ReleaseResource();
+}
+
+// last reference gone, which can be on the game thread (component) or the render thread (proxy)
+//
+void FApparanceMeshRenderData::Destroy( FApparanceMeshRenderData* prender_data )
+{
+	DEC_MEMORY_STAT_BY( STAT_ApparanceMesh_RenderDataMemory, prender_data->ResourceSize );
+
+	if(IsInRenderingThread())
+	{
+		prender_data->ReleaseResources();
+		delete prender_data;
+	}
+	else
+	{
+		ENQUEUE_RENDER_COMMAND( ReleaseApparanceMeshRenderData )(
+			[prender_data]( FRHICommandListImmediate& RHICmdList )
+			{
+				prender_data->ReleaseResources();
+				delete prender_data;
+			} );
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// FApparanceMeshSceneProxy
+
+/// <summary>
+/// what to draw for one section
+/// </summary>
+struct FApparanceMeshProxySection
+{
+	FApparanceMeshRenderDataPtr RenderData;	//keeps buffers alive while we draw them
+	UMaterialInterface*         Material;
+};
+
+/// <summary>
+/// static scene proxy, drawing shared section buffers via cached mesh draw commands
+/// </summary>
+class FApparanceMeshSceneProxy final : public FPrimitiveSceneProxy
+{
+	TArray<FApparanceMeshProxySection> Sections;
+	FMaterialRelevance MaterialRelevance;
+
+public:
+	virtual SIZE_T GetTypeHash() const override
+	{
+		static size_t UniquePointer;
+		return reinterpret_cast<size_t>(&UniquePointer);
+	}
+
+	FApparanceMeshSceneProxy( UApparanceMeshComponent* pcomponent )
+		: FPrimitiveSceneProxy( pcomponent )
+		, MaterialRelevance( pcomponent->GetMaterialRelevance( GetScene().GetFeatureLevel() ) )
+	{
+		for(int i = 0; i < pcomponent->GetNumSections(); i++)
+		{
+			const FApparanceMeshRenderDataPtr& render_data = pcomponent->GetSection( i );
+			if(!render_data.IsValid() || render_data->NumIndices == 0)
+			{
+				continue;
+			}
+
+			FApparanceMeshProxySection& section = Sections.AddDefaulted_GetRef();
+			section.RenderData = render_data;
+			section.Material = pcomponent->GetMaterial( i );
+			if(!section.Material)
+			{
+				section.Material = UMaterial::GetDefaultMaterial( MD_Surface );
+			}
+		}
+	}
+
+	virtual void DrawStaticElements( FStaticPrimitiveDrawInterface* PDI ) override
+	{
+		for(const FApparanceMeshProxySection& section : Sections)
+		{
+			const FApparanceMeshRenderData* prender_data = section.RenderData.Get();
+			FMeshBatch mesh;
+			mesh.VertexFactory = &prender_data->VertexFactory;
+			mesh.MaterialRenderProxy = section.Material->GetRenderProxy();
+			mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
+			mesh.Type = PT_TriangleList;
+			mesh.DepthPriorityGroup = SDPG_World;
+			mesh.LODIndex = 0;
+			mesh.CastShadow = true;
+			FMeshBatchElement& element = mesh.Elements[0];
+			element.IndexBuffer = &prender_data->IndexBuffer;
+			element.FirstIndex = 0;
+			element.NumPrimitives = prender_data->NumIndices / 3;
+			element.MinVertexIndex = 0;
+			element.MaxVertexIndex = prender_data->NumVertices - 1;
+			PDI->DrawMesh( mesh, FLT_MAX );
+		}
+	}
+
+	virtual FPrimitiveViewRelevance GetViewRelevance( const FSceneView* View ) const override
+	{
+		FPrimitiveViewRelevance result;
+		result.bDrawRelevance = IsShown( View );
+		result.bShadowRelevance = IsShadowCast( View );
+		result.bStaticRelevance = true;
+		result.bDynamicRelevance = false;
+		result.bRenderInMainPass = ShouldRenderInMainPass();
+		result.bUsesLightingChannels = GetLightingChannelMask() != GetDefaultLightingChannelMask();
+		result.bRenderCustomDepth = ShouldRenderCustomDepth();
+		result.bTranslucentSelfShadow = bCastVolumetricTranslucentShadow;
+		MaterialRelevance.SetPrimitiveViewRelevance( result );
+		result.bVelocityRelevance = IsMovable() && result.bOpaque && result.bRenderInMainPass;
+		return result;
+	}
+
+	virtual bool CanBeOccluded() const override
+	{
+		return !MaterialRelevance.bDisableDepthTest;
+	}
+
+	virtual uint32 GetMemoryFootprint() const override
+	{
+		return sizeof( *this ) + GetAllocatedSize();
+	}
+
+	uint32 GetAllocatedSize() const
+	{
+		return FPrimitiveSceneProxy::GetAllocatedSize() + Sections.GetAllocatedSize();
+	}
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// UApparanceMeshComponent
+
+UApparanceMeshComponent::UApparanceMeshComponent()
+	: LocalBounds( ForceInit )
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	SetCollisionEnabled( ECollisionEnabled::NoCollision );	//render only
+}
+
+// take ownership of section geometry
+//
+void UApparanceMeshComponent::SetSection( int section_index, FApparanceMeshSectionData&& section_data )
+{
+	SetSection( section_index, FApparanceMeshRenderData::Create( MoveTemp( section_data ) ) );
+}
+
+// use (possibly shared) section render data
+//
+void UApparanceMeshComponent::SetSection( int section_index, const FApparanceMeshRenderDataPtr& render_data )
+{
+	if(section_index >= Sections.Num())
+	{
+		Sections.SetNum( section_index + 1 );
+	}
+	if(Sections[section_index].IsValid())
+	{
+		Sections[section_index]->RemoveUser();
+	}
+	Sections[section_index] = render_data;
+	if(render_data.IsValid())
+	{
+		render_data->AddUser();
+	}
+
+	UpdateLocalBounds();
+	MarkRenderStateDirty();
+}
+
+// drop all geometry
+//
+void UApparanceMeshComponent::ClearSections()
+{
+	ReleaseSections();
+
+	UpdateLocalBounds();
+	MarkRenderStateDirty();
+}
+
+void UApparanceMeshComponent::BeginDestroy()
+{
+	ReleaseSections();
+
+	Super::BeginDestroy();
+}
+
+FPrimitiveSceneProxy* UApparanceMeshComponent::CreateSceneProxy()
+{
+	SCOPE_CYCLE_COUNTER( STAT_ApparanceMesh_CreateSceneProxy );
+
+	if(Sections.Num() == 0)
+	{
+		return nullptr;
+	}
+	return new FApparanceMeshSceneProxy( this );
+}
+
+int32 UApparanceMeshComponent::GetNumMaterials() const
+{
+	return Sections.Num();
+}
+
+// includes the default material drawn for sections without one (see FApparanceMeshSceneProxy), so it's compiled for our vertex factory
+//
+void UApparanceMeshComponent::GetUsedMaterials( TArray<UMaterialInterface*>& OutMaterials, bool bGetDebugMaterials ) const
+{
+	Super::GetUsedMaterials( OutMaterials, bGetDebugMaterials );
+
+	for(int i = 0; i < Sections.Num(); i++)
+	{
+		if(Sections[i].IsValid() && Sections[i]->NumIndices > 0 && !GetMaterial( i ))
+		{
+			OutMaterials.AddUnique( UMaterial::GetDefaultMaterial( MD_Surface ) );
+			break;
+		}
+	}
+}
+
+FBoxSphereBounds UApparanceMeshComponent::CalcBounds( const FTransform& LocalToWorld ) const
+{
+	FBoxSphereBounds bounds( LocalBounds.TransformBy( LocalToWorld ) );
+	bounds.BoxExtent *= BoundsScale;
+	bounds.SphereRadius *= BoundsScale;
+	return bounds;
+}
+
+// stop using section render data (buffers released when no-one else is using them)
+//
+void UApparanceMeshComponent::ReleaseSections()
+{
+	for(const FApparanceMeshRenderDataPtr& render_data : Sections)
+	{
+		if(render_data.IsValid())
+		{
+			render_data->RemoveUser();
+		}
+	}
+	Sections.Empty();
+}
+
+void UApparanceMeshComponent::UpdateLocalBounds()
+{
+	FBox local_box( ForceInit );
+	for(const FApparanceMeshRenderDataPtr& render_data : Sections)
+	{
+		if(render_data.IsValid())
+		{
+			local_box += render_data->Bounds;
+		}
+	}
+	LocalBounds = local_box.IsValid ? FBoxSphereBounds( local_box ) : FBoxSphereBounds( FVector::ZeroVector, FVector::ZeroVector, 0 );
+
+	UpdateBounds();
+	MarkRenderTransformDirty();
+}
+
+
+#if APPARANCE_DEBUGGING_HELP_ApparanceMeshComponent
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
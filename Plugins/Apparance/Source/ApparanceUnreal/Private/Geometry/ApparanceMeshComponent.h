@@ -0,0 +1,130 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+//unreal
+#include "Components/MeshComponent.h"
+#include "PackedNormal.h"
+#include "StaticMeshResources.h"
+#include "LocalVertexFactory.h"
+
+//module
+#include "ApparanceUnrealVersioning.h"
+
+// auto (last)
+#include "ApparanceMeshComponent.generated.h"
+
+
+//render vertex component types (always float)
+#if UE_VERSION_AT_LEAST(5,0,0)
+typedef FVector3f FApparanceMeshVector;
+typedef FVector2f FApparanceMeshUV;
+#else
+typedef FVector   FApparanceMeshVector;
+typedef FVector2D FApparanceMeshUV;
+#endif
+
+
+/// <summary>
+/// render ready geometry for one mesh section, laid out as the GPU vertex buffers want it
+/// NOTE: passed to the render data by move, no copies made
+/// </summary>
+struct FApparanceMeshSectionData
+{
+	TArray<FApparanceMeshVector> Positions;
+	TArray<FPackedNormal>        Tangents;		//pair per vertex: TangentX, TangentZ (normal, W is binormal sign)
+	TArray<FApparanceMeshUV>     TexCoords;		//NumTexCoords per vertex
+	TArray<FColor>               Colours;		//empty if none (white)
+	TArray<uint32>               Indices;		//16-bit used on GPU when possible
+	int32                        NumTexCoords = 1;
+	FBox                         Bounds = FBox( ForceInit );
+
+	int32 GetNumVertices() const { return Positions.Num(); }
+	bool IsEmpty() const { return Positions.Num() == 0 || Indices.Num() == 0; }
+	SIZE_T GetAllocatedSize() const
+	{
+		return Positions.GetAllocatedSize() + Tangents.GetAllocatedSize() + TexCoords.GetAllocatedSize() + Colours.GetAllocatedSize() + Indices.GetAllocatedSize();
+	}
+};
+
+
+/// <summary>
+/// GPU buffers for one mesh section, built once and shared by any components/proxies drawing the same geometry
+/// NOTE: lifetime managed by thread safe shared pointer, resources are released on the render thread once the last user is gone
+/// </summary>
+class FApparanceMeshRenderData
+{
+public:
+	FStaticMeshVertexBuffers VertexBuffers;
+	FRawStaticIndexBuffer    IndexBuffer;
+	FLocalVertexFactory      VertexFactory;
+	int32                    NumVertices;
+	int32                    NumIndices;
+	FBox                     Bounds;
+	SIZE_T                   ResourceSize;	//approximate GPU memory used
+	uint64                   ContentHash;	//source geometry hash (0 if not shared)
+
+	//create and start upload (game thread)
+	static TSharedPtr<FApparanceMeshRenderData, ESPMode::ThreadSafe> Create( FApparanceMeshSectionData&& section_data, uint64 content_hash = 0 );
+
+	//component use tracking (game thread), for sharing stats
+	void AddUser();
+	void RemoveUser();
+	int32 GetUserCount() const { return Users; }
+
+private:
+	int32 Users;
+
+	FApparanceMeshRenderData( ERHIFeatureLevel::Type feature_level );
+	void ReleaseResources();
+	static void Destroy( FApparanceMeshRenderData* prender_data );
+};
+
+typedef TSharedPtr<FApparanceMeshRenderData, ESPMode::ThreadSafe> FApparanceMeshRenderDataPtr;
+
+
+// Apparance Mesh Component
+// Lightweight render-only alternative to the procedural mesh component for generated geometry
+// NOTE: collision is handled by separate (procedural mesh) collision components
+//
+UCLASS()
+class APPARANCEUNREAL_API UApparanceMeshComponent
+	: public UMeshComponent
+{
+	GENERATED_BODY()
+
+	//section render data, kept for scene proxy (re)creation
+	TArray<FApparanceMeshRenderDataPtr> Sections;
+	//local space bounds of all sections
+	FBoxSphereBounds LocalBounds;
+
+public:
+	UApparanceMeshComponent();
+
+	//content
+	void SetSection( int section_index, FApparanceMeshSectionData&& section_data );
+	void SetSection( int section_index, const FApparanceMeshRenderDataPtr& render_data );
+	void ClearSections();
+	int GetNumSections() const { return Sections.Num(); }
+	const FApparanceMeshRenderDataPtr& GetSection( int section_index ) const { return Sections[section_index]; }
+
+	//UObject
+	virtual void BeginDestroy() override;
+	//UPrimitiveComponent
+	virtual FPrimitiveSceneProxy* CreateSceneProxy() override;
+	//UMeshComponent
+	virtual int32 GetNumMaterials() const override;
+	virtual void GetUsedMaterials( TArray<UMaterialInterface*>& OutMaterials, bool bGetDebugMaterials = false ) const override;
+	//USceneComponent
+	virtual FBoxSphereBounds CalcBounds( const FTransform& LocalToWorld ) const override;
+
+private:
+	void ReleaseSections();
+	void UpdateLocalBounds();
+};
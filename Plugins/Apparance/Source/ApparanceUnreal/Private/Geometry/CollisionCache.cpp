@@ -0,0 +1,701 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_CollisionCache 0
+#if APPARANCE_DEBUGGING_HELP_CollisionCache
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "CollisionCache.h"
+
+// unreal
+#include "ProceduralMeshComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "PhysicsEngine/PhysicsSettings.h"
+#include "Hash/CityHash.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/EngineVersion.h"
+#include "Async/Async.h"
+#include "Engine/World.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "EntityRendering.h"
+#include "FrameBudget.h"
+
+
+// profiler stats
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Collision Cache Hits" ), STAT_CollisionCacheHits, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Collision Cache Misses" ), STAT_CollisionCacheMisses, STATGROUP_Apparance );
+DECLARE_FLOAT_ACCUMULATOR_STAT( TEXT( "Collision Cook Time Saved (ms)" ), STAT_CollisionCookTimeSaved, STATGROUP_Apparance );
+DECLARE_MEMORY_STAT( TEXT( "Collision Cache Memory" ), STAT_CollisionCacheMemory, STATGROUP_Apparance );
+
+//bump to invalidate persisted entries
+#define APPARANCE_COLLISION_CACHE_VERSION 1
+#define APPARANCE_COLLISION_CACHE_MAGIC 0x43435041 //'APCC'
+
+//evict down to this fraction of a limit, so eviction isn't needed again straight away
+#define APPARANCE_COLLISION_CACHE_EVICT_TARGET 0.75
+
+//give up waiting for an async cook to complete after this long (s), e.g. if it was aborted
+#define APPARANCE_COLLISION_CACHE_CAPTURE_TIMEOUT 30.0
+
+//persisted entry header
+struct FCollisionCacheFileHeader
+{
+	uint32 Magic;
+	uint32 Version;
+	float  CookTime;
+	uint32 DataSize;
+};
+
+
+/// <summary>
+/// physics format cooked data is stored under
+/// </summary>
+static FName GetPhysicsFormatName()
+{
+	static FName PhysicsFormatName( FPlatformProperties::GetPhysicsFormat() );
+	return PhysicsFormatName;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// FCollisionCache
+
+FCollisionCache::FCollisionCache()
+	: m_bEnabled( false )
+	, m_MemoryLimit( 0 )
+	, m_DiskLimit( 0 )
+	, m_MemoryUsed( 0 )
+	, m_DiskUsed( 0 )
+	, m_UseCounter( 0 )
+	, m_HitCount( 0 )
+	, m_MissCount( 0 )
+	, m_CookTimeSaved( 0 )
+{
+}
+
+// setup, find what we already have on disk
+//
+void FCollisionCache::Init( bool enable, int memory_limit_mb, int disk_limit_mb )
+{
+	Shutdown();
+	m_bEnabled = enable;
+	m_MemoryLimit = (int64)FMath::Max( memory_limit_mb, 0 ) * 1024 * 1024;
+	m_DiskLimit = (int64)FMath::Max( disk_limit_mb, 0 ) * 1024 * 1024;
+	if(!m_bEnabled)
+	{
+		return;
+	}
+
+	//existing entries
+	m_Directory = FPaths::Combine( FPaths::ProjectSavedDir(), TEXT( "Apparance" ), TEXT( "CollisionCache" ) );
+	IFileManager& file_manager = IFileManager::Get();
+	file_manager.MakeDirectory( *m_Directory, true );
+	TArray<FString> files;
+	file_manager.FindFiles( files, *FPaths::Combine( m_Directory, TEXT( "*.bin" ) ), true, false );
+
+	//oldest first so use order carries over
+	TArray<TPair<FDateTime, FString>> by_age;
+	for(const FString& file : files)
+	{
+		by_age.Add( TPair<FDateTime, FString>( file_manager.GetTimeStamp( *FPaths::Combine( m_Directory, file ) ), file ) );
+	}
+	by_age.Sort( []( const TPair<FDateTime, FString>& a, const TPair<FDateTime, FString>& b ) { return a.Key < b.Key; } );
+	for(const TPair<FDateTime, FString>& file : by_age)
+	{
+		const uint64 key = FCString::Strtoui64( *FPaths::GetBaseFilename( file.Value ), nullptr, 16 );
+		FEntry& entry = m_Entries.Add( key );
+		entry.DiskSize = file_manager.FileSize( *FPaths::Combine( m_Directory, file.Value ) );
+		entry.CookTime = 0;	//known once loaded
+		entry.LastUse = ++m_UseCounter;
+		entry.bLoading = false;
+		m_DiskUsed += entry.DiskSize;
+	}
+	EnforceLimits();
+
+	//bring the most recently used back in, as much as fits in memory
+	const int64 prefetch_limit = (int64)(m_MemoryLimit * APPARANCE_COLLISION_CACHE_EVICT_TARGET);
+	int64 prefetch_size = 0;
+	for(int i = by_age.Num() - 1; i >= 0; i--)
+	{
+		const uint64 key = FCString::Strtoui64( *FPaths::GetBaseFilename( by_age[i].Value ), nullptr, 16 );
+		FEntry* pentry = m_Entries.Find( key );
+		if(pentry)
+		{
+			prefetch_size += pentry->DiskSize;
+			if(prefetch_size > prefetch_limit)
+			{
+				break;
+			}
+			LoadEntry( key, *pentry );
+		}
+	}
+	KickIo();
+}
+
+// release memory, persisted entries stay
+//
+void FCollisionCache::Shutdown()
+{
+	FlushIo();
+	ResetEntries();
+	m_PendingCaptures.Empty();
+}
+
+// forget all entries (memory only)
+//
+void FCollisionCache::ResetEntries()
+{
+	m_Entries.Empty();
+	m_MemoryUsed = 0;
+	m_DiskUsed = 0;
+	SET_MEMORY_STAT( STAT_CollisionCacheMemory, 0 );
+}
+
+// collision update, use cooked data if we've cooked it before, otherwise cook and capture
+//
+void FCollisionCache::UpdateCollision( UProceduralMeshComponent* pmc, const TArray<TArray<FVector>>* phulls, uint64 content_key )
+{
+	if(!m_bEnabled)
+	{
+		ApplyCollision( pmc, phulls );
+		return;
+	}
+
+	//any previous cook of this component is being replaced
+	m_PendingCaptures.RemoveAll( [pmc]( const FPendingCapture& capture ) { return capture.Component.Get() == pmc; } );
+
+	const uint64 key = CalcKey( pmc, phulls, content_key );
+	UBodySetup* pbody_setup = pmc->GetBodySetup();
+
+	//seen before?
+	FEntry* pentry = m_Entries.Find( key );
+	if(pentry && pentry->Data.Num() > 0)
+	{
+		const double start_time = FPlatformTime::Seconds();
+
+		//supply cooked data, body setup uses it instead of cooking (has to be synchronous for this)
+		FFormatContainer cooked_data;
+		FByteBulkData& bulk_data = cooked_data.GetFormat( GetPhysicsFormatName() );
+		bulk_data.Lock( LOCK_READ_WRITE );
+		FMemory::Memcpy( bulk_data.Realloc( pentry->Data.Num() ), pentry->Data.GetData(), pentry->Data.Num() );
+		bulk_data.Unlock();
+		const bool async_cooking = pmc->bUseAsyncCooking;
+		pmc->bUseAsyncCooking = false;
+		pbody_setup->CookedFormatDataOverride = &cooked_data;
+		ApplyCollision( pmc, phulls );
+		pbody_setup->CookedFormatDataOverride = nullptr;
+		pmc->bUseAsyncCooking = async_cooking;
+
+		const float saved = FMath::Max( 0.0f, pentry->CookTime - (float)(FPlatformTime::Seconds() - start_time) );
+		m_CookTimeSaved += saved;
+		m_HitCount++;
+		INC_DWORD_STAT( STAT_CollisionCacheHits );
+		INC_FLOAT_STAT_BY( STAT_CollisionCookTimeSaved, saved * 1000.0f );
+		Touch( key, *pentry );
+		EnforceLimits();
+		return;
+	}
+
+	//cook as normal
+	m_MissCount++;
+	INC_DWORD_STAT( STAT_CollisionCacheMisses );
+	const double start_time = FPlatformTime::Seconds();
+	ApplyCollision( pmc, phulls );
+
+	//persisted? load for next time rather than capture
+	if(pentry)
+	{
+		if(!pentry->bLoading)
+		{
+			LoadEntry( key, *pentry );
+		}
+		return;
+	}
+
+	//can't capture cooked data here
+	if(FPlatformProperties::RequiresCookedData())
+	{
+		return;
+	}
+
+	//capture once cooked (same condition the component uses to decide on async cooking)
+	UWorld* pworld = pmc->GetWorld();
+	if(pmc->bUseAsyncCooking && pworld && pworld->IsGameWorld())
+	{
+		FPendingCapture& capture = m_PendingCaptures.AddDefaulted_GetRef();
+		capture.Component = pmc;
+		capture.PreviousBodySetup = pbody_setup;
+		capture.Key = key;
+		capture.StartTime = start_time;
+	}
+	else
+	{
+		CaptureCookedData( key, pmc->GetBodySetup(), (float)(FPlatformTime::Seconds() - start_time) );
+	}
+}
+
+// per frame servicing of captures and disk access
+//
+void FCollisionCache::Tick()
+{
+	if(!m_bEnabled)
+	{
+		return;
+	}
+	HandleIoResults();
+	UpdateCaptures();
+	KickIo();
+}
+
+// keep cooked data of misses whose async cook has completed
+//
+void FCollisionCache::UpdateCaptures()
+{
+	const double now = FPlatformTime::Seconds();
+	for(int i = 0; i < m_PendingCaptures.Num(); i++)
+	{
+		const FPendingCapture& capture = m_PendingCaptures[i];
+		UProceduralMeshComponent* pmc = capture.Component.Get();
+		UBodySetup* pbody_setup = pmc ? pmc->GetBodySetup() : nullptr;
+		const bool cooked = pbody_setup && pbody_setup != capture.PreviousBodySetup.Get();
+		if(cooked)
+		{
+			//may have to serialise (editor cooks on request), so within budget
+			if(!g_ApparanceFrameBudget.HasTime())
+			{
+				continue;
+			}
+			FFrameBudget::FScope budget_scope( EApparanceWorkCategory::GeometryAdd );
+			if(!m_Entries.Contains( capture.Key ))	//(identical content may have been captured already)
+			{
+				CaptureCookedData( capture.Key, pbody_setup, 0 );
+			}
+		}
+		else if(pmc && now - capture.StartTime < APPARANCE_COLLISION_CACHE_CAPTURE_TIMEOUT)
+		{
+			continue;
+		}
+		m_PendingCaptures.RemoveAtSwap( i-- );
+	}
+}
+
+// keep the cooked data a body setup has, or produces on request
+// NOTE: cook time is what any request cost, async cooking time isn't known
+//
+bool FCollisionCache::CaptureCookedData( uint64 key, UBodySetup* pbody_setup, float cook_time )
+{
+	if(!pbody_setup)
+	{
+		return false;
+	}
+	const double start_time = FPlatformTime::Seconds();
+	FByteBulkData* pbulk_data = pbody_setup->GetCookedData( GetPhysicsFormatName() );
+	const int64 size = pbulk_data ? pbulk_data->GetBulkDataSize() : 0;
+	if(size <= 0)
+	{
+		return false;
+	}
+	TArray<uint8> data;
+	data.SetNumUninitialized( (int32)size );
+	FMemory::Memcpy( data.GetData(), pbulk_data->LockReadOnly(), size );
+	pbulk_data->Unlock();
+	AddEntry( key, MoveTemp( data ), cook_time + (float)(FPlatformTime::Seconds() - start_time) );
+	return true;
+}
+
+// log cache state
+//
+void FCollisionCache::Report() const
+{
+	int resident = 0;
+	for(const TPair<uint64, FEntry>& entry : m_Entries)
+	{
+		resident += entry.Value.Data.Num() > 0 ? 1 : 0;
+	}
+	const int lookups = m_HitCount + m_MissCount;
+	UE_LOG( LogApparance, Display, TEXT( "Collision cache: %s, %i hits, %i misses (%.1f%% hit rate), %.1f ms cook time saved" ), m_bEnabled ? TEXT( "enabled" ) : TEXT( "disabled" ), m_HitCount, m_MissCount, lookups > 0 ? 100.0 * m_HitCount / lookups : 0.0, m_CookTimeSaved * 1000.0 );
+	UE_LOG( LogApparance, Display, TEXT( "  %i entries, %i resident, %.2f/%.2f MB memory, %.2f/%.2f MB disk (%s)" ), m_Entries.Num(), resident, m_MemoryUsed / (1024.0 * 1024.0), m_MemoryLimit / (1024.0 * 1024.0), m_DiskUsed / (1024.0 * 1024.0), m_DiskLimit / (1024.0 * 1024.0), *m_Directory );
+}
+
+// forget everything we've cooked
+//
+void FCollisionCache::Clear()
+{
+	for(const TPair<uint64, FEntry>& entry : m_Entries)
+	{
+		if(entry.Value.DiskSize > 0)
+		{
+			QueueIo( EIoType::Delete, entry.Key );
+		}
+	}
+	KickIo();
+	ResetEntries();
+	m_PendingCaptures.Empty();
+	m_HitCount = 0;
+	m_MissCount = 0;
+	m_CookTimeSaved = 0;
+}
+
+// identity of the collision content, and anything that affects how it is cooked
+//
+uint64 FCollisionCache::CalcKey( UProceduralMeshComponent* pmc, const TArray<TArray<FVector>>* phulls, uint64 content_key ) const
+{
+	uint64 hash = APPARANCE_COLLISION_CACHE_VERSION;
+	auto Mix = [&hash]( const void* pdata, int64 size )
+	{
+		hash = CityHash64WithSeed( (const char*)pdata, (uint32)size, hash );
+	};
+
+	//cooking setup
+	const TCHAR* format = FPlatformProperties::GetPhysicsFormat();
+	Mix( format, FCString::Strlen( format ) * sizeof( TCHAR ) );
+	const uint32 changelist = FEngineVersion::Current().GetChangelist();
+	Mix( &changelist, sizeof( changelist ) );
+	const uint8 flags = (pmc->bUseComplexAsSimpleCollision ? 1 : 0) | (UPhysicsSettings::Get()->bSupportUVFromHitResults ? 2 : 0);
+	Mix( &flags, sizeof( flags ) );
+
+	//triangles, already identified by caller?
+	if(content_key)
+	{
+		Mix( &content_key, sizeof( content_key ) );
+	}
+	static TArray<FVector> positions;	//scratch, reused to avoid reallocation (game thread only)
+	const int num_sections = pmc->GetNumSections();
+	for(int s = 0; s < num_sections && !content_key; s++)
+	{
+		const FProcMeshSection* psection = pmc->GetProcMeshSection( s );
+		if(psection && psection->bEnableCollision)
+		{
+			const int num_v = psection->ProcVertexBuffer.Num();
+			positions.SetNumUninitialized( num_v, false );
+			for(int v = 0; v < num_v; v++)
+			{
+				positions[v] = psection->ProcVertexBuffer[v].Position;
+			}
+			Mix( &num_v, sizeof( num_v ) );
+			Mix( positions.GetData(), positions.Num() * sizeof( FVector ) );
+			Mix( psection->ProcIndexBuffer.GetData(), psection->ProcIndexBuffer.Num() * sizeof( uint32 ) );
+		}
+	}
+
+	//hulls
+	if(phulls)
+	{
+		for(const TArray<FVector>& hull : *phulls)
+		{
+			const int num_points = hull.Num();
+			Mix( &num_points, sizeof( num_points ) );
+			Mix( hull.GetData(), hull.Num() * sizeof( FVector ) );
+		}
+	}
+	return hash;
+}
+
+// queue bringing persisted entry into memory
+//
+void FCollisionCache::LoadEntry( uint64 key, FEntry& entry )
+{
+	entry.bLoading = true;
+	QueueIo( EIoType::Load, key );
+}
+
+// keep newly cooked data, in memory and on disk
+//
+void FCollisionCache::AddEntry( uint64 key, TArray<uint8>&& data, float cook_time )
+{
+	FEntry& entry = m_Entries.FindOrAdd( key );
+	m_MemoryUsed -= entry.Data.Num();
+	m_DiskUsed -= entry.DiskSize;
+	entry.Data = MoveTemp( data );
+	entry.CookTime = cook_time;
+	entry.LastUse = ++m_UseCounter;
+	entry.bLoading = false;
+	m_MemoryUsed += entry.Data.Num();
+
+	//persist
+	FCollisionCacheFileHeader header;
+	header.Magic = APPARANCE_COLLISION_CACHE_MAGIC;
+	header.Version = APPARANCE_COLLISION_CACHE_VERSION;
+	header.CookTime = cook_time;
+	header.DataSize = entry.Data.Num();
+	TArray<uint8> file_data;
+	file_data.SetNumUninitialized( sizeof( header ) + entry.Data.Num() );
+	FMemory::Memcpy( file_data.GetData(), &header, sizeof( header ) );
+	FMemory::Memcpy( file_data.GetData() + sizeof( header ), entry.Data.GetData(), entry.Data.Num() );
+	entry.DiskSize = file_data.Num();	//(until we hear otherwise)
+	m_DiskUsed += entry.DiskSize;
+	QueueIo( EIoType::Save, key, MoveTemp( file_data ) );
+
+	SET_MEMORY_STAT( STAT_CollisionCacheMemory, m_MemoryUsed );
+	EnforceLimits();
+}
+
+// mark as recently used
+//
+void FCollisionCache::Touch( uint64 key, FEntry& entry )
+{
+	entry.LastUse = ++m_UseCounter;
+	if(entry.DiskSize > 0)
+	{
+		//so use order carries over to next session
+		QueueIo( EIoType::Touch, key );
+	}
+}
+
+// evict least recently used entries from memory, and from disk, until under limits
+//
+void FCollisionCache::EnforceLimits()
+{
+	if(m_MemoryUsed <= m_MemoryLimit && m_DiskUsed <= m_DiskLimit)
+	{
+		return;
+	}
+
+	//by age
+	TArray<TPair<uint64, uint64>> by_use;
+	by_use.Reserve( m_Entries.Num() );
+	for(const TPair<uint64, FEntry>& entry : m_Entries)
+	{
+		by_use.Add( TPair<uint64, uint64>( entry.Value.LastUse, entry.Key ) );
+	}
+	by_use.Sort( []( const TPair<uint64, uint64>& a, const TPair<uint64, uint64>& b ) { return a.Key < b.Key; } );
+
+	//memory (persisted data can be reloaded)
+	if(m_MemoryUsed > m_MemoryLimit)
+	{
+		const int64 target = (int64)(m_MemoryLimit * APPARANCE_COLLISION_CACHE_EVICT_TARGET);
+		for(int i = 0; i < by_use.Num() && m_MemoryUsed > target; i++)
+		{
+			FEntry& entry = m_Entries[by_use[i].Value];
+			m_MemoryUsed -= entry.Data.Num();
+			entry.Data.Empty();
+			if(entry.DiskSize == 0)
+			{
+				m_Entries.Remove( by_use[i].Value );
+			}
+		}
+		SET_MEMORY_STAT( STAT_CollisionCacheMemory, m_MemoryUsed );
+	}
+
+	//disk
+	if(m_DiskUsed > m_DiskLimit)
+	{
+		const int64 target = (int64)(m_DiskLimit * APPARANCE_COLLISION_CACHE_EVICT_TARGET);
+		for(int i = 0; i < by_use.Num() && m_DiskUsed > target; i++)
+		{
+			FEntry* pentry = m_Entries.Find( by_use[i].Value );
+			if(pentry && pentry->DiskSize > 0)
+			{
+				QueueIo( EIoType::Delete, by_use[i].Value );
+				m_DiskUsed -= pentry->DiskSize;
+				m_MemoryUsed -= pentry->Data.Num();
+				m_Entries.Remove( by_use[i].Value );
+			}
+		}
+		SET_MEMORY_STAT( STAT_CollisionCacheMemory, m_MemoryUsed );
+	}
+}
+
+// persisted entry location
+//
+FString FCollisionCache::GetEntryPath( uint64 key ) const
+{
+	return FPaths::Combine( m_Directory, FString::Printf( TEXT( "%016llx.bin" ), key ) );
+}
+
+// apply completed disk access
+//
+void FCollisionCache::HandleIoResults()
+{
+	FIoResult result;
+	while(m_IoResults.Dequeue( result ))
+	{
+		FEntry* pentry = m_Entries.Find( result.Key );
+		if(!pentry)
+		{
+			continue;	//evicted/cleared since
+		}
+		if(result.Type == EIoType::Load && pentry->bLoading)
+		{
+			pentry->bLoading = false;
+			if(result.bSuccess)
+			{
+				m_MemoryUsed -= pentry->Data.Num();
+				pentry->Data = MoveTemp( result.Data );
+				pentry->CookTime = result.CookTime;
+				m_MemoryUsed += pentry->Data.Num();
+				SET_MEMORY_STAT( STAT_CollisionCacheMemory, m_MemoryUsed );
+			}
+			else
+			{
+				//stale, damaged, or gone, don't try again
+				m_DiskUsed -= pentry->DiskSize;
+				m_Entries.Remove( result.Key );
+			}
+		}
+		else if(result.Type == EIoType::Save && !result.bSuccess)
+		{
+			m_DiskUsed -= pentry->DiskSize;
+			pentry->DiskSize = 0;
+		}
+	}
+	EnforceLimits();
+}
+
+// add to disk access queue
+//
+void FCollisionCache::QueueIo( EIoType type, uint64 key, TArray<uint8>&& data )
+{
+	FIoRequest& request = m_IoRequests.AddDefaulted_GetRef();
+	request.Type = type;
+	request.Key = key;
+	request.Path = GetEntryPath( key );
+	request.Data = MoveTemp( data );
+}
+
+// hand queued disk access to a worker, one batch at a time so it happens in order
+//
+void FCollisionCache::KickIo()
+{
+	if(m_IoRequests.Num() == 0 || (m_IoTask.IsValid() && !m_IoTask.IsReady()))
+	{
+		return;
+	}
+	m_IoTask = Async( EAsyncExecution::ThreadPool, [this, requests = MoveTemp( m_IoRequests )]() mutable
+	{
+		RunIoRequests( requests, m_IoResults );
+	} );
+	m_IoRequests.Reset();
+}
+
+// complete all disk access (results are discarded)
+//
+void FCollisionCache::FlushIo()
+{
+	if(m_IoTask.IsValid())
+	{
+		m_IoTask.Wait();
+		m_IoTask.Reset();
+	}
+	RunIoRequests( m_IoRequests, m_IoResults );
+	m_IoRequests.Reset();
+	m_IoResults.Empty();
+}
+
+// perform disk access
+// NOTE: worker thread
+//
+void FCollisionCache::RunIoRequests( TArray<FIoRequest>& requests, TQueue<FIoResult, EQueueMode::Spsc>& results )
+{
+	IFileManager& file_manager = IFileManager::Get();
+	for(FIoRequest& request : requests)
+	{
+		FIoResult result;
+		result.Type = request.Type;
+		result.Key = request.Key;
+		result.bSuccess = false;
+		result.CookTime = 0;
+		switch(request.Type)
+		{
+			case EIoType::Load:
+			{
+				TArray<uint8> file_data;
+				if(FFileHelper::LoadFileToArray( file_data, *request.Path, FILEREAD_Silent ))
+				{
+					FCollisionCacheFileHeader header;
+					if(file_data.Num() >= (int)sizeof( header ))
+					{
+						FMemory::Memcpy( &header, file_data.GetData(), sizeof( header ) );
+					}
+					if(file_data.Num() < (int)sizeof( header ) || header.Magic != APPARANCE_COLLISION_CACHE_MAGIC || header.Version != APPARANCE_COLLISION_CACHE_VERSION || (int64)header.DataSize != (int64)(file_data.Num() - sizeof( header )) || header.DataSize == 0)
+					{
+						file_manager.Delete( *request.Path );
+					}
+					else
+					{
+						result.Data.SetNumUninitialized( header.DataSize );
+						FMemory::Memcpy( result.Data.GetData(), file_data.GetData() + sizeof( header ), header.DataSize );
+						result.CookTime = header.CookTime;
+						result.bSuccess = true;
+					}
+				}
+				results.Enqueue( MoveTemp( result ) );
+				break;
+			}
+			case EIoType::Save:
+				result.bSuccess = FFileHelper::SaveArrayToFile( request.Data, *request.Path );
+				results.Enqueue( MoveTemp( result ) );
+				break;
+			case EIoType::Touch:
+				file_manager.SetTimeStamp( *request.Path, FDateTime::UtcNow() );
+				break;
+			case EIoType::Delete:
+				file_manager.Delete( *request.Path, false, false, true );
+				break;
+		}
+	}
+}
+
+// trigger (re)building of component physics from its collision sections/hulls
+//
+void FCollisionCache::ApplyCollision( UProceduralMeshComponent* pmc, const TArray<TArray<FVector>>* phulls )
+{
+	if(phulls)
+	{
+		pmc->SetCollisionConvexMeshes( *phulls );
+	}
+	else
+	{
+		//SetProcMeshSection doesn't rebuild collision itself, clearing the (unused) convex elements does
+		pmc->ClearCollisionConvexMeshes();
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// console
+
+/// <summary>
+/// log hit rate, time saved, and space used by the collision cache
+/// </summary>
+static void ReportCollisionCache( const TArray<FString>& args )
+{
+	g_ApparanceCollisionCache.Report();
+}
+
+/// <summary>
+/// empty the collision cache, including persisted entries
+/// </summary>
+static void ClearCollisionCache( const TArray<FString>& args )
+{
+	g_ApparanceCollisionCache.Clear();
+	UE_LOG( LogApparance, Display, TEXT( "Collision cache cleared" ) );
+}
+
+static FAutoConsoleCommand GApparanceReportCollisionCacheCommand(
+	TEXT( "Apparance.ReportCollisionCache" ),
+	TEXT( "Log hit rate, cook time saved, and memory/disk used by the cooked collision cache." ),
+	FConsoleCommandWithArgsDelegate::CreateStatic( &ReportCollisionCache ) );
+
+static FAutoConsoleCommand GApparanceClearCollisionCacheCommand(
+	TEXT( "Apparance.ClearCollisionCache" ),
+	TEXT( "Empty the cooked collision cache, in memory and on disk." ),
+	FConsoleCommandWithArgsDelegate::CreateStatic( &ClearCollisionCache ) );
+
+
+#if APPARANCE_DEBUGGING_HELP_CollisionCache
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
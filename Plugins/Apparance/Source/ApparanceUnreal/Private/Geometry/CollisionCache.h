@@ -0,0 +1,129 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "Containers/Queue.h"
+
+
+// Cooked collision data cache
+// Physics data cooked for generated collision is kept, keyed by a hash of the collision content, so identical collision (rebuilds, level reloads, repeated modules) is loaded instead of cooked again
+// Entries are persisted to disk under the project's Saved folder, memory and disk use are limited with least recently used eviction
+// Misses cook asynchronously as normal, the cooked data is captured once the cook completes (within the frame budget)
+// Disk access is queued and serviced in order on a worker, persisted entries become usable once loaded (recent ones are loaded at startup)
+// NOTE: game thread only
+// NOTE: new entries can only be captured where the engine produces serialisable cooked data (editor and uncooked builds), otherwise collision is just cooked as normal
+//
+class FCollisionCache
+{
+	struct FEntry
+	{
+		TArray<uint8> Data;			//cooked data, empty if not resident
+		int64         DiskSize;		//size of persisted file (0 if not persisted)
+		float         CookTime;		//seconds it took to cook originally
+		uint64        LastUse;		//use stamp, for LRU
+		bool          bLoading;		//disk read queued
+	};
+
+	//miss waiting for its async cook to complete
+	struct FPendingCapture
+	{
+		TWeakObjectPtr<class UProceduralMeshComponent> Component;
+		TWeakObjectPtr<class UBodySetup>               PreviousBodySetup;	//replaced when cook completes
+		uint64                                         Key;
+		double                                         StartTime;
+	};
+
+	//disk access, run in order on a worker
+	enum class EIoType : uint8
+	{
+		Load,
+		Save,
+		Touch,
+		Delete,
+	};
+	struct FIoRequest
+	{
+		EIoType       Type;
+		uint64        Key;
+		FString       Path;
+		TArray<uint8> Data;	//file to save
+	};
+	struct FIoResult
+	{
+		EIoType       Type;
+		uint64        Key;
+		bool          bSuccess;	//(stale/damaged files are deleted)
+		float         CookTime;
+		TArray<uint8> Data;		//loaded cooked data
+	};
+
+	bool                 m_bEnabled;
+	FString              m_Directory;
+	int64                m_MemoryLimit;
+	int64                m_DiskLimit;
+
+	//index of all known entries, by content hash
+	TMap<uint64, FEntry> m_Entries;
+	int64                m_MemoryUsed;
+	int64                m_DiskUsed;
+	uint64               m_UseCounter;
+
+	//in flight
+	TArray<FPendingCapture> m_PendingCaptures;
+	TArray<FIoRequest>   m_IoRequests;		//queued since last kick
+	TFuture<void>        m_IoTask;
+	TQueue<FIoResult, EQueueMode::Spsc> m_IoResults;
+
+	//totals, for reporting
+	int                  m_HitCount;
+	int                  m_MissCount;
+	double               m_CookTimeSaved;
+
+public:
+	FCollisionCache();
+
+	//setup, scans existing disk entries
+	void Init( bool enable, int memory_limit_mb, int disk_limit_mb );
+	void Shutdown();
+
+	//rebuild collision of a procedural mesh component from its collision sections and hulls (null for complex only), using previously cooked data if we have it
+	//content key identifies the collision sections (e.g. from part content hashes), 0 to hash their triangles
+	void UpdateCollision( class UProceduralMeshComponent* pmc, const TArray<TArray<FVector>>* phulls, uint64 content_key = 0 );
+
+	//per frame, completes captures and disk access
+	void Tick();
+
+	//reporting
+	void Report() const;
+	//drop everything, including from disk
+	void Clear();
+
+private:
+	uint64 CalcKey( class UProceduralMeshComponent* pmc, const TArray<TArray<FVector>>* phulls, uint64 content_key ) const;
+	void LoadEntry( uint64 key, FEntry& entry );
+	void AddEntry( uint64 key, TArray<uint8>&& data, float cook_time );
+	void Touch( uint64 key, FEntry& entry );
+	void EnforceLimits();
+	FString GetEntryPath( uint64 key ) const;
+	void UpdateCaptures();
+	bool CaptureCookedData( uint64 key, class UBodySetup* pbody_setup, float cook_time );
+	void HandleIoResults();
+	void QueueIo( EIoType type, uint64 key, TArray<uint8>&& data = TArray<uint8>() );
+	void KickIo();
+	void FlushIo();
+	void ResetEntries();
+	static void RunIoRequests( TArray<FIoRequest>& requests, TQueue<FIoResult, EQueueMode::Spsc>& results );
+	static void ApplyCollision( class UProceduralMeshComponent* pmc, const TArray<TArray<FVector>>* phulls );
+};
+
+extern FCollisionCache g_ApparanceCollisionCache;
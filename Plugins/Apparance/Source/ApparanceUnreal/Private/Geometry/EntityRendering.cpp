@@ -23,18 +23,29 @@ PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
 #include "ProceduralMeshComponent.h"
 #include "ProfilingDebugging/ScopedTimers.h"
 #include "Engine/BlueprintGeneratedClass.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/AutomationTest.h"
 
 // module
 #include "ApparanceUnreal.h"
 #include "ApparanceEntity.h"
 #include "Geometry.h"
+#include "GeometryMerging.h"
 #include "AssetDatabase.h"
 #include "ApparanceParametersComponent.h"
 #include "ApparanceEngineSetup.h"
 #include "Utility/RateLimiter.h"
+#include "GeometryScheduler.h"
+#include "FrameBudget.h"
+#include "MaterialCache.h"
+#include "ApparanceInstancePool.h"
 
 //std
-#include <list>
+
+//view movement tracking
+#define VIEW_PREDICTION_RESPONSE 0.15f		//(s) velocity smoothing time constant
+#define VIEW_PREDICTION_MIN_SPEED 100.0f	//(uu/s) slower views aren't worth predicting
+#define VIEW_PREDICTION_CUT_DISTANCE 10000.0f	//(uu) moving further in one frame is a camera cut, not movement
 
 DEFINE_STAT( STAT_AddingContent );
 DEFINE_STAT( STAT_RemovingContent );
@@ -133,9 +144,19 @@ FEntityRendering::FEntityRendering()
 	: m_pActor( nullptr )
 	, m_pEntity( nullptr )
 	, m_pDeferredProcedure( nullptr )
-	, m_View( this )
+	, m_ViewCount( 1 )
+	, m_ContentRequestId( INDEX_NONE )
+	, m_bSwapping( false )
+	, m_SwapRequestId( INDEX_NONE )
+	, m_SwapStartTime( 0 )
+	, m_SwapLastActivity( 0 )
+	, m_bSwapQueued( false )
+	, m_CurrentGeometryId( Apparance::InvalidID )
 	, m_pEditingParameters( nullptr )
 {
+	m_pMergedGeometry = MakeShareable( new FMergedGeometry( this ) );
+	m_Views.Add( MakeUnique<FEntityView>( this ) );
+	m_PredictedViews.Add( MakeUnique<FEntityView>( this, true ) );
 #if WITH_EDITOR
 	m_pRateLimiter = MakeShareable( new FRateLimiter() );
 	m_pRateLimiter->Init( 32 );
@@ -149,6 +170,8 @@ void Apparance_NotifyEntityRenderingDelete( FEntityRendering* per );
 FEntityRendering::~FEntityRendering()
 {
 	delete m_pDeferredProcedure;
+	ReleaseAllMaterials();
+	ReleaseAutoInstanceCounts();
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
 	Apparance_NotifyEntityRenderingDelete( this );
 #endif
@@ -236,6 +259,14 @@ void FEntityRendering::TriggerBuild( Apparance::IClosure* proc )
 		m_pRateLimiter->Begin( request_id );
 	}
 
+#if TIMESLICE_GEOMETRY_ADD_REMOVE
+	//rebuild of existing content? keep that up until the new content is ready (from now, old content can start going before new arrives)
+	if(m_ContentRequestId != INDEX_NONE && UApparanceEngineSetup::GetSwapContentOnRebuild())
+	{
+		BeginSwap( request_id );
+	}
+#endif
+
 	//change of proc/rebuild invalidates cached materials
 	InvalidateMaterials();
 }
@@ -244,6 +275,15 @@ void FEntityRendering::TriggerBuild( Apparance::IClosure* proc )
 //
 void FEntityRendering::Tick( float DeltaSeconds )
 {
+	//merged geometry changes since last tick, applied together
+	if(m_pMergedGeometry.IsValid())
+	{
+		m_pMergedGeometry->Flush();
+	}
+
+	//placements switching between components and instances
+	UpdateAutoInstanceMigration();
+
 	if(m_pEntity)
 	{
 		//deferred updates
@@ -259,9 +299,155 @@ void FEntityRendering::Tick( float DeltaSeconds )
 			}
 		}
 
-		//TODO: use actual viewports
-		struct Apparance::Host::IEntityView* views[1] = { &m_View };
-		m_pEntity->Update( views, 1, DeltaSeconds );
+		//all views of our world
+		UpdateViews( DeltaSeconds );
+		TArray<struct Apparance::Host::IEntityView*, TInlineAllocator<8>> views;
+		for(int i = 0; i < m_ViewCount; i++)
+		{
+			views.Add( m_Views[i].Get() );
+		}
+		for(int i = 0; i < m_ViewCount; i++)
+		{
+			if(m_Views[i]->IsPredicting())
+			{
+				views.Add( m_PredictedViews[i].Get() );
+			}
+		}
+		m_pEntity->Update( views.GetData(), views.Num(), DeltaSeconds );
+	}
+}
+
+// match our views to everywhere our world is currently viewed from
+//
+void FEntityRendering::UpdateViews( float delta_seconds )
+{
+	TArray<FVector> view_locations;
+	FApparanceUnrealModule::GetModule()->GetViewLocations( m_pActor->GetWorld(), view_locations );
+
+	//always at least one
+	if(view_locations.Num() == 0)
+	{
+		view_locations.Add( FVector::ZeroVector );
+	}
+
+	UpdateViewLocations( view_locations, UApparanceEngineSetup::GetViewPredictionTime(), delta_seconds );
+}
+
+// move our views to the given locations, predicting ahead if wanted
+//
+void FEntityRendering::UpdateViewLocations( const TArray<FVector>& view_locations, float look_ahead, float delta_seconds )
+{
+	//(views are kept for reuse, each with its predicted view)
+	while(m_Views.Num() < view_locations.Num())
+	{
+		m_Views.Add( MakeUnique<FEntityView>( this ) );
+	}
+	while(m_PredictedViews.Num() < m_Views.Num())
+	{
+		m_PredictedViews.Add( MakeUnique<FEntityView>( this, true ) );
+	}
+	m_ViewCount = view_locations.Num();
+
+	//track movement
+	for(int i = 0; i < m_ViewCount; i++)
+	{
+		m_Views[i]->UpdateLocation( view_locations[i], delta_seconds );
+		FVector predicted;
+		if(m_Views[i]->UpdatePrediction( look_ahead, predicted ))
+		{
+			m_PredictedViews[i]->SetLocation( predicted );
+		}
+	}
+}
+
+// how far the nearest view is from a point in the world
+//
+float FEntityRendering::GetViewDistance( const FVector& world_location ) const
+{
+	float nearest = MAX_FLT;
+	for(int i = 0; i < m_ViewCount; i++)
+	{
+		nearest = FMath::Min( nearest, (float)FVector::Dist( m_Views[i]->GetLocation(), world_location ) );
+		if(m_Views[i]->IsPredicting())
+		{
+			nearest = FMath::Min( nearest, (float)FVector::Dist( m_PredictedViews[i]->GetLocation(), world_location ) );
+		}
+	}
+	return nearest;
+}
+
+// set tier detail blending to cover the ranges all (actual) views need
+//
+void FEntityRendering::ApplyDetailRange( int tier_index, FVector4 range )
+{
+	//widest range (near0, near1, far1, far0) of any view
+	for(int i = 0; i < m_ViewCount; i++)
+	{
+		FVector4 view_range;
+		if(m_Views[i]->GetDetailRange( tier_index, view_range ))
+		{
+			range.X = FMath::Min( range.X, view_range.X );
+			range.Y = FMath::Min( range.Y, view_range.Y );
+			range.Z = FMath::Max( range.Z, view_range.Z );
+			range.W = FMath::Max( range.W, view_range.W );
+		}
+	}
+
+	//calc
+	FDetailTier* ptier = GetTier( tier_index );
+	float f0 = range.W;
+	float f1 = -1.0f/(range.W-range.Z);
+	float f2 = range.X;
+	float f3 = 1.0f/(range.Y-range.X);
+	FLinearColor blend( f0, f1, f2, f3 );
+
+	//apply via components?
+	if(UApparanceEngineSetup::GetDetailBlendPrimitiveData())
+	{
+		//only on change, each one dirties render state
+		if(ptier->bDetailBlendSet && ptier->DetailBlend == blend)
+		{
+			return;
+		}
+		ptier->DetailBlend = blend;
+		ptier->bDetailBlendSet = true;
+
+		for(auto It = ptier->Components.CreateConstIterator(); It; ++It)
+		{
+			ApplyDetailBlend( It.Value().Get(), tier_index );
+		}
+		ApplyDetailBlend( m_pMergedGeometry->GetComponent( tier_index ), tier_index );
+		return;
+	}
+
+	//apply via materials
+	ptier->DetailBlend = blend;
+	ptier->bDetailBlendSet = true;
+	for( int i=0 ; i<ptier->Materials.Num() ; i++)		
+	{
+		FParameterisedMaterial* ppm = ptier->Materials[i].Get();
+		UMaterialInstanceDynamic* pmaterial = ppm->MaterialInstance.Get();
+		if(pmaterial)
+		{
+			pmaterial->SetVectorParameterValue( "DetailBlend", ptier->DetailBlend );
+		}
+	}
+}
+
+// set a tier content component's detail blending, when driven by custom primitive data
+//
+void FEntityRendering::ApplyDetailBlend( UPrimitiveComponent* pcomponent, int tier_index )
+{
+	if(!pcomponent || !UApparanceEngineSetup::GetDetailBlendPrimitiveData())
+	{
+		return;
+	}
+
+	FDetailTier* ptier = GetTier( tier_index );
+	if(ptier->bDetailBlendSet)
+	{
+		const FLinearColor& blend = ptier->DetailBlend;
+		pcomponent->SetCustomPrimitiveDataVector4( DETAIL_BLEND_PRIMITIVE_DATA_INDEX, FVector4( blend.R, blend.G, blend.B, blend.A ) );
 	}
 }
 
@@ -369,24 +555,19 @@ void Apparance_TickGenLog()
 
 
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
-struct TimesliceRecord
-{
-	bool IsAdd;
-	//add/remove
-	FEntityRendering* EntityRendering;
-	int  GeometryId;
-	//add
-	struct Apparance::Host::IGeometry* Geometry;
-	int TierIndex;
-	Apparance::Vector3 Offset;
-	int RequestId;
-};
-std::list<TimesliceRecord*> Timeslicer;
+FGeometryScheduler Timeslicer;
 
 bool bPendingGeometry = false;
 double dGeomTime = 0;
 FDurationTimer geomTimer( dGeomTime );
-double dMaxTimesliceTime = 0;
+
+//add being spread over several ticks
+FTimesliceRecord ActiveAdd;
+FGeometryAddProgress ActiveAddProgress;
+bool bActiveAdd = false;
+
+//entities with a rebuild being swapped in
+TArray<FEntityRendering*> SwappingEntities;
 
 void NotifyPendingState( bool pending )
 {
@@ -413,7 +594,31 @@ void NotifyPendingState( bool pending )
 Apparance::GeometryID FEntityRendering::AddGeometry( struct Apparance::Host::IGeometry* geometry, int tier_index, Apparance::Vector3 offset, int request_id )
 {
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
-	if(Timeslicer.empty())
+	//late content from a build since superseded isn't wanted (request ids increase with each build)
+	if(request_id < m_ContentRequestId || (m_bSwapping && request_id < m_SwapRequestId && request_id != m_ContentRequestId))
+	{
+		return Apparance::GeometryID( m_NextGeometryID++ );
+	}
+
+	//rebuild of existing content? keep that up until all the new content is ready
+	if(request_id > m_ContentRequestId)
+	{
+		if(m_ContentRequestId != INDEX_NONE && UApparanceEngineSetup::GetSwapContentOnRebuild())
+		{
+			BeginSwap( request_id );
+		}
+		else
+		{
+			m_ContentRequestId = request_id;
+		}
+	}
+	const bool swap_content = m_bSwapping && request_id == m_SwapRequestId;
+	if(swap_content)
+	{
+		m_SwapLastActivity = FPlatformTime::Seconds();
+	}
+
+	if(Timeslicer.IsEmpty() && !bActiveAdd && g_ApparanceFrameBudget.HasTime())
 	{
 		//if not busy, can do immediately
 		return AddGeometry_Deferred( geometry, tier_index, offset, request_id );
@@ -422,21 +627,25 @@ Apparance::GeometryID FEntityRendering::AddGeometry( struct Apparance::Host::IGe
 	{
 		int id = m_NextGeometryID++;
 		//deferred add
-		TimesliceRecord* pr = new TimesliceRecord();
-		pr->EntityRendering = this;
-		pr->IsAdd = true;
-		pr->GeometryId = id;
-		pr->Geometry = geometry;
-		pr->TierIndex = tier_index;
-		pr->Offset = offset;
-		pr->RequestId = request_id;
-		if(Timeslicer.empty())
+		FTimesliceRecord r;
+		r.EntityRendering = this;
+		r.IsAdd = true;
+		r.GeometryId = id;
+		r.Geometry = geometry;
+		r.TierIndex = tier_index;
+		r.Offset = offset;
+		r.RequestId = request_id;
+		if(Timeslicer.IsEmpty() && !bActiveAdd)
 		{
 			NotifyPendingState( true );
-	}
-		Timeslicer.push_back( pr );
+		}
+		Timeslicer.Add( r );
+		if(swap_content)
+		{
+			m_bSwapQueued = true;
+		}
 		return Apparance::GeometryID( id );
-}
+	}
 #else
 	//immediate pass-through
 	return AddGeometry_Deferred( geometry, tier_index, offset, request_id );
@@ -446,18 +655,13 @@ Apparance::GeometryID FEntityRendering::AddGeometry( struct Apparance::Host::IGe
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
 void Apparance_NotifyEntityRenderingDelete( FEntityRendering* per )
 {
-	//must clear any pending geometry for this er
-	for(std::list<TimesliceRecord*>::iterator it = Timeslicer.begin(); it != Timeslicer.end(); ++it)
+	//must clear all pending geometry for this er
+	Timeslicer.RemoveEntity( per );
+	if(bActiveAdd && ActiveAdd.EntityRendering == per)
 	{
-		const TimesliceRecord* pr = *it;
-		if(pr->EntityRendering==per)
-		{
-			//remove instead of deferring a remove
-			delete pr;
-			Timeslicer.erase( it );
-			return;
-		}
+		bActiveAdd = false;
 	}
+	SwappingEntities.Remove( per );
 }
 
 bool Apparance_IsPendingGeometryAdd()
@@ -467,27 +671,114 @@ bool Apparance_IsPendingGeometryAdd()
 
 int Apparance_GetPendingCount()
 {
-	return (int)Timeslicer.size();
+	return Timeslicer.Num() + (bActiveAdd ? 1 : 0);
 }
 
 void Apparance_SetTimesliceLimit(float maxMS)
 {
-	dMaxTimesliceTime = maxMS/1000.0f;	//s
+	g_ApparanceFrameBudget.SetLimit( maxMS );
+}
+
+void Apparance_SetLoading( bool loading )
+{
+	g_ApparanceFrameBudget.SetLoading( loading );
 }
 
 bool Apparance_NotifyGeometryDestruction( struct Apparance::Host::IGeometry* pgeometry )
 {
-	for(std::list<TimesliceRecord*>::iterator it = Timeslicer.begin(); it != Timeslicer.end(); ++it)
+	//part way through adding it? drop what was placed so far
+	if(bActiveAdd && ActiveAdd.Geometry == pgeometry)
 	{
-		const TimesliceRecord* pr = *it;
-		if(pr->Geometry == pgeometry && pr->IsAdd)
+		bActiveAdd = false;
+		if(ActiveAdd.EntityRendering->GetActor())
 		{
-			Timeslicer.erase( it );
-			return true;
+			ActiveAdd.EntityRendering->RemoveGeometry_Deferred( ActiveAdd.GeometryId );
 		}
+		return true;
 	}
-	return false;
+	return Timeslicer.RemoveAdd( pgeometry );
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+/// <summary>
+/// queue deep pending add lists for a batch of throwaway entities, cancel some by geometry id, remove some entities' records explicitly, then destroy the entities
+/// every cancellation must hit, and nothing of theirs may be left queued
+/// </summary>
+IMPLEMENT_SIMPLE_AUTOMATION_TEST( FApparanceTimeslicerCancellationTest, "Apparance.Geometry.TimeslicerCancellation", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter )
+
+bool FApparanceTimeslicerCancellationTest::RunTest( const FString& Parameters )
+{
+	const int entity_count = 100;
+	const int record_count = 1000;
+	const int initial_count = Timeslicer.Num();
+
+	//queue
+	double start_time = FPlatformTime::Seconds();
+	TArray<FEntityRendering*> entities;
+	TArray<int> cancel_ids;
+	for(int e = 0; e < entity_count; e++)
+	{
+		FEntityRendering* per = new FEntityRendering();
+		entities.Add( per );
+		for(int i = 0; i < record_count; i++)
+		{
+			FTimesliceRecord r;
+			r.EntityRendering = per;
+			r.IsAdd = true;
+			r.GeometryId = FEntityRendering::m_NextGeometryID++;
+			r.Geometry = nullptr;
+			r.TierIndex = 0;
+			r.Offset = Apparance::Vector3( { 0, 0, 0 } );
+			r.RequestId = 0;
+			Timeslicer.Add( r );
+			if((i & 3) == 0)
+			{
+				cancel_ids.Add( r.GeometryId );
+			}
+		}
+	}
+	const double queue_time = FPlatformTime::Seconds() - start_time;
+	const int total = entity_count * record_count;
+	TestEqual( TEXT( "All queued" ), Timeslicer.Num(), initial_count + total );
+
+	//cancel some individually
+	start_time = FPlatformTime::Seconds();
+	int cancelled = 0;
+	for(int id : cancel_ids)
+	{
+		cancelled += Timeslicer.RemoveAdd( id ) ? 1 : 0;
+	}
+	const double cancel_time = FPlatformTime::Seconds() - start_time;
+	TestEqual( TEXT( "Every cancellation by geometry id found its record" ), cancelled, cancel_ids.Num() );
+	TestFalse( TEXT( "Cancelled records can't be cancelled again" ), Timeslicer.RemoveAdd( cancel_ids[0] ) );
+	TestEqual( TEXT( "Cancelled records no longer pending" ), Timeslicer.Num(), initial_count + total - cancelled );
+
+	//remove half the entities' records explicitly, each has what wasn't cancelled left
+	const int remaining_per_entity = record_count - record_count / 4;
+	int removed = 0;
+	for(int e = 0; e < entity_count / 2; e++)
+	{
+		removed += Timeslicer.RemoveEntity( entities[e] );
+		TestFalse( TEXT( "No adds left for removed entity" ), Timeslicer.HasAdds( entities[e], 0 ) );
+	}
+	TestEqual( TEXT( "Entity removal took each entity's remaining records" ), removed, (entity_count / 2) * remaining_per_entity );
+
+	//tear down the rest
+	start_time = FPlatformTime::Seconds();
+	for(FEntityRendering* per : entities)
+	{
+		delete per;
+	}
+	const double destroy_time = FPlatformTime::Seconds() - start_time;
+
+	//nothing stale
+	TestEqual( TEXT( "No records left pending" ), Timeslicer.Num(), initial_count );
+
+	AddInfo( FString::Printf( TEXT( "%i entities x %i records: queue %.3fus per record, cancel %.3fms (%i by geometry id), destroy %.3fms" ),
+		entity_count, record_count, queue_time * 1000000.0 / total, cancel_time * 1000.0, cancelled, destroy_time * 1000.0 ) );
+	return true;
 }
+#endif //WITH_DEV_AUTOMATION_TESTS
 
 #endif
 
@@ -495,76 +786,216 @@ void FEntityRendering::RemoveGeometry( Apparance::GeometryID geometry_id )
 {
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
 	//corresponding add still pending?
-	for(std::list<TimesliceRecord*>::iterator it=Timeslicer.begin() ; it!=Timeslicer.end() ; ++it)
+	if(Timeslicer.RemoveAdd( (int)geometry_id ))
+	{
+		//remove instead of deferring a remove
+		return;
+	}
+	if(bActiveAdd && ActiveAdd.GeometryId == (int)geometry_id)
+	{
+		//part way through, stop and remove what was placed so far
+		bActiveAdd = false;
+	}
+#endif
+
+#if TIMESLICE_GEOMETRY_ADD_REMOVE
+	if(UApparanceEngineSetup::GetSwapContentOnRebuild())
 	{
-		const TimesliceRecord* pr = *it;
-		if(pr->GeometryId == geometry_id && pr->IsAdd)
+		//old content stays up until the rebuild replacing it is ready (new content superseded before then can go)
+		if(m_bSwapping)
 		{
-			//remove instead of deferring a remove
-			delete pr;
-			Timeslicer.erase( it );
+			m_SwapLastActivity = FPlatformTime::Seconds();
+		}
+		if(m_bSwapping && m_SwapPlaced.Remove( (int)geometry_id ) == 0)
+		{
+			m_SwapRetiring.Add( (int)geometry_id );
 			return;
 		}
+
+		//hide now, deferred remove
+		RetireContent( (int)geometry_id );
+		return;
+	}
+	if(!g_ApparanceFrameBudget.HasTime())
+	{
+		//out of time this frame, hide now and remove when budget allows
+		RetireContent( (int)geometry_id );
+		return;
 	}
 #endif
+	//immediate pass-through
+	RemoveGeometry_Deferred( geometry_id );
+}
+
+#if TIMESLICE_GEOMETRY_ADD_REMOVE
+// start holding on to existing content while a rebuild is placed
+//
+void FEntityRendering::BeginSwap( int request_id )
+{
+	//(only ever forwards, late content from superseded builds doesn't restart anything)
+	if(request_id <= m_ContentRequestId || (m_bSwapping && request_id <= m_SwapRequestId))
+	{
+		return;
+	}
+	const double now = FPlatformTime::Seconds();
+	if(!m_bSwapping)
+	{
+		m_bSwapping = true;
+		m_SwapStartTime = now;	//(timeout runs from the first, so constant rebuilding can't postpone it)
+		SwappingEntities.AddUnique( this );
+	}
+	//(a newer rebuild supersedes one still in progress)
+	m_SwapRequestId = request_id;
+	m_SwapLastActivity = now;
+	m_bSwapQueued = false;
+}
 
-#if 0//IMMEDIATE REMOVE for now TIMESLICE_GEOMETRY_ADD_REMOVE
-	//deferred remove
-	TimesliceRecord* pr = new TimesliceRecord();
-	pr->EntityRendering = this;
-	pr->IsAdd = false;
-	pr->GeometryId = (int)geometry_id;
-	if(Timeslicer.empty())
+// swap over once the new build's initial placement is done, true when no longer swapping
+// the engine doesn't signal build completion, but a build arrives faster than it can be placed, so it's done once its queued content has all been placed
+// content small enough to be placed as it arrives is taken as complete once it stops arriving for a while instead
+//
+bool FEntityRendering::UpdateSwap()
+{
+	if(!m_bSwapping)
+	{
+		return true;
+	}
+	if(!m_pActor)
+	{
+		//torn down
+		m_bSwapping = false;
+		return true;
+	}
+	const double now = FPlatformTime::Seconds();
+	const bool timed_out = now - m_SwapStartTime > SWAP_TIMEOUT;
+	if(!timed_out)
+	{
+		//nothing yet?
+		if(m_SwapPlaced.Num() == 0)
+		{
+			return false;
+		}
+		//still being placed?
+		if(Timeslicer.HasAdds( this, m_SwapRequestId ) || (bActiveAdd && ActiveAdd.EntityRendering == this && ActiveAdd.RequestId == m_SwapRequestId))
+		{
+			return false;
+		}
+		//never queued, still arriving?
+		if(!m_bSwapQueued && now - m_SwapLastActivity < SWAP_QUIET_TIME)
+		{
+			return false;
+		}
+	}
+	FinishSwap();
+	return true;
+}
+
+// show new content and retire old, all in the same frame
+//
+void FEntityRendering::FinishSwap()
+{
+	for(int id : m_SwapPlaced)
+	{
+		SetContentVisibility( id, m_pActor->bShown );
+	}
+	for(int id : m_SwapRetiring)
+	{
+		RetireContent( id );
+	}
+	m_SwapPlaced.Empty();
+	m_SwapRetiring.Empty();
+	m_ContentRequestId = m_SwapRequestId;
+	m_SwapRequestId = INDEX_NONE;
+	m_bSwapping = false;
+}
+
+// hide content straight away, actual removal is queued so it only costs what the frame budget allows
+//
+void FEntityRendering::RetireContent( int geometry_id )
+{
+	SetContentVisibility( geometry_id, false );
+
+	FTimesliceRecord r;
+	r.EntityRendering = this;
+	r.IsAdd = false;
+	r.GeometryId = geometry_id;
+	r.Geometry = nullptr;
+	r.TierIndex = 0;
+	r.Offset = Apparance::Vector3( { 0, 0, 0 } );
+	r.RequestId = 0;
+	if(Timeslicer.IsEmpty() && !bActiveAdd)
 	{
 		NotifyPendingState( true );
 	}
-	Timeslicer.push_back( pr );
-#else
-	//immediate pass-through
-	RemoveGeometry_Deferred( geometry_id );
-#endif
+	Timeslicer.Add( r );
 }
+#endif
 
 void Apparance_TickTimeslicedGeometryHandling()
 {
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
-	if(!Timeslicer.empty())
+	//cancellations may have emptied the queue
+	if(Timeslicer.IsEmpty() && !bActiveAdd && bPendingGeometry)
 	{
-		const double start_time = FPlatformTime::Seconds();
-		do {
-			//pop next
-			TimesliceRecord* pr = Timeslicer.front();
-			Timeslicer.pop_front();
-			if(Timeslicer.empty())
-			{
-				NotifyPendingState( false );
-			}
+		NotifyPendingState( false );
+	}
 
-			if(pr->EntityRendering->GetActor()) //still in use?
+	if(!Timeslicer.IsEmpty() || bActiveAdd)
+	{
+		//order by current view
+		Timeslicer.Reprioritise();
+
+		//budget shared with all other main thread work this frame
+		do {
+			//continue partial add, or pop most important
+			if(!bActiveAdd)
 			{
-				if(pr->IsAdd)
+				FTimesliceRecord r;
+				Timeslicer.Pop( r );
+				if(r.EntityRendering->GetActor()) //still in use?
 				{
-					//add
-					const int preserve_id = FEntityRendering::m_NextGeometryID;
-					FEntityRendering::m_NextGeometryID = pr->GeometryId; //ensure use id originally returned
-					pr->EntityRendering->AddGeometry_Deferred( pr->Geometry, pr->TierIndex, pr->Offset, pr->RequestId );
-					FEntityRendering::m_NextGeometryID = preserve_id;
+					if(r.IsAdd)
+					{
+						//add (resumable), using id originally returned
+						ActiveAdd = r;
+						ActiveAddProgress = FGeometryAddProgress();
+						ActiveAddProgress.GeometryId = r.GeometryId;
+						bActiveAdd = true;
+					}
+					else
+					{
+						//remove
+						r.EntityRendering->RemoveGeometry_Deferred( r.GeometryId );
+					}
 				}
-				else
+			}
+			if(bActiveAdd)
+			{
+				//as much as budget allows (at least some progress each tick)
+				const double end_time = g_ApparanceFrameBudget.IsLimited() ? FPlatformTime::Seconds() + g_ApparanceFrameBudget.GetRemaining() : 0;
+				if(!ActiveAdd.EntityRendering->GetActor() || ActiveAdd.EntityRendering->AddGeometry_Step( ActiveAdd.Geometry, ActiveAdd.TierIndex, ActiveAdd.Offset, ActiveAdd.RequestId, ActiveAddProgress, end_time ))
 				{
-					//remove
-					pr->EntityRendering->RemoveGeometry_Deferred( pr->GeometryId );
+					bActiveAdd = false;
 				}
 			}
-			delete pr;
 
 			//cleared all?
-			if(Timeslicer.empty())
+			if(Timeslicer.IsEmpty() && !bActiveAdd)
 			{
+				NotifyPendingState( false );
 				break;
 			}
 			//or spend too long?
-		} while(((FPlatformTime::Seconds() - start_time)) < dMaxTimesliceTime);
+		} while(g_ApparanceFrameBudget.HasTime());
+	}
+
+	//rebuilds ready to show
+	for(int i = SwappingEntities.Num() - 1; i >= 0; i--)
+	{
+		if(SwappingEntities[i]->UpdateSwap())
+		{
+			SwappingEntities.RemoveAtSwap( i, 1, false );
+		}
 	}
 #endif
 }
@@ -573,53 +1004,92 @@ void Apparance_TickTimeslicedGeometryHandling()
 // New geometry 
 //
 Apparance::GeometryID FEntityRendering::AddGeometry_Deferred( struct Apparance::Host::IGeometry* geometry, int tier_index, Apparance::Vector3 offset, int request_id )
+{
+	//all in one go
+	FGeometryAddProgress progress;
+	progress.GeometryId = m_NextGeometryID++;
+	AddGeometry_Step( geometry, tier_index, offset, request_id, progress, 0 );
+
+	//done, this is the handle for this added content
+	return Apparance::GeometryID( progress.GeometryId );
+}
+
+// New geometry, as much as time allows (end_time of 0 is unlimited)
+// returns true once complete, otherwise call again with the same progress to continue
+// partial content is hidden (and ISM instances are held back) until the add completes
+//
+bool FEntityRendering::AddGeometry_Step( struct Apparance::Host::IGeometry* geometry, int tier_index, Apparance::Vector3 offset, int request_id, FGeometryAddProgress& progress, double end_time )
 {
 	SCOPE_CYCLE_COUNTER( STAT_AddingContent );
-	GENLOG_INC(nGenLogAdd)
+	FFrameBudget::FScope budget_scope( EApparanceWorkCategory::GeometryAdd );
 #if LOG_GEOMETRY_ADD_STATS
 	FScopedDurationTimer timer( nGenLogDuration );
 #endif
 
-	int id = m_NextGeometryID++;
+	const int id = progress.GeometryId;
+	TGuardValue<int> material_use_scope( m_CurrentGeometryId, id );
 	//UE_LOG( LogApparance, Log, TEXT("Apparance Entity %p : AddGeometry( %p, %i, %f,%f,%f ) = %i"), m_pEntity, geometry, tier_index, offset.X, offset.Y, offset.Z, id );
 
 	FApparanceGeometry* pmygeometry = (FApparanceGeometry*)geometry; //upcast to known internal type
 
-	//---- GEOMETRY ----
-	m_pActor->BeginGeometryUpdate();
+	//first step
+	if(!progress.Started)
+	{
+		GENLOG_INC(nGenLogAdd)
+		progress.Started = true;
 
-	//ensure tier
+		//---- GEOMETRY ----
+		m_pActor->BeginGeometryUpdate();
 
-	//any triangle geometry?
-	FVector unreal_offset = UNREALSPACE_FROM_APPARANCESPACE( offset );
-	if(geometry->GetPartCount()>0)
-	{
-		//get actor to generate component to host geometry
-		class UProceduralMeshComponent* pcollisioncomponent = nullptr;
-		class UProceduralMeshComponent* pgeometrycomponent = m_pActor->AddGeometry( geometry, tier_index, unreal_offset, pcollisioncomponent );
+		//ensure tier
 
-		//add to component lookup
-		if(pgeometrycomponent)
+		//any triangle geometry?
+		FVector unreal_offset = UNREALSPACE_FROM_APPARANCESPACE( offset );
+		if(geometry->GetPartCount()>0 && UApparanceEngineSetup::GetMergeGeometrySections())
 		{
-			m_pActor->GeometryCache.Add( id, pgeometrycomponent );
+			//consolidate into sections shared by tier and material
+			TGuardValue<int> section_material_scope( m_CurrentGeometryId, Apparance::InvalidID );	//(sections outlive any one piece of content)
+			m_pMergedGeometry->AddGeometry( id, pmygeometry, tier_index, unreal_offset );	//(applied to component on tick)
 		}
-		if(pcollisioncomponent)
+		else if(geometry->GetPartCount()>0)
 		{
-			m_pActor->CollisionCache.Add( id, pcollisioncomponent );
-		}
+			//get actor to generate component(s) to host geometry
+			TArray<class UMeshComponent*> geometrycomponents;
+			TArray<class UPrimitiveComponent*> collisioncomponents;
+			m_pActor->AddGeometry( geometry, tier_index, unreal_offset, geometrycomponents, collisioncomponents );
 
-		//add to tier (by ID)
-		if(pgeometrycomponent)
-		{
+			//add to component lookup, and to tier (by ID)
 			FDetailTier* ptier = GetTier( tier_index );
-			ptier->Components.Add( id, pgeometrycomponent );
+			for(class UMeshComponent* pgeometrycomponent : geometrycomponents)
+			{
+				if(pgeometrycomponent)
+				{
+					m_pActor->GeometryCache.FindOrAdd( id ).Geometry.Add( pgeometrycomponent );
+					ptier->Components.Add( id, pgeometrycomponent );
+					ApplyDetailBlend( pgeometrycomponent, tier_index );
+				}
+			}
+			for(class UPrimitiveComponent* pcollisioncomponent : collisioncomponents)
+			{
+				m_pActor->CollisionCache.FindOrAdd( id ).Collision.Add( pcollisioncomponent );
+			}
 		}
 	}
 
 	//---- MESHES/BLUEPRINTS ----
 	auto& object_list = pmygeometry->GetObjects();
-	for (int i = 0; i < object_list.Num(); i++)
+	bool costly_placement = false;	//(blueprint spawned, check time straight away)
+	for (int i = progress.NextObject; i < object_list.Num(); i++)
 	{
+		//out of time? carry on from here next step (placements can be costly, but checking every one isn't free either)
+		if(end_time > 0 && i > progress.NextObject && (costly_placement || (i % TIMESLICE_OBJECTS_PER_CHECK) == 0) && FPlatformTime::Seconds() >= end_time)
+		{
+			progress.NextObject = i;
+			SetContentVisibility( id, false );
+			progress.ContentHidden = true;
+			return false;
+		}
+
 		Apparance::ObjectID object_type = object_list[i].ID;
 		Apparance::IParameterCollection* placement_parameters = object_list[i].Parameters;
 
@@ -781,6 +1251,8 @@ Apparance::GeometryID FEntityRendering::AddGeometry_Deferred( struct Apparance::
 		if (pblueprintclass)
 		{
 			GENLOG_INC(nGenLogBlueprints)
+			FFrameBudget::FScope budget_scope( EApparanceWorkCategory::Blueprints );
+			costly_placement = true;
 			//are we placing another procedural object?
 			AApparanceEntity* ptemplate_entity = pblueprintclass?Cast<AApparanceEntity>( pblueprintclass->GetDefaultObject() ):nullptr;
 			bool is_proc_object = ptemplate_entity != nullptr;
@@ -1029,48 +1501,24 @@ Apparance::GeometryID FEntityRendering::AddGeometry_Deferred( struct Apparance::
 			EApparanceInstancingMode instancing_mode = (asset_instancing_mode == EApparanceInstancingMode::PerEntity) ? project_instancing_mode : asset_instancing_mode;
 
 			//apply creation method
-			if (instancing_mode==EApparanceInstancingMode::Always || (instancing_mode==EApparanceInstancingMode::PerEntity && m_pActor->UseMeshInstancing()))
+			bool instanced = instancing_mode==EApparanceInstancingMode::Always || (instancing_mode==EApparanceInstancingMode::PerEntity && m_pActor->UseMeshInstancing());
+			if (instancing_mode==EApparanceInstancingMode::Auto)
+			{
+				instanced = AddAutoInstancedMesh( id, pbasemesh );
+			}
+			if (instanced)
 			{
 				GENLOG_INC( nGenLogInstances )
 				//add via instanced mesh
-				FMeshInstanceHandle handle = m_pActor->AddInstancedMesh( pbasemesh, objecttransform );
-
-				//ensure place to store meshes
-				FMeshInstanceCacheEntry* pinstancecacheentry = m_pActor->InstanceCache.Find( id );
-				TSharedPtr<TArray<FMeshInstanceHandle>> phandlelist;
-				if (pinstancecacheentry)
-				{
-					phandlelist = pinstancecacheentry->Instances;
-				}
-				else
-				{
-					phandlelist = MakeShareable( new TArray<FMeshInstanceHandle>() );
-					FMeshInstanceCacheEntry mice;
-					mice.Instances = phandlelist;
-					m_pActor->InstanceCache.Add(id, mice);
-				}
-
-				if(phandlelist) //TODO: why would this be null in a cook?
-				{
-					phandlelist->Add( handle );
-				}
+				FMeshInstanceHandle handle = m_pActor->AddInstancedMesh( id, pbasemesh, objecttransform );
+				TrackMeshInstance( id, handle );
 			}
 			else
 			{ 
 				//add as mesh component
 				GENLOG_INC( nGenLogMeshes )
 				UStaticMeshComponent* pmesh = m_pActor->AddMesh( pbasemesh, objecttransform );
-				if (pmesh)
-				{
-					//ensure place to store meshes
-					FMeshCacheEntry* pmeshcacheentry = m_pActor->MeshCache.Find(id);
-					if (!pmeshcacheentry)
-					{
-						pmeshcacheentry = &m_pActor->MeshCache.Emplace( id );
-					}
-
-					pmeshcacheentry->Meshes.Add(pmesh);
-				}
+				TrackMeshComponent( id, pmesh );
 			}
 		}
 		if (pcomponent_template)
@@ -1102,7 +1550,22 @@ Apparance::GeometryID FEntityRendering::AddGeometry_Deferred( struct Apparance::
 			}
 		}
 	}
-	m_pActor->EndGeometryUpdate( tier_index );
+	progress.NextObject = object_list.Num();
+	m_pActor->EndGeometryUpdate( id, tier_index );
+
+	//part of a rebuild? stays hidden until the rest of it is ready
+	if(m_bSwapping && request_id == m_SwapRequestId)
+	{
+		SetContentVisibility( id, false );	//(even if hidden while partial, instances have only just been placed)
+		progress.ContentHidden = false;
+		m_SwapPlaced.Add( id );
+	}
+	//complete, show everything at once
+	else if(progress.ContentHidden)
+	{
+		SetContentVisibility( id, m_pActor->bShown );
+		progress.ContentHidden = false;
+	}
 
 	//---- ----
 	//notify tooling
@@ -1113,16 +1576,288 @@ Apparance::GeometryID FEntityRendering::AddGeometry_Deferred( struct Apparance::
 	{
 		m_pRateLimiter->End( request_id );
 	}
-
-	//done, this is the handle for this added content
-	return Apparance::GeometryID( id );
+	return true;
 }
 
-// Old geometry
+// show/hide the visible components and actors placed for some content
+//
+void FEntityRendering::SetContentVisibility( int geometry_id, bool visible )
+{
+	if(visible)
+	{
+		m_HiddenContent.Remove( geometry_id );
+	}
+	else
+	{
+		m_HiddenContent.Add( geometry_id );
+	}
+
+	if(FGeometryCacheEntry* pgeometrycacheentry = m_pActor->GeometryCache.Find( geometry_id ))
+	{
+		for(TWeakObjectPtr<class UMeshComponent> pcomp : pgeometrycacheentry->Geometry)
+		{
+			if(pcomp.IsValid())
+			{
+				pcomp->SetVisibility( visible, true );
+			}
+		}
+	}
+	if(m_pActor->InstanceCache.Contains( geometry_id ))
+	{
+		m_pActor->SetInstancedMeshVisibility( geometry_id, visible );
+	}
+	if(FMeshCacheEntry* pmeshcacheentry = m_pActor->MeshCache.Find( geometry_id ))
+	{
+		for(TWeakObjectPtr<UStaticMeshComponent> pmesh : pmeshcacheentry->Meshes)
+		{
+			if(pmesh.IsValid())
+			{
+				pmesh->SetVisibility( visible, true );
+			}
+		}
+	}
+	if(FActorComponentCacheEntry* pactorcompcacheentry = m_pActor->ActorComponentCache.Find( geometry_id ))
+	{
+		for(TWeakObjectPtr<UActorComponent> pcomp : pactorcompcacheentry->Components)
+		{
+			USceneComponent* pscene_comp = Cast<USceneComponent>( pcomp.Get() );
+			if(pscene_comp)
+			{
+				pscene_comp->SetVisibility( visible, true );
+			}
+		}
+	}
+	if(FActorCacheEntry* pactorcacheentry = m_pActor->ActorCache.Find( geometry_id ))
+	{
+		for(TWeakObjectPtr<AActor> pactor : pactorcacheentry->Actors)
+		{
+			if(pactor.IsValid() && pactor->GetRootComponent())
+			{
+				pactor->GetRootComponent()->SetVisibility( visible, true );
+			}
+		}
+	}
+}
+
+// record an instanced mesh placed as part of some content
+//
+void FEntityRendering::TrackMeshInstance( int geometry_id, const FMeshInstanceHandle& handle )
+{
+	//ensure place to store meshes
+	FMeshInstanceCacheEntry* pinstancecacheentry = m_pActor->InstanceCache.Find( geometry_id );
+	TSharedPtr<TArray<FMeshInstanceHandle>> phandlelist;
+	if (pinstancecacheentry)
+	{
+		phandlelist = pinstancecacheentry->Instances;
+	}
+	else
+	{
+		phandlelist = MakeShareable( new TArray<FMeshInstanceHandle>() );
+		FMeshInstanceCacheEntry mice;
+		mice.Instances = phandlelist;
+		m_pActor->InstanceCache.Add(geometry_id, mice);
+	}
+
+	if(phandlelist) //TODO: why would this be null in a cook?
+	{
+		phandlelist->Add( handle );
+	}
+}
+
+// record a mesh component placed as part of some content
+//
+void FEntityRendering::TrackMeshComponent( int geometry_id, UStaticMeshComponent* pmesh )
+{
+	if (pmesh)
+	{
+		//ensure place to store meshes
+		FMeshCacheEntry* pmeshcacheentry = m_pActor->MeshCache.Find(geometry_id);
+		if (!pmeshcacheentry)
+		{
+			pmeshcacheentry = &m_pActor->MeshCache.Emplace( geometry_id );
+		}
+
+		pmeshcacheentry->Meshes.Add(pmesh);
+	}
+}
+
+// count a placement of an automatically instanced mesh, returns whether to instance it
+// counted across the world when instances are pooled between entities, otherwise per entity
+// crossing the threshold switches existing placements of the mesh over too, as the frame budget allows
+//
+bool FEntityRendering::AddAutoInstancedMesh( int geometry_id, UStaticMesh* pmesh )
+{
+	m_GeometryAutoInstancedMeshes.FindOrAdd( geometry_id ).FindOrAdd( pmesh )++;
+	FAutoInstancedMesh& auto_mesh = m_AutoInstancedMeshes.FindOrAdd( pmesh );
+	if(auto_mesh.Count++ == 0 && m_pActor->UseInstancePool())
+	{
+		auto_mesh.Pool = m_pActor->GetInstancePool();
+	}
+	int count = auto_mesh.Count;
+	if(UApparanceInstancePool* ppool = auto_mesh.Pool.Get())
+	{
+		count = ppool->AdjustAutoInstanceCount( pmesh, 1 );
+	}
+
+	if(!auto_mesh.bInstanced && count >= UApparanceEngineSetup::GetAutoInstancingThreshold() && m_pActor->UseMeshInstancing())
+	{
+		auto_mesh.bInstanced = true;
+		QueueAutoInstanceMigration( pmesh );
+	}
+	return auto_mesh.bInstanced;
+}
+
+// content with automatically instanced meshes gone
+// meshes that drop below the release threshold switch back to components
+//
+void FEntityRendering::RemoveAutoInstancedMeshes( int geometry_id )
+{
+	m_AutoInstanceMigrations.RemoveAll( [geometry_id]( const TPair<int, TWeakObjectPtr<UStaticMesh>>& migration ) { return migration.Key == geometry_id; } );
+
+	TMap<TWeakObjectPtr<UStaticMesh>, int> meshes;
+	if(!m_GeometryAutoInstancedMeshes.RemoveAndCopyValue( geometry_id, meshes ))
+	{
+		return;
+	}
+
+	const int release_threshold = UApparanceEngineSetup::GetAutoInstancingReleaseThreshold();
+	for(const TPair<TWeakObjectPtr<UStaticMesh>, int>& it : meshes)
+	{
+		FAutoInstancedMesh* pauto_mesh = m_AutoInstancedMeshes.Find( it.Key );
+		if(!pauto_mesh)
+		{
+			continue;
+		}
+		pauto_mesh->Count -= it.Value;
+		int count = pauto_mesh->Count;
+		if(UApparanceInstancePool* ppool = pauto_mesh->Pool.Get())
+		{
+			count = ppool->AdjustAutoInstanceCount( it.Key.Get(), -it.Value );
+		}
+		if(pauto_mesh->Count <= 0)
+		{
+			m_AutoInstancedMeshes.Remove( it.Key );
+		}
+		else if(pauto_mesh->bInstanced && count < release_threshold)
+		{
+			pauto_mesh->bInstanced = false;
+			if(UStaticMesh* pmesh = it.Key.Get())
+			{
+				QueueAutoInstanceMigration( pmesh );
+			}
+		}
+	}
+}
+
+// existing content with placements of a mesh needs switching to its current mode
+//
+void FEntityRendering::QueueAutoInstanceMigration( UStaticMesh* pmesh )
+{
+	for(const TPair<int, TMap<TWeakObjectPtr<UStaticMesh>, int>>& it : m_GeometryAutoInstancedMeshes)
+	{
+		if(it.Value.Contains( pmesh ))
+		{
+			m_AutoInstanceMigrations.AddUnique( TPair<int, TWeakObjectPtr<UStaticMesh>>( it.Key, pmesh ) );
+		}
+	}
+}
+
+// switch queued content over a piece at a time, while there's frame time for it
+//
+void FEntityRendering::UpdateAutoInstanceMigration()
+{
+	for(int i = 0; i < m_AutoInstanceMigrations.Num() && g_ApparanceFrameBudget.HasTime(); )
+	{
+		const int geometry_id = m_AutoInstanceMigrations[i].Key;
+#if TIMESLICE_GEOMETRY_ADD_REMOVE
+		//content part way through being added is switched once complete
+		if(bActiveAdd && ActiveAdd.EntityRendering == this && ActiveAdd.GeometryId == geometry_id)
+		{
+			i++;
+			continue;
+		}
+#endif
+		//to whichever mode the mesh is in now (may have flipped back since queued)
+		UStaticMesh* pmesh = m_AutoInstanceMigrations[i].Value.Get();
+		const FAutoInstancedMesh* pauto_mesh = pmesh ? m_AutoInstancedMeshes.Find( pmesh ) : nullptr;
+		if(pauto_mesh)
+		{
+			FFrameBudget::FScope budget_scope( EApparanceWorkCategory::GeometryAdd );
+			MigrateAutoInstancedMesh( geometry_id, pmesh, pauto_mesh->bInstanced );
+		}
+		m_AutoInstanceMigrations.RemoveAt( i );
+	}
+}
+
+// move a piece of content's placements of an automatically instanced mesh between mesh components and instances
+//
+void FEntityRendering::MigrateAutoInstancedMesh( int geometry_id, UStaticMesh* pmesh, bool instanced )
+{
+	if(instanced)
+	{
+		//components to instances
+		FMeshCacheEntry* pmeshcacheentry = m_pActor->MeshCache.Find( geometry_id );
+		if(!pmeshcacheentry)
+		{
+			return;
+		}
+		int moved = 0;
+		for(int i = pmeshcacheentry->Meshes.Num() - 1; i >= 0; i--)
+		{
+			UStaticMeshComponent* pcomponent = pmeshcacheentry->Meshes[i].Get();
+			if(pcomponent && pcomponent->GetStaticMesh() == pmesh)
+			{
+				FMatrix placement = pcomponent->GetRelativeTransform().ToMatrixWithScale();
+				TrackMeshInstance( geometry_id, m_pActor->AddInstancedMesh( geometry_id, pmesh, placement ) );
+				m_pActor->RemoveMesh( pcomponent );
+				pmeshcacheentry->Meshes.RemoveAt( i );
+				moved++;
+			}
+		}
+		if(moved > 0)
+		{
+			m_pActor->PlaceInstancedMeshes( geometry_id );
+		}
+	}
+	else
+	{
+		//instances to components
+		TArray<FTransform> placements;
+		m_pActor->TakeInstancedMeshes( geometry_id, pmesh, placements );
+		for(const FTransform& transform : placements)
+		{
+			FMatrix placement = transform.ToMatrixWithScale();
+			TrackMeshComponent( geometry_id, m_pActor->AddMesh( pmesh, placement ) );
+		}
+	}
+
+	//hidden content stays hidden
+	if(m_HiddenContent.Contains( geometry_id ))
+	{
+		SetContentVisibility( geometry_id, false );
+	}
+}
+
+// our placements no longer count towards the world totals
+//
+void FEntityRendering::ReleaseAutoInstanceCounts()
+{
+	for(const TPair<TWeakObjectPtr<UStaticMesh>, FAutoInstancedMesh>& it : m_AutoInstancedMeshes)
+	{
+		if(UApparanceInstancePool* ppool = it.Value.Pool.Get())
+		{
+			ppool->AdjustAutoInstanceCount( it.Key.Get(), -it.Value.Count );
+		}
+	}
+	m_AutoInstancedMeshes.Empty();
+}
+
+// Old geometry
 void FEntityRendering::RemoveGeometry_Deferred(Apparance::GeometryID geometry_id)
 {
 	GENLOG_INC( nGenLogRemove )
 	SCOPE_CYCLE_COUNTER( STAT_RemovingContent );
+	FFrameBudget::FScope budget_scope( EApparanceWorkCategory::GeometryRemove );
 
 	//UE_LOG( LogApparance, Log, TEXT("RemoveGeometry( %i )"), geometry_id );
 	if(geometry_id!=Apparance::InvalidID)
@@ -1156,28 +1891,36 @@ void FEntityRendering::RemoveContent( Apparance::GeometryID geometry_id )
 #endif
 
 	//---- GEOMETRY ----
+	//remove from merged sections (compacting only those affected, on tick)
+	m_pMergedGeometry->RemoveGeometry( geometry_id );
 	//remove proc mesh
-	TWeakObjectPtr<class UProceduralMeshComponent>* ppcomp = m_pActor->GeometryCache.Find(geometry_id);
-	if (ppcomp)
+	FGeometryCacheEntry* pgeometrycacheentry = m_pActor->GeometryCache.Find(geometry_id);
+	if (pgeometrycacheentry)
 	{
-		class UProceduralMeshComponent* pcomponent = (*ppcomp).Get();
-		if (pcomponent) //isn't present after undo of an entity delete
+		for (int i = 0; i < pgeometrycacheentry->Geometry.Num(); i++)
 		{
-			//UE_LOG( LogApparance, Log, TEXT( "Removing Geometry id %i : [%p]" ), geometry_id, ppcomp );
-			m_pActor->RemoveGeometry(pcomponent);
-			m_pActor->GeometryCache.Remove(geometry_id);
+			class UMeshComponent* pcomponent = pgeometrycacheentry->Geometry[i].Get();
+			if (pcomponent) //isn't present after undo of an entity delete
+			{
+				//UE_LOG( LogApparance, Log, TEXT( "Removing Geometry id %i : [%p]" ), geometry_id, pcomponent );
+				m_pActor->RemoveGeometry(pcomponent);
+			}
 		}
+		m_pActor->GeometryCache.Remove(geometry_id);
 	}
-	//remove collision mesh
-	TWeakObjectPtr<class UProceduralMeshComponent>* pcolcomp = m_pActor->CollisionCache.Find( geometry_id );
-	if(pcolcomp)
+	//remove collision mesh/heightfields
+	FCollisionCacheEntry* pcollisioncacheentry = m_pActor->CollisionCache.Find( geometry_id );
+	if(pcollisioncacheentry)
 	{
-		class UProceduralMeshComponent* pcomponent = (*pcolcomp).Get();
-		if(pcomponent) //isn't present after undo of an entity delete
+		for(int i = 0; i < pcollisioncacheentry->Collision.Num(); i++)
 		{
-			m_pActor->RemoveGeometry( pcomponent );
-			m_pActor->CollisionCache.Remove( geometry_id );
+			class UPrimitiveComponent* pcomponent = pcollisioncacheentry->Collision[i].Get();
+			if(pcomponent) //isn't present after undo of an entity delete
+			{
+				m_pActor->RemoveGeometry( pcomponent );
+			}
 		}
+		m_pActor->CollisionCache.Remove( geometry_id );
 	}
 
 	//TODO: remove need for search?
@@ -1192,18 +1935,11 @@ void FEntityRendering::RemoveContent( Apparance::GeometryID geometry_id )
 	m_EditingTier.Components.Remove( geometry_id );
 
 	//---- MESHES ----
-	//remove instance
+	//remove instances (just this geometry's)
 	FMeshInstanceCacheEntry* pcache_entry = m_pActor->InstanceCache.Find(geometry_id);
 	if (pcache_entry)
 	{
-		TArray<FMeshInstanceHandle>* pinstances = pcache_entry->Instances.Get();
-		if (pinstances)
-		{
-			for (int i = 0; i < pinstances->Num(); i++)
-			{
-				m_pActor->RemoveInstancedMesh(pinstances->operator[](i));
-			}
-		}
+		m_pActor->RemoveInstancedMeshes( geometry_id );
 		pcache_entry->Instances.Reset();
 
 		m_pActor->InstanceCache.Remove(geometry_id);
@@ -1248,6 +1984,13 @@ void FEntityRendering::RemoveContent( Apparance::GeometryID geometry_id )
 
 		m_pActor->ActorCache.Remove(geometry_id);
 	}
+
+	//---- MATERIALS ----
+	ReleaseMaterials( geometry_id );
+
+	//---- AUTO INSTANCING ----
+	m_HiddenContent.Remove( geometry_id );
+	RemoveAutoInstancedMeshes( geometry_id );
 }
 
 // content removal: all
@@ -1255,8 +1998,22 @@ void FEntityRendering::RemoveContent( Apparance::GeometryID geometry_id )
 void FEntityRendering::RemoveAllContent()
 {
 	//tier data dead
+	ReleaseAllMaterials();
 	m_Tiers.Empty();
 
+	//nothing left to swap
+	m_ContentRequestId = INDEX_NONE;
+	m_SwapRequestId = INDEX_NONE;
+	m_bSwapping = false;
+	m_SwapPlaced.Empty();
+	m_SwapRetiring.Empty();
+
+	//no placements left
+	ReleaseAutoInstanceCounts();
+	m_GeometryAutoInstancedMeshes.Empty();
+	m_AutoInstanceMigrations.Empty();
+	m_HiddenContent.Empty();
+
 	//checks (can be null in dead ER objects arrising from some BP editing cases)
 	if (!m_pActor)
 	{
@@ -1267,23 +2024,29 @@ void FEntityRendering::RemoveAllContent()
 	//remove all proc meshes
 	for(auto It = m_pActor->GeometryCache.CreateIterator(); It ; ++It)
 	{
-		TWeakObjectPtr<class UProceduralMeshComponent> pcomp = It.Value();
-		if (pcomp.IsValid()) //isn't present after undo of an entity delete
+		for(TWeakObjectPtr<class UMeshComponent> pcomp : It.Value().Geometry)
 		{
-			m_pActor->RemoveGeometry(pcomp.Get());
+			if (pcomp.IsValid()) //isn't present after undo of an entity delete
+			{
+				m_pActor->RemoveGeometry(pcomp.Get());
+			}
 		}
 	}
 	m_pActor->GeometryCache.Empty();
 	//remove all proc collision
 	for(auto It = m_pActor->CollisionCache.CreateIterator(); It; ++It)
 	{
-		TWeakObjectPtr<class UProceduralMeshComponent> pcomp = It.Value();
-		if(pcomp.IsValid()) //isn't present after undo of an entity delete
+		for(TWeakObjectPtr<class UPrimitiveComponent> pcomp : It.Value().Collision)
 		{
-			m_pActor->RemoveGeometry( pcomp.Get() );
+			if(pcomp.IsValid()) //isn't present after undo of an entity delete
+			{
+				m_pActor->RemoveGeometry( pcomp.Get() );
+			}
 		}
 	}
 	m_pActor->CollisionCache.Empty();
+	//remove all merged geometry
+	m_pMergedGeometry->Clear();
 
 	//---- MESHES ----
 	//remove instances (requires special handling)
@@ -1493,26 +2256,58 @@ struct FDetailTier* FEntityRendering::GetTier( int tier_index )
 //
 void FEntityRendering::InvalidateMaterials()
 {
-	//clear out our record, components hold actual references and they will be gone soon anyway
+	//collision use is re-queried, material instances are shared and released as the content using them is removed
+	//(asset changes stop old instances being found again, see FMaterialCache::Invalidate)
 	for(int i=0 ; i<m_Tiers.Num() ;i++)
 	{
-		m_Tiers[i]->Materials.Empty();
 		m_Tiers[i]->Collision.Empty();
 	}
 
-	m_EditingTier.Materials.Empty();
 	m_EditingTier.Collision.Empty();
 }
 
+// content no longer using its materials
+//
+void FEntityRendering::ReleaseMaterials( int geometry_id )
+{
+	TArray<TPair<int, TSharedPtr<FParameterisedMaterial>>> materials;
+	m_GeometryMaterials.MultiFind( geometry_id, materials );
+	for(const TPair<int, TSharedPtr<FParameterisedMaterial>>& use : materials)
+	{
+		GetTier( use.Key )->ReleaseMaterialUse( m_pActor, use.Value );
+	}
+	m_GeometryMaterials.Remove( geometry_id );
+}
+
+// all content no longer using any materials
+//
+void FEntityRendering::ReleaseAllMaterials()
+{
+	for(const TPair<int, TPair<int, TSharedPtr<FParameterisedMaterial>>>& it : m_GeometryMaterials)
+	{
+		GetTier( it.Value.Key )->ReleaseMaterialUse( m_pActor, it.Value.Value );
+	}
+	m_GeometryMaterials.Empty();
+}
+
 // lookup up material, should have been registered by material operator node
 //
 class UMaterialInterface* FEntityRendering::GetMaterial( Apparance::MaterialID material_id, TSharedPtr<Apparance::IParameterCollection> parameters, TArray<Apparance::TextureID>& textures, int tier_index, bool* pwant_collision_out )
 {
-	//generate instances of this material for each tier so they can have different blend parameters
+	//tiers track their material use (and instances per tier when they carry blend parameters)
 	FDetailTier* ptier = GetTier( tier_index );
 
 	//resolve material
-	class UMaterialInterface* pmaterial = ptier->GetMaterial( m_pActor, material_id, parameters, textures, pwant_collision_out );
+	TSharedPtr<FParameterisedMaterial> pentry;
+	class UMaterialInterface* pmaterial = ptier->GetMaterial( m_pActor, material_id, parameters, textures, pwant_collision_out, pentry );
+
+	//held until the content being added is removed
+	TPair<int, TSharedPtr<FParameterisedMaterial>> use( tier_index, pentry );
+	if(pentry.IsValid() && !m_GeometryMaterials.FindPair( m_CurrentGeometryId, use ))
+	{
+		m_GeometryMaterials.Add( m_CurrentGeometryId, use );
+		ptier->AddMaterialUse( m_pActor, pentry );
+	}
 	return pmaterial;
 }
 
@@ -1523,80 +2318,31 @@ class UMaterialInterface* FEntityRendering::GetMaterial( Apparance::MaterialID m
 
 // lookup/cache a material instance
 //
-class UMaterialInterface* FDetailTier::GetMaterial( AApparanceEntity* pactor, Apparance::MaterialID material_id, TSharedPtr<Apparance::IParameterCollection> parameters, TArray<Apparance::TextureID>& textures, bool* pwant_collision_out )
+class UMaterialInterface* FDetailTier::GetMaterial( AApparanceEntity* pactor, Apparance::MaterialID material_id, TSharedPtr<Apparance::IParameterCollection> parameters, TArray<Apparance::TextureID>& textures, bool* pwant_collision_out, TSharedPtr<FParameterisedMaterial>& entry_out )
 {
 	//extract collision flag
 	bool* pcollisionflag = Collision.Find( material_id );
 	bool want_collision = pcollisionflag && *pcollisionflag;
 
-	//search for existing
-	for(int i = 0; i < Materials.Num(); i++)
+	//shared instance for the same material, parameters, and textures?
+	//across the world if blending is via the components, otherwise the instance carries this entity tier's blend so only shared within it
+	UWorld* pworld = pactor->GetWorld();
+	const bool world_shared = UApparanceEngineSetup::GetDetailBlendPrimitiveData();
+	const int material_tier = world_shared ? DETAIL_BLEND_SHARED_TIER : TierIndex;
+	AApparanceEntity* powner = world_shared ? nullptr : pactor;
+	uint32 hash = 0;
+	TSharedPtr<FParameterisedMaterial> pentry = g_ApparanceMaterialCache.Find( pworld, powner, material_id, material_tier, parameters, textures, hash );
+	if(pentry.IsValid() && (pentry->MaterialInstance.IsValid() || pentry->MaterialInstance.IsExplicitlyNull()/*collision only*/))
 	{
-		FParameterisedMaterial* pexisting_mat = Materials[i].Get();
-
-		//same material asset?
-		if(pexisting_mat->ID != material_id)
-		{
-			continue;
-		}
-	
-		//parameters?
-		Apparance::IParameterCollection* existing_parameters = pexisting_mat->Parameters.Get();
-		bool has_params = parameters.IsValid();
-		bool existing_params = existing_parameters != nullptr;
-		if(has_params != existing_params)
-		{
-			continue;
-		}
-
-		//check paramter match
-		if(has_params)
-		{
-			//same parameters?
-			if(((existing_parameters != parameters.Get()) && !existing_parameters->Equal( parameters.Get() )))
-			{
-				continue;
-			}
-
-			//same textures?
-			if(pexisting_mat->Textures.Num() != textures.Num())
-			{
-				continue;
-			}
-			bool same_textures = true;
-			for(int t = 0; t < textures.Num(); t++)
-			{
-				if(pexisting_mat->Textures[t] != textures[t])
-				{
-					same_textures = false;
-					break;
-				}
-			}
-			if(!same_textures)
-			{
-				continue;
-			}
-		}
-
-		//found a match...
-		if (!pexisting_mat->MaterialInstance.IsValid())
-		{
-			//...but it has expired
-			Materials.RemoveAt( i ); //purge from tracking
-			break;
-		}
-
+		Collision.Add( material_id, pentry->WantCollision );
 		if(pwant_collision_out)
 		{
-			*pwant_collision_out = want_collision;
+			*pwant_collision_out = pentry->WantCollision;
 		}
-
-		//they fully match!
-		return pexisting_mat->MaterialInstance.Get();
+		entry_out = pentry;
+		return pentry->MaterialInstance.Get();
 	}
 
-	//cache a new one
-
 	//query asset database
 	UMaterialInterface* pbasematerial = nullptr;
 	const UApparanceResourceListEntry_Material* pmaterialentry;
@@ -1608,38 +2354,45 @@ class UMaterialInterface* FDetailTier::GetMaterial( AApparanceEntity* pactor, Ap
 			pbasematerial = FApparanceUnrealModule::GetModule()->GetFallbackMaterial();
 		}
 	}
-
-	//store
-	TSharedPtr<FParameterisedMaterial> new_mat_entry = MakeShareable( new FParameterisedMaterial() );
-	int new_variant_index = Materials.Num();
-	Materials.Add( new_mat_entry );
 	Collision.Add( material_id, want_collision );
 
-	//fill in
-	new_mat_entry->ID = material_id;
-	new_mat_entry->Parameters = parameters;
-	new_mat_entry->Textures = textures;
+	//new entry, or one whose instance has expired
+	const bool new_entry = !pentry.IsValid();
+	if(new_entry)
+	{
+		pentry = MakeShareable( new FParameterisedMaterial() );
+		pentry->ID = material_id;
+		pentry->Parameters = parameters;
+		pentry->Textures = textures;
+		pentry->TierIndex = material_tier;
+		pentry->World = pworld;
+		pentry->Owner = powner;
+		pentry->Hash = hash;
+		g_ApparanceMaterialCache.Add( pentry );
+	}
+	pentry->WantCollision = want_collision;
 
-	//wrap with instance
+	//wrap with instance (shared, so belongs to the world rather than any one entity)
+	FFrameBudget::FScope budget_scope( EApparanceWorkCategory::Materials );
 	UMaterialInstanceDynamic* pmaterial = nullptr;
 	if(pbasematerial)
 	{
-		pmaterial = UMaterialInstanceDynamic::Create( pbasematerial, pactor );
+		pmaterial = UMaterialInstanceDynamic::Create( pbasematerial, pworld );
 	}
-	new_mat_entry->MaterialInstance = pmaterial;
-
-	//make actor aware of new material variant in play
-	pactor->MaterialCache.Add( (int)material_id | (int)(TierIndex << 18) | (int)(new_variant_index << 25), pmaterial );
+	pentry->MaterialInstance = pmaterial;
 
 	//apply initial parameters
 	if(pmaterialentry)
 	{
-		pmaterialentry->Apply( new_mat_entry->MaterialInstance.Get(), new_mat_entry->Parameters.Get(), new_mat_entry->Textures );
+		pmaterialentry->Apply( pentry->MaterialInstance.Get(), pentry->Parameters.Get(), pentry->Textures );
 
 #if WITH_EDITOR
 		//need to monitor for internal dyamic resource changes, which can only happen in-editor
-		FAssetDatabase* passet_db = FApparanceUnrealModule::GetAssetDatabase();
-		passet_db->Editor_TrackMaterialUse( pmaterialentry, new_mat_entry );
+		if(new_entry)
+		{
+			FAssetDatabase* passet_db = FApparanceUnrealModule::GetAssetDatabase();
+			passet_db->Editor_TrackMaterialUse( pmaterialentry, pentry );
+		}
 #endif
 	}
 
@@ -1649,16 +2402,78 @@ class UMaterialInterface* FDetailTier::GetMaterial( AApparanceEntity* pactor, Ap
 	}
 
 	//result
+	entry_out = pentry;
 	return pmaterial;
 }
 
+/// <summary>
+/// where a material variant is listed in an entity's MaterialCache, fields kept apart: id (32 bits), tier (16), slot (16)
+/// </summary>
+static uint64 MakeMaterialCacheKey( Apparance::MaterialID material_id, int tier_index, int slot )
+{
+	check( slot >= 0 && slot <= MAX_uint16 );
+	return (uint64)(uint32)material_id | ((uint64)(uint16)tier_index << 32) | ((uint64)(uint16)slot << 48);
+}
+
+// content at this tier has started using a material
+//
+void FDetailTier::AddMaterialUse( AApparanceEntity* pactor, const TSharedPtr<FParameterisedMaterial>& pentry )
+{
+	int& uses = MaterialUses.FindOrAdd( pentry.Get() );
+	if(uses++ == 0)
+	{
+		//make actor aware of new material variant in play (first free slot for this material at this tier)
+		int slot = 0;
+		uint64 key = MakeMaterialCacheKey( pentry->ID, TierIndex, slot );
+		while(pactor->MaterialCache.Contains( key ))
+		{
+			key = MakeMaterialCacheKey( pentry->ID, TierIndex, ++slot );
+		}
+		pactor->MaterialCache.Add( key, pentry->MaterialInstance.Get() );
+		ActorMaterialKeys.Add( pentry.Get(), key );
+
+		Materials.Add( pentry );
+		g_ApparanceMaterialCache.AddRef( pentry );
+
+		//blend carried by the instance? start with this tier's
+		UMaterialInstanceDynamic* pmaterial = pentry->MaterialInstance.Get();
+		if(pmaterial && bDetailBlendSet && !UApparanceEngineSetup::GetDetailBlendPrimitiveData())
+		{
+			pmaterial->SetVectorParameterValue( "DetailBlend", DetailBlend );
+		}
+	}
+}
+
+// content at this tier has stopped using a material
+//
+void FDetailTier::ReleaseMaterialUse( AApparanceEntity* pactor, const TSharedPtr<FParameterisedMaterial>& pentry )
+{
+	int* puses = MaterialUses.Find( pentry.Get() );
+	if(puses && --(*puses) == 0)
+	{
+		MaterialUses.Remove( pentry.Get() );
+		uint64 key;
+		if(ActorMaterialKeys.RemoveAndCopyValue( pentry.Get(), key ) && pactor)
+		{
+			pactor->MaterialCache.Remove( key );
+		}
+		Materials.RemoveSingleSwap( pentry );
+		g_ApparanceMaterialCache.Release( pentry );
+	}
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////
 // FEntityView
 
-FEntityView::FEntityView( FEntityRendering* per )
+FEntityView::FEntityView( FEntityRendering* per, bool predicted )
 	: m_pEntityRendering( per )
+	, m_Location( FVector::ZeroVector )
+	, m_bPredicted( predicted )
+	, m_Velocity( FVector::ZeroVector )
+	, m_bTracking( false )
+	, m_bPredicting( false )
 {
 }
 
@@ -1668,43 +2483,251 @@ FEntityView::~FEntityView()
 
 Apparance::Vector3 FEntityView::GetPosition() const
 {
-	auto world = m_pEntityRendering->GetActor()->GetWorld();
-	auto view_locs = world->ViewLocationsRenderedLastFrame;
-	if(view_locs.Num() >0)
+	return APPARANCESPACE_FROM_UNREALSPACE( m_Location );
+}
+
+void FEntityView::SetDetailRange( int tier_index, float near0, float near1, float far1, float far0 )
+{
+	//transform to unreal space
+	const FVector4 range(
+		UNREALSCALE_FROM_APPARANCESCALE( near0 ),
+		UNREALSCALE_FROM_APPARANCESCALE( near1 ),
+		UNREALSCALE_FROM_APPARANCESCALE( far1 ),
+		UNREALSCALE_FROM_APPARANCESCALE( far0 ) );
+
+	//store
+	if(tier_index >= 0)
 	{
-		FVector view_loc = view_locs[0];		
-		Apparance::Vector3 view_position = APPARANCESPACE_FROM_UNREALSPACE( view_loc );
-		return view_position;
+		while(tier_index >= m_DetailRanges.Num())
+		{
+			m_DetailRanges.Add( FVector4( -1, -1, -1, -1 ) );	//(not set)
+		}
+		m_DetailRanges[tier_index] = range;
 	}
 
-	return Apparance::Vector3({0,0,0});
+	//combine with other views (predicted ones only drive generation)
+	if(!m_bPredicted)
+	{
+		m_pEntityRendering->ApplyDetailRange( tier_index, range );
+	}
 }
 
-void FEntityView::SetDetailRange( int tier_index, float near0, float near1, float far1, float far0 )
+// move view, tracking its velocity
+//
+void FEntityView::UpdateLocation( const FVector& location, float delta_seconds )
 {
-	FDetailTier* ptier = m_pEntityRendering->GetTier( tier_index );
+	if(m_bTracking && delta_seconds > 0)
+	{
+		const FVector movement = location - m_Location;
+		if(movement.SizeSquared() > FMath::Square( VIEW_PREDICTION_CUT_DISTANCE ))
+		{
+			//cut/teleport, start again
+			m_Velocity = FVector::ZeroVector;
+		}
+		else
+		{
+			//smoothed, independent of frame rate
+			const float blend = 1.0f - FMath::Exp( -delta_seconds / VIEW_PREDICTION_RESPONSE );
+			m_Velocity = FMath::Lerp( m_Velocity, movement / delta_seconds, blend );
+		}
+	}
+	m_Location = location;
+	m_bTracking = true;
+}
 
-	//transform to unreal space
-	near0 = UNREALSCALE_FROM_APPARANCESCALE( near0 );
-	near1 = UNREALSCALE_FROM_APPARANCESCALE( near1 );
-	far1 = UNREALSCALE_FROM_APPARANCESCALE( far1 );
-	far0 = UNREALSCALE_FROM_APPARANCESCALE( far0 );
-		
-	//calc
-	float f0 = far0;
-	float f1 = -1.0f/(far0-far1);
-	float f2 = near0;
-	float f3 = 1.0f/(near1-near0);
-	ptier->DetailBlend = FLinearColor( f0, f1, f2, f3 );
+// where the view is expected to be after a while, if it's going anywhere
+//
+bool FEntityView::UpdatePrediction( float look_ahead, FVector& predicted_out )
+{
+	m_bPredicting = look_ahead > 0 && m_Velocity.SizeSquared() > FMath::Square( VIEW_PREDICTION_MIN_SPEED );
+	if(m_bPredicting)
+	{
+		predicted_out = m_Location + m_Velocity * look_ahead;
+	}
+	return m_bPredicting;
+}
 
-	//apply
-	for( int i=0 ; i<ptier->Materials.Num() ; i++)		
+// detail range this view wants for a tier, if any
+//
+bool FEntityView::GetDetailRange( int tier_index, FVector4& range_out ) const
+{
+	if(m_DetailRanges.IsValidIndex( tier_index ) && m_DetailRanges[tier_index].W >= 0)
 	{
-		FParameterisedMaterial* ppm = ptier->Materials[i].Get();
-		UMaterialInstanceDynamic* pmaterial = ppm->MaterialInstance.Get();
-		pmaterial->SetVectorParameterValue( "DetailBlend", ptier->DetailBlend );
+		range_out = m_DetailRanges[tier_index];
+		return true;
+	}
+	return false;
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+//scripted camera path replay
+#define VIEW_PREDICTION_TEST_STEP (1.0f/60.0f)	//(s) fixed, so runs are repeatable
+#define VIEW_PREDICTION_TEST_TILE 2000.0f		//(uu) content tile size
+#define VIEW_PREDICTION_TEST_RADIUS 4000.0f		//(uu) distance tiles are needed within
+#define VIEW_PREDICTION_TEST_DURATION 7.0f		//(s) path moves for 6s, then stops
+
+/// <summary>
+/// camera position along the scripted path: RTS style pan, a sharp turn, a diagonal sweep, then a stop
+/// </summary>
+static FVector ViewPredictionTestPath( float t, float speed )
+{
+	const float leg = 2.0f;	//(s)
+	FVector p = FVector::ZeroVector;
+	const FVector legs[3] = { FVector( 1, 0, 0 ), FVector( 0, 1, 0 ), FVector( -0.7071f, 0.7071f, 0 ) };
+	for(int i = 0; i < 3 && t > 0; i++)
+	{
+		p += legs[i] * speed * FMath::Min( t, leg );
+		t -= leg;
 	}
+	return p + FVector( 0, 0, 1000.0f );
+}
+
+/// <summary>
+/// content lag measured over a replay
+/// </summary>
+struct FViewPredictionTestResult
+{
+	int   Needed = 0;		//tiles the actual camera needed
+	int   Late = 0;			//of those, ready after they were needed
+	int   Wasted = 0;		//requested but never needed
+	float AverageLag = 0;	//(s)
+	float MaxLag = 0;		//(s)
+	bool  PredictingAtEnd = false;	//after the camera has stopped
+
+	bool operator==( const FViewPredictionTestResult& other ) const
+	{
+		return Needed == other.Needed && Late == other.Late && Wasted == other.Wasted && AverageLag == other.AverageLag && MaxLag == other.MaxLag && PredictingAtEnd == other.PredictingAtEnd;
+	}
+};
+
+/// <summary>
+/// replay the path through view tracking, tiles are requested when any submitted view comes within range and are ready a fixed latency later
+/// </summary>
+static FViewPredictionTestResult ViewPredictionTestRun( float look_ahead, float speed, float latency )
+{
+	struct FTile
+	{
+		float RequestTime = -1;
+		float NeededTime = -1;
+	};
+	TMap<FIntPoint, FTile> tiles;
+
+	//request/need every tile in range of a point
+	auto touch = [&tiles]( const FVector& location, float t, bool needed )
+	{
+		const int r = FMath::CeilToInt( VIEW_PREDICTION_TEST_RADIUS / VIEW_PREDICTION_TEST_TILE );
+		const FIntPoint centre( FMath::FloorToInt( location.X / VIEW_PREDICTION_TEST_TILE ), FMath::FloorToInt( location.Y / VIEW_PREDICTION_TEST_TILE ) );
+		for(int y = -r; y <= r; y++)
+		{
+			for(int x = -r; x <= r; x++)
+			{
+				const FIntPoint cell = centre + FIntPoint( x, y );
+				const FVector tile_centre( (cell.X + 0.5f) * VIEW_PREDICTION_TEST_TILE, (cell.Y + 0.5f) * VIEW_PREDICTION_TEST_TILE, location.Z );
+				if(FVector::Dist( tile_centre, location ) < VIEW_PREDICTION_TEST_RADIUS)
+				{
+					FTile& tile = tiles.FindOrAdd( cell );
+					if(tile.RequestTime < 0)
+					{
+						tile.RequestTime = t;
+					}
+					if(needed && tile.NeededTime < 0)
+					{
+						tile.NeededTime = t;
+					}
+				}
+			}
+		}
+	};
+
+	//replay (whole frames, so time doesn't accumulate rounding)
+	FViewPredictionTestResult result;
+	FEntityView view( nullptr );
+	const int frames = FMath::RoundToInt( VIEW_PREDICTION_TEST_DURATION / VIEW_PREDICTION_TEST_STEP );
+	for(int frame = 0; frame <= frames; frame++)
+	{
+		const float t = frame * VIEW_PREDICTION_TEST_STEP;
+		view.UpdateLocation( ViewPredictionTestPath( t, speed ), VIEW_PREDICTION_TEST_STEP );
+		touch( view.GetLocation(), t, true );
+		FVector predicted;
+		if(view.UpdatePrediction( look_ahead, predicted ))
+		{
+			touch( predicted, t, false );
+		}
+	}
+	result.PredictingAtEnd = view.IsPredicting();
+
+	//measure
+	for(const TPair<FIntPoint, FTile>& it : tiles)
+	{
+		const FTile& tile = it.Value;
+		if(tile.NeededTime < 0)
+		{
+			result.Wasted++;
+			continue;
+		}
+		const float lag = FMath::Max( tile.RequestTime + latency - tile.NeededTime, 0.0f );
+		result.Needed++;
+		result.Late += lag > 0 ? 1 : 0;
+		result.AverageLag += lag;
+		result.MaxLag = FMath::Max( result.MaxLag, lag );
+	}
+	result.AverageLag /= FMath::Max( result.Needed, 1 );
+	return result;
+}
+
+/// <summary>
+/// content must lag less behind a fast camera with view prediction than without, repeatably, prediction must stop with the camera and reset on cuts, and every entity view must get its predicted view
+/// </summary>
+IMPLEMENT_SIMPLE_AUTOMATION_TEST( FApparanceViewPredictionTest, "Apparance.Geometry.ViewPrediction", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter )
+
+bool FApparanceViewPredictionTest::RunTest( const FString& Parameters )
+{
+	const float look_ahead = 0.5f;	//(s)
+	const float speed = 5000.0f;	//(uu/s)
+	const float latency = 0.5f;		//(s) generation
+
+	//lag, without and with prediction
+	const FViewPredictionTestResult without = ViewPredictionTestRun( 0.0f, speed, latency );
+	const FViewPredictionTestResult with = ViewPredictionTestRun( look_ahead, speed, latency );
+	TestTrue( TEXT( "Path needs content" ), without.Needed > 0 );
+	TestEqual( TEXT( "Without prediction every needed tile is late" ), without.Late, without.Needed );
+	TestEqual( TEXT( "Without prediction nothing is wasted" ), without.Wasted, 0 );
+	TestTrue( TEXT( "Prediction reduces late tiles" ), with.Late < without.Late );
+	TestTrue( TEXT( "Prediction reduces average lag" ), with.AverageLag < without.AverageLag );
+	TestTrue( TEXT( "Prediction doesn't increase worst lag" ), with.MaxLag <= without.MaxLag );
+	TestFalse( TEXT( "Prediction stops with the camera" ), with.PredictingAtEnd );
+
+	//repeatable
+	TestTrue( TEXT( "Replay is deterministic" ), ViewPredictionTestRun( look_ahead, speed, latency ) == with );
+
+	//camera cut isn't movement
+	FEntityView view( nullptr );
+	view.UpdateLocation( FVector::ZeroVector, VIEW_PREDICTION_TEST_STEP );
+	view.UpdateLocation( FVector( speed * VIEW_PREDICTION_TEST_STEP, 0, 0 ), VIEW_PREDICTION_TEST_STEP );
+	TestTrue( TEXT( "Movement tracked" ), view.GetVelocity().X > 0 );
+	view.UpdateLocation( FVector( VIEW_PREDICTION_CUT_DISTANCE * 2, 0, 0 ), VIEW_PREDICTION_TEST_STEP );
+	TestTrue( TEXT( "Cut resets velocity" ), view.GetVelocity().IsZero() );
+	FVector predicted;
+	TestFalse( TEXT( "No prediction after cut" ), view.UpdatePrediction( look_ahead, predicted ) );
+
+	//entity views, a single moving view (the one every entity starts with) gets a predicted view ahead of it
+	FEntityRendering entity_rendering;
+	const FVector ahead( speed * look_ahead * 2, 0, 0 );
+	const int frames = FMath::RoundToInt( 1.0f / VIEW_PREDICTION_TEST_STEP );
+	for(int frame = 0; frame <= frames; frame++)
+	{
+		TArray<FVector> view_locations;
+		view_locations.Add( FVector( speed * frame * VIEW_PREDICTION_TEST_STEP, 0, 0 ) );
+		entity_rendering.UpdateViewLocations( view_locations, look_ahead, VIEW_PREDICTION_TEST_STEP );
+	}
+	const FVector camera( speed * frames * VIEW_PREDICTION_TEST_STEP, 0, 0 );
+	TestTrue( TEXT( "Single view predicts ahead" ), entity_rendering.GetViewDistance( camera + ahead ) < FVector::Dist( camera, camera + ahead ) - 1.0f );
+	TestTrue( TEXT( "Single view still covers the camera" ), entity_rendering.GetViewDistance( camera ) < 1.0f );
+
+	AddInfo( FString::Printf( TEXT( "%.0f uu/s camera, %.2fs latency: %i tiles needed, late %i -> %i, lag avg %.3fs -> %.3fs max %.3fs -> %.3fs, %i requested but never needed" ), speed, latency, without.Needed, without.Late, with.Late, without.AverageLag, with.AverageLag, without.MaxLag, with.MaxLag, with.Wasted ) );
+	return true;
 }
+#endif //WITH_DEV_AUTOMATION_TESTS
 
 #if APPARANCE_DEBUGGING_HELP_EntityRendering
 PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
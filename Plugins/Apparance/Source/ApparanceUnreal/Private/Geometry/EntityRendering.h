@@ -11,7 +11,12 @@
 
 //test/debug
 #define TIMESLICE_GEOMETRY_ADD_REMOVE 1
+#define TIMESLICE_OBJECTS_PER_CHECK 8	//mesh/blueprint placements between timeslice budget checks during a geometry add
 #define LOG_GEOMETRY_ADD_STATS 0
+#define DETAIL_BLEND_PRIMITIVE_DATA_INDEX 0	//first of four custom primitive data floats carrying DetailBlend (see GetDetailBlendPrimitiveData)
+#define DETAIL_BLEND_SHARED_TIER (-2)		//material tier of instances shared by all tiers (no per tier blend parameters)
+#define SWAP_QUIET_TIME 0.5		//rebuild placed without queuing is taken as complete once nothing has arrived for it for this long (s)
+#define SWAP_TIMEOUT 10.0		//rebuild swapped in regardless after this long (s), e.g. if it produces nothing
 //
 #if LOG_GEOMETRY_ADD_STATS
 # define GENLOG_INC(a) a++;
@@ -23,6 +28,7 @@
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
 extern bool Apparance_IsPendingGeometryAdd();
 extern void Apparance_SetTimesliceLimit( float maxMS );
+extern void Apparance_SetLoading( bool loading );
 extern int Apparance_GetPendingCount();
 #endif
 
@@ -50,42 +56,88 @@ struct FParameterisedMaterial : public TSharedFromThis<FParameterisedMaterial>
 	//parameters
 	TSharedPtr<Apparance::IParameterCollection>          Parameters;
 	TArray<Apparance::TextureID>                         Textures;
+	bool                                                 WantCollision = false;
+	//sharing (see FMaterialCache)
+	int                                                  TierIndex = 0;	//or DETAIL_BLEND_SHARED_TIER
+	TWeakObjectPtr<class UWorld>                         World;
+	TWeakObjectPtr<class UObject>                        Owner;	//only user (null if shared across the world)
+	uint32                                               Generation = 0;	//asset database state it was made from
+	uint32                                               Hash = 0;
+	int                                                  RefCount = 0;	//entity tiers using it
 };
 
 
 typedef TArray<TSharedPtr<FParameterisedMaterial>>                TMaterialList;
-typedef TMap<int, TWeakObjectPtr<class UProceduralMeshComponent>> TComponentMap;
+typedef TMultiMap<int, TWeakObjectPtr<class UMeshComponent>> TComponentMap;	//can be several per id (spatial chunks)
 
 // tracking tier specific resources/assets
 //
 struct FDetailTier : public TSharedFromThis<FDetailTier>
 {
-	int TierIndex;
+	int TierIndex = -1;
 
 	//graphical content
 	TMaterialList Materials;	//use to generate visible geometry?
+	TMap<FParameterisedMaterial*, int> MaterialUses;	//content using each of them
+	TMap<FParameterisedMaterial*, uint64> ActorMaterialKeys;	//where each is listed in the actor's MaterialCache
 	TCollisionMap Collision;	//use to generate collision to?
 	TComponentMap Components;
 
 	//blend parameters
 	FLinearColor DetailBlend;
+	bool bDetailBlendSet = false;	//(components keep the material defaults until it is)
 
 	//material management
-	class UMaterialInterface* GetMaterial( class AApparanceEntity* pactor, Apparance::MaterialID material_id, TSharedPtr<Apparance::IParameterCollection> parameters, TArray<Apparance::TextureID>& textures, bool* pwant_collision_out );
+	class UMaterialInterface* GetMaterial( class AApparanceEntity* pactor, Apparance::MaterialID material_id, TSharedPtr<Apparance::IParameterCollection> parameters, TArray<Apparance::TextureID>& textures, bool* pwant_collision_out, TSharedPtr<FParameterisedMaterial>& entry_out );
+	void AddMaterialUse( class AApparanceEntity* pactor, const TSharedPtr<FParameterisedMaterial>& pentry );
+	void ReleaseMaterialUse( class AApparanceEntity* pactor, const TSharedPtr<FParameterisedMaterial>& pentry );
 
 };
 
 
-// Handles view interfacing
+// progress through a timesliced geometry add, so large content can be placed over several frames
+//
+struct FGeometryAddProgress
+{
+	int  GeometryId = 0;
+	bool Started = false;		//geometry stage done
+	int  NextObject = 0;		//placements done so far
+	bool ContentHidden = false;	//partial content hidden until complete
+};
+
+
+// Handles view interfacing, one per view content detail is needed for (viewports, scene captures)
 //
 class FEntityView : public Apparance::Host::IEntityView
 {
 	class FEntityRendering* m_pEntityRendering;
 
+	//view
+	FVector         m_Location;		//world space
+	bool            m_bPredicted;	//where a view is expected to be, for generation only
+	//tier detail ranges requested for this view (near0, near1, far1, far0) in unreal space
+	TArray<FVector4> m_DetailRanges;
+
+	//movement
+	FVector         m_Velocity;		//smoothed
+	bool            m_bTracking;	//have a previous location
+	bool            m_bPredicting;	//moving enough to have a predicted view
+
 public:
-	FEntityView( FEntityRendering* per );
+	FEntityView( FEntityRendering* per, bool predicted=false );
 	virtual ~FEntityView();
 
+	//setup
+	void SetLocation( const FVector& location ) { m_Location = location; }
+	void UpdateLocation( const FVector& location, float delta_seconds );	//(tracks velocity)
+	bool UpdatePrediction( float look_ahead, FVector& predicted_out );
+
+	//access
+	const FVector& GetLocation() const { return m_Location; }
+	const FVector& GetVelocity() const { return m_Velocity; }
+	bool IsPredicting() const { return m_bPredicting; }
+	bool GetDetailRange( int tier_index, FVector4& range_out ) const;
+
 	//~ Begin Apparance IEntityRendering Interface
 	Apparance::Vector3 GetPosition() const;
 	void               SetDetailRange( int tier_index, float near0, float near1, float far1, float far0 );
@@ -106,14 +158,43 @@ class FEntityRendering : public Apparance::Host::IEntityRendering
 	//int							m_NextGeometryID;
 	Apparance::IClosure*		m_pDeferredProcedure;
 	TSharedPtr<struct FRateLimiter>	m_pRateLimiter;
+	TSharedPtr<class FMergedGeometry> m_pMergedGeometry;
 
 	// view info
-	FEntityView                 m_View;
+	TArray<TUniquePtr<FEntityView>> m_Views;	//(stable, the engine may track them)
+	TArray<TUniquePtr<FEntityView>> m_PredictedViews;	//ahead of each view, when moving
+	int                             m_ViewCount;	//in use this frame
 
 	// tiers
 	TArray<TSharedPtr<FDetailTier>> m_Tiers;
 	FDetailTier                     m_EditingTier;
 
+	// rebuild swapping
+	int                             m_ContentRequestId;	//build current content came from
+	bool                            m_bSwapping;
+	int                             m_SwapRequestId;	//build being placed
+	double                          m_SwapStartTime;
+	double                          m_SwapLastActivity;	//last add/remove while swapping
+	bool                            m_bSwapQueued;		//build's content has been queued for placement
+	TArray<int>                     m_SwapPlaced;		//new content, hidden until swap
+	TArray<int>                     m_SwapRetiring;		//old content, removed on swap
+
+	//automatic instancing, live placements of each mesh (see EApparanceInstancingMode::Auto)
+	struct FAutoInstancedMesh
+	{
+		int  Count = 0;
+		bool bInstanced = false;
+		TWeakObjectPtr<class UApparanceInstancePool> Pool;	//also counted across the world here, when pooled
+	};
+	TMap<TWeakObjectPtr<class UStaticMesh>, FAutoInstancedMesh>            m_AutoInstancedMeshes;
+	TMap<int, TMap<TWeakObjectPtr<class UStaticMesh>, int>>                m_GeometryAutoInstancedMeshes;	//by geometry id
+	TArray<TPair<int, TWeakObjectPtr<class UStaticMesh>>>                  m_AutoInstanceMigrations;	//content to switch over, (geometry id, mesh)
+	TSet<int>                                                               m_HiddenContent;
+
+	//materials used by each piece of content (tracked while it's being added), (tier,material) pairs
+	TMultiMap<int, TPair<int, TSharedPtr<FParameterisedMaterial>>> m_GeometryMaterials;
+	int                                                              m_CurrentGeometryId;
+
 	//interactive editing
 	Apparance::IParameterCollection* m_pEditingParameters;
 
@@ -146,19 +227,40 @@ public:
 	struct FDetailTier* GetTier( int tier_index );
 	class UMaterialInterface* GetMaterial( Apparance::MaterialID material, TSharedPtr<Apparance::IParameterCollection> parameters, TArray<Apparance::TextureID>& textures, int tier_index, bool* pwant_collision_out=nullptr );
 	class AApparanceEntity* GetActor() { return m_pActor; }
+	float GetViewDistance( const FVector& world_location ) const;
+	void UpdateViewLocations( const TArray<FVector>& view_locations, float look_ahead, float delta_seconds );
+	void ApplyDetailRange( int tier_index, FVector4 range );
+	void ApplyDetailBlend( class UPrimitiveComponent* pcomponent, int tier_index );
 	Apparance::IEntity* GetEntityAPI() { return m_pEntity; }
 
 	//testing deferred add/remove
 	static int m_NextGeometryID;
 	Apparance::GeometryID AddGeometry_Deferred( Apparance::Host::IGeometry* geometry, int tier_index, Apparance::Vector3 offset, int request_id );
+	bool                  AddGeometry_Step( Apparance::Host::IGeometry* geometry, int tier_index, Apparance::Vector3 offset, int request_id, FGeometryAddProgress& progress, double end_time );
 	void                  RemoveGeometry_Deferred( Apparance::GeometryID geometry_id );
+	bool                  UpdateSwap();
 
 private:
 
 	void InvalidateMaterials();
+	void ReleaseMaterials( int geometry_id );
+	void ReleaseAllMaterials();
+	void SetContentVisibility( int geometry_id, bool visible );
+	void TrackMeshInstance( int geometry_id, const struct FMeshInstanceHandle& handle );
+	void TrackMeshComponent( int geometry_id, class UStaticMeshComponent* pmesh );
+	bool AddAutoInstancedMesh( int geometry_id, class UStaticMesh* pmesh );
+	void RemoveAutoInstancedMeshes( int geometry_id );
+	void QueueAutoInstanceMigration( class UStaticMesh* pmesh );
+	void UpdateAutoInstanceMigration();
+	void MigrateAutoInstancedMesh( int geometry_id, class UStaticMesh* pmesh, bool instanced );
+	void ReleaseAutoInstanceCounts();
 	void RemoveContent( Apparance::GeometryID geometry_id );
 	void RemoveAllContent();
+	void BeginSwap( int request_id );
+	void FinishSwap();
+	void RetireContent( int geometry_id );
 	void TriggerBuild( Apparance::IClosure* proc );
+	void UpdateViews( float delta_seconds );
 
 	friend class AApparanceEntity;
 
@@ -17,45 +17,83 @@ PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
 
 // unreal
 #include "Math/UnrealMath.h"
+#include "Hash/CityHash.h"
+#include "ProceduralMeshComponent.h"
 
 // module
 #include "ApparanceUnreal.h"
+#include "GeometryConversion.h"
+#include "GeometryFactory.h"
+#include "GeometryOptimisation.h"
+#include "GeometryChunking.h"
 
 
 //////////////////////////////////////////////////////////////////////////
 // FApparanceGeometry
 
-FApparanceGeometry::FApparanceGeometry()
+FApparanceGeometry::FApparanceGeometry( FGeometryFactory* pfactory )
+	: m_pFactory( pfactory )
+	, m_ChunkCount( 1 )
 {
 }
 
 FApparanceGeometry::~FApparanceGeometry()
+{
+	Reset();
+}
+
+// drop all parts and objects, parts go back to the factory pool if we have one
+//
+void FApparanceGeometry::Reset()
 {
 	for(auto ppart : m_Parts)
 	{
-		delete ppart;
+		if(m_pFactory)
+		{
+			m_pFactory->ReleasePart( ppart );
+		}
+		else
+		{
+			delete ppart;
+		}
+	}
+	for(auto ppart : m_ChunkParts)
+	{
+		if(m_pFactory)
+		{
+			m_pFactory->ReleasePart( ppart );
+		}
+		else
+		{
+			delete ppart;
+		}
 	}
-	m_Parts.Empty();
+	m_Parts.Reset();
+	m_ChunkParts.Reset();
+	m_DrawParts.Reset();
 
 	for (int i = 0; i < m_Objects.Num(); i++)
 	{
 		delete m_Objects[i].Parameters;
 	}
-	m_Objects.Empty();
+	m_Objects.Reset();
+	m_ChunkCount = 1;
 }
 
 int FApparanceGeometry::GetVertexLimit() const
 { 
-	return MAX_int32; 
+	return m_pFactory ? m_pFactory->GetVertexLimit() : MAX_int32;
 }
 int FApparanceGeometry::GetIndexLimit() const
 { 
-	return MAX_int32;
+	return m_pFactory ? m_pFactory->GetIndexLimit() : MAX_int32;
 }
 
 struct Apparance::Host::IGeometryPart* FApparanceGeometry::AddTriangleList( Apparance::MaterialID material, Apparance::IParameterCollection* parameters, const Apparance::TextureID* textures, int texture_count, int vertex_count, int triangle_count )
 {
-	FApparanceGeometryPart* part = new FApparanceGeometryPart( material, parameters, textures, texture_count, vertex_count, triangle_count );
+	FApparanceGeometryPart* part = m_pFactory
+		? m_pFactory->AcquirePart( material, parameters, textures, texture_count, vertex_count, triangle_count )
+		: new FApparanceGeometryPart( material, parameters, textures, texture_count, vertex_count, triangle_count );
 	m_Parts.Add( part );
 	return part;
 }
@@ -80,6 +118,7 @@ void FApparanceGeometry::AddObject(Apparance::ObjectID object_type, Apparance::I
 	m_Objects.Add(placement);
 }
 
+#if !APPARANCE_GEOMETRY_FLOAT_NATIVE
 /// <summary>
 /// in-place upcast of float vector array into double vector array
 /// NOTE: These arrays assumed contiguous and are filled in with float vectors by Apparance. To support the double vectors Unreal (5) needs we pretend they are float arrays for Apparance to fill in, then convert them in-place to double vectors
@@ -120,10 +159,12 @@ static void HandleDoublePromotion( TArray<FVector2D>& vector_array )
 		}
 	}
 }
+#endif
 
 // finished adding parts, carry out any finalising possible/needed
 void FApparanceGeometry::SealGeometry()
 {
+#if !APPARANCE_GEOMETRY_FLOAT_NATIVE
 	//promote float data to doubles if needed
 	for(int i = 0; i < m_Parts.Num(); i++)
 	{
@@ -135,6 +176,47 @@ void FApparanceGeometry::SealGeometry()
 			HandleDoublePromotion( m_Parts[i]->UVs[t] );
 		}
 	}
+#endif
+
+	//split large parts into spatial chunks for finer culling
+	//(split off into parts of our own, the engine's parts stay as it made them)
+	m_DrawParts = m_Parts;
+	if(m_pFactory && m_pFactory->GetChunkSize() > 0)
+	{
+		m_ChunkCount = ApparanceChunkGeometry( m_Parts, m_pFactory->GetChunkSize(), m_pFactory, m_ChunkParts );
+		if(m_ChunkParts.Num() > 0)
+		{
+			m_DrawParts.RemoveAll( []( const FApparanceGeometryPart* part ) { return part->IsSplit(); } );
+			m_DrawParts.Append( m_ChunkParts );
+		}
+	}
+
+	//vertex welding and cache ordering
+	if(m_pFactory && m_pFactory->GetOptimiseGeometry())
+	{
+		for(int i = 0; i < m_DrawParts.Num(); i++)
+		{
+			ApparanceOptimiseGeometryPart( m_DrawParts[i] );
+		}
+	}
+
+	//identify content so identical geometry can share render data
+	if(m_pFactory && m_pFactory->GetHashGeometry())
+	{
+		for(int i = 0; i < m_DrawParts.Num(); i++)
+		{
+			m_DrawParts[i]->CalculateContentHash();
+		}
+	}
+
+	//convert to unreal mesh data here on the synth thread, rather than later on the game thread
+	if(m_pFactory && m_pFactory->GetPrepareMeshSections())
+	{
+		for(int i = 0; i < m_DrawParts.Num(); i++)
+		{
+			m_DrawParts[i]->PrepareMeshSection();
+		}
+	}
 }
 
 
@@ -178,7 +260,26 @@ void FApparanceGeometry::GetExtents( FVector& out_min, FVector& out_max )
 
 FApparanceGeometryPart::FApparanceGeometryPart( Apparance::MaterialID material, Apparance::IParameterCollection* parameters, const Apparance::TextureID* textures, int texture_count, int vertex_count, int triangle_count )
 	: m_pEngineData( nullptr )
+	, m_bPreparedSectionValid( false )
+	, m_VertexCount( 0 )
+	, m_TriangleCount( 0 )
+	, m_ChunkIndex( 0 )
+	, m_bSplit( false )
+	, m_ContentHash( 0 )
+{
+	Init( material, parameters, textures, texture_count, vertex_count, triangle_count );
+}
+
+FApparanceGeometryPart::~FApparanceGeometryPart()
+{
+}
+
+// set up for new content
+//
+void FApparanceGeometryPart::Init( Apparance::MaterialID material, Apparance::IParameterCollection* parameters, const Apparance::TextureID* textures, int texture_count, int vertex_count, int triangle_count )
 {
+	m_VertexCount = vertex_count;
+	m_TriangleCount = triangle_count;
 	Material = material;
 	Parameters = nullptr;
 	if(parameters)
@@ -192,20 +293,213 @@ FApparanceGeometryPart::FApparanceGeometryPart( Apparance::MaterialID material,
 		Textures.Add( textures[i] );
 	}
 
-	Positions.SetNumZeroed( vertex_count );
-	Normals.SetNumZeroed( vertex_count );
-	Tangents.SetNumZeroed( vertex_count );
-	Colours.SetNumZeroed( vertex_count );
-	for (int i = 0; i < ApparanceGeometry_MaxTextureChannels; i++)
+	//NOTE: geometry channels are allocated on demand, see EnsureChannel
+}
+
+// release content, keeping channel allocations for reuse
+//
+void FApparanceGeometryPart::Reset()
+{
+	m_pEngineData = nullptr;
+	m_bPreparedSectionValid = false;
+	m_VertexCount = 0;
+	m_TriangleCount = 0;
+	m_ChunkIndex = 0;
+	m_bSplit = false;
+	m_ContentHash = 0;
+	Parameters = nullptr;
+	Textures.Reset();
+
+	Positions.Reset();
+	Normals.Reset();
+	Tangents.Reset();
+	Colours.Reset();
+	for(int i = 0; i < ApparanceGeometry_MaxTextureChannels; i++)
 	{
-		UVs[i].SetNumZeroed( vertex_count );
+		UVs[i].Reset();
 	}
+	Triangles.Reset();
+}
 
-	Triangles.SetNumZeroed( triangle_count * 3 );
+/// <summary>
+/// free a channel allocation if it's over the size limit
+/// </summary>
+template<typename T>
+static void TrimChannel( TArray<T>& channel, SIZE_T max_channel_bytes )
+{
+	if(channel.GetAllocatedSize() > max_channel_bytes)
+	{
+		channel.Empty();
+	}
 }
 
-FApparanceGeometryPart::~FApparanceGeometryPart()
+// memory held for reuse (after Reset)
+//
+SIZE_T FApparanceGeometryPart::GetAllocatedSize() const
 {
+	SIZE_T bytes = Positions.GetAllocatedSize() + Normals.GetAllocatedSize() + Tangents.GetAllocatedSize() + Colours.GetAllocatedSize() + Triangles.GetAllocatedSize();
+	for(int i = 0; i < ApparanceGeometry_MaxTextureChannels; i++)
+	{
+		bytes += UVs[i].GetAllocatedSize();
+	}
+	if(m_pPreparedSection)
+	{
+		bytes += m_pPreparedSection->ProcVertexBuffer.GetAllocatedSize() + m_pPreparedSection->ProcIndexBuffer.GetAllocatedSize();
+	}
+	return bytes;
+}
+
+// drop allocations from unusually large content, so recycled parts don't keep their largest ever buffers
+//
+void FApparanceGeometryPart::TrimAllocations( SIZE_T max_channel_bytes )
+{
+	TrimChannel( Positions, max_channel_bytes );
+	TrimChannel( Normals, max_channel_bytes );
+	TrimChannel( Tangents, max_channel_bytes );
+	TrimChannel( Colours, max_channel_bytes );
+	for(int i = 0; i < ApparanceGeometry_MaxTextureChannels; i++)
+	{
+		TrimChannel( UVs[i], max_channel_bytes );
+	}
+	TrimChannel( Triangles, max_channel_bytes );
+	if(m_pPreparedSection && m_pPreparedSection->ProcVertexBuffer.GetAllocatedSize() > max_channel_bytes)
+	{
+		m_pPreparedSection.Reset();
+	}
+}
+
+/// <summary>
+/// compact a channel according to a vertex remapping, see RemapVertices
+/// </summary>
+template<typename T>
+static void RemapChannel( TArray<T>& channel, const TArray<int32>& remap, int new_vertex_count )
+{
+	int next = 0;
+	for(int v = 0; v < remap.Num(); v++)
+	{
+		if(remap[v] == next)	//first occurrence
+		{
+			channel[next++] = channel[v];
+		}
+	}
+	channel.SetNum( new_vertex_count, false );
+}
+
+// rearrange vertices (e.g. after welding)
+//
+void FApparanceGeometryPart::RemapVertices( const TArray<int32>& remap, int new_vertex_count )
+{
+	check( remap.Num() == m_VertexCount );
+
+	//only channels that were written
+	if(HasPositions())
+	{
+		RemapChannel( Positions, remap, new_vertex_count );
+	}
+	if(HasNormals())
+	{
+		RemapChannel( Normals, remap, new_vertex_count );
+	}
+	if(HasTangents())
+	{
+		RemapChannel( Tangents, remap, new_vertex_count );
+	}
+	if(HasColours())
+	{
+		RemapChannel( Colours, remap, new_vertex_count );
+	}
+	for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+	{
+		if(HasTextureCoordinates( t ))
+		{
+			RemapChannel( UVs[t], remap, new_vertex_count );
+		}
+	}
+	m_VertexCount = new_vertex_count;
+
+	for(int i = 0; i < Triangles.Num(); i++)
+	{
+		Triangles[i] = remap[Triangles[i]];
+	}
+}
+
+// content has been split off into chunk parts, free our copy of it
+// NOTE: counts and bounds are left as the engine set them
+//
+void FApparanceGeometryPart::MarkSplit()
+{
+	m_bSplit = true;
+	m_bPreparedSectionValid = false;
+	Positions.Empty();
+	Normals.Empty();
+	Tangents.Empty();
+	Colours.Empty();
+	for(int i = 0; i < ApparanceGeometry_MaxTextureChannels; i++)
+	{
+		UVs[i].Empty();
+	}
+	Triangles.Empty();
+}
+
+/// <summary>
+/// fold a channel into a running hash, absent channels hash differently to present ones
+/// </summary>
+template<typename T>
+static uint64 HashChannel( const TArray<T>& channel, bool present, uint64 hash )
+{
+	if(!present)
+	{
+		return CityHash128to64( Uint128_64( hash, 0 ) );
+	}
+	return CityHash64WithSeed( (const char*)channel.GetData(), channel.Num() * sizeof( T ), hash );
+}
+
+// hash of everything that ends up in the vertex/index buffers
+// NOTE: appearance (material/parameters) is not included, render data is shared regardless
+//
+void FApparanceGeometryPart::CalculateContentHash()
+{
+	uint64 hash = CityHash128to64( Uint128_64( m_VertexCount, m_TriangleCount ) );
+	hash = HashChannel( Positions, HasPositions(), hash );
+	hash = HashChannel( Normals, HasNormals(), hash );
+	hash = HashChannel( Tangents, HasTangents(), hash );
+	hash = HashChannel( Colours, HasColours(), hash );
+	for(int i = 0; i < ApparanceGeometry_MaxTextureChannels; i++)
+	{
+		hash = HashChannel( UVs[i], HasTextureCoordinates( i ), hash );
+	}
+	hash = HashChannel( Triangles, HasIndices(), hash );
+	m_ContentHash = hash ? hash : 1;	//0 reserved for 'not hashed'
+}
+
+// convert into unreal mesh section ready for use
+// NOTE: collision flag depends on material, so applied at mesh creation time
+//
+void FApparanceGeometryPart::PrepareMeshSection()
+{
+	if(!HasPositions() || !HasIndices())
+	{
+		return;
+	}
+	if(!m_pPreparedSection)
+	{
+		m_pPreparedSection = MakeUnique<FProcMeshSection>();
+	}
+	ApparanceBuildMeshSection( this, *m_pPreparedSection, false );
+	m_bPreparedSectionValid = true;
+}
+
+// hand prepared mesh section over (moved, not copied), part has none afterwards
+//
+bool FApparanceGeometryPart::TakePreparedSection( FProcMeshSection& section_out )
+{
+	if(!m_bPreparedSectionValid)
+	{
+		return false;
+	}
+	section_out = MoveTemp( *m_pPreparedSection );
+	m_bPreparedSectionValid = false;
+	return true;
 }
 
 Apparance::Parameter::Type FApparanceGeometryPart::GetPositionType() const
@@ -229,8 +523,22 @@ Apparance::Parameter::Type FApparanceGeometryPart::GetTextureCoordinateType( int
 	return Apparance::Parameter::Type::Vector2;
 }
 
+/// <summary>
+/// allocate a channel the first time the engine asks for it
+/// NOTE: channels the procedure never writes to are never requested, so cost nothing
+/// </summary>
+template<typename T>
+static void EnsureChannel( TArray<T>& channel, int count )
+{
+	if(channel.Num()!=count)
+	{
+		channel.SetNumZeroed( count );
+	}
+}
+
 Apparance::GeometryChannel FApparanceGeometryPart::GetPositions()
 {
+	EnsureChannel( Positions, m_VertexCount );
 	Apparance::GeometryChannel c;
 	c.Data = Positions.GetData();
 	c.Count = Positions.Num();
@@ -240,6 +548,7 @@ Apparance::GeometryChannel FApparanceGeometryPart::GetPositions()
 }
 Apparance::GeometryChannel FApparanceGeometryPart::GetNormals()
 {
+	EnsureChannel( Normals, m_VertexCount );
 	Apparance::GeometryChannel c;
 	c.Data = Normals.GetData();
 	c.Count = Normals.Num();
@@ -249,6 +558,7 @@ Apparance::GeometryChannel FApparanceGeometryPart::GetNormals()
 }
 Apparance::GeometryChannel FApparanceGeometryPart::GetTangents()
 {
+	EnsureChannel( Tangents, m_VertexCount );
 	Apparance::GeometryChannel c;
 	c.Data = Tangents.GetData();
 	c.Count = Tangents.Num();
@@ -258,6 +568,7 @@ Apparance::GeometryChannel FApparanceGeometryPart::GetTangents()
 }
 Apparance::GeometryChannel FApparanceGeometryPart::GetColours( int colour_channel_index )
 {
+	EnsureChannel( Colours, m_VertexCount );
 	Apparance::GeometryChannel c;
 	c.Data = Colours.GetData();
 	c.Count = Colours.Num();
@@ -267,16 +578,18 @@ Apparance::GeometryChannel FApparanceGeometryPart::GetColours( int colour_channe
 }
 Apparance::GeometryChannel FApparanceGeometryPart::GetTextureCoordinates( int texture_channel_index )
 {
+	EnsureChannel( UVs[texture_channel_index], m_VertexCount );
 	Apparance::GeometryChannel c;
 	c.Data = UVs[texture_channel_index].GetData();
 	c.Count = UVs[texture_channel_index].Num();
-	c.Size = sizeof(FVector2D);
+	c.Size = sizeof(Apparance::Vector2);
 	c.Span = UVs[texture_channel_index].GetTypeSize();
 	return c;
 }
 
 Apparance::GeometryChannel FApparanceGeometryPart::GetIndices()
 {
+	EnsureChannel( Triangles, m_TriangleCount * 3 );
 	Apparance::GeometryChannel c;
 	c.Data = Triangles.GetData();
 	c.Count = Triangles.Num();
@@ -16,10 +16,22 @@
 #include "Math/Vector.h"
 
 // module
+#include "ApparanceUnrealVersioning.h"
 #include "Utility/ApparanceConversion.h"
 
 const int ApparanceGeometry_MaxTextureChannels = 3;
 
+//store vertex data in the float form Apparance writes it in, rather than widening to double precision (UE5)
+#define APPARANCE_GEOMETRY_FLOAT_NATIVE 1
+
+#if APPARANCE_GEOMETRY_FLOAT_NATIVE && UE_VERSION_AT_LEAST(5,0,0)
+typedef FVector3f FApparanceGeometryVector;
+typedef FVector2f FApparanceGeometryVector2D;
+#else //double native, or pre-5.0 (already float)
+typedef FVector   FApparanceGeometryVector;
+typedef FVector2D FApparanceGeometryVector2D;
+#endif
+
 
 struct FApparancePlacement
 {
@@ -31,13 +43,20 @@ struct FApparancePlacement
 //
 class FApparanceGeometry : public Apparance::Host::IGeometry
 {
-	TArray<class FApparanceGeometryPart*> m_Parts;
+	TArray<class FApparanceGeometryPart*> m_Parts;		//as added by the engine
+	TArray<class FApparanceGeometryPart*> m_ChunkParts;	//what any parts spanning several chunks were split into (not seen by the engine)
+	TArray<class FApparanceGeometryPart*> m_DrawParts;	//engine parts that weren't split, and chunk parts (once sealed)
 	TArray<FApparancePlacement>           m_Objects;
+	struct FGeometryFactory*              m_pFactory;	//source of pooled parts (optional)
+	int                                   m_ChunkCount;	//spatial chunks parts are spread over
 
 public:
-	FApparanceGeometry();
+	FApparanceGeometry( struct FGeometryFactory* pfactory=nullptr );
 	virtual ~FApparanceGeometry();
 
+	//pooling, release all content ready for reuse
+	void Reset();
+
 	//~ Begin Apparance IGeometry Interface
 	virtual int GetVertexLimit() const override;
 	virtual int GetIndexLimit() const override;
@@ -53,8 +72,9 @@ public:
 	//~ End Apparance IGeometry Interface
 
 	//access
-	const TArray<class FApparanceGeometryPart*>& GetParts() const { return m_Parts; }
+	const TArray<class FApparanceGeometryPart*>& GetParts() const { return m_DrawParts; }	//(parts to draw)
 	const TArray<FApparancePlacement>&           GetObjects() const { return m_Objects; }
+	int GetChunkCount() const { return m_ChunkCount; }
 	void GetExtents( FVector& out_min, FVector& out_max );
 };
 
@@ -65,6 +85,22 @@ class FApparanceGeometryPart : public Apparance::Host::IGeometryPart
 {
 	Apparance::IUnknownData* m_pEngineData;
 
+	//unreal mesh data, if converted ahead of time
+	TUniquePtr<struct FProcMeshSection> m_pPreparedSection;
+	bool                     m_bPreparedSectionValid;
+
+	//channels are only allocated when requested by the engine
+	int                      m_VertexCount;
+	int                      m_TriangleCount;
+
+	//spatial chunk of the geometry this part belongs to
+	int                      m_ChunkIndex;
+	//content was split between chunk parts (not drawn itself)
+	bool                     m_bSplit;
+
+	//hash of sealed geometry content, for sharing render data (0 if not calculated)
+	uint64                   m_ContentHash;
+
 public:
 	//appearance
 	Apparance::MaterialID    Material;
@@ -74,11 +110,11 @@ public:
 	FVector                  BoundsMax;
 
 	//geometry
-	TArray<FVector>          Positions;
-	TArray<FVector>          Normals;
-	TArray<FVector>          Tangents;
-	TArray<FLinearColor>     Colours;
-	TArray<FVector2D>        UVs[ApparanceGeometry_MaxTextureChannels];
+	TArray<FApparanceGeometryVector>   Positions;
+	TArray<FApparanceGeometryVector>   Normals;
+	TArray<FApparanceGeometryVector>   Tangents;
+	TArray<FLinearColor>               Colours;
+	TArray<FApparanceGeometryVector2D> UVs[ApparanceGeometry_MaxTextureChannels];
 
 	TArray<int32>            Triangles;
 
@@ -86,6 +122,13 @@ public:
 	FApparanceGeometryPart( Apparance::MaterialID material, Apparance::IParameterCollection* parameters, const Apparance::TextureID* textures, int texture_count, int vertex_count, int triangle_count );
 	virtual ~FApparanceGeometryPart();
 
+	//pooling, set up for new content/release content (channel allocations are kept)
+	void Init( Apparance::MaterialID material, Apparance::IParameterCollection* parameters, const Apparance::TextureID* textures, int texture_count, int vertex_count, int triangle_count );
+	void Reset();
+	//pooling, memory held by channel allocations, and freeing of any larger than limit
+	SIZE_T GetAllocatedSize() const;
+	void TrimAllocations( SIZE_T max_channel_bytes );
+
 	virtual Apparance::Parameter::Type GetPositionType() const override;
 	virtual Apparance::Parameter::Type GetNormalType() const override;
 	virtual Apparance::Parameter::Type GetTangentType() const override;
@@ -107,5 +150,32 @@ public:
 
 	//access
 	void GetExtents( FVector& out_min, FVector& out_max );
+	int GetVertexCount() const { return m_VertexCount; }
+	int GetTriangleCount() const { return m_TriangleCount; }
+	int GetChunkIndex() const { return m_ChunkIndex; }
+	void SetChunkIndex( int chunk_index ) { m_ChunkIndex = chunk_index; }
+
+	//channel presence (i.e. was it written by the engine)
+	bool HasPositions() const { return Positions.Num()==m_VertexCount && m_VertexCount>0; }
+	bool HasNormals() const { return Normals.Num()==m_VertexCount && m_VertexCount>0; }
+	bool HasTangents() const { return Tangents.Num()==m_VertexCount && m_VertexCount>0; }
+	bool HasColours() const { return Colours.Num()==m_VertexCount && m_VertexCount>0; }
+	bool HasTextureCoordinates( int texture_channel_index ) const { return UVs[texture_channel_index].Num()==m_VertexCount && m_VertexCount>0; }
+	bool HasIndices() const { return Triangles.Num()==m_TriangleCount*3 && m_TriangleCount>0; }
+
+	//rearrange vertex data, each vertex moves to remap[v] (remap[v]<=v, first occurrences ascending), triangles updated to match
+	void RemapVertices( const TArray<int32>& remap, int new_vertex_count );
+	//content now held by chunk parts, channels freed (counts and bounds kept, as the engine knows them)
+	void MarkSplit();
+	bool IsSplit() const { return m_bSplit; }
+
+	//content identity (synth thread)
+	void CalculateContentHash();
+	uint64 GetContentHash() const { return m_ContentHash; }
+
+	//ahead of time conversion (synth thread)
+	void PrepareMeshSection();
+	const struct FProcMeshSection* GetPreparedSection() const { return m_bPreparedSectionValid?m_pPreparedSection.Get():nullptr; }
+	bool TakePreparedSection( struct FProcMeshSection& section_out );
 };
 
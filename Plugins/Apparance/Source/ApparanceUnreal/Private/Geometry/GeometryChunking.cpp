@@ -0,0 +1,218 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_GeometryChunking 0
+#if APPARANCE_DEBUGGING_HELP_GeometryChunking
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "GeometryChunking.h"
+
+// unreal
+
+// module
+#include "ApparanceUnreal.h"
+#include "Geometry.h"
+#include "GeometryFactory.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_CYCLE_STAT( TEXT( "Chunk Geometry" ), STAT_ChunkGeometry, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Split Geometry Parts" ), STAT_SplitGeometryParts, STATGROUP_Apparance );
+
+
+/// <summary>
+/// linear index of the grid cell a point is in
+/// </summary>
+static int GetChunkCell( const FVector& point, const FVector& origin, const FIntVector& dims, float chunk_size )
+{
+	const int x = FMath::Clamp( FMath::FloorToInt( (point.X - origin.X) / chunk_size ), 0, dims.X - 1 );
+	const int y = FMath::Clamp( FMath::FloorToInt( (point.Y - origin.Y) / chunk_size ), 0, dims.Y - 1 );
+	const int z = FMath::Clamp( FMath::FloorToInt( (point.Z - origin.Z) / chunk_size ), 0, dims.Z - 1 );
+	return x + dims.X * (y + dims.Y * z);
+}
+
+/// <summary>
+/// copy the remapped subset of a vertex channel, if it was written
+/// </summary>
+template<typename T>
+static void ExtractChannel( const TArray<T>& source, TArray<T>& dest, const TArray<int32>& remap, int vertex_count, bool present )
+{
+	if(!present)
+	{
+		return;
+	}
+	dest.SetNumUninitialized( vertex_count );
+	for(int v = 0; v < remap.Num(); v++)
+	{
+		if(remap[v] >= 0)
+		{
+			dest[remap[v]] = source[v];
+		}
+	}
+}
+
+/// <summary>
+/// new part holding just some of the triangles of another (and the vertices they use)
+/// </summary>
+static FApparanceGeometryPart* ExtractTriangles( const FApparanceGeometryPart* part, const TArray<int32>& triangles, FGeometryFactory* pfactory, TArray<int32>& remap )
+{
+	//vertices used, in order of first use
+	remap.Init( -1, part->GetVertexCount() );
+	int vertex_count = 0;
+	for(int32 t : triangles)
+	{
+		for(int c = 0; c < 3; c++)
+		{
+			const int32 v = part->Triangles[t * 3 + c];
+			if(remap[v] < 0)
+			{
+				remap[v] = vertex_count++;
+			}
+		}
+	}
+
+	//same appearance, parameters shared as they are read only from here on
+	FApparanceGeometryPart* chunk = pfactory
+		? pfactory->AcquirePart( part->Material, nullptr, part->Textures.GetData(), part->Textures.Num(), vertex_count, triangles.Num() )
+		: new FApparanceGeometryPart( part->Material, nullptr, part->Textures.GetData(), part->Textures.Num(), vertex_count, triangles.Num() );
+	chunk->Parameters = part->Parameters;
+
+	//vertex data
+	ExtractChannel( part->Positions, chunk->Positions, remap, vertex_count, part->HasPositions() );
+	ExtractChannel( part->Normals, chunk->Normals, remap, vertex_count, part->HasNormals() );
+	ExtractChannel( part->Tangents, chunk->Tangents, remap, vertex_count, part->HasTangents() );
+	ExtractChannel( part->Colours, chunk->Colours, remap, vertex_count, part->HasColours() );
+	for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+	{
+		ExtractChannel( part->UVs[t], chunk->UVs[t], remap, vertex_count, part->HasTextureCoordinates( t ) );
+	}
+
+	//triangles
+	chunk->Triangles.SetNumUninitialized( triangles.Num() * 3 );
+	int32* pindices = chunk->Triangles.GetData();
+	for(int32 t : triangles)
+	{
+		*pindices++ = remap[part->Triangles[t * 3 + 0]];
+		*pindices++ = remap[part->Triangles[t * 3 + 1]];
+		*pindices++ = remap[part->Triangles[t * 3 + 2]];
+	}
+
+	//tight bounds
+	FBox bounds( ForceInit );
+	for(const FApparanceGeometryVector& p : chunk->Positions)
+	{
+		bounds += FVector( p );
+	}
+	chunk->SetBounds( Apparance::Vector3( (float)bounds.Min.X, (float)bounds.Min.Y, (float)bounds.Min.Z ), Apparance::Vector3( (float)bounds.Max.X, (float)bounds.Max.Y, (float)bounds.Max.Z ) );
+
+	return chunk;
+}
+
+// grid partitioning of geometry parts
+//
+int ApparanceChunkGeometry( const TArray<FApparanceGeometryPart*>& parts, float chunk_size, FGeometryFactory* pfactory, TArray<FApparanceGeometryPart*>& chunk_parts_out )
+{
+	SCOPE_CYCLE_COUNTER( STAT_ChunkGeometry );
+
+	//overall extent
+	FBox bounds( ForceInit );
+	for(const FApparanceGeometryPart* part : parts)
+	{
+		if(part->HasPositions())
+		{
+			for(const FApparanceGeometryVector& p : part->Positions)
+			{
+				bounds += FVector( p );
+			}
+		}
+	}
+
+	//small enough already?
+	const FVector extent = bounds.IsValid ? bounds.GetSize() : FVector::ZeroVector;
+	if(chunk_size <= 0 || extent.GetMax() <= chunk_size)
+	{
+		for(FApparanceGeometryPart* part : parts)
+		{
+			part->SetChunkIndex( 0 );
+		}
+		return 1;
+	}
+
+	//grid fitted to geometry
+	const FIntVector dims(
+		FMath::Max( 1, FMath::CeilToInt( extent.X / chunk_size ) ),
+		FMath::Max( 1, FMath::CeilToInt( extent.Y / chunk_size ) ),
+		FMath::Max( 1, FMath::CeilToInt( extent.Z / chunk_size ) ) );
+	TMap<int, int> cell_chunks;
+	auto get_chunk = [&cell_chunks]( int cell ) -> int
+	{
+		int* pchunk = cell_chunks.Find( cell );
+		return pchunk ? *pchunk : cell_chunks.Add( cell, cell_chunks.Num() );
+	};
+
+	//assign triangles to cells
+	const int num_parts = parts.Num();
+	TArray<int32> triangle_cells;
+	TMap<int, TArray<int32>> cell_triangles;
+	TArray<int32> remap;
+	for(int i = 0; i < num_parts; i++)
+	{
+		FApparanceGeometryPart* part = parts[i];
+		if(!part->HasPositions() || !part->HasIndices())
+		{
+			part->SetChunkIndex( 0 );
+			continue;
+		}
+
+		//cell of each triangle centroid
+		const int num_triangles = part->GetTriangleCount();
+		triangle_cells.SetNumUninitialized( num_triangles );
+		bool single_cell = true;
+		for(int t = 0; t < num_triangles; t++)
+		{
+			const FVector centroid = FVector( part->Positions[part->Triangles[t * 3 + 0]] + part->Positions[part->Triangles[t * 3 + 1]] + part->Positions[part->Triangles[t * 3 + 2]] ) / 3.0f;
+			triangle_cells[t] = GetChunkCell( centroid, bounds.Min, dims, chunk_size );
+			single_cell &= triangle_cells[t] == triangle_cells[0];
+		}
+
+		//all in one place?
+		if(single_cell)
+		{
+			part->SetChunkIndex( get_chunk( triangle_cells[0] ) );
+			continue;
+		}
+
+		//split by cell
+		cell_triangles.Reset();
+		for(int t = 0; t < num_triangles; t++)
+		{
+			cell_triangles.FindOrAdd( triangle_cells[t] ).Add( t );
+		}
+		for(const TPair<int, TArray<int32>>& cell : cell_triangles)
+		{
+			FApparanceGeometryPart* chunk = ExtractTriangles( part, cell.Value, pfactory, remap );
+			chunk->SetChunkIndex( get_chunk( cell.Key ) );
+			chunk_parts_out.Add( chunk );
+			INC_DWORD_STAT( STAT_SplitGeometryParts );
+		}
+
+		//original part stays as the engine knows it (count, bounds), but its content now lives in the chunks
+		part->MarkSplit();
+	}
+
+	return FMath::Max( 1, cell_chunks.Num() );
+}
+
+
+#if APPARANCE_DEBUGGING_HELP_GeometryChunking
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,28 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+
+// module
+
+
+/// <summary>
+/// partition the parts of a geometry into a spatial grid of chunks so each chunk can be culled separately
+/// parts spanning several grid cells are split into one new part per cell (by triangle centroid), others are just tagged with their cell's chunk
+/// NOTE: intended for use on the synth thread as geometry is sealed
+/// </summary>
+/// <param name="parts">geometry parts, any that are split are marked as such (and their content freed), but stay in place</param>
+/// <param name="chunk_size">grid cell size (Apparance units)</param>
+/// <param name="pfactory">source of new parts (optional)</param>
+/// <param name="chunk_parts_out">new parts split parts were divided into</param>
+/// <returns>number of chunks the geometry now occupies (1 if no split was needed)</returns>
+int ApparanceChunkGeometry( const TArray<class FApparanceGeometryPart*>& parts, float chunk_size, struct FGeometryFactory* pfactory, TArray<class FApparanceGeometryPart*>& chunk_parts_out );
@@ -0,0 +1,516 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_GeometryCollision 0
+#if APPARANCE_DEBUGGING_HELP_GeometryCollision
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "GeometryCollision.h"
+
+// unreal
+
+// module
+#include "ApparanceUnreal.h"
+#include "Geometry.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_CYCLE_STAT( TEXT( "Build Simple Collision" ), STAT_BuildSimpleCollision, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Simple Collision Hulls" ), STAT_SimpleCollisionHulls, STATGROUP_Apparance );
+DECLARE_CYCLE_STAT( TEXT( "Build Heightfield" ), STAT_BuildHeightfield, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Heightfields" ), STAT_Heightfields, STATGROUP_Apparance );
+
+//most samples taken along a triangle edge when voxelising
+#define APPARANCE_COLLISION_MAX_TRIANGLE_SAMPLES 64
+//thinnest a hull can be, flat parts (floors, walls) are padded to this so they still cook (Apparance units, i.e. 2cm)
+#define APPARANCE_COLLISION_MIN_THICKNESS 0.02f
+
+
+/// <summary>
+/// part position, in Unreal handedness
+/// </summary>
+static FORCEINLINE FVector GetPosition( const FApparanceGeometryPart* part, int v )
+{
+	const FApparanceGeometryVector& p = part->Positions[v];
+	return FVector( p.Y, p.X, p.Z );
+}
+
+/// <summary>
+/// the eight corners of a box as a hull, padded out to minimum thickness along any flat axis
+/// </summary>
+static void AddBoxHull( const FVector& min, const FVector& max, TArray<TArray<FVector>>& hulls_out )
+{
+	FVector padded_min = min;
+	FVector padded_max = max;
+	for(int a = 0; a < 3; a++)
+	{
+		const float pad = (APPARANCE_COLLISION_MIN_THICKNESS - (float)(max[a] - min[a])) * 0.5f;
+		if(pad > 0)
+		{
+			padded_min[a] -= pad;
+			padded_max[a] += pad;
+		}
+	}
+
+	TArray<FVector>& hull = hulls_out.AddDefaulted_GetRef();
+	hull.Reserve( 8 );
+	for(int c = 0; c < 8; c++)
+	{
+		hull.Add( FVector( (c & 1) ? padded_max.X : padded_min.X, (c & 2) ? padded_max.Y : padded_min.Y, (c & 4) ? padded_max.Z : padded_min.Z ) );
+	}
+}
+
+/// <summary>
+/// give a (nearly) planar hull minimum thickness, by extruding its points either side of its plane
+/// hulls without a plane (all points in a line or the same place) become a padded box
+/// </summary>
+static void ThickenHull( TArray<TArray<FVector>>& hulls_out )
+{
+	TArray<FVector>& hull = hulls_out.Last();
+
+	//plane through three well spread points
+	const FVector p0 = hull[0];
+	int i1 = 0;
+	for(int i = 1; i < hull.Num(); i++)
+	{
+		if(FVector::DistSquared( hull[i], p0 ) > FVector::DistSquared( hull[i1], p0 ))
+		{
+			i1 = i;
+		}
+	}
+	const FVector edge = hull[i1] - p0;
+	FVector normal = FVector::ZeroVector;
+	for(int i = 1; i < hull.Num(); i++)
+	{
+		const FVector n = FVector::CrossProduct( edge, hull[i] - p0 );
+		if(n.SizeSquared() > normal.SizeSquared())
+		{
+			normal = n;
+		}
+	}
+	if(!normal.Normalize())
+	{
+		const FBox bounds( hull.GetData(), hull.Num() );
+		hulls_out.Pop( false );
+		AddBoxHull( bounds.Min, bounds.Max, hulls_out );
+		return;
+	}
+
+	//thick enough already?
+	double min_dist = DBL_MAX;
+	double max_dist = -DBL_MAX;
+	for(const FVector& p : hull)
+	{
+		const double dist = FVector::DotProduct( p - p0, normal );
+		min_dist = FMath::Min( min_dist, dist );
+		max_dist = FMath::Max( max_dist, dist );
+	}
+	if(max_dist - min_dist >= APPARANCE_COLLISION_MIN_THICKNESS)
+	{
+		return;
+	}
+
+	//flatten onto mid plane and extrude both ways
+	const double mid_dist = (min_dist + max_dist) * 0.5;
+	const int num_points = hull.Num();
+	hull.Reserve( num_points * 2 );
+	for(int i = 0; i < num_points; i++)
+	{
+		const FVector on_plane = hull[i] - normal * (FVector::DotProduct( hull[i] - p0, normal ) - mid_dist);
+		hull[i] = on_plane + normal * (APPARANCE_COLLISION_MIN_THICKNESS * 0.5f);
+		hull.Add( on_plane - normal * (APPARANCE_COLLISION_MIN_THICKNESS * 0.5f) );
+	}
+}
+
+/// <summary>
+/// bounds of all part vertices
+/// </summary>
+static FBox CalcBounds( const FApparanceGeometryPart* part )
+{
+	FBox bounds( ForceInit );
+	const int num_v = part->GetVertexCount();
+	for(int v = 0; v < num_v; v++)
+	{
+		bounds += GetPosition( part, v );
+	}
+	return bounds;
+}
+
+/// <summary>
+/// single hull from the vertices furthest along each of the 26 axis, edge, and corner directions
+/// </summary>
+static void BuildConvexHull( const FApparanceGeometryPart* part, TArray<TArray<FVector>>& hulls_out )
+{
+	const int num_dirs = 26;
+	FVector dirs[num_dirs];
+	int d = 0;
+	for(int x = -1; x <= 1; x++)
+	{
+		for(int y = -1; y <= 1; y++)
+		{
+			for(int z = -1; z <= 1; z++)
+			{
+				if(x != 0 || y != 0 || z != 0)
+				{
+					dirs[d++] = FVector( x, y, z );
+				}
+			}
+		}
+	}
+
+	//support vertex per direction
+	int best_vertex[num_dirs];
+	double best_dist[num_dirs];
+	for(d = 0; d < num_dirs; d++)
+	{
+		best_vertex[d] = 0;
+		best_dist[d] = -DBL_MAX;
+	}
+	const int num_v = part->GetVertexCount();
+	for(int v = 0; v < num_v; v++)
+	{
+		const FVector p = GetPosition( part, v );
+		for(d = 0; d < num_dirs; d++)
+		{
+			const double dist = FVector::DotProduct( p, dirs[d] );
+			if(dist > best_dist[d])
+			{
+				best_dist[d] = dist;
+				best_vertex[d] = v;
+			}
+		}
+	}
+
+	//unique points
+	TArray<FVector>& hull = hulls_out.AddDefaulted_GetRef();
+	hull.Reserve( num_dirs );
+	for(d = 0; d < num_dirs; d++)
+	{
+		hull.AddUnique( GetPosition( part, best_vertex[d] ) );
+	}
+
+	//flat parts wouldn't cook
+	ThickenHull( hulls_out );
+}
+
+/// <summary>
+/// mark grid cells touched by the part's triangles (sampled across each triangle at under half a cell spacing) and merge them into boxes
+/// </summary>
+static void BuildVoxelHulls( const FApparanceGeometryPart* part, int resolution, TArray<TArray<FVector>>& hulls_out )
+{
+	const FBox bounds = CalcBounds( part );
+	const FVector size = bounds.GetSize();
+
+	//grid, flat axes get one cell
+	int cells[3];
+	FVector cell_size;
+	for(int a = 0; a < 3; a++)
+	{
+		cells[a] = size[a] > KINDA_SMALL_NUMBER ? resolution : 1;
+		cell_size[a] = FMath::Max( (float)(size[a] / cells[a]), KINDA_SMALL_NUMBER );
+	}
+	const float sample_spacing = FMath::Max( (float)cell_size.GetMin() * 0.5f, KINDA_SMALL_NUMBER );
+	TBitArray<> occupied( false, cells[0] * cells[1] * cells[2] );
+	auto CellIndex = [&]( int x, int y, int z ) { return x + (y + z * cells[1]) * cells[0]; };
+	auto MarkCell = [&]( const FVector& p )
+	{
+		const FVector local = (p - bounds.Min) / cell_size;
+		const int x = FMath::Clamp( FMath::FloorToInt( local.X ), 0, cells[0] - 1 );
+		const int y = FMath::Clamp( FMath::FloorToInt( local.Y ), 0, cells[1] - 1 );
+		const int z = FMath::Clamp( FMath::FloorToInt( local.Z ), 0, cells[2] - 1 );
+		occupied[CellIndex( x, y, z )] = true;
+	};
+
+	//rasterise
+	const int num_t = part->GetTriangleCount();
+	const int32* pindices = part->Triangles.GetData();
+	for(int t = 0; t < num_t; t++)
+	{
+		const FVector a = GetPosition( part, pindices[t * 3 + 0] );
+		const FVector b = GetPosition( part, pindices[t * 3 + 1] );
+		const FVector c = GetPosition( part, pindices[t * 3 + 2] );
+		const float longest = (float)FMath::Max3( FVector::Dist( a, b ), FVector::Dist( b, c ), FVector::Dist( c, a ) );
+		const int steps = FMath::Clamp( FMath::CeilToInt( longest / sample_spacing ), 1, APPARANCE_COLLISION_MAX_TRIANGLE_SAMPLES );
+		for(int i = 0; i <= steps; i++)
+		{
+			for(int j = 0; i + j <= steps; j++)
+			{
+				const float u = (float)i / steps;
+				const float v = (float)j / steps;
+				MarkCell( a + (b - a) * u + (c - a) * v );
+			}
+		}
+	}
+
+	//merge runs along X, then identical runs on following Y rows, into rectangles per layer
+	//then rectangles with the same footprint on following layers, into boxes
+	struct FVoxelBox
+	{
+		int Min[3];
+		int Max[3];	//exclusive
+	};
+	TArray<FVoxelBox> boxes;
+	TMap<uint64, int> open_boxes;		//by footprint, boxes reaching up to the current layer
+	TMap<uint64, int> next_open_boxes;
+	TBitArray<> used( false, occupied.Num() );
+	for(int z = 0; z < cells[2]; z++)
+	{
+		for(int y = 0; y < cells[1]; y++)
+		{
+			for(int x = 0; x < cells[0]; x++)
+			{
+				if(!occupied[CellIndex( x, y, z )] || used[CellIndex( x, y, z )])
+				{
+					continue;
+				}
+
+				//run length
+				int x_end = x + 1;
+				while(x_end < cells[0] && occupied[CellIndex( x_end, y, z )] && !used[CellIndex( x_end, y, z )])
+				{
+					x_end++;
+				}
+
+				//extend over rows
+				int y_end = y + 1;
+				while(y_end < cells[1])
+				{
+					bool row_matches = true;
+					for(int i = x; i < x_end && row_matches; i++)
+					{
+						row_matches = occupied[CellIndex( i, y_end, z )] && !used[CellIndex( i, y_end, z )];
+					}
+					if(!row_matches)
+					{
+						break;
+					}
+					y_end++;
+				}
+
+				//claim
+				for(int j = y; j < y_end; j++)
+				{
+					for(int i = x; i < x_end; i++)
+					{
+						used[CellIndex( i, j, z )] = true;
+					}
+				}
+
+				//extend box from layer below with same footprint, or start new one
+				const uint64 footprint = (uint64)x | ((uint64)x_end << 16) | ((uint64)y << 32) | ((uint64)y_end << 48);
+				const int* pbelow = open_boxes.Find( footprint );
+				if(pbelow)
+				{
+					boxes[*pbelow].Max[2] = z + 1;
+					next_open_boxes.Add( footprint, *pbelow );
+				}
+				else
+				{
+					FVoxelBox box = { { x, y, z }, { x_end, y_end, z + 1 } };
+					next_open_boxes.Add( footprint, boxes.Add( box ) );
+				}
+				x = x_end - 1;
+			}
+		}
+		Swap( open_boxes, next_open_boxes );
+		next_open_boxes.Reset();
+	}
+
+	//emit
+	for(const FVoxelBox& box : boxes)
+	{
+		const FVector box_min = bounds.Min + FVector( box.Min[0], box.Min[1], box.Min[2] ) * cell_size;
+		const FVector box_max = bounds.Min + FVector( box.Max[0], box.Max[1], box.Max[2] ) * cell_size;
+		AddBoxHull( box_min, box_max.ComponentMin( bounds.Max ), hulls_out );	//(flat axes padded)
+	}
+}
+
+// simple collision shapes for a part
+//
+int ApparanceBuildSimpleCollision( const FApparanceGeometryPart* part, EApparanceCollisionMode mode, int voxel_resolution, TArray<TArray<FVector>>& hulls_out )
+{
+	SCOPE_CYCLE_COUNTER( STAT_BuildSimpleCollision );
+
+	if(!part->HasPositions() || !part->HasIndices())
+	{
+		return 0;
+	}
+
+	const int start_count = hulls_out.Num();
+	switch(mode)
+	{
+		case EApparanceCollisionMode::Box:
+		{
+			const FBox bounds = CalcBounds( part );
+			AddBoxHull( bounds.Min, bounds.Max, hulls_out );
+			break;
+		}
+		case EApparanceCollisionMode::ConvexHull:
+			BuildConvexHull( part, hulls_out );
+			break;
+		case EApparanceCollisionMode::VoxelHulls:
+			BuildVoxelHulls( part, FMath::Max( voxel_resolution, 1 ), hulls_out );
+			break;
+		default:
+			break;
+	}
+
+	const int added = hulls_out.Num() - start_count;
+	INC_DWORD_STAT_BY( STAT_SimpleCollisionHulls, added );
+	return added;
+}
+
+/// <summary>
+/// count distinct, evenly spaced, coordinate values along an axis (0 if not evenly spaced)
+/// </summary>
+static int FindGridLines( const FApparanceGeometryPart* part, int axis, float tolerance, float& spacing_out )
+{
+	static TArray<float> coords;	//scratch, reused to avoid reallocation (game thread only)
+	const int num_v = part->GetVertexCount();
+	coords.SetNumUninitialized( num_v, false );
+	for(int v = 0; v < num_v; v++)
+	{
+		coords[v] = (float)GetPosition( part, v )[axis];
+	}
+	coords.Sort();
+
+	//distinct values
+	int count = 1;
+	for(int i = 1; i < num_v; i++)
+	{
+		count += (coords[i] - coords[i - 1]) > tolerance ? 1 : 0;
+	}
+	if(count < 2)
+	{
+		return 0;
+	}
+
+	//evenly spaced?
+	spacing_out = (coords.Last() - coords[0]) / (count - 1);
+	int line = 0;
+	for(int i = 1; i < num_v; i++)
+	{
+		if((coords[i] - coords[i - 1]) > tolerance)
+		{
+			line++;
+			if(FMath::Abs( coords[i] - (coords[0] + line * spacing_out) ) > tolerance)
+			{
+				return 0;
+			}
+		}
+	}
+	return count;
+}
+
+// height grid from part, if it is one
+//
+bool ApparanceBuildHeightfield( const FApparanceGeometryPart* part, FApparanceHeightfieldData& heightfield_out )
+{
+	SCOPE_CYCLE_COUNTER( STAT_BuildHeightfield );
+
+	if(!part->HasPositions() || !part->HasIndices())
+	{
+		return false;
+	}
+	const FBox bounds = CalcBounds( part );
+	const FVector size = bounds.GetSize();
+	const float tolerance = FMath::Max( (float)FMath::Max( size.X, size.Y ) * 0.0001f, KINDA_SMALL_NUMBER );
+
+	//grid layout
+	float spacing_x, spacing_y;
+	const int num_x = FindGridLines( part, 0, tolerance, spacing_x );
+	const int num_y = num_x ? FindGridLines( part, 1, tolerance, spacing_y ) : 0;
+	const int num_v = part->GetVertexCount();
+	const int num_t = part->GetTriangleCount();
+	if(num_x == 0 || num_y == 0 || num_x * num_y > num_v || num_t != (num_x - 1) * (num_y - 1) * 2)
+	{
+		return false;
+	}
+
+	//one height per grid point
+	static TArray<int32> vertex_grid_index;	//scratch, reused to avoid reallocation (game thread only)
+	vertex_grid_index.SetNumUninitialized( num_v, false );
+	heightfield_out.Heights.SetNumUninitialized( num_x * num_y );
+	TBitArray<> present( false, num_x * num_y );
+	for(int v = 0; v < num_v; v++)
+	{
+		const FVector p = GetPosition( part, v ) - bounds.Min;
+		const int x = FMath::RoundToInt( p.X / spacing_x );
+		const int y = FMath::RoundToInt( p.Y / spacing_y );
+		if(FMath::Abs( p.X - x * spacing_x ) > tolerance || FMath::Abs( p.Y - y * spacing_y ) > tolerance)
+		{
+			return false;
+		}
+		const int index = x + y * num_x;
+		if(present[index] && FMath::Abs( heightfield_out.Heights[index] - p.Z ) > tolerance)
+		{
+			return false;	//overhang/skirt
+		}
+		heightfield_out.Heights[index] = (float)p.Z;
+		present[index] = true;
+		vertex_grid_index[v] = index;
+	}
+	if(present.Find( false ) != INDEX_NONE)
+	{
+		return false;
+	}
+
+	//triangles only span a cell, and split it the way the physics heightfield does (from x,y to x+1,y+1), unless the cell is flat enough not to matter
+	const int32* pindices = part->Triangles.GetData();
+	for(int t = 0; t < num_t; t++)
+	{
+		int min_x = MAX_int32, max_x = MIN_int32, min_y = MAX_int32, max_y = MIN_int32;
+		for(int c = 0; c < 3; c++)
+		{
+			const int index = vertex_grid_index[pindices[t * 3 + c]];
+			min_x = FMath::Min( min_x, index % num_x );
+			max_x = FMath::Max( max_x, index % num_x );
+			min_y = FMath::Min( min_y, index / num_x );
+			max_y = FMath::Max( max_y, index / num_x );
+		}
+		if(max_x - min_x != 1 || max_y - min_y != 1)
+		{
+			return false;
+		}
+		const int index00 = min_x + min_y * num_x;
+		const int index11 = max_x + max_y * num_x;
+		bool on_diagonal[2] = { false, false };
+		for(int c = 0; c < 3; c++)
+		{
+			const int index = vertex_grid_index[pindices[t * 3 + c]];
+			on_diagonal[0] |= index == index00;
+			on_diagonal[1] |= index == index11;
+		}
+		if(!on_diagonal[0] || !on_diagonal[1])
+		{
+			const float* pheights = heightfield_out.Heights.GetData();
+			const float twist = pheights[index00] + pheights[index11] - pheights[index00 + 1] - pheights[index00 + num_x];
+			if(FMath::Abs( twist ) > tolerance)
+			{
+				return false;	//other diagonal, would collide differently to how it renders
+			}
+		}
+	}
+
+	heightfield_out.NumX = num_x;
+	heightfield_out.NumY = num_y;
+	heightfield_out.Origin = bounds.Min;
+	heightfield_out.SpacingX = spacing_x;
+	heightfield_out.SpacingY = spacing_y;
+	INC_DWORD_STAT( STAT_Heightfields );
+	return true;
+}
+
+
+#if APPARANCE_DEBUGGING_HELP_GeometryCollision
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,56 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+
+// module
+#include "ApparanceEngineSetup.h"
+
+
+/// <summary>
+/// regular grid of heights, X fastest, in Unreal handedness but Apparance scale
+/// </summary>
+struct FApparanceHeightfieldData
+{
+	int32         NumX = 0;					//grid points along X
+	int32         NumY = 0;					//grid points along Y
+	FVector       Origin = FVector::ZeroVector;	//first grid point, at zero height
+	float         SpacingX = 0;
+	float         SpacingY = 0;
+	TArray<float> Heights;					//NumX*NumY, above Origin
+};
+
+
+/// <summary>
+/// derive simple collision shapes for a generated geometry part, as convex point sets ready for the procedural mesh component
+/// Box: one hull, the part bounds
+/// ConvexHull: one hull, of the part's extreme points in a fixed set of directions (bounded point count, slightly inside the true hull)
+/// VoxelHulls: a box per run of occupied cells in a coarse grid over the part, merged in X, Y, and Z
+/// NOTE: flat parts get hulls padded to a minimum thickness, zero thickness hulls don't cook
+/// NOTE: points are in Unreal handedness but Apparance scale, like the mesh sections
+/// </summary>
+/// <param name="part">source geometry, in Apparance handedness</param>
+/// <param name="mode">kind of shapes to build (complex/none build nothing)</param>
+/// <param name="voxel_resolution">grid cells along each axis for voxel hulls</param>
+/// <param name="hulls_out">hulls are appended to this</param>
+/// <returns>number of hulls added</returns>
+int ApparanceBuildSimpleCollision( const class FApparanceGeometryPart* part, EApparanceCollisionMode mode, int voxel_resolution, TArray<TArray<FVector>>& hulls_out );
+
+/// <summary>
+/// detect whether a part is a regular height grid (evenly spaced in X and Y, one height per grid point, every cell filled) and extract its heights
+/// cells must be split into triangles along the same diagonal as the physics heightfield (unless flat), otherwise mesh collision is needed
+/// NOTE: game thread only (uses shared scratch space)
+/// </summary>
+/// <param name="part">source geometry, in Apparance handedness</param>
+/// <param name="heightfield_out">grid found</param>
+/// <returns>true if the part is a height grid</returns>
+bool ApparanceBuildHeightfield( const class FApparanceGeometryPart* part, FApparanceHeightfieldData& heightfield_out );
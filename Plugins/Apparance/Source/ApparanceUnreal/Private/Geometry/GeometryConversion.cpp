@@ -0,0 +1,454 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_GeometryConversion 0
+#if APPARANCE_DEBUGGING_HELP_GeometryConversion
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "GeometryConversion.h"
+
+// unreal
+#include "Math/VectorRegister.h"
+#include "ProceduralMeshComponent.h"
+#include "Misc/AutomationTest.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "Geometry.h"
+#include "ApparanceMeshComponent.h"
+
+
+//vector register type used for float sources (name changed in 5.0)
+#if UE_VERSION_AT_LEAST(5,0,0)
+typedef VectorRegister4Float FApparanceFloatRegister;
+#else
+typedef VectorRegister FApparanceFloatRegister;
+#endif
+
+
+/// <summary>
+/// load a source vector and swap X/Y into Unreal handedness, storing into Unreal vector type
+/// NOTE: widening to double (UE5) happens in register
+/// </summary>
+static FORCEINLINE void ConvertHandedness( const FApparanceGeometryVector& src, FVector& dst )
+{
+	auto v = VectorLoadFloat3( &src.X );
+	v = VectorSwizzle( v, 1, 0, 2, 3 );	//swap XY
+#if UE_VERSION_AT_LEAST(5,0,0)
+	VectorStoreFloat3( VectorRegister4Double( v ), &dst.X );
+#else
+	VectorStoreFloat3( v, &dst.X );
+#endif
+}
+
+/// <summary>
+/// quantise linear colour to bytes, equivalent to FLinearColor::QuantizeRound
+/// </summary>
+static FORCEINLINE void ConvertColour( const FLinearColor& src, FColor& dst, const FApparanceFloatRegister& scale, const FApparanceFloatRegister& round )
+{
+	FApparanceFloatRegister c = VectorLoad( &src.R );
+	c = VectorMin( VectorMax( c, VectorSetFloat1( 0.0f ) ), VectorSetFloat1( 1.0f ) );
+	c = VectorMultiplyAdd( c, scale, round );
+	c = VectorSwizzle( c, 2, 1, 0, 3 );	//RGBA to FColor BGRA memory order
+	VectorStoreByte4( c, &dst );			//truncates, hence rounding offset
+}
+
+
+// build procedural mesh section from part, all streams at once
+//
+void ApparanceBuildMeshSection( const FApparanceGeometryPart* part, FProcMeshSection& section, bool want_collision )
+{
+	const int num_v = part->GetVertexCount();
+	const bool has_normals = part->HasNormals();
+	const bool has_tangents = part->HasTangents();
+	const bool has_colours = part->HasColours();
+	const bool has_uv0 = part->HasTextureCoordinates( 0 );
+	const bool has_uv1 = part->HasTextureCoordinates( 1 );
+	const bool has_uv2 = part->HasTextureCoordinates( 2 );
+
+	//source streams
+	const FApparanceGeometryVector* positions = part->Positions.GetData();
+	const FApparanceGeometryVector* normals = part->Normals.GetData();
+	const FApparanceGeometryVector* tangents = part->Tangents.GetData();
+	const FLinearColor* colours = part->Colours.GetData();
+	const FApparanceGeometryVector2D* uv0 = part->UVs[0].GetData();
+	const FApparanceGeometryVector2D* uv1 = part->UVs[1].GetData();
+	const FApparanceGeometryVector2D* uv2 = part->UVs[2].GetData();
+
+	//PMC defaults for missing streams
+	const FVector default_normal( 0, 0, 1 );
+	const FProcMeshTangent default_tangent;
+	const FColor default_colour( 255, 255, 255 );
+	const FApparanceFloatRegister colour_scale = VectorSetFloat1( 255.0f );
+	const FApparanceFloatRegister colour_round = VectorSetFloat1( 0.5f );
+
+	//keeps allocation
+	section.ProcVertexBuffer.Reset();
+	section.ProcIndexBuffer.Reset();
+	section.SectionLocalBox.Init();
+	section.ProcVertexBuffer.AddUninitialized( num_v );
+
+	//single pass, every vertex field written exactly once
+	FVector bounds_min( MAX_flt );
+	FVector bounds_max( -MAX_flt );
+	FProcMeshVertex* pvertex = section.ProcVertexBuffer.GetData();
+	for(int v = 0; v < num_v; v++, pvertex++)
+	{
+		//3D space transform
+		ConvertHandedness( positions[v], pvertex->Position );
+		bounds_min = bounds_min.ComponentMin( pvertex->Position );
+		bounds_max = bounds_max.ComponentMax( pvertex->Position );
+		if(has_normals)
+		{
+			ConvertHandedness( normals[v], pvertex->Normal );
+		}
+		else
+		{
+			pvertex->Normal = default_normal;
+		}
+
+		//type conversions
+		if(has_tangents)
+		{
+			ConvertHandedness( tangents[v], pvertex->Tangent.TangentX );
+			pvertex->Tangent.bFlipTangentY = true;	//apparance maps bottom up?
+		}
+		else
+		{
+			pvertex->Tangent = default_tangent;
+		}
+		if(has_colours)
+		{
+			ConvertColour( colours[v], pvertex->Color, colour_scale, colour_round );
+		}
+		else
+		{
+			pvertex->Color = default_colour;
+		}
+		pvertex->UV0 = has_uv0 ? FVector2D( uv0[v] ) : FVector2D::ZeroVector;
+		pvertex->UV1 = has_uv1 ? FVector2D( uv1[v] ) : FVector2D::ZeroVector;
+		pvertex->UV2 = has_uv2 ? FVector2D( uv2[v] ) : FVector2D::ZeroVector;
+		pvertex->UV3 = pvertex->UV2;	//only three available
+	}
+	if(num_v > 0)
+	{
+		section.SectionLocalBox = FBox( bounds_min, bounds_max );
+	}
+
+	//indices
+	const int num_i = part->Triangles.Num();
+	section.ProcIndexBuffer.AddUninitialized( num_i );
+	FMemory::Memcpy( section.ProcIndexBuffer.GetData(), part->Triangles.GetData(), num_i * sizeof( uint32 ) );	//int32 to uint32, same bits
+
+	section.bEnableCollision = want_collision;
+	section.bSectionVisible = true;
+}
+
+
+// set component section by move
+//
+void ApparanceMoveMeshSection( UProceduralMeshComponent* pmc, int section_index, FProcMeshSection&& section )
+{
+	//slot, bounds, and render state set up by an empty stand-in (cheap copy), then the real data moved in
+	//(scene proxy is only recreated at end of frame, so sees the moved data)
+	FProcMeshSection stand_in;
+	stand_in.SectionLocalBox = section.SectionLocalBox;
+	stand_in.bEnableCollision = section.bEnableCollision;
+	stand_in.bSectionVisible = section.bSectionVisible;
+	pmc->SetProcMeshSection( section_index, stand_in );
+	*pmc->GetProcMeshSection( section_index ) = MoveTemp( section );
+}
+
+
+/// <summary>
+/// swap X/Y into Unreal handedness, staying float
+/// </summary>
+static FORCEINLINE FApparanceMeshVector SwapHandedness( const FApparanceGeometryVector& src )
+{
+	return FApparanceMeshVector( (float)src.Y, (float)src.X, (float)src.Z );
+}
+
+// build mesh component section streams from part, all streams at once
+//
+void ApparanceBuildMeshSectionData( const FApparanceGeometryPart* part, FApparanceMeshSectionData& section_data )
+{
+	const int num_v = part->GetVertexCount();
+	const bool has_normals = part->HasNormals();
+	const bool has_tangents = part->HasTangents();
+	const bool has_colours = part->HasColours();
+	bool has_uvs[ApparanceGeometry_MaxTextureChannels];
+	int num_uvs = 1;	//always at least one
+	for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+	{
+		has_uvs[t] = part->HasTextureCoordinates( t );
+		if(has_uvs[t])
+		{
+			num_uvs = t + 1;
+		}
+	}
+
+	//PMC defaults for missing streams
+	const FPackedNormal default_tangent_x( FApparanceMeshVector( 1, 0, 0 ) );
+	FPackedNormal default_tangent_z( FApparanceMeshVector( 0, 0, 1 ) );
+	default_tangent_z.Vector.W = 127;
+	const FApparanceMeshUV zero_uv( 0, 0 );
+
+	section_data.NumTexCoords = num_uvs;
+	section_data.Positions.SetNumUninitialized( num_v );
+	section_data.Tangents.SetNumUninitialized( num_v * 2 );
+	section_data.TexCoords.SetNumUninitialized( num_v * num_uvs );
+	section_data.Colours.Reset();
+	if(has_colours)
+	{
+		section_data.Colours.SetNumUninitialized( num_v );
+	}
+
+	//single pass
+	FApparanceMeshVector bounds_min( MAX_flt );
+	FApparanceMeshVector bounds_max( -MAX_flt );
+	FApparanceMeshVector* pposition = section_data.Positions.GetData();
+	FPackedNormal* ptangent = section_data.Tangents.GetData();
+	FApparanceMeshUV* puv = section_data.TexCoords.GetData();
+	for(int v = 0; v < num_v; v++)
+	{
+		//3D space transform
+		*pposition = SwapHandedness( part->Positions[v] );
+		bounds_min = bounds_min.ComponentMin( *pposition );
+		bounds_max = bounds_max.ComponentMax( *pposition );
+		pposition++;
+
+		//tangent basis
+		*ptangent++ = has_tangents ? FPackedNormal( SwapHandedness( part->Tangents[v] ) ) : default_tangent_x;
+		if(has_normals)
+		{
+			FPackedNormal normal( SwapHandedness( part->Normals[v] ) );
+			normal.Vector.W = has_tangents ? -127 : 127;	//apparance maps bottom up? (flip tangent Y)
+			*ptangent++ = normal;
+		}
+		else
+		{
+			*ptangent++ = default_tangent_z;
+		}
+
+		//type conversions
+		if(has_colours)
+		{
+			section_data.Colours[v] = part->Colours[v].QuantizeRound();
+		}
+		for(int t = 0; t < num_uvs; t++)
+		{
+			*puv++ = has_uvs[t] ? FApparanceMeshUV( part->UVs[t][v] ) : zero_uv;
+		}
+	}
+	section_data.Bounds = num_v > 0 ? FBox( FVector( bounds_min ), FVector( bounds_max ) ) : FBox( ForceInit );
+
+	//indices
+	const int num_i = part->Triangles.Num();
+	section_data.Indices.SetNumUninitialized( num_i );
+	FMemory::Memcpy( section_data.Indices.GetData(), part->Triangles.GetData(), num_i * sizeof( uint32 ) );	//int32 to uint32, same bits
+}
+
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/// <summary>
+/// the original per-stream conversion, kept for comparison
+/// separate passes for double promotion, handedness/tangents/colours, then copy into the section
+/// </summary>
+static void BuildMeshSection_PerStream( const FApparanceGeometryPart* part, FProcMeshSection& section, bool want_collision )
+{
+	int num_v = part->GetVertexCount();
+
+	//promotion pass
+	TArray<FVector> positions;
+	TArray<FVector> normals;
+	TArray<FVector2D> uvs[ApparanceGeometry_MaxTextureChannels];
+	positions.SetNumUninitialized( num_v );
+	normals.SetNumUninitialized( num_v );
+	for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+	{
+		uvs[t].SetNumUninitialized( num_v );
+	}
+	for(int v = 0; v < num_v; v++)
+	{
+		positions[v] = FVector( part->Positions[v] );
+		normals[v] = FVector( part->Normals[v] );
+	}
+	for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+	{
+		for(int v = 0; v < num_v; v++)
+		{
+			uvs[t][v] = FVector2D( part->UVs[t][v] );
+		}
+	}
+
+	//conversion pass
+	TArray<FColor> int_colours;
+	int_colours.AddZeroed( num_v );
+	TArray<FProcMeshTangent> tangents;
+	tangents.AddZeroed( num_v );
+	for(int v = 0; v < num_v; v++)
+	{
+		positions[v] = UNREALHANDEDNESS_FROM_APPARANCEHANDEDNESS( positions[v] );
+		normals[v] = UNREALHANDEDNESS_FROM_APPARANCEHANDEDNESS( normals[v] );
+		tangents[v].TangentX = UNREALHANDEDNESS_FROM_APPARANCEHANDEDNESS( part->Tangents[v] );
+		tangents[v].bFlipTangentY = true;
+		int_colours[v] = part->Colours[v].QuantizeRound();
+	}
+
+	//section copy pass (as CreateMeshSection)
+	section.Reset();
+	section.ProcVertexBuffer.AddUninitialized( num_v );
+	for(int v = 0; v < num_v; v++)
+	{
+		FProcMeshVertex& vertex = section.ProcVertexBuffer[v];
+		vertex.Position = positions[v];
+		vertex.Normal = normals[v];
+		vertex.UV0 = uvs[0][v];
+		vertex.UV1 = uvs[1][v];
+		vertex.UV2 = uvs[2][v];
+		vertex.UV3 = uvs[2][v];
+		vertex.Color = int_colours[v];
+		vertex.Tangent = tangents[v];
+		section.SectionLocalBox += vertex.Position;
+	}
+	section.ProcIndexBuffer.AddUninitialized( part->Triangles.Num() );
+	for(int i = 0; i < part->Triangles.Num(); i++)
+	{
+		section.ProcIndexBuffer[i] = part->Triangles[i];
+	}
+	section.bEnableCollision = want_collision;
+}
+
+/// <summary>
+/// fill out a synthetic part with all streams populated
+/// </summary>
+static FApparanceGeometryPart* CreateBenchmarkPart( int vertex_count, FRandomStream& random )
+{
+	int triangle_count = vertex_count / 3;
+	FApparanceGeometryPart* part = new FApparanceGeometryPart( 0, nullptr, nullptr, 0, vertex_count, triangle_count );
+
+	//request all channels, as the engine would
+	part->GetPositions();
+	part->GetNormals();
+	part->GetTangents();
+	part->GetColours( 0 );
+	for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+	{
+		part->GetTextureCoordinates( t );
+	}
+	part->GetIndices();
+
+	for(int v = 0; v < vertex_count; v++)
+	{
+		part->Positions[v] = FApparanceGeometryVector( random.GetUnitVector() * 1000.0f );
+		part->Normals[v] = FApparanceGeometryVector( random.GetUnitVector() );
+		part->Tangents[v] = FApparanceGeometryVector( random.GetUnitVector() );
+		part->Colours[v] = FLinearColor( random.GetFraction(), random.GetFraction(), random.GetFraction(), 1.0f );
+		for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+		{
+			part->UVs[t][v] = FApparanceGeometryVector2D( random.GetFraction(), random.GetFraction() );
+		}
+	}
+	for(int i = 0; i < triangle_count * 3; i++)
+	{
+		part->Triangles[i] = random.RandHelper( vertex_count );
+	}
+	return part;
+}
+
+/// <summary>
+/// fused conversion must produce exactly what the per-stream conversion did, over the same synthetic parts
+/// timings of both are reported for comparison
+/// </summary>
+IMPLEMENT_SIMPLE_AUTOMATION_TEST( FApparanceMeshConversionTest, "Apparance.Geometry.MeshConversion", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter )
+
+bool FApparanceMeshConversionTest::RunTest( const FString& Parameters )
+{
+	const int vertex_count = 30000;
+	const int iterations = 5;
+	FRandomStream random( 12345 );
+	FApparanceGeometryPart* part = CreateBenchmarkPart( vertex_count, random );
+
+	//per-stream (fresh section each time, as before)
+	double start_time = FPlatformTime::Seconds();
+	FProcMeshSection per_stream_section;
+	for(int i = 0; i < iterations; i++)
+	{
+		per_stream_section = FProcMeshSection();
+		BuildMeshSection_PerStream( part, per_stream_section, true );
+	}
+	double per_stream_time = FPlatformTime::Seconds() - start_time;
+
+	//fused (reused scratch section)
+	start_time = FPlatformTime::Seconds();
+	FProcMeshSection fused_section;
+	for(int i = 0; i < iterations; i++)
+	{
+		ApparanceBuildMeshSection( part, fused_section, true );
+	}
+	double fused_time = FPlatformTime::Seconds() - start_time;
+
+	//verify
+	TestEqual( TEXT( "Vertex count" ), fused_section.ProcVertexBuffer.Num(), per_stream_section.ProcVertexBuffer.Num() );
+	TestEqual( TEXT( "Index count" ), fused_section.ProcIndexBuffer.Num(), per_stream_section.ProcIndexBuffer.Num() );
+	TestTrue( TEXT( "Bounds" ), fused_section.SectionLocalBox.Min.Equals( per_stream_section.SectionLocalBox.Min ) && fused_section.SectionLocalBox.Max.Equals( per_stream_section.SectionLocalBox.Max ) );
+	TestEqual( TEXT( "Collision flag" ), fused_section.bEnableCollision, per_stream_section.bEnableCollision );
+	if(fused_section.ProcVertexBuffer.Num() == per_stream_section.ProcVertexBuffer.Num())
+	{
+		int mismatches = 0;
+		for(int v = 0; v < fused_section.ProcVertexBuffer.Num(); v++)
+		{
+			const FProcMeshVertex& a = per_stream_section.ProcVertexBuffer[v];
+			const FProcMeshVertex& b = fused_section.ProcVertexBuffer[v];
+			const bool colour_match =	//(multiply-add may round the other way exactly on a boundary)
+				FMath::Abs( (int)a.Color.R - (int)b.Color.R ) <= 1 && FMath::Abs( (int)a.Color.G - (int)b.Color.G ) <= 1 &&
+				FMath::Abs( (int)a.Color.B - (int)b.Color.B ) <= 1 && a.Color.A == b.Color.A;
+			if(!a.Position.Equals( b.Position ) || !a.Normal.Equals( b.Normal ) || !a.Tangent.TangentX.Equals( b.Tangent.TangentX ) || a.Tangent.bFlipTangentY != b.Tangent.bFlipTangentY
+				|| !colour_match || !a.UV0.Equals( b.UV0 ) || !a.UV1.Equals( b.UV1 ) || !a.UV2.Equals( b.UV2 ) || !a.UV3.Equals( b.UV3 ))
+			{
+				mismatches++;
+			}
+		}
+		TestEqual( TEXT( "Vertices differing between methods" ), mismatches, 0 );
+	}
+	if(fused_section.ProcIndexBuffer.Num() == per_stream_section.ProcIndexBuffer.Num())
+	{
+		TestTrue( TEXT( "Indices" ), FMemory::Memcmp( fused_section.ProcIndexBuffer.GetData(), per_stream_section.ProcIndexBuffer.GetData(), fused_section.ProcIndexBuffer.Num() * sizeof( uint32 ) ) == 0 );
+	}
+	delete part;
+
+	//missing streams get PMC defaults
+	FApparanceGeometryPart* sparse_part = new FApparanceGeometryPart( 0, nullptr, nullptr, 0, 3, 1 );
+	sparse_part->GetPositions();
+	sparse_part->GetIndices();
+	for(int v = 0; v < 3; v++)
+	{
+		sparse_part->Positions[v] = FApparanceGeometryVector( (float)v, 0.0f, 0.0f );
+		sparse_part->Triangles[v] = v;
+	}
+	ApparanceBuildMeshSection( sparse_part, fused_section, false );
+	TestEqual( TEXT( "Default normal" ), fused_section.ProcVertexBuffer[0].Normal, FVector( 0, 0, 1 ) );
+	TestEqual( TEXT( "Default colour" ), fused_section.ProcVertexBuffer[0].Color, FColor( 255, 255, 255 ) );
+	TestEqual( TEXT( "Handedness" ), fused_section.ProcVertexBuffer[1].Position, FVector( 0, 1, 0 ) );
+	delete sparse_part;
+
+	AddInfo( FString::Printf( TEXT( "per-stream: %.3fms per part, fused: %.3fms per part (x%.2f)" ),
+		per_stream_time * 1000.0 / iterations, fused_time * 1000.0 / iterations, fused_time > 0 ? per_stream_time / fused_time : 0.0 ) );
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
+
+
+#if APPARANCE_DEBUGGING_HELP_GeometryConversion
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,45 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+
+// module
+
+
+/// <summary>
+/// convert a generated geometry part into a procedural mesh section in a single streaming pass
+/// handedness swap, tangent setup and colour quantisation are done per vertex with vector ops straight into the section vertex buffer
+/// NOTE: section is reset, but its allocations are kept, pass in the same one to avoid reallocation
+/// NOTE: only converts streams actually written, any left empty get the PMC defaults
+/// </summary>
+/// <param name="part">source geometry, in Apparance handedness</param>
+/// <param name="section">destination section, in Unreal handedness</param>
+/// <param name="want_collision">collision flag for the section</param>
+void ApparanceBuildMeshSection( const class FApparanceGeometryPart* part, struct FProcMeshSection& section, bool want_collision );
+
+/// <summary>
+/// hand a mesh section over to a procedural mesh component without copying its buffers
+/// slot, bounds, and render state are updated as SetProcMeshSection would (collision still needs explicit update)
+/// </summary>
+/// <param name="pmc">component to set section of</param>
+/// <param name="section_index">section slot, added if needed</param>
+/// <param name="section">section data, moved from</param>
+void ApparanceMoveMeshSection( class UProceduralMeshComponent* pmc, int section_index, struct FProcMeshSection&& section );
+
+/// <summary>
+/// convert a generated geometry part into Apparance mesh component section data in a single streaming pass
+/// vertex data stays float and in the separate streams the GPU buffers use, ready to be moved into the component
+/// NOTE: only converts streams actually written, any left empty get the same defaults as the PMC
+/// </summary>
+/// <param name="part">source geometry, in Apparance handedness</param>
+/// <param name="section_data">destination streams, in Unreal handedness</param>
+void ApparanceBuildMeshSectionData( const class FApparanceGeometryPart* part, struct FApparanceMeshSectionData& section_data );
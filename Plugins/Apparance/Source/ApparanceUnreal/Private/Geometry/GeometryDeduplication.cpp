@@ -0,0 +1,161 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_GeometryDeduplication 0
+#if APPARANCE_DEBUGGING_HELP_GeometryDeduplication
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "GeometryDeduplication.h"
+
+// unreal
+#include "HAL/IConsoleManager.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "Geometry.h"
+#include "GeometryConversion.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Shared Geometry Hits" ), STAT_SharedGeometryHits, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Shared Geometry Misses" ), STAT_SharedGeometryMisses, STATGROUP_Apparance );
+
+//how many misses (new entries) between sweeps of dead entries
+#define GEOMETRY_DEDUPLICATION_PRUNE_INTERVAL 256
+
+
+//////////////////////////////////////////////////////////////////////////
+// FGeometryDeduplication
+
+FGeometryDeduplication::FGeometryDeduplication()
+	: m_MissesSincePrune( 0 )
+	, m_HitCount( 0 )
+	, m_MissCount( 0 )
+{
+}
+
+// find/create render data for a part
+//
+FApparanceMeshRenderDataPtr FGeometryDeduplication::Acquire( const FApparanceGeometryPart* part )
+{
+	const uint64 hash = part->GetContentHash();
+
+	//seen before?
+	if(hash != 0)
+	{
+		TWeakPtr<FApparanceMeshRenderData, ESPMode::ThreadSafe>* pentry = m_Entries.Find( hash );
+		if(pentry)
+		{
+			FApparanceMeshRenderDataPtr render_data = pentry->Pin();
+			//sanity check against hash collision
+			if(render_data.IsValid() && render_data->NumVertices == part->GetVertexCount() && render_data->NumIndices == part->GetTriangleCount() * 3)
+			{
+				m_HitCount++;
+				INC_DWORD_STAT( STAT_SharedGeometryHits );
+				return render_data;
+			}
+		}
+	}
+
+	//new
+	FApparanceMeshSectionData section_data;
+	ApparanceBuildMeshSectionData( part, section_data );
+	FApparanceMeshRenderDataPtr render_data = FApparanceMeshRenderData::Create( MoveTemp( section_data ), hash );
+	if(hash != 0)
+	{
+		m_MissCount++;
+		INC_DWORD_STAT( STAT_SharedGeometryMisses );
+		m_Entries.Add( hash, render_data );
+
+		//occasional tidy
+		if(++m_MissesSincePrune >= GEOMETRY_DEDUPLICATION_PRUNE_INTERVAL)
+		{
+			Prune();
+		}
+	}
+	return render_data;
+}
+
+// forget everything (render data lives on with its users)
+//
+void FGeometryDeduplication::Empty()
+{
+	m_Entries.Empty();
+	m_MissesSincePrune = 0;
+	m_HitCount = 0;
+	m_MissCount = 0;
+}
+
+// current sharing state
+//
+void FGeometryDeduplication::GetSharing( int& out_entries, int& out_users, SIZE_T& out_memory_used, SIZE_T& out_memory_saved ) const
+{
+	out_entries = 0;
+	out_users = 0;
+	out_memory_used = 0;
+	out_memory_saved = 0;
+	for(const TPair<uint64, TWeakPtr<FApparanceMeshRenderData, ESPMode::ThreadSafe>>& entry : m_Entries)
+	{
+		FApparanceMeshRenderDataPtr render_data = entry.Value.Pin();
+		if(render_data.IsValid() && render_data->GetUserCount() > 0)
+		{
+			out_entries++;
+			out_users += render_data->GetUserCount();
+			out_memory_used += render_data->ResourceSize;
+			out_memory_saved += render_data->ResourceSize * (render_data->GetUserCount() - 1);
+		}
+	}
+}
+
+// drop entries no longer in use
+//
+void FGeometryDeduplication::Prune()
+{
+	for(auto It = m_Entries.CreateIterator(); It; ++It)
+	{
+		if(!It.Value().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+	m_MissesSincePrune = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// reporting
+
+/// <summary>
+/// log hit rate and memory saved by render data sharing
+/// </summary>
+static void ReportGeometryDeduplication( const TArray<FString>& args )
+{
+	int entries, users;
+	SIZE_T memory_used, memory_saved;
+	g_ApparanceGeometryDeduplication.GetSharing( entries, users, memory_used, memory_saved );
+	const uint64 hits = g_ApparanceGeometryDeduplication.GetHitCount();
+	const uint64 misses = g_ApparanceGeometryDeduplication.GetMissCount();
+	const double hit_rate = (hits + misses) > 0 ? (double)hits / (double)(hits + misses) : 0.0;
+
+	UE_LOG( LogApparance, Display, TEXT( "Geometry deduplication: %llu hits, %llu misses (%.1f%% hit rate)" ), hits, misses, hit_rate * 100.0 );
+	UE_LOG( LogApparance, Display, TEXT( "  %i shared render data in use by %i sections, %.2f MB used, %.2f MB saved" ), entries, users, memory_used / (1024.0 * 1024.0), memory_saved / (1024.0 * 1024.0) );
+}
+
+static FAutoConsoleCommand GApparanceReportGeometryDeduplicationCommand(
+	TEXT( "Apparance.ReportGeometryDeduplication" ),
+	TEXT( "Log how much generated geometry render data is being shared: hit rate, and memory used and saved." ),
+	FConsoleCommandWithArgsDelegate::CreateStatic( &ReportGeometryDeduplication ) );
+
+
+#if APPARANCE_DEBUGGING_HELP_GeometryDeduplication
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,51 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+
+// module
+#include "ApparanceMeshComponent.h"
+
+
+// Shared render data for identical geometry
+// Parts with the same content hash (e.g. repeated modules across entities) share one set of GPU buffers, only their components differ
+// NOTE: game thread only, entries are weak so data goes away with the last component using it
+//
+class FGeometryDeduplication
+{
+	//live render data by content hash
+	TMap<uint64, TWeakPtr<FApparanceMeshRenderData, ESPMode::ThreadSafe>> m_Entries;
+	int m_MissesSincePrune;
+
+	//totals, for reporting
+	uint64 m_HitCount;
+	uint64 m_MissCount;
+
+public:
+	FGeometryDeduplication();
+
+	//render data for a part, shared if we have seen its content before (unhashed parts always get their own)
+	FApparanceMeshRenderDataPtr Acquire( const class FApparanceGeometryPart* part );
+
+	//drop tracking of all entries
+	void Empty();
+
+	//reporting
+	uint64 GetHitCount() const { return m_HitCount; }
+	uint64 GetMissCount() const { return m_MissCount; }
+	void GetSharing( int& out_entries, int& out_users, SIZE_T& out_memory_used, SIZE_T& out_memory_saved ) const;
+
+private:
+	void Prune();
+};
+
+extern FGeometryDeduplication g_ApparanceGeometryDeduplication;
@@ -10,6 +10,8 @@
 #include "GeometryFactory.h"
 
 // unreal
+#include "Misc/ScopeLock.h"
+#include "HAL/PlatformTLS.h"
 
 // module
 #include "ApparanceUnreal.h"
@@ -17,12 +19,121 @@
 #include "EntityRendering.h"
 
 
+// pool stats
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Geometry Pool Hits" ), STAT_GeometryPoolHits, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Geometry Pool Misses" ), STAT_GeometryPoolMisses, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Geometry Part Pool Hits" ), STAT_GeometryPartPoolHits, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Geometry Part Pool Misses" ), STAT_GeometryPartPoolMisses, STATGROUP_Apparance );
+DECLARE_DWORD_ACCUMULATOR_STAT( TEXT( "Pooled Geometry" ), STAT_PooledGeometry, STATGROUP_Apparance );
+DECLARE_DWORD_ACCUMULATOR_STAT( TEXT( "Pooled Geometry Parts" ), STAT_PooledGeometryParts, STATGROUP_Apparance );
+
 
 //////////////////////////////////////////////////////////////////////////
 // FGeometryFactory
 
 FGeometryFactory::FGeometryFactory()
+	: m_bPrepareMeshSections( false )
+	, m_bOptimiseGeometry( false )
+	, m_VertexLimit( MAX_int32 )
+	, m_IndexLimit( MAX_int32 )
+	, m_ChunkSize( 0 )
+	, m_bHashGeometry( false )
 {
+	m_ThreadPoolSlot = FPlatformTLS::AllocTlsSlot();
+}
+
+FGeometryFactory::~FGeometryFactory()
+{
+	//normally already emptied at module shutdown
+	for(auto pgeometry : m_GeometryPool)
+	{
+		delete pgeometry;
+	}
+	for(auto ppart : m_PartPool)
+	{
+		delete ppart;
+	}
+	for(FThreadPool* ppool : m_ThreadPools)
+	{
+		for(auto pgeometry : ppool->Geometry)
+		{
+			delete pgeometry;
+		}
+		for(auto ppart : ppool->Parts)
+		{
+			delete ppart;
+		}
+		delete ppool;
+	}
+	FPlatformTLS::FreeTlsSlot( m_ThreadPoolSlot );
+}
+
+// limit size of parts the engine will generate (0 or less is unlimited)
+//
+void FGeometryFactory::SetPartLimits( int vertex_limit, int index_limit )
+{
+	m_VertexLimit = vertex_limit > 0 ? vertex_limit : MAX_int32;
+	m_IndexLimit = index_limit > 0 ? index_limit : MAX_int32;
+}
+
+/// <summary>
+/// take from a thread pool, refilling it from the shared pool in a batch if it's empty
+/// </summary>
+template<typename T>
+static T* PopPooled( TArray<T*>& thread_pool, TArray<T*>& shared_pool, FCriticalSection& lock )
+{
+	if(thread_pool.Num() == 0)
+	{
+		FScopeLock scope( &lock );
+		const int batch = FMath::Min( shared_pool.Num(), GEOMETRY_POOL_THREAD_CAPACITY / 2 );
+		thread_pool.Append( shared_pool.GetData() + shared_pool.Num() - batch, batch );
+		shared_pool.RemoveAt( shared_pool.Num() - batch, batch, false );
+	}
+	return thread_pool.Num() > 0 ? thread_pool.Pop( false ) : nullptr;
+}
+
+/// <summary>
+/// keep in a thread pool, spilling half of it to the shared pool in a batch if it's full
+/// (e.g. geometry created on synthesis threads is destroyed on the game thread)
+/// </summary>
+template<typename T>
+static void PushPooled( T* pobject, TArray<T*>& thread_pool, TArray<T*>& shared_pool, FCriticalSection& lock )
+{
+	thread_pool.Push( pobject );
+	if(thread_pool.Num() > GEOMETRY_POOL_THREAD_CAPACITY)
+	{
+		const int batch = thread_pool.Num() / 2;
+		FScopeLock scope( &lock );
+		shared_pool.Append( thread_pool.GetData() + thread_pool.Num() - batch, batch );
+		thread_pool.RemoveAt( thread_pool.Num() - batch, batch, false );
+	}
+}
+
+/// <summary>
+/// track peak number in use
+/// NOTE: approximate under contention, only guides pool size
+/// </summary>
+static void UpdateHighWater( FThreadSafeCounter& high_water, int live_count )
+{
+	if(live_count > high_water.GetValue())
+	{
+		high_water.Set( live_count );
+	}
+}
+
+// this thread's pool, created on first use
+//
+FGeometryFactory::FThreadPool& FGeometryFactory::GetThreadPool()
+{
+	FThreadPool* ppool = (FThreadPool*)FPlatformTLS::GetTlsValue( m_ThreadPoolSlot );
+	if(!ppool)
+	{
+		ppool = new FThreadPool();
+		FPlatformTLS::SetTlsValue( m_ThreadPoolSlot, ppool );
+		FScopeLock lock( &m_PoolLock );
+		m_ThreadPools.Add( ppool );	//(kept until shutdown, even if thread ends)
+	}
+	return *ppool;
 }
 
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
@@ -31,14 +142,39 @@ extern bool Apparance_NotifyGeometryDestruction( struct Apparance::Host::IGeomet
 
 struct Apparance::Host::IGeometry* FGeometryFactory::CreateGeometry(int debug_request_version)
 {
-	return new FApparanceGeometry();
+	UpdateHighWater( m_LiveGeometryHighWater, m_LiveGeometryCount.Increment() );
+	FApparanceGeometry* pgeometry = PopPooled( GetThreadPool().Geometry, m_GeometryPool, m_PoolLock );
+	if(pgeometry)
+	{
+		m_PooledGeometryCount.Decrement();
+		INC_DWORD_STAT( STAT_GeometryPoolHits );
+		DEC_DWORD_STAT( STAT_PooledGeometry );
+		return pgeometry;
+	}
+	INC_DWORD_STAT( STAT_GeometryPoolMisses );
+	return new FApparanceGeometry( this );
 }
 void FGeometryFactory::DestroyGeometry( struct Apparance::Host::IGeometry* pgeometry )
 {
 #if TIMESLICE_GEOMETRY_ADD_REMOVE
 	Apparance_NotifyGeometryDestruction( pgeometry );
 #endif
-	delete pgeometry;
+	FApparanceGeometry* papparance_geometry = static_cast<FApparanceGeometry*>( pgeometry );
+
+	//parts back to pool first
+	papparance_geometry->Reset();
+
+	const int live_count = m_LiveGeometryCount.Decrement();
+	if(m_PooledGeometryCount.GetValue() + live_count < m_LiveGeometryHighWater.GetValue())
+	{
+		m_PooledGeometryCount.Increment();
+		PushPooled( papparance_geometry, GetThreadPool().Geometry, m_GeometryPool, m_PoolLock );
+		INC_DWORD_STAT( STAT_PooledGeometry );
+	}
+	else
+	{
+		delete papparance_geometry;
+	}
 }
 Apparance::MaterialID FGeometryFactory::GetDefaultTriangleMaterial()
 { 
@@ -48,3 +184,92 @@ Apparance::MaterialID FGeometryFactory::GetDefaultLineMaterial()
 { 
 	return Apparance::InvalidID; 
 }
+
+// recycled part if available, set up for the new content
+//
+FApparanceGeometryPart* FGeometryFactory::AcquirePart( Apparance::MaterialID material, Apparance::IParameterCollection* parameters, const Apparance::TextureID* textures, int texture_count, int vertex_count, int triangle_count )
+{
+	UpdateHighWater( m_LivePartHighWater, m_LivePartCount.Increment() );
+	FApparanceGeometryPart* ppart = PopPooled( GetThreadPool().Parts, m_PartPool, m_PoolLock );
+	if(ppart)
+	{
+		m_PooledPartCount.Decrement();
+		m_PooledPartBytes.Subtract( (int64)ppart->GetAllocatedSize() );
+		INC_DWORD_STAT( STAT_GeometryPartPoolHits );
+		DEC_DWORD_STAT( STAT_PooledGeometryParts );
+		ppart->Init( material, parameters, textures, texture_count, vertex_count, triangle_count );
+		return ppart;
+	}
+	INC_DWORD_STAT( STAT_GeometryPartPoolMisses );
+	return new FApparanceGeometryPart( material, parameters, textures, texture_count, vertex_count, triangle_count );
+}
+
+// return part to pool, keeping its channel allocations (within limits), unless we have more than we've ever needed or the pool memory budget is used up
+//
+void FGeometryFactory::ReleasePart( FApparanceGeometryPart* ppart )
+{
+	ppart->Reset();
+
+	const int live_count = m_LivePartCount.Decrement();
+	bool retain = m_PooledPartCount.GetValue() + live_count < m_LivePartHighWater.GetValue();
+	if(retain)
+	{
+		//don't hold on to unusually large allocations
+		ppart->TrimAllocations( GEOMETRY_POOL_PART_RETAIN_BYTES );
+		const int64 bytes = (int64)ppart->GetAllocatedSize();
+		retain = m_PooledPartBytes.Add( bytes ) + bytes <= GEOMETRY_POOL_MAX_BYTES;
+		if(!retain)
+		{
+			m_PooledPartBytes.Subtract( bytes );
+		}
+	}
+
+	if(retain)
+	{
+		m_PooledPartCount.Increment();
+		PushPooled( ppart, GetThreadPool().Parts, m_PartPool, m_PoolLock );
+		INC_DWORD_STAT( STAT_PooledGeometryParts );
+	}
+	else
+	{
+		delete ppart;
+	}
+}
+
+// free everything held for reuse
+// NOTE: synthesis must be stopped, thread pools are emptied from this thread
+//
+void FGeometryFactory::EmptyPools()
+{
+	TArray<FApparanceGeometry*> geometry_pool;
+	TArray<FApparanceGeometryPart*> part_pool;
+	{
+		FScopeLock lock( &m_PoolLock );
+		geometry_pool = MoveTemp( m_GeometryPool );
+		part_pool = MoveTemp( m_PartPool );
+		for(FThreadPool* ppool : m_ThreadPools)
+		{
+			geometry_pool.Append( ppool->Geometry );
+			part_pool.Append( ppool->Parts );
+			ppool->Geometry.Empty();
+			ppool->Parts.Empty();
+		}
+		m_LiveGeometryHighWater.Set( m_LiveGeometryCount.GetValue() );
+		m_LivePartHighWater.Set( m_LivePartCount.GetValue() );
+		m_PooledGeometryCount.Reset();
+		m_PooledPartCount.Reset();
+		m_PooledPartBytes.Reset();
+	}
+
+	//pooled geometry has no parts, safe to delete outside lock
+	for(auto pgeometry : geometry_pool)
+	{
+		delete pgeometry;
+	}
+	for(auto ppart : part_pool)
+	{
+		delete ppart;
+	}
+	SET_DWORD_STAT( STAT_PooledGeometry, 0 );
+	SET_DWORD_STAT( STAT_PooledGeometryParts, 0 );
+}
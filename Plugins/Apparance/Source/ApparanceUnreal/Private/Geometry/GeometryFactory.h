@@ -12,16 +12,75 @@
 // Apparance API
 #include "Apparance.h"
 
+// unreal
+#include "HAL/CriticalSection.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/ThreadSafeCounter64.h"
+
+//recycling limits
+#define GEOMETRY_POOL_THREAD_CAPACITY 64						//objects of each kind a thread keeps to itself before sharing
+#define GEOMETRY_POOL_PART_RETAIN_BYTES (1024*1024)				//largest channel allocation a recycled part keeps
+#define GEOMETRY_POOL_MAX_BYTES (64*1024*1024)					//total channel memory held by pooled parts
+
 
 // Source of new geometry
+// NOTE: geometry and parts are recycled, create/destroy are called from synthesis threads as well as the game thread
+// NOTE: each thread recycles through its own pool, only going to the shared (locked) pool in batches when it runs out or has too many
 //
 struct FGeometryFactory : public Apparance::Host::IGeometryFactory
 {
+	//recycled objects held by one thread
+	struct FThreadPool
+	{
+		TArray<class FApparanceGeometry*>     Geometry;
+		TArray<class FApparanceGeometryPart*> Parts;
+	};
+
 	// apparance
 
+	//convert to unreal mesh data on synth thread when sealed
+	bool m_bPrepareMeshSections;
+	//weld/reorder for vertex cache when sealed
+	bool m_bOptimiseGeometry;
+	//part size limits (MAX_int32 unlimited)
+	int m_VertexLimit;
+	int m_IndexLimit;
+	//spatial chunk grid size (Apparance units, 0 no chunking)
+	float m_ChunkSize;
+	//content hash parts when sealed, for render data sharing
+	bool m_bHashGeometry;
+
+	//recycling, per thread pools (TLS) in front of shared pool
+	uint32                                m_ThreadPoolSlot;
+	FCriticalSection                      m_PoolLock;	//shared pool and thread pool list
+	TArray<FThreadPool*>                  m_ThreadPools;
+	TArray<class FApparanceGeometry*>     m_GeometryPool;
+	TArray<class FApparanceGeometryPart*> m_PartPool;
+	//pool sizing, retain up to peak number in use at once, and parts up to a memory budget
+	FThreadSafeCounter                    m_LiveGeometryCount;
+	FThreadSafeCounter                    m_LiveGeometryHighWater;
+	FThreadSafeCounter                    m_PooledGeometryCount;
+	FThreadSafeCounter                    m_LivePartCount;
+	FThreadSafeCounter                    m_LivePartHighWater;
+	FThreadSafeCounter                    m_PooledPartCount;
+	FThreadSafeCounter64                  m_PooledPartBytes;
+
 public:
 	FGeometryFactory();
+	virtual ~FGeometryFactory();
 
+	//setup (game thread, before synthesis starts)
+	void SetPrepareMeshSections( bool enable ) { m_bPrepareMeshSections = enable; }
+	bool GetPrepareMeshSections() const { return m_bPrepareMeshSections; }
+	void SetOptimiseGeometry( bool enable ) { m_bOptimiseGeometry = enable; }
+	bool GetOptimiseGeometry() const { return m_bOptimiseGeometry; }
+	void SetPartLimits( int vertex_limit, int index_limit );
+	int GetVertexLimit() const { return m_VertexLimit; }
+	int GetIndexLimit() const { return m_IndexLimit; }
+	void SetChunkSize( float chunk_size ) { m_ChunkSize = chunk_size; }
+	float GetChunkSize() const { return m_ChunkSize; }
+	void SetHashGeometry( bool enable ) { m_bHashGeometry = enable; }
+	bool GetHashGeometry() const { return m_bHashGeometry; }
 
 	//~ Begin Apparance IGeometryFactory Interface
 	virtual struct Apparance::Host::IGeometry* CreateGeometry(int debug_request_version);
@@ -31,6 +90,13 @@ public:
 	virtual Apparance::MaterialID GetDefaultLineMaterial();
 	//~ End Apparance IGeometryFactory Interface
 
-	
+	//part recycling (any thread)
+	class FApparanceGeometryPart* AcquirePart( Apparance::MaterialID material, Apparance::IParameterCollection* parameters, const Apparance::TextureID* textures, int texture_count, int vertex_count, int triangle_count );
+	void ReleasePart( class FApparanceGeometryPart* ppart );
+
+	//release all pooled objects (synthesis stopped)
+	void EmptyPools();
 
+private:
+	FThreadPool& GetThreadPool();
 };
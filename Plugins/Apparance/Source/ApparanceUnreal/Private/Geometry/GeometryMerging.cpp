@@ -0,0 +1,428 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_GeometryMerging 0
+#if APPARANCE_DEBUGGING_HELP_GeometryMerging
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "GeometryMerging.h"
+
+// unreal
+#include "Materials/MaterialInterface.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "ApparanceEntity.h"
+#include "EntityRendering.h"
+#include "Geometry.h"
+#include "GeometryConversion.h"
+
+
+// profiler stats
+DECLARE_CYCLE_STAT( TEXT( "Merge Geometry" ), STAT_MergeGeometry, STATGROUP_Apparance );
+DECLARE_CYCLE_STAT( TEXT( "Rebuild Merged Sections" ), STAT_RebuildMergedSections, STATGROUP_Apparance );
+DECLARE_DWORD_ACCUMULATOR_STAT( TEXT( "Merged Sections" ), STAT_MergedSections, STATGROUP_Apparance );
+DECLARE_DWORD_ACCUMULATOR_STAT( TEXT( "Merged Components" ), STAT_MergedComponents, STATGROUP_Apparance );
+
+
+//////////////////////////////////////////////////////////////////////////
+// FMergedGeometry
+
+FMergedGeometry::FMergedGeometry( FEntityRendering* per )
+	: m_pEntityRendering( per )
+	, m_bDirty( false )
+{
+}
+
+FMergedGeometry::~FMergedGeometry()
+{
+	//components are owned by the actor, just the stats to account for
+	DEC_DWORD_STAT_BY( STAT_MergedSections, GetSectionCount() );
+	DEC_DWORD_STAT_BY( STAT_MergedComponents, GetComponentCount() );
+}
+
+// add the triangle geometry of a geometry id to the merged sections
+// returns true if any was added (applied to components on next flush)
+//
+bool FMergedGeometry::AddGeometry( int geometry_id, FApparanceGeometry* pgeometry, int tier_index, FVector unreal_offset )
+{
+	SCOPE_CYCLE_COUNTER( STAT_MergeGeometry );
+
+	//merged component sits at entity origin, parts are offset into its (apparance scale) space
+	const FVector component_offset = unreal_offset / UNREALSCALE_FROM_APPARANCESCALE3( FVector::OneVector );
+
+	FMergedTier& tier = m_Tiers.FindOrAdd( tier_index );
+	static FProcMeshSection scratch;	//conversion keeps its allocations, reused to avoid reallocation (game thread only)
+	bool added = false;
+
+	const TArray<class FApparanceGeometryPart*>& parts = pgeometry->GetParts();
+	for(int i = 0; i < parts.Num(); i++)
+	{
+		const FApparanceGeometryPart* part = parts[i];
+
+		//skip parts that were never populated
+		if(!part->HasPositions() || !part->HasIndices())
+		{
+			continue;
+		}
+
+		//host, created on first use
+		UProceduralMeshComponent* pcomponent = FindOrAddComponent( tier_index, tier );
+		if(!pcomponent)
+		{
+			break;
+		}
+
+		//material info
+		bool want_collision = false;
+		class UMaterialInterface* material_instance = m_pEntityRendering->GetMaterial( part->Material, part->Parameters, part->Textures, tier_index, &want_collision );
+
+		//find section to add to
+		const FMergedSectionKey key( material_instance, want_collision );
+		const int section_index = FindOrAddSection( tier, key );
+		FMergedSection& section = tier.Sections[section_index];
+		if(section_index >= pcomponent->GetNumSections())
+		{
+			pcomponent->SetProcMeshSection( section_index, FProcMeshSection() );	//(empty slot)
+		}
+		FProcMeshSection& buffer = *pcomponent->GetProcMeshSection( section_index );
+
+		//mesh data, either prepared on the synth thread or converted now
+		const FProcMeshSection* psource = part->GetPreparedSection();
+		if(!psource)
+		{
+			ApparanceBuildMeshSection( part, scratch, want_collision );
+			psource = &scratch;
+		}
+
+		//append to the section buffers, offset into component space
+		//(a geometry id's parts are added together, so its range is at the end if it already has one)
+		const int base_vertex = buffer.ProcVertexBuffer.Num();
+		FMergedRange* prange = section.Contributions.Find( geometry_id );
+		if(!prange || prange->VertexStart + prange->VertexCount != base_vertex || prange->IndexStart + prange->IndexCount != buffer.ProcIndexBuffer.Num())
+		{
+			prange = &section.Contributions.Add( geometry_id );
+			prange->VertexStart = base_vertex;
+			prange->IndexStart = buffer.ProcIndexBuffer.Num();
+		}
+		buffer.ProcVertexBuffer.Reserve( base_vertex + psource->ProcVertexBuffer.Num() );
+		for(const FProcMeshVertex& vertex : psource->ProcVertexBuffer)
+		{
+			FProcMeshVertex& v = buffer.ProcVertexBuffer.Add_GetRef( vertex );
+			v.Position += component_offset;
+		}
+		buffer.ProcIndexBuffer.Reserve( buffer.ProcIndexBuffer.Num() + psource->ProcIndexBuffer.Num() );
+		for(uint32 index : psource->ProcIndexBuffer)
+		{
+			buffer.ProcIndexBuffer.Add( index + base_vertex );
+		}
+		prange->VertexCount += psource->ProcVertexBuffer.Num();
+		prange->IndexCount += psource->ProcIndexBuffer.Num();
+		prange->Bounds += psource->SectionLocalBox.ShiftBy( component_offset );
+
+		//track
+		m_GeometrySections.FindOrAdd( geometry_id ).AddUnique( TPair<int, int>( tier_index, section_index ) );
+		section.bDirty = true;
+		tier.bDirty = true;
+		m_bDirty = true;
+		added = true;
+	}
+
+	return added;
+}
+
+// remove all contributions of a geometry id
+// returns true if it had any (applied to components on next flush)
+//
+bool FMergedGeometry::RemoveGeometry( int geometry_id )
+{
+	TArray<TPair<int, int>>* psections = m_GeometrySections.Find( geometry_id );
+	if(!psections)
+	{
+		return false;
+	}
+
+	for(const TPair<int, int>& tier_section : *psections)
+	{
+		FMergedTier* ptier = m_Tiers.Find( tier_section.Key );
+		if(ptier && ptier->Sections.IsValidIndex( tier_section.Value ))
+		{
+			FMergedSection& section = ptier->Sections[tier_section.Value];
+			if(section.Contributions.Remove( geometry_id ) != 0)
+			{
+				//gap closed up at flush, along with any others
+				section.bNeedsCompact = true;
+				section.bDirty = true;
+				ptier->bDirty = true;
+				m_bDirty = true;
+			}
+		}
+	}
+	m_GeometrySections.Remove( geometry_id );
+	return true;
+}
+
+// drop all merged content and components
+//
+void FMergedGeometry::Clear()
+{
+	DEC_DWORD_STAT_BY( STAT_MergedSections, GetSectionCount() );
+	DEC_DWORD_STAT_BY( STAT_MergedComponents, GetComponentCount() );
+
+	AApparanceEntity* pactor = m_pEntityRendering->GetActor();
+	for(TPair<int, FMergedTier>& tier_entry : m_Tiers)
+	{
+		UProceduralMeshComponent* pcomponent = tier_entry.Value.Component.Get();
+		if(pcomponent && pactor)
+		{
+			pactor->RemoveGeometry( pcomponent );
+		}
+	}
+	m_Tiers.Empty();
+	m_GeometrySections.Empty();
+	m_bDirty = false;
+}
+
+// apply any adds/removes since last flush to the components
+//
+void FMergedGeometry::Flush()
+{
+	if(!m_bDirty)
+	{
+		return;
+	}
+	m_bDirty = false;
+	SCOPE_CYCLE_COUNTER( STAT_RebuildMergedSections );
+
+	AApparanceEntity* pactor = m_pEntityRendering->GetActor();
+	if(!pactor)
+	{
+		return;
+	}
+
+	for(TPair<int, FMergedTier>& tier_entry : m_Tiers)
+	{
+		FMergedTier& tier = tier_entry.Value;
+		if(!tier.bDirty)
+		{
+			continue;
+		}
+		tier.bDirty = false;
+		UProceduralMeshComponent* pcomponent = tier.Component.Get();
+		if(!pcomponent)
+		{
+			tier = FMergedTier();
+			continue;
+		}
+
+		//update changed sections
+		bool collision_changed = false;
+		int active_sections = 0;
+		for(int s = 0; s < tier.Sections.Num(); s++)
+		{
+			FMergedSection& section = tier.Sections[s];
+			if(section.bDirty)
+			{
+				section.bDirty = false;
+				collision_changed |= section.Key.bCollision;
+				if(section.Contributions.Num() == 0)
+				{
+					//nothing left, retire section
+					pcomponent->ClearMeshSection( s );
+					tier.SectionLookup.Remove( section.Key );
+					tier.FreeSections.Add( s );
+					section = FMergedSection();
+					DEC_DWORD_STAT( STAT_MergedSections );
+					continue;
+				}
+				UpdateSection( pcomponent, s, section );
+			}
+			if(section.bActive)
+			{
+				active_sections++;
+			}
+		}
+
+		//SetProcMeshSection doesn't rebuild collision itself, clearing the (unused) convex elements does
+		//(whole component is re-cooked, so only when a collision section changed, and at most once per flush)
+		if(collision_changed)
+		{
+			pcomponent->ClearCollisionConvexMeshes();
+		}
+
+		//nothing left in tier?
+		if(active_sections == 0)
+		{
+			pactor->RemoveGeometry( pcomponent );
+			tier = FMergedTier();
+			DEC_DWORD_STAT( STAT_MergedComponents );
+		}
+	}
+}
+
+// number of sections in use
+//
+int FMergedGeometry::GetSectionCount() const
+{
+	int count = 0;
+	for(const TPair<int, FMergedTier>& tier_entry : m_Tiers)
+	{
+		count += tier_entry.Value.SectionLookup.Num();
+	}
+	return count;
+}
+
+// number of components hosting merged sections
+//
+int FMergedGeometry::GetComponentCount() const
+{
+	int count = 0;
+	for(const TPair<int, FMergedTier>& tier_entry : m_Tiers)
+	{
+		if(tier_entry.Value.Component.IsValid())
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+// component hosting a tier's merged sections, if any
+//
+UProceduralMeshComponent* FMergedGeometry::GetComponent( int tier_index ) const
+{
+	const FMergedTier* ptier = m_Tiers.Find( tier_index );
+	return ptier ? ptier->Component.Get() : nullptr;
+}
+
+// component hosting a tier, created on demand
+//
+UProceduralMeshComponent* FMergedGeometry::FindOrAddComponent( int tier_index, FMergedTier& tier )
+{
+	UProceduralMeshComponent* pcomponent = tier.Component.Get();
+	if(!pcomponent)
+	{
+		AApparanceEntity* pactor = m_pEntityRendering->GetActor();
+		if(!pactor)
+		{
+			return nullptr;
+		}
+		pcomponent = pactor->AddMergedGeometry( tier_index );
+		tier.Component = pcomponent;
+		m_pEntityRendering->ApplyDetailBlend( pcomponent, tier_index );
+		INC_DWORD_STAT( STAT_MergedComponents );
+	}
+	return pcomponent;
+}
+
+// section for a material, re-using retired section slots
+//
+int FMergedGeometry::FindOrAddSection( FMergedTier& tier, const FMergedSectionKey& key )
+{
+	int* pindex = tier.SectionLookup.Find( key );
+	if(pindex)
+	{
+		return *pindex;
+	}
+
+	int section_index;
+	if(tier.FreeSections.Num() > 0)
+	{
+		section_index = tier.FreeSections.Pop();
+	}
+	else
+	{
+		section_index = tier.Sections.AddDefaulted();
+	}
+	FMergedSection& section = tier.Sections[section_index];
+	section.Key = key;
+	section.bActive = true;
+	tier.SectionLookup.Add( key, section_index );
+	INC_DWORD_STAT( STAT_MergedSections );
+	return section_index;
+}
+
+// close up gaps left by removed contributions, in one pass over the buffers
+//
+void FMergedGeometry::CompactSection( FProcMeshSection& buffer, FMergedSection& section )
+{
+	//remaining contributions, in buffer order
+	TArray<FMergedRange*> ranges;
+	for(TPair<int, FMergedRange>& contribution : section.Contributions)
+	{
+		ranges.Add( &contribution.Value );
+	}
+	ranges.Sort( []( const FMergedRange& a, const FMergedRange& b ) { return a.VertexStart < b.VertexStart; } );
+
+	//slide each down to follow the previous
+	int next_vertex = 0;
+	int next_index = 0;
+	for(FMergedRange* prange : ranges)
+	{
+		const int vertex_shift = prange->VertexStart - next_vertex;
+		if(vertex_shift > 0)
+		{
+			FMemory::Memmove( &buffer.ProcVertexBuffer[next_vertex], &buffer.ProcVertexBuffer[prange->VertexStart], prange->VertexCount * sizeof( FProcMeshVertex ) );
+		}
+		if(vertex_shift > 0 || prange->IndexStart != next_index)
+		{
+			for(int i = 0; i < prange->IndexCount; i++)
+			{
+				buffer.ProcIndexBuffer[next_index + i] = buffer.ProcIndexBuffer[prange->IndexStart + i] - vertex_shift;
+			}
+		}
+		prange->VertexStart = next_vertex;
+		prange->IndexStart = next_index;
+		next_vertex += prange->VertexCount;
+		next_index += prange->IndexCount;
+	}
+	buffer.ProcVertexBuffer.SetNum( next_vertex, false );
+	buffer.ProcIndexBuffer.SetNum( next_index, false );
+	section.bNeedsCompact = false;
+}
+
+// apply changes to the section buffers to the component
+//
+void FMergedGeometry::UpdateSection( UProceduralMeshComponent* pcomponent, int section_index, FMergedSection& section )
+{
+	FProcMeshSection* pbuffer = pcomponent->GetProcMeshSection( section_index );
+	if(!pbuffer)
+	{
+		return;
+	}
+	if(section.bNeedsCompact)
+	{
+		CompactSection( *pbuffer, section );
+	}
+
+	//bounds of what's left
+	FBox bounds( ForceInit );
+	for(const TPair<int, FMergedRange>& contribution : section.Contributions)
+	{
+		bounds += contribution.Value.Bounds;
+	}
+
+	//collision only sections aren't drawn
+	UMaterialInterface* material = section.Key.Material.Get();
+	pbuffer->SectionLocalBox = bounds;
+	pbuffer->bEnableCollision = section.Key.bCollision;
+	pbuffer->bSectionVisible = material || !section.Key.bCollision;
+
+	//re-submit (moved out and back in, no copy) for bounds and render state update
+	FProcMeshSection buffer = MoveTemp( *pbuffer );
+	ApparanceMoveMeshSection( pcomponent, section_index, MoveTemp( buffer ) );
+	pcomponent->SetMaterial( section_index, material );
+}
+
+
+#if APPARANCE_DEBUGGING_HELP_GeometryMerging
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,146 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+#include "ProceduralMeshComponent.h"
+
+// module
+
+
+/// <summary>
+/// what parts can share a merged section
+/// </summary>
+struct FMergedSectionKey
+{
+	TWeakObjectPtr<class UMaterialInterface> Material;	//null for collision only
+	bool                                     bCollision;
+
+	FMergedSectionKey()
+		: bCollision( false )
+	{}
+	FMergedSectionKey( class UMaterialInterface* material, bool collision )
+		: Material( material )
+		, bCollision( collision )
+	{}
+
+	bool operator==( const FMergedSectionKey& other ) const
+	{
+		return Material == other.Material && bCollision == other.bCollision;
+	}
+	friend uint32 GetTypeHash( const FMergedSectionKey& key )
+	{
+		return HashCombine( GetTypeHash( key.Material ), GetTypeHash( key.bCollision ) );
+	}
+};
+
+/// <summary>
+/// where the contribution of one geometry id sits in a merged section's buffers
+/// </summary>
+struct FMergedRange
+{
+	int VertexStart;
+	int VertexCount;
+	int IndexStart;
+	int IndexCount;
+	FBox Bounds;
+
+	FMergedRange()
+		: VertexStart( 0 )
+		, VertexCount( 0 )
+		, IndexStart( 0 )
+		, IndexCount( 0 )
+		, Bounds( ForceInit )
+	{}
+};
+
+/// <summary>
+/// one section of a merged component, built from the parts of any number of geometry ids
+/// the merged vertex/index buffers are the component's section itself, contributions are ranges of them
+/// </summary>
+struct FMergedSection
+{
+	FMergedSectionKey Key;
+	//contributing geometry, converted and offset into component space
+	TMap<int, FMergedRange> Contributions;
+	//changed since last flush
+	bool bDirty;
+	//has gaps left by removed contributions
+	bool bNeedsCompact;
+	//in use
+	bool bActive;
+
+	FMergedSection()
+		: bDirty( false )
+		, bNeedsCompact( false )
+		, bActive( false )
+	{}
+};
+
+/// <summary>
+/// merged sections of a single detail tier, hosted by one component
+/// </summary>
+struct FMergedTier
+{
+	TWeakObjectPtr<class UProceduralMeshComponent> Component;
+	//section array index is component section index
+	TArray<FMergedSection> Sections;
+	TMap<FMergedSectionKey, int> SectionLookup;
+	TArray<int> FreeSections;
+	bool bDirty;
+
+	FMergedTier()
+		: bDirty( false )
+	{}
+};
+
+
+/// <summary>
+/// Consolidates the triangle geometry of an entity so that parts with the same tier and material share one mesh section
+/// Contributions are appended straight onto the section buffers and tracked per geometry id, so removal only compacts the sections they were part of
+/// Changes are applied to components by Flush, once per tick, so building up content part by part doesn't re-upload/re-cook for every part
+/// </summary>
+class FMergedGeometry
+{
+	class FEntityRendering* m_pEntityRendering;
+
+	//by tier index
+	TMap<int, FMergedTier> m_Tiers;
+	//which sections each geometry id contributed to, (tier,section) pairs
+	TMap<int, TArray<TPair<int, int>>> m_GeometrySections;
+	//changes waiting for flush
+	bool m_bDirty;
+
+public:
+	FMergedGeometry( class FEntityRendering* per );
+	~FMergedGeometry();
+
+	//content
+	bool AddGeometry( int geometry_id, class FApparanceGeometry* pgeometry, int tier_index, FVector unreal_offset );
+	bool RemoveGeometry( int geometry_id );
+	void Clear();
+
+	//apply changes to components (render state, bounds, collision)
+	void Flush();
+	bool IsDirty() const { return m_bDirty; }
+
+	//info
+	bool HasGeometry( int geometry_id ) const { return m_GeometrySections.Contains( geometry_id ); }
+	int GetSectionCount() const;
+	int GetComponentCount() const;
+	class UProceduralMeshComponent* GetComponent( int tier_index ) const;
+
+private:
+	class UProceduralMeshComponent* FindOrAddComponent( int tier_index, FMergedTier& tier );
+	int FindOrAddSection( FMergedTier& tier, const FMergedSectionKey& key );
+	void CompactSection( FProcMeshSection& buffer, FMergedSection& section );
+	void UpdateSection( class UProceduralMeshComponent* pcomponent, int section_index, FMergedSection& section );
+};
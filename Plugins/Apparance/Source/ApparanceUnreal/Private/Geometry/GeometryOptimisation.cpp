@@ -0,0 +1,482 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_GeometryOptimisation 0
+#if APPARANCE_DEBUGGING_HELP_GeometryOptimisation
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "GeometryOptimisation.h"
+
+// unreal
+#include "Misc/Crc.h"
+#include "Misc/AutomationTest.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "Geometry.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_CYCLE_STAT( TEXT( "OptimiseGeometry" ), STAT_OptimiseGeometry, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Welded Vertices" ), STAT_WeldedVertices, STATGROUP_Apparance );
+
+//vertex cache size the triangle ordering targets
+static const int ForsythCacheSize = 32;
+
+
+// both optimisation stages
+//
+void ApparanceOptimiseGeometryPart( FApparanceGeometryPart* part )
+{
+	if(!part->HasPositions() || !part->HasIndices())
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER( STAT_OptimiseGeometry );
+
+	int welded = ApparanceWeldVertices( part );
+	INC_DWORD_STAT_BY( STAT_WeldedVertices, welded );
+
+	ApparanceOptimiseVertexCache( part->Triangles, part->GetVertexCount() );
+}
+
+
+/// <summary>
+/// hash/compare helpers for a channel, skipped if not written
+/// </summary>
+template<typename T>
+static FORCEINLINE uint32 HashChannel( const TArray<T>& channel, bool present, int v, uint32 crc )
+{
+	return present ? FCrc::MemCrc32( &channel[v], sizeof( T ), crc ) : crc;
+}
+template<typename T>
+static FORCEINLINE bool MatchChannel( const TArray<T>& channel, bool present, int a, int b )
+{
+	return !present || FMemory::Memcmp( &channel[a], &channel[b], sizeof( T ) ) == 0;
+}
+
+// exact (bitwise) vertex welding, via open addressed hash table
+//
+int ApparanceWeldVertices( FApparanceGeometryPart* part )
+{
+	const int num_v = part->GetVertexCount();
+	if(num_v < 2)
+	{
+		return 0;
+	}
+	const bool has_positions = part->HasPositions();
+	const bool has_normals = part->HasNormals();
+	const bool has_tangents = part->HasTangents();
+	const bool has_colours = part->HasColours();
+	bool has_uvs[ApparanceGeometry_MaxTextureChannels];
+	for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+	{
+		has_uvs[t] = part->HasTextureCoordinates( t );
+	}
+
+	auto hash_vertex = [&]( int v ) -> uint32
+	{
+		uint32 crc = HashChannel( part->Positions, has_positions, v, 0 );
+		crc = HashChannel( part->Normals, has_normals, v, crc );
+		crc = HashChannel( part->Tangents, has_tangents, v, crc );
+		crc = HashChannel( part->Colours, has_colours, v, crc );
+		for(int t = 0; t < ApparanceGeometry_MaxTextureChannels; t++)
+		{
+			crc = HashChannel( part->UVs[t], has_uvs[t], v, crc );
+		}
+		return crc;
+	};
+	auto match_vertex = [&]( int a, int b ) -> bool
+	{
+		bool match = MatchChannel( part->Positions, has_positions, a, b )
+			&& MatchChannel( part->Normals, has_normals, a, b )
+			&& MatchChannel( part->Tangents, has_tangents, a, b )
+			&& MatchChannel( part->Colours, has_colours, a, b );
+		for(int t = 0; t < ApparanceGeometry_MaxTextureChannels && match; t++)
+		{
+			match = MatchChannel( part->UVs[t], has_uvs[t], a, b );
+		}
+		return match;
+	};
+
+	//table of first occurrence vertex indices
+	const uint32 table_size = FMath::RoundUpToPowerOfTwo( (uint32)num_v * 2 );
+	const uint32 table_mask = table_size - 1;
+	TArray<int32> table;
+	table.SetNumUninitialized( table_size );
+	FMemory::Memset( table.GetData(), 0xff, table_size * sizeof( int32 ) );	//-1
+
+	TArray<int32> remap;
+	remap.SetNumUninitialized( num_v );
+	int unique_count = 0;
+	for(int v = 0; v < num_v; v++)
+	{
+		uint32 slot = hash_vertex( v ) & table_mask;
+		while(true)
+		{
+			int32 existing = table[slot];
+			if(existing == -1)
+			{
+				//new
+				table[slot] = v;
+				remap[v] = unique_count++;
+				break;
+			}
+			if(match_vertex( existing, v ))
+			{
+				//duplicate
+				remap[v] = remap[existing];
+				break;
+			}
+			slot = (slot + 1) & table_mask;
+		}
+	}
+
+	int removed = num_v - unique_count;
+	if(removed > 0)
+	{
+		part->RemapVertices( remap, unique_count );
+	}
+	return removed;
+}
+
+
+/// <summary>
+/// Forsyth vertex score, favouring recently used vertices and those with few remaining triangles
+/// </summary>
+static FORCEINLINE float ForsythVertexScore( int cache_position, int remaining_valence )
+{
+	if(remaining_valence == 0)
+	{
+		return -1.0f;	//no triangles left to use it
+	}
+
+	float score = 0.0f;
+	if(cache_position >= 0)
+	{
+		if(cache_position < 3)
+		{
+			score = 0.75f;	//used by last triangle, fixed score so no preference within it
+		}
+		else
+		{
+			const float scaler = 1.0f / (ForsythCacheSize - 3);
+			score = FMath::Pow( 1.0f - (cache_position - 3) * scaler, 1.5f );
+		}
+	}
+
+	//boost vertices with few triangles left, gets rid of lone triangles
+	score += 2.0f * FMath::InvSqrt( (float)remaining_valence );
+	return score;
+}
+
+// greedy triangle ordering, always adding highest scoring triangle next
+//
+void ApparanceOptimiseVertexCache( TArray<int32>& triangles, int vertex_count )
+{
+	const int num_tris = triangles.Num() / 3;
+	if(num_tris < 2 || vertex_count <= 0)
+	{
+		return;
+	}
+
+	//per vertex triangle lists
+	TArray<int32> valence;
+	valence.SetNumZeroed( vertex_count );
+	for(int i = 0; i < num_tris * 3; i++)
+	{
+		valence[triangles[i]]++;
+	}
+	TArray<int32> adjacency_start;
+	adjacency_start.SetNumUninitialized( vertex_count + 1 );
+	adjacency_start[0] = 0;
+	for(int v = 0; v < vertex_count; v++)
+	{
+		adjacency_start[v + 1] = adjacency_start[v] + valence[v];
+	}
+	TArray<int32> adjacency;
+	adjacency.SetNumUninitialized( num_tris * 3 );
+	{
+		TArray<int32> fill( adjacency_start.GetData(), vertex_count );
+		for(int t = 0; t < num_tris; t++)
+		{
+			for(int k = 0; k < 3; k++)
+			{
+				int v = triangles[t * 3 + k];
+				adjacency[fill[v]++] = t;
+			}
+		}
+	}
+
+	//initial scores
+	TArray<int32> cache_position;
+	cache_position.Init( -1, vertex_count );
+	TArray<float> vertex_score;
+	vertex_score.SetNumUninitialized( vertex_count );
+	for(int v = 0; v < vertex_count; v++)
+	{
+		vertex_score[v] = ForsythVertexScore( -1, valence[v] );
+	}
+	TArray<float> triangle_score;
+	triangle_score.SetNumUninitialized( num_tris );
+	TArray<bool> triangle_added;
+	triangle_added.SetNumZeroed( num_tris );
+	int best_triangle = -1;
+	float best_score = -1.0f;
+	for(int t = 0; t < num_tris; t++)
+	{
+		triangle_score[t] = vertex_score[triangles[t * 3]] + vertex_score[triangles[t * 3 + 1]] + vertex_score[triangles[t * 3 + 2]];
+		if(triangle_score[t] > best_score)
+		{
+			best_score = triangle_score[t];
+			best_triangle = t;
+		}
+	}
+
+	//simulated LRU cache, with room for the overflow of one triangle
+	int cache[ForsythCacheSize + 3];
+	int cache_count = 0;
+	int scan_cursor = 0;
+	TArray<int32> output;
+	output.Reserve( num_tris * 3 );
+	for(int emitted = 0; emitted < num_tris; emitted++)
+	{
+		//nothing in the cache scores? fall back to next unused in original order
+		if(best_triangle < 0)
+		{
+			while(triangle_added[scan_cursor])
+			{
+				scan_cursor++;
+			}
+			best_triangle = scan_cursor;
+		}
+		triangle_added[best_triangle] = true;
+
+		//emit, triangle vertices go to front of cache
+		int new_cache[ForsythCacheSize + 3];
+		int new_count = 0;
+		const int32* tri = &triangles[best_triangle * 3];
+		for(int k = 0; k < 3; k++)
+		{
+			int v = tri[k];
+			output.Add( v );
+
+			//remove from vertex's remaining triangles
+			int start = adjacency_start[v];
+			int end = start + valence[v];
+			for(int a = start; a < end; a++)
+			{
+				if(adjacency[a] == best_triangle)
+				{
+					adjacency[a] = adjacency[end - 1];
+					break;
+				}
+			}
+			valence[v]--;
+
+			bool already = false;
+			for(int c = 0; c < new_count; c++)
+			{
+				already |= new_cache[c] == v;
+			}
+			if(!already)
+			{
+				new_cache[new_count++] = v;
+			}
+		}
+		for(int c = 0; c < cache_count; c++)
+		{
+			int v = cache[c];
+			if(v != tri[0] && v != tri[1] && v != tri[2])
+			{
+				new_cache[new_count++] = v;
+			}
+		}
+
+		//update vertex scores, including any just evicted
+		for(int c = 0; c < new_count; c++)
+		{
+			int v = new_cache[c];
+			cache_position[v] = c < ForsythCacheSize ? c : -1;
+			vertex_score[v] = ForsythVertexScore( cache_position[v], valence[v] );
+		}
+		cache_count = FMath::Min( new_count, ForsythCacheSize );
+		FMemory::Memcpy( cache, new_cache, cache_count * sizeof( int ) );
+
+		//rescore affected triangles, picking next best
+		best_triangle = -1;
+		best_score = -1.0f;
+		for(int c = 0; c < new_count; c++)
+		{
+			int v = new_cache[c];
+			int start = adjacency_start[v];
+			int end = start + valence[v];
+			for(int a = start; a < end; a++)
+			{
+				int t = adjacency[a];
+				float score = vertex_score[triangles[t * 3]] + vertex_score[triangles[t * 3 + 1]] + vertex_score[triangles[t * 3 + 2]];
+				triangle_score[t] = score;
+				if(score > best_score)
+				{
+					best_score = score;
+					best_triangle = t;
+				}
+			}
+		}
+	}
+
+	triangles = MoveTemp( output );
+}
+
+// simulate FIFO post-transform cache
+//
+float ApparanceCalculateACMR( const TArray<int32>& triangles, int vertex_count, int cache_size )
+{
+	const int num_tris = triangles.Num() / 3;
+	if(num_tris == 0)
+	{
+		return 0.0f;
+	}
+
+	//per vertex timestamp of entry into cache
+	TArray<int32> cache_entry_time;
+	cache_entry_time.Init( MIN_int32 / 2, vertex_count );
+	int misses = 0;
+	for(int i = 0; i < num_tris * 3; i++)
+	{
+		int v = triangles[i];
+		if(misses - cache_entry_time[v] >= cache_size)
+		{
+			cache_entry_time[v] = misses;
+			misses++;
+		}
+	}
+	return (float)misses / num_tris;
+}
+
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/// <summary>
+/// grid of quads as an unwelded triangle soup in shuffled order, typical of unoptimised generated output
+/// </summary>
+static FApparanceGeometryPart* CreateSyntheticGridPart( int quads_per_side, FRandomStream& random )
+{
+	int num_quads = quads_per_side * quads_per_side;
+	int num_tris = num_quads * 2;
+	int num_v = num_tris * 3;
+	FApparanceGeometryPart* part = new FApparanceGeometryPart( 0, nullptr, nullptr, 0, num_v, num_tris );
+	part->GetPositions();
+	part->GetNormals();
+	part->GetTextureCoordinates( 0 );
+	part->GetIndices();
+
+	//shuffled quad order
+	TArray<int32> quad_order;
+	quad_order.SetNumUninitialized( num_quads );
+	for(int q = 0; q < num_quads; q++)
+	{
+		quad_order[q] = q;
+	}
+	for(int q = num_quads - 1; q > 0; q--)
+	{
+		quad_order.Swap( q, random.RandHelper( q + 1 ) );
+	}
+
+	int v = 0;
+	for(int q = 0; q < num_quads; q++)
+	{
+		int x = quad_order[q] % quads_per_side;
+		int y = quad_order[q] / quads_per_side;
+		const int corners[6][2] = { {0,0}, {1,0}, {1,1}, {0,0}, {1,1}, {0,1} };
+		for(int c = 0; c < 6; c++, v++)
+		{
+			float px = (float)(x + corners[c][0]);
+			float py = (float)(y + corners[c][1]);
+			part->Positions[v] = FApparanceGeometryVector( px, py, 0.0f );
+			part->Normals[v] = FApparanceGeometryVector( 0.0f, 0.0f, 1.0f );
+			part->UVs[0][v] = FApparanceGeometryVector2D( px / quads_per_side, py / quads_per_side );
+			part->Triangles[v] = v;
+		}
+	}
+	return part;
+}
+
+/// <summary>
+/// triangles of a part as comparable corner data, sorted so triangle order doesn't matter
+/// </summary>
+static TArray<FString> GetTriangleCorners( const FApparanceGeometryPart* part )
+{
+	TArray<FString> corners;
+	for(int t = 0; t < part->GetTriangleCount(); t++)
+	{
+		FString triangle;
+		for(int k = 0; k < 3; k++)
+		{
+			const int v = part->Triangles[t * 3 + k];
+			triangle += FString::Printf( TEXT( "(%s|%s|%s)" ), *part->Positions[v].ToString(), *part->Normals[v].ToString(), *part->UVs[0][v].ToString() );
+		}
+		corners.Add( MoveTemp( triangle ) );
+	}
+	corners.Sort();
+	return corners;
+}
+
+/// <summary>
+/// welding and reordering a shuffled triangle soup grid must leave the same triangles, fully welded, with better cache efficiency
+/// ACMR at each stage is reported
+/// </summary>
+IMPLEMENT_SIMPLE_AUTOMATION_TEST( FApparanceGeometryOptimisationTest, "Apparance.Geometry.Optimisation", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter )
+
+bool FApparanceGeometryOptimisationTest::RunTest( const FString& Parameters )
+{
+	const int quads_per_side = 32;
+	const int cache_size = 16;
+	FRandomStream random( 12345 );
+	FApparanceGeometryPart* part = CreateSyntheticGridPart( quads_per_side, random );
+	const TArray<FString> original_corners = GetTriangleCorners( part );
+	const int original_triangles = part->GetTriangleCount();
+	const float original_acmr = ApparanceCalculateACMR( part->Triangles, part->GetVertexCount(), cache_size );
+
+	//weld, grid shares every corner
+	const int welded = ApparanceWeldVertices( part );
+	const int expected_vertices = (quads_per_side + 1) * (quads_per_side + 1);
+	TestEqual( TEXT( "Welded vertex count" ), part->GetVertexCount(), expected_vertices );
+	TestEqual( TEXT( "Vertices removed" ), welded, original_triangles * 3 - expected_vertices );
+	TestEqual( TEXT( "Positions channel" ), part->Positions.Num(), part->GetVertexCount() );
+	TestEqual( TEXT( "UV channel" ), part->UVs[0].Num(), part->GetVertexCount() );
+	TestTrue( TEXT( "Same triangles after welding" ), GetTriangleCorners( part ) == original_corners );
+	const float welded_acmr = ApparanceCalculateACMR( part->Triangles, part->GetVertexCount(), cache_size );
+
+	//reorder
+	ApparanceOptimiseVertexCache( part->Triangles, part->GetVertexCount() );
+	TestEqual( TEXT( "Triangle count" ), part->GetTriangleCount(), original_triangles );
+	TestTrue( TEXT( "Same triangles after reordering" ), GetTriangleCorners( part ) == original_corners );
+	const float optimised_acmr = ApparanceCalculateACMR( part->Triangles, part->GetVertexCount(), cache_size );
+	TestTrue( TEXT( "Welding improves cache efficiency" ), welded_acmr < original_acmr );
+	TestTrue( TEXT( "Reordering improves cache efficiency" ), optimised_acmr < welded_acmr );
+	TestTrue( TEXT( "Reordered grid ACMR under 1" ), optimised_acmr < 1.0f );
+
+	//already welded, nothing more to do
+	TestEqual( TEXT( "Welding is idempotent" ), ApparanceWeldVertices( part ), 0 );
+
+	AddInfo( FString::Printf( TEXT( "%ix%i grid ACMR: unwelded %.3f, welded %.3f, reordered %.3f" ), quads_per_side, quads_per_side, original_acmr, welded_acmr, optimised_acmr ) );
+	delete part;
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
+
+
+#if APPARANCE_DEBUGGING_HELP_GeometryOptimisation
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,38 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+
+// module
+
+
+/// <summary>
+/// weld exact duplicate vertices and reorder triangles for vertex cache locality
+/// NOTE: intended for use on the synth thread as geometry is sealed
+/// </summary>
+void ApparanceOptimiseGeometryPart( class FApparanceGeometryPart* part );
+
+/// <summary>
+/// merge vertices that are identical in every written channel
+/// </summary>
+/// <returns>number of vertices removed</returns>
+int ApparanceWeldVertices( class FApparanceGeometryPart* part );
+
+/// <summary>
+/// reorder triangle list for post-transform cache efficiency (Forsyth's linear-speed method)
+/// </summary>
+void ApparanceOptimiseVertexCache( TArray<int32>& triangles, int vertex_count );
+
+/// <summary>
+/// average cache miss ratio, transformed vertices per triangle for a simulated FIFO cache
+/// </summary>
+float ApparanceCalculateACMR( const TArray<int32>& triangles, int vertex_count, int cache_size = 16 );
@@ -0,0 +1,356 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_GeometryScheduler 0
+#if APPARANCE_DEBUGGING_HELP_GeometryScheduler
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "GeometryScheduler.h"
+
+// unreal
+#include "GameFramework/Actor.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "ApparanceEntity.h"
+#include "Geometry.h"
+#include "EntityRendering.h"
+#include "Utility/ApparanceConversion.h"
+
+
+// profiler stats
+DECLARE_CYCLE_STAT( TEXT( "Reprioritise Pending Geometry" ), STAT_ReprioritiseGeometry, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Pending Geometry" ), STAT_PendingGeometry, STATGROUP_Apparance );
+
+//smallest size content is treated as, so points/tiny geometry don't score as infinitely far
+#define GEOMETRY_SCHEDULER_MIN_RADIUS 100.0f
+//priority scaling per detail tier, coarser (lower) tiers are favoured as they fill gaps the finer tiers refine
+#define GEOMETRY_SCHEDULER_TIER_BIAS 0.25f
+//priority boost per second waiting, so far content isn't starved by a moving camera
+#define GEOMETRY_SCHEDULER_AGE_BOOST 0.5f
+
+
+//////////////////////////////////////////////////////////////////////////
+// FGeometryScheduler
+
+FGeometryScheduler::FGeometryScheduler()
+	: m_LiveCount( 0 )
+	, m_TombstoneCount( 0 )
+{
+}
+
+// queue a record, working out where its content will be
+//
+void FGeometryScheduler::Add( const FTimesliceRecord& record )
+{
+	//slot
+	int32 slot;
+	if(m_FreeSlots.Num() > 0)
+	{
+		slot = m_FreeSlots.Pop( false );
+	}
+	else
+	{
+		slot = m_Slots.AddDefaulted();
+	}
+	FSlot& s = m_Slots[slot];
+	s.Record = record;
+	s.State = ESlotState::Live;
+
+	//index
+	int32& head = m_EntityHeads.FindOrAdd( record.EntityRendering, INDEX_NONE );
+	s.EntityPrev = INDEX_NONE;
+	s.EntityNext = head;
+	if(head != INDEX_NONE)
+	{
+		m_Slots[head].EntityPrev = slot;
+	}
+	head = slot;
+	if(record.IsAdd)
+	{
+		m_GeometryIdSlots.Add( record.GeometryId, slot );
+		if(record.Geometry)
+		{
+			m_GeometrySlots.Add( record.Geometry, slot );
+		}
+	}
+
+	//placement
+	FTimesliceRecord& r = s.Record;
+	r.Centre = FVector::ZeroVector;
+	r.Radius = GEOMETRY_SCHEDULER_MIN_RADIUS;
+	AActor* pactor = r.EntityRendering ? r.EntityRendering->GetActor() : nullptr;
+	if(pactor)
+	{
+		FVector local_centre = UNREALSPACE_FROM_APPARANCESPACE( r.Offset );
+		if(r.IsAdd && r.Geometry && r.Geometry->GetPartCount() > 0)
+		{
+			FVector extent_min, extent_max;
+			((FApparanceGeometry*)r.Geometry)->GetExtents( extent_min, extent_max );
+			local_centre += (extent_min + extent_max) * 0.5f;
+			r.Radius = FMath::Max( (float)((extent_max - extent_min).Size() * 0.5f), GEOMETRY_SCHEDULER_MIN_RADIUS );
+		}
+		const FTransform& actor_transform = pactor->GetActorTransform();
+		r.Centre = actor_transform.TransformPosition( local_centre );
+		r.Radius *= (float)actor_transform.GetMaximumAxisScale();
+	}
+	r.QueueTime = FPlatformTime::Seconds();
+	CalcPriority( r, r.QueueTime );
+
+	//queue
+	m_Queue.HeapPush( slot, [this]( int32 a, int32 b ) { return m_Slots[a].Record.Priority < m_Slots[b].Record.Priority; } );
+	m_LiveCount++;
+	SET_DWORD_STAT( STAT_PendingGeometry, m_LiveCount );
+}
+
+// remove the most important record
+//
+bool FGeometryScheduler::Pop( FTimesliceRecord& record_out )
+{
+	while(m_Queue.Num() > 0)
+	{
+		int32 slot;
+		m_Queue.HeapPop( slot, [this]( int32 a, int32 b ) { return m_Slots[a].Record.Priority < m_Slots[b].Record.Priority; }, false );
+
+		//skip cancelled
+		if(m_Slots[slot].State == ESlotState::Tombstone)
+		{
+			m_TombstoneCount--;
+			Release( slot );
+			continue;
+		}
+
+		record_out = m_Slots[slot].Record;
+		Unlink( slot );
+		Release( slot );
+		m_LiveCount--;
+		SET_DWORD_STAT( STAT_PendingGeometry, m_LiveCount );
+		return true;
+	}
+	return false;
+}
+
+// rescore everything for the current views and restore heap order
+//
+void FGeometryScheduler::Reprioritise()
+{
+	SCOPE_CYCLE_COUNTER( STAT_ReprioritiseGeometry );
+	Compact();
+	if(m_Queue.Num() < 2)
+	{
+		return;
+	}
+	const double now = FPlatformTime::Seconds();
+	for(int32 slot : m_Queue)
+	{
+		CalcPriority( m_Slots[slot].Record, now );
+	}
+	Heapify();
+}
+
+// cancel all pending records for an entity
+//
+int FGeometryScheduler::RemoveEntity( FEntityRendering* per )
+{
+	const int32* phead = m_EntityHeads.Find( per );
+	if(!phead)
+	{
+		return 0;
+	}
+	int count = 0;
+	int32 slot = *phead;
+	while(slot != INDEX_NONE)
+	{
+		const int32 next = m_Slots[slot].EntityNext;
+		Cancel( slot );
+		slot = next;
+		count++;
+	}
+	return count;
+}
+
+// cancel a pending add, by the geometry id handed out for it
+//
+bool FGeometryScheduler::RemoveAdd( int geometry_id )
+{
+	const int32* pslot = m_GeometryIdSlots.Find( geometry_id );
+	if(!pslot)
+	{
+		return false;
+	}
+	Cancel( *pslot );
+	return true;
+}
+
+// cancel a pending add, by its geometry
+//
+bool FGeometryScheduler::RemoveAdd( Apparance::Host::IGeometry* pgeometry )
+{
+	const int32* pslot = m_GeometrySlots.Find( pgeometry );
+	if(!pslot)
+	{
+		return false;
+	}
+	Cancel( *pslot );
+	return true;
+}
+
+// any adds pending for a particular build of an entity?
+//
+bool FGeometryScheduler::HasAdds( FEntityRendering* per, int request_id ) const
+{
+	const int32* phead = m_EntityHeads.Find( per );
+	for(int32 slot = phead ? *phead : INDEX_NONE; slot != INDEX_NONE; slot = m_Slots[slot].EntityNext)
+	{
+		const FTimesliceRecord& r = m_Slots[slot].Record;
+		if(r.IsAdd && r.RequestId == request_id)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// drop everything
+//
+void FGeometryScheduler::Empty()
+{
+	m_Slots.Empty();
+	m_FreeSlots.Empty();
+	m_Queue.Empty();
+	m_EntityHeads.Empty();
+	m_GeometryIdSlots.Empty();
+	m_GeometrySlots.Empty();
+	m_LiveCount = 0;
+	m_TombstoneCount = 0;
+	SET_DWORD_STAT( STAT_PendingGeometry, 0 );
+}
+
+// how soon a record should be handled, roughly inverse of its size on screen, favouring coarse tiers and long waits
+//
+void FGeometryScheduler::CalcPriority( FTimesliceRecord& record, double now )
+{
+	//removals and orphaned records are cheap, get them out of the way
+	AApparanceEntity* pactor = record.EntityRendering ? record.EntityRendering->GetActor() : nullptr;
+	if(!record.IsAdd || !pactor || !pactor->GetWorld())
+	{
+		record.Priority = 0;
+		return;
+	}
+
+	//nearest view distance relative to content size
+	const float distance = FMath::Max( record.EntityRendering->GetViewDistance( record.Centre ) - record.Radius, 0.0f );
+	float priority = distance / record.Radius;
+
+	//tier and age
+	priority *= 1.0f + record.TierIndex * GEOMETRY_SCHEDULER_TIER_BIAS;
+	priority /= 1.0f + (float)(now - record.QueueTime) * GEOMETRY_SCHEDULER_AGE_BOOST;
+	record.Priority = priority;
+}
+
+// mark a live record as cancelled, it stays queued until popped or compacted
+//
+void FGeometryScheduler::Cancel( int32 slot )
+{
+	check( m_Slots[slot].State == ESlotState::Live );
+	Unlink( slot );
+	m_Slots[slot].State = ESlotState::Tombstone;
+	m_LiveCount--;
+	m_TombstoneCount++;
+	SET_DWORD_STAT( STAT_PendingGeometry, m_LiveCount );
+}
+
+// take a record out of the lookups
+//
+void FGeometryScheduler::Unlink( int32 slot )
+{
+	FSlot& s = m_Slots[slot];
+
+	//entity list
+	if(s.EntityPrev != INDEX_NONE)
+	{
+		m_Slots[s.EntityPrev].EntityNext = s.EntityNext;
+	}
+	else if(s.EntityNext != INDEX_NONE)
+	{
+		m_EntityHeads[s.Record.EntityRendering] = s.EntityNext;
+	}
+	else
+	{
+		m_EntityHeads.Remove( s.Record.EntityRendering );
+	}
+	if(s.EntityNext != INDEX_NONE)
+	{
+		m_Slots[s.EntityNext].EntityPrev = s.EntityPrev;
+	}
+	s.EntityPrev = INDEX_NONE;
+	s.EntityNext = INDEX_NONE;
+
+	//geometry
+	if(s.Record.IsAdd)
+	{
+		const int32* pslot = m_GeometryIdSlots.Find( s.Record.GeometryId );
+		if(pslot && *pslot == slot)
+		{
+			m_GeometryIdSlots.Remove( s.Record.GeometryId );
+		}
+		pslot = s.Record.Geometry ? m_GeometrySlots.Find( s.Record.Geometry ) : nullptr;
+		if(pslot && *pslot == slot)
+		{
+			m_GeometrySlots.Remove( s.Record.Geometry );
+		}
+	}
+}
+
+// slot available for reuse
+//
+void FGeometryScheduler::Release( int32 slot )
+{
+	m_Slots[slot].State = ESlotState::Free;
+	m_FreeSlots.Add( slot );
+}
+
+// drop tombstones from the queue (heap order needs restoring after)
+//
+void FGeometryScheduler::Compact()
+{
+	if(m_TombstoneCount == 0)
+	{
+		return;
+	}
+	int32 write = 0;
+	for(int32 read = 0; read < m_Queue.Num(); read++)
+	{
+		const int32 slot = m_Queue[read];
+		if(m_Slots[slot].State == ESlotState::Tombstone)
+		{
+			Release( slot );
+		}
+		else
+		{
+			m_Queue[write++] = slot;
+		}
+	}
+	m_Queue.SetNum( write, false );
+	m_TombstoneCount = 0;
+}
+
+// restore heap order after rescoring
+//
+void FGeometryScheduler::Heapify()
+{
+	m_Queue.Heapify( [this]( int32 a, int32 b ) { return m_Slots[a].Record.Priority < m_Slots[b].Record.Priority; } );
+}
+
+
+#if APPARANCE_DEBUGGING_HELP_GeometryScheduler
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,110 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+
+// apparance
+#include "Apparance.h"
+
+
+// Pending deferred geometry add/remove
+//
+struct FTimesliceRecord
+{
+	bool IsAdd;
+	//add/remove
+	class FEntityRendering* EntityRendering;
+	int  GeometryId;
+	//add
+	struct Apparance::Host::IGeometry* Geometry;
+	int TierIndex;
+	Apparance::Vector3 Offset;
+	int RequestId;
+
+	//scheduling
+	FVector Centre;			//world space
+	float   Radius;			//world space
+	double  QueueTime;		//when added
+	float   Priority;		//lower is sooner
+};
+
+
+// Timesliced geometry scheduler
+// Pending records are processed nearest/largest on screen first instead of in arrival order, so distant tiles can't hold up content near the camera
+// Records live in pooled slots and the queue is a heap of slot indices, reprioritising as the view moves is just a rescore and re-heapify
+// Records are indexed by entity and geometry, cancelled records are left in the heap as tombstones and skipped/compacted later, so cancellation is constant time
+// NOTE: game thread only
+//
+class FGeometryScheduler
+{
+	enum class ESlotState : uint8
+	{
+		Free,
+		Live,
+		Tombstone,	//cancelled, still in queue
+	};
+
+	struct FSlot
+	{
+		FTimesliceRecord Record;
+		ESlotState       State;
+		int32            EntityPrev;	//per-entity list links
+		int32            EntityNext;
+	};
+
+	//record storage, slots are reused
+	TArray<FSlot>  m_Slots;
+	TArray<int32>  m_FreeSlots;
+
+	//slots pending (including tombstones), heap ordered by priority
+	TArray<int32>  m_Queue;
+	int            m_LiveCount;
+	int            m_TombstoneCount;
+
+	//lookup
+	TMap<class FEntityRendering*, int32>              m_EntityHeads;		//first slot of each entity's list
+	TMap<int, int32>                                   m_GeometryIdSlots;	//adds by geometry id
+	TMap<struct Apparance::Host::IGeometry*, int32>    m_GeometrySlots;		//adds by geometry
+
+public:
+	FGeometryScheduler();
+
+	//state
+	bool IsEmpty() const { return m_LiveCount == 0; }
+	int Num() const { return m_LiveCount; }
+
+	//queue a record, scored immediately
+	void Add( const FTimesliceRecord& record );
+	//take the most important record
+	bool Pop( FTimesliceRecord& record_out );
+	//rescore all pending records against current view positions
+	void Reprioritise();
+
+	//cancellation
+	int  RemoveEntity( class FEntityRendering* per );
+	bool RemoveAdd( int geometry_id );
+	bool RemoveAdd( struct Apparance::Host::IGeometry* pgeometry );
+
+	//query
+	bool HasAdds( class FEntityRendering* per, int request_id ) const;
+
+	//drop everything
+	void Empty();
+
+private:
+	static void CalcPriority( FTimesliceRecord& record, double now );
+	void Cancel( int32 slot );
+	void Unlink( int32 slot );
+	void Release( int32 slot );
+	void Compact();
+	void Heapify();
+};
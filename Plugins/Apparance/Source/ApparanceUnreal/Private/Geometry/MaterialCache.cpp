@@ -0,0 +1,321 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_MaterialCache 0
+#if APPARANCE_DEBUGGING_HELP_MaterialCache
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "MaterialCache.h"
+
+// unreal
+#include "HAL/IConsoleManager.h"
+#include "Misc/Crc.h"
+#include "Engine/World.h"
+#include "Misc/AutomationTest.h"
+
+// module
+#include "ApparanceUnreal.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Shared Material Hits" ), STAT_SharedMaterialHits, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Shared Material Misses" ), STAT_SharedMaterialMisses, STATGROUP_Apparance );
+DECLARE_DWORD_COUNTER_STAT( TEXT( "Shared Materials" ), STAT_SharedMaterials, STATGROUP_Apparance );
+
+
+//////////////////////////////////////////////////////////////////////////
+// FMaterialCache
+
+FMaterialCache::FMaterialCache()
+	: m_PruneThreshold( MATERIAL_CACHE_PRUNE_MIN )
+	, m_HitCount( 0 )
+	, m_MissCount( 0 )
+{
+}
+
+// start watching for worlds going away
+//
+void FMaterialCache::Init()
+{
+	m_WorldCleanupHandle = FWorldDelegates::OnPostWorldCleanup.AddRaw( this, &FMaterialCache::HandleWorldCleanup );
+}
+
+// done, forget everything
+//
+void FMaterialCache::Shutdown()
+{
+	FWorldDelegates::OnPostWorldCleanup.Remove( m_WorldCleanupHandle );
+	m_WorldCleanupHandle.Reset();
+	Empty();
+}
+
+// look up an entry, hash is returned for use with Add on a miss
+//
+TSharedPtr<FParameterisedMaterial> FMaterialCache::Find( UWorld* world, const UObject* owner, Apparance::MaterialID material_id, int tier_index, const TSharedPtr<Apparance::IParameterCollection>& parameters, const TArray<Apparance::TextureID>& textures, uint32& hash_out )
+{
+	const uint32 generation = (uint32)m_Generation.GetValue();
+	hash_out = CalcHash( generation, world, owner, material_id, tier_index, parameters.Get(), textures );
+	for(auto It = m_Entries.CreateConstKeyIterator( hash_out ); It; ++It)
+	{
+		const TSharedPtr<FParameterisedMaterial>& pentry = It.Value();
+		if(Matches( pentry.Get(), generation, world, owner, material_id, tier_index, parameters.Get(), textures ))
+		{
+			m_HitCount++;
+			INC_DWORD_STAT( STAT_SharedMaterialHits );
+			return pentry;
+		}
+	}
+	m_MissCount++;
+	INC_DWORD_STAT( STAT_SharedMaterialMisses );
+	return nullptr;
+}
+
+// start sharing a new entry (not in use until AddRef)
+//
+void FMaterialCache::Add( const TSharedPtr<FParameterisedMaterial>& pentry )
+{
+	//growing, clear out any left unused
+	if(m_Entries.Num() >= m_PruneThreshold)
+	{
+		Prune();
+		m_PruneThreshold = FMath::Max( m_Entries.Num() * 2, MATERIAL_CACHE_PRUNE_MIN );
+	}
+
+	pentry->RefCount = 0;
+	pentry->Generation = (uint32)m_Generation.GetValue();
+	m_Entries.Add( pentry->Hash, pentry );
+	SET_DWORD_STAT( STAT_SharedMaterials, m_Entries.Num() );
+}
+
+// another user of an entry
+//
+void FMaterialCache::AddRef( const TSharedPtr<FParameterisedMaterial>& pentry )
+{
+	pentry->RefCount++;
+}
+
+// user done with an entry, last one out drops it from the cache
+//
+void FMaterialCache::Release( const TSharedPtr<FParameterisedMaterial>& pentry )
+{
+	if(--pentry->RefCount <= 0)
+	{
+		//(may already be gone if emptied)
+		m_Entries.RemoveSingle( pentry->Hash, pentry );
+		SET_DWORD_STAT( STAT_SharedMaterials, m_Entries.Num() );
+	}
+}
+
+// forget everything (instances live on with their users)
+//
+void FMaterialCache::Empty()
+{
+	m_Entries.Empty();
+	m_HitCount = 0;
+	m_MissCount = 0;
+	SET_DWORD_STAT( STAT_SharedMaterials, 0 );
+}
+
+// drop entries nothing is using (never was, or all released since emptied), and those of a world being cleaned up or already gone
+// NOTE: entries still in use stay with their users, releasing them later is harmless
+//
+void FMaterialCache::Prune( UWorld* world )
+{
+	for(auto It = m_Entries.CreateIterator(); It; ++It)
+	{
+		const FParameterisedMaterial* pentry = It.Value().Get();
+		const bool world_gone = !pentry->World.IsExplicitlyNull() && (!pentry->World.IsValid() || pentry->World.Get() == world);
+		if(pentry->RefCount <= 0 || world_gone)
+		{
+			It.RemoveCurrent();
+		}
+	}
+	SET_DWORD_STAT( STAT_SharedMaterials, m_Entries.Num() );
+}
+
+// world finished with, its instances can't be shared any more
+//
+void FMaterialCache::HandleWorldCleanup( UWorld* world, bool session_ended, bool cleanup_resources )
+{
+	Prune( world );
+}
+
+// current sharing state
+//
+void FMaterialCache::GetSharing( int& out_entries, int& out_users ) const
+{
+	out_entries = 0;
+	out_users = 0;
+	for(const TPair<uint32, TSharedPtr<FParameterisedMaterial>>& entry : m_Entries)
+	{
+		if(entry.Value->MaterialInstance.IsValid())
+		{
+			out_entries++;
+			out_users += entry.Value->RefCount;
+		}
+	}
+}
+
+// stable hash of everything that makes an instance distinct
+//
+uint32 FMaterialCache::CalcHash( uint32 generation, UWorld* world, const UObject* owner, Apparance::MaterialID material_id, int tier_index, const Apparance::IParameterCollection* parameters, const TArray<Apparance::TextureID>& textures )
+{
+	uint32 hash = HashCombine( GetTypeHash( generation ), GetTypeHash( world ) );
+	hash = HashCombine( hash, GetTypeHash( owner ) );
+	hash = HashCombine( hash, GetTypeHash( (uint32)material_id ) );
+	hash = HashCombine( hash, GetTypeHash( tier_index ) );
+	if(parameters)
+	{
+		int byte_count = 0;
+		const unsigned char* pbytes = parameters->GetBytes( byte_count );
+		if(pbytes && byte_count > 0)
+		{
+			hash = FCrc::MemCrc32( pbytes, byte_count, hash );
+		}
+	}
+	if(textures.Num() > 0)
+	{
+		hash = FCrc::MemCrc32( textures.GetData(), textures.Num() * sizeof( Apparance::TextureID ), hash );
+	}
+	return hash;
+}
+
+// full comparison, guards against hash collision
+//
+bool FMaterialCache::Matches( const FParameterisedMaterial* pentry, uint32 generation, UWorld* world, const UObject* owner, Apparance::MaterialID material_id, int tier_index, const Apparance::IParameterCollection* parameters, const TArray<Apparance::TextureID>& textures )
+{
+	if(pentry->Generation != generation || pentry->ID != material_id || pentry->TierIndex != tier_index || pentry->World.Get() != world || pentry->Owner.Get() != owner)
+	{
+		return false;
+	}
+
+	//parameters
+	const Apparance::IParameterCollection* existing_parameters = pentry->Parameters.Get();
+	if((existing_parameters != nullptr) != (parameters != nullptr))
+	{
+		return false;
+	}
+	if(parameters && existing_parameters != parameters && !existing_parameters->Equal( parameters ))
+	{
+		return false;
+	}
+
+	//textures
+	return pentry->Textures == textures;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// reporting
+
+/// <summary>
+/// log hit rate and sharing of material instances
+/// </summary>
+static void ReportMaterialCache( const TArray<FString>& args )
+{
+	int entries, users;
+	g_ApparanceMaterialCache.GetSharing( entries, users );
+	const uint64 hits = g_ApparanceMaterialCache.GetHitCount();
+	const uint64 misses = g_ApparanceMaterialCache.GetMissCount();
+	const double hit_rate = (hits + misses) > 0 ? (double)hits / (double)(hits + misses) : 0.0;
+
+	UE_LOG( LogApparance, Display, TEXT( "Material cache: %llu hits, %llu misses (%.1f%% hit rate)" ), hits, misses, hit_rate * 100.0 );
+	UE_LOG( LogApparance, Display, TEXT( "  %i shared material instances in use by %i entity tiers" ), entries, users );
+}
+
+static FAutoConsoleCommand GApparanceReportMaterialCacheCommand(
+	TEXT( "Apparance.ReportMaterialCache" ),
+	TEXT( "Log how many material instances are being shared between entities, and the lookup hit rate." ),
+	FConsoleCommandWithArgsDelegate::CreateStatic( &ReportMaterialCache ) );
+
+
+//////////////////////////////////////////////////////////////////////////
+// testing
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/// <summary>
+/// new entry as GetMaterial would set one up after a miss
+/// </summary>
+static TSharedPtr<FParameterisedMaterial> MaterialCacheTestAdd( FMaterialCache& cache, Apparance::MaterialID material_id )
+{
+	uint32 hash = 0;
+	TArray<Apparance::TextureID> textures;
+	cache.Find( nullptr, nullptr, material_id, 0, nullptr, textures, hash );
+	TSharedPtr<FParameterisedMaterial> pentry = MakeShareable( new FParameterisedMaterial() );
+	pentry->ID = material_id;
+	pentry->Hash = hash;
+	cache.Add( pentry );
+	return pentry;
+}
+
+/// <summary>
+/// lookup of a test entry
+/// </summary>
+static TSharedPtr<FParameterisedMaterial> MaterialCacheTestFind( FMaterialCache& cache, Apparance::MaterialID material_id )
+{
+	uint32 hash = 0;
+	TArray<Apparance::TextureID> textures;
+	return cache.Find( nullptr, nullptr, material_id, 0, nullptr, textures, hash );
+}
+
+/// <summary>
+/// entries are shared while in use, dropped by the last release, pruned when never used, and not found again once invalidated
+/// </summary>
+IMPLEMENT_SIMPLE_AUTOMATION_TEST( FApparanceMaterialCacheTest, "Apparance.Geometry.MaterialCache", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter )
+
+bool FApparanceMaterialCacheTest::RunTest( const FString& Parameters )
+{
+	FMaterialCache cache;
+
+	//shared while in use
+	TSharedPtr<FParameterisedMaterial> pshared = MaterialCacheTestAdd( cache, 1 );
+	cache.AddRef( pshared );
+	cache.AddRef( pshared );
+	TestTrue( TEXT( "Found once added" ), MaterialCacheTestFind( cache, 1 ) == pshared );
+	cache.Release( pshared );
+	TestTrue( TEXT( "Kept while a user remains" ), MaterialCacheTestFind( cache, 1 ) == pshared );
+	cache.Release( pshared );
+	TestFalse( TEXT( "Dropped by last release" ), MaterialCacheTestFind( cache, 1 ).IsValid() );
+	TestEqual( TEXT( "Nothing left after release" ), cache.GetEntryCount(), 0 );
+
+	//never used
+	TSharedPtr<FParameterisedMaterial> pused = MaterialCacheTestAdd( cache, 2 );
+	cache.AddRef( pused );
+	MaterialCacheTestAdd( cache, 3 );
+	cache.Prune();
+	TestFalse( TEXT( "Unused entry pruned" ), MaterialCacheTestFind( cache, 3 ).IsValid() );
+	TestTrue( TEXT( "Used entry survives pruning" ), MaterialCacheTestFind( cache, 2 ) == pused );
+
+	//growth prunes unused entries
+	for(int i = 0; i < MATERIAL_CACHE_PRUNE_MIN * 2; i++)
+	{
+		MaterialCacheTestAdd( cache, 1000 + i );
+	}
+	TestTrue( TEXT( "Unused entries pruned as the cache grows" ), cache.GetEntryCount() <= MATERIAL_CACHE_PRUNE_MIN + 1 );
+	TestTrue( TEXT( "Used entry survives growth" ), MaterialCacheTestFind( cache, 2 ) == pused );
+
+	//invalidated
+	cache.Invalidate();
+	TestFalse( TEXT( "Not found after invalidation" ), MaterialCacheTestFind( cache, 2 ).IsValid() );
+	cache.Release( pused );
+	cache.Prune();
+	TestEqual( TEXT( "Released after invalidation" ), cache.GetEntryCount(), 0 );
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
+
+
+#if APPARANCE_DEBUGGING_HELP_MaterialCache
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,81 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+#define MATERIAL_CACHE_PRUNE_MIN 256	//entries before unused ones are first pruned on add (then whenever the cache doubles)
+
+
+// unreal
+#include "CoreMinimal.h"
+
+// apparance
+#include "Apparance.h"
+
+
+// Shared material instances for identically parameterised materials
+// Entities in the same world using a material with the same parameters and textures share one dynamic instance instead of creating their own, when detail blending is via primitive data
+// Otherwise instances carry the detail blend of the entity tier using them, so are only shared within that entity tier
+// Entries are found by hash of their inputs and reference counted by the entity tiers using them, dropping out when the last user releases them
+// Invalidating (asset database changes) starts a new generation, older entries are no longer found but stay with their users until released
+// Entries never used, or of worlds that are gone, are pruned as the cache grows and when worlds are cleaned up
+// NOTE: game thread only, instances are weak (components using them keep them alive)
+//
+class FMaterialCache
+{
+	//live entries by hash of their inputs (can be several per hash)
+	TMultiMap<uint32, TSharedPtr<struct FParameterisedMaterial>> m_Entries;
+
+	//entries only match within a generation
+	FThreadSafeCounter m_Generation;
+
+	//pruning
+	int m_PruneThreshold;
+	FDelegateHandle m_WorldCleanupHandle;
+
+	//totals, for reporting
+	uint64 m_HitCount;
+	uint64 m_MissCount;
+
+public:
+	FMaterialCache();
+
+	//setup
+	void Init();
+	void Shutdown();
+
+	//existing entry for these inputs, if any
+	//owner limits sharing to one user (null to share across the world)
+	TSharedPtr<struct FParameterisedMaterial> Find( class UWorld* world, const class UObject* owner, Apparance::MaterialID material_id, int tier_index, const TSharedPtr<Apparance::IParameterCollection>& parameters, const TArray<Apparance::TextureID>& textures, uint32& hash_out );
+	//new entry, as set up after a failed Find
+	void Add( const TSharedPtr<struct FParameterisedMaterial>& pentry );
+
+	//usage
+	void AddRef( const TSharedPtr<struct FParameterisedMaterial>& pentry );
+	void Release( const TSharedPtr<struct FParameterisedMaterial>& pentry );
+
+	//drop tracking of all entries
+	void Empty();
+	//drop entries with no users, or of a world (or any that has gone)
+	void Prune( class UWorld* world=nullptr );
+	//stop handing out existing entries (thread safe)
+	void Invalidate() { m_Generation.Increment(); }
+
+	//reporting
+	uint64 GetHitCount() const { return m_HitCount; }
+	uint64 GetMissCount() const { return m_MissCount; }
+	void GetSharing( int& out_entries, int& out_users ) const;
+	int GetEntryCount() const { return m_Entries.Num(); }
+
+private:
+	void HandleWorldCleanup( class UWorld* world, bool session_ended, bool cleanup_resources );
+	static uint32 CalcHash( uint32 generation, class UWorld* world, const class UObject* owner, Apparance::MaterialID material_id, int tier_index, const Apparance::IParameterCollection* parameters, const TArray<Apparance::TextureID>& textures );
+	static bool Matches( const struct FParameterisedMaterial* pentry, uint32 generation, class UWorld* world, const class UObject* owner, Apparance::MaterialID material_id, int tier_index, const Apparance::IParameterCollection* parameters, const TArray<Apparance::TextureID>& textures );
+};
+
+extern FMaterialCache g_ApparanceMaterialCache;
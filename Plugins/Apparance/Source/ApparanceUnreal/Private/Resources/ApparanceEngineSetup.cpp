@@ -117,6 +117,14 @@ EApparanceInstancingMode UApparanceEngineSetup::GetInstancedRenderingMode()
 {
 	return APPARANCESETUPVAR(EnableInstancedRendering);
 }
+int UApparanceEngineSetup::GetAutoInstancingThreshold()
+{
+	return APPARANCESETUPVAR(AutoInstancingThreshold);
+}
+int UApparanceEngineSetup::GetAutoInstancingReleaseThreshold()
+{
+	return FMath::Min( APPARANCESETUPVAR(AutoInstancingReleaseThreshold), GetAutoInstancingThreshold() );
+}
 UMaterial* UApparanceEngineSetup::GetMissingMaterial()
 {
 	return APPARANCESETUPVAR( MissingMaterial.LoadSynchronous());
@@ -129,6 +137,87 @@ UStaticMesh* UApparanceEngineSetup::GetMissingObject()
 {
 	return APPARANCESETUPVAR(MissingObject.LoadSynchronous());
 }
+bool UApparanceEngineSetup::GetPrepareGeometryOnSynthesisThread()
+{
+	return APPARANCESETUPVAR(bPrepareGeometryOnSynthesisThread);
+}
+bool UApparanceEngineSetup::GetOptimiseGeometry()
+{
+	return APPARANCESETUPVAR(bOptimiseGeometry);
+}
+bool UApparanceEngineSetup::GetUseApparanceMeshComponent()
+{
+	return APPARANCESETUPVAR(bUseApparanceMeshComponent);
+}
+bool UApparanceEngineSetup::GetDeduplicateGeometry()
+{
+	return APPARANCESETUPVAR(bDeduplicateGeometry);
+}
+bool UApparanceEngineSetup::GetMergeGeometrySections()
+{
+	return APPARANCESETUPVAR(bMergeGeometrySections);
+}
+bool UApparanceEngineSetup::GetSwapContentOnRebuild()
+{
+	return APPARANCESETUPVAR(bSwapContentOnRebuild);
+}
+bool UApparanceEngineSetup::GetDetailBlendPrimitiveData()
+{
+	return APPARANCESETUPVAR(bDetailBlendPrimitiveData);
+}
+EApparanceCollisionMode UApparanceEngineSetup::GetCollisionMode()
+{
+	EApparanceCollisionMode mode = APPARANCESETUPVAR(CollisionMode);
+	return mode==EApparanceCollisionMode::Default ? EApparanceCollisionMode::Complex : mode;
+}
+int UApparanceEngineSetup::GetCollisionVoxelResolution()
+{
+	return APPARANCESETUPVAR(CollisionVoxelResolution);
+}
+bool UApparanceEngineSetup::GetCacheCollision()
+{
+	return APPARANCESETUPVAR(bCacheCollision);
+}
+int UApparanceEngineSetup::GetCollisionCacheMemoryLimit()
+{
+	return APPARANCESETUPVAR(CollisionCacheMemoryLimit);
+}
+int UApparanceEngineSetup::GetCollisionCacheDiskLimit()
+{
+	return APPARANCESETUPVAR(CollisionCacheDiskLimit);
+}
+int UApparanceEngineSetup::GetGeometryVertexLimit()
+{
+	return APPARANCESETUPVAR(GeometryVertexLimit);
+}
+int UApparanceEngineSetup::GetGeometryIndexLimit()
+{
+	return APPARANCESETUPVAR(GeometryIndexLimit);
+}
+float UApparanceEngineSetup::GetGeometryChunkSize()
+{
+	return APPARANCESETUPVAR(GeometryChunkSize);
+}
+float UApparanceEngineSetup::GetFrameBudget()
+{
+	return APPARANCESETUPVAR(FrameBudget);
+}
+float UApparanceEngineSetup::GetTargetFrameRate()
+{
+	return APPARANCESETUPVAR(TargetFrameRate);
+}
+float UApparanceEngineSetup::GetViewPredictionTime()
+{
+	return APPARANCESETUPVAR(ViewPredictionTime);
+}
+bool UApparanceEngineSetup::GetShareInstancedMeshes()
+{
+	return APPARANCESETUPVAR(bShareInstancedMeshes);
+}
+float UApparanceEngineSetup::GetInstancePoolBucketSize()
+{
+	return APPARANCESETUPVAR(InstancePoolBucketSize);
+}
 
 
 
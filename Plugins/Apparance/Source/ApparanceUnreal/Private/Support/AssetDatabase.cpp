@@ -31,6 +31,8 @@ PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
 
 // module
 #include "ApparanceUnreal.h"
+#include "FrameBudget.h"
+#include "MaterialCache.h"
 
 
 //////////////////////////////////////////////////////////////////////////
@@ -114,6 +116,9 @@ void FAssetDatabase::Invalidate()
 {
 	Reset();
 
+	//material instances made from the old state can't be reused
+	g_ApparanceMaterialCache.Invalidate();
+
 	//trigger rebuild of all entities
 	if (FApparanceUnrealModule::GetModule())
 	{
@@ -891,11 +896,19 @@ void FAssetDatabase::CreateDynamicAssets()
 #if ENABLE_TEXTUREGEN_DIAGS
 		UE_LOG(LogApparance, Display, TEXT("TEXTUREGEN: CreateDynamicAssets x %i"), NewTextures.Num());
 #endif
-		for(int i = 0; i < NewTextures.Num(); i++)
+		//as many as the frame budget allows (at least one)
+		FFrameBudget::FScope budget_scope( EApparanceWorkCategory::Textures );
+		const double end_time = FPlatformTime::Seconds() + g_ApparanceFrameBudget.GetRemaining();
+		int applied = 0;
+		while(applied < NewTextures.Num())
 		{
-			NewTextures[i].Apply( this );
+			NewTextures[applied++].Apply( this );
+			if(g_ApparanceFrameBudget.IsLimited() && FPlatformTime::Seconds() >= end_time)
+			{
+				break;
+			}
 		}
-		NewTextures.Empty();
+		NewTextures.RemoveAt( 0, applied, false );
 	}
 }
 
@@ -0,0 +1,180 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+//local debugging help
+#define APPARANCE_DEBUGGING_HELP_FrameBudget 0
+#if APPARANCE_DEBUGGING_HELP_FrameBudget
+PRAGMA_DISABLE_OPTIMIZATION_ACTUAL
+#endif
+
+// main
+#include "FrameBudget.h"
+
+// unreal
+
+// module
+#include "ApparanceUnreal.h"
+#include "EntityRendering.h"
+
+
+// profiler stats
+DECLARE_FLOAT_COUNTER_STAT( TEXT( "Frame Budget (ms)" ), STAT_FrameBudget, STATGROUP_Apparance );
+DECLARE_FLOAT_COUNTER_STAT( TEXT( "Frame Budget Spent (ms)" ), STAT_FrameBudgetSpent, STATGROUP_Apparance );
+DECLARE_FLOAT_COUNTER_STAT( TEXT( "Geometry Add Time (ms)" ), STAT_WorkGeometryAdd, STATGROUP_Apparance );
+DECLARE_FLOAT_COUNTER_STAT( TEXT( "Geometry Remove Time (ms)" ), STAT_WorkGeometryRemove, STATGROUP_Apparance );
+DECLARE_FLOAT_COUNTER_STAT( TEXT( "Texture Creation Time (ms)" ), STAT_WorkTextures, STATGROUP_Apparance );
+DECLARE_FLOAT_COUNTER_STAT( TEXT( "Material Setup Time (ms)" ), STAT_WorkMaterials, STATGROUP_Apparance );
+DECLARE_FLOAT_COUNTER_STAT( TEXT( "Blueprint Spawn Time (ms)" ), STAT_WorkBlueprints, STATGROUP_Apparance );
+
+//range the adaptive allowance can move within, relative to the configured budget
+#define FRAME_BUDGET_MIN_SCALE 0.25
+#define FRAME_BUDGET_MAX_SCALE 4.0
+//frames this much longer than target are stalls (loading, breakpoints), not load to react to
+#define FRAME_BUDGET_STALL_SCALE 4.0
+//share of the frame (target, or 30Hz without one) allowed while loading
+#define FRAME_BUDGET_LOADING_FRACTION 0.75
+#define FRAME_BUDGET_LOADING_FRAME_TIME (1.0 / 30.0)
+
+
+//////////////////////////////////////////////////////////////////////////
+// FFrameBudget
+
+FFrameBudget::FFrameBudget()
+	: m_Limit( 0 )
+	, m_TargetFrameTime( 0 )
+	, m_Budget( 0 )
+	, m_Spent( 0 )
+	, m_SmoothedFrameTime( 0 )
+	, m_ScopeDepth( 0 )
+	, m_bLoading( false )
+{
+	FMemory::Memzero( m_CategoryTime );
+}
+
+// configure
+//
+void FFrameBudget::Init( float budget_ms, float target_frame_rate )
+{
+	m_TargetFrameTime = target_frame_rate > 0 ? 1.0 / target_frame_rate : 0.0;
+	m_SmoothedFrameTime = m_TargetFrameTime;
+	SetLimit( budget_ms );
+}
+
+// change nominal allowance (e.g. from script)
+//
+void FFrameBudget::SetLimit( float budget_ms )
+{
+	m_Limit = FMath::Max( budget_ms, 0.0f ) / 1000.0;
+	m_Budget = m_Limit;
+}
+
+// loading signal, allowance is raised until cleared
+//
+void FFrameBudget::SetLoading( bool loading )
+{
+	if(loading == m_bLoading)
+	{
+		return;
+	}
+	m_bLoading = loading;
+	if(!m_bLoading)
+	{
+		//start adapting again from nominal
+		m_Budget = m_Limit;
+		m_SmoothedFrameTime = m_TargetFrameTime;
+	}
+}
+
+// work out this frame's allowance from how the last frames went
+//
+void FFrameBudget::BeginFrame( float delta_seconds )
+{
+	//report last frame
+	SET_FLOAT_STAT( STAT_FrameBudget, m_Budget * 1000.0 );
+	SET_FLOAT_STAT( STAT_FrameBudgetSpent, m_Spent * 1000.0 );
+	SET_FLOAT_STAT( STAT_WorkGeometryAdd, m_CategoryTime[(int)EApparanceWorkCategory::GeometryAdd] * 1000.0 );
+	SET_FLOAT_STAT( STAT_WorkGeometryRemove, m_CategoryTime[(int)EApparanceWorkCategory::GeometryRemove] * 1000.0 );
+	SET_FLOAT_STAT( STAT_WorkTextures, m_CategoryTime[(int)EApparanceWorkCategory::Textures] * 1000.0 );
+	SET_FLOAT_STAT( STAT_WorkMaterials, m_CategoryTime[(int)EApparanceWorkCategory::Materials] * 1000.0 );
+	SET_FLOAT_STAT( STAT_WorkBlueprints, m_CategoryTime[(int)EApparanceWorkCategory::Blueprints] * 1000.0 );
+	FMemory::Memzero( m_CategoryTime );
+	m_Spent = 0;
+
+	//loading, frame time doesn't matter as much
+	if(IsLimited() && m_bLoading)
+	{
+		const double frame_time = m_TargetFrameTime > 0 ? m_TargetFrameTime : FRAME_BUDGET_LOADING_FRAME_TIME;
+		m_Budget = FMath::Max( frame_time * FRAME_BUDGET_LOADING_FRACTION, m_Limit * FRAME_BUDGET_MAX_SCALE );
+		return;
+	}
+
+	//fixed?
+	if(!IsLimited() || m_TargetFrameTime <= 0)
+	{
+		m_Budget = m_Limit;
+		return;
+	}
+
+	//ignore stalls
+	if(delta_seconds <= 0 || delta_seconds > m_TargetFrameTime * FRAME_BUDGET_STALL_SCALE)
+	{
+		return;
+	}
+	m_SmoothedFrameTime = FMath::Lerp( m_SmoothedFrameTime, (double)delta_seconds, 0.25 );
+
+	//adapt
+	if(delta_seconds > m_TargetFrameTime * 1.2)
+	{
+		//spike, back off hard
+		m_Budget *= 0.5;
+	}
+	else if(m_SmoothedFrameTime > m_TargetFrameTime * 1.05)
+	{
+		//over target, ease off
+		m_Budget *= 0.9;
+	}
+	else if(m_SmoothedFrameTime < m_TargetFrameTime * 0.9)
+	{
+		//headroom, use some of it
+		m_Budget += (m_TargetFrameTime - m_SmoothedFrameTime) * 0.25;
+	}
+	m_Budget = FMath::Clamp( m_Budget, m_Limit * FRAME_BUDGET_MIN_SCALE, m_Limit * FRAME_BUDGET_MAX_SCALE );
+}
+
+// accumulate work time
+//
+void FFrameBudget::Account( EApparanceWorkCategory category, double seconds, bool outermost )
+{
+	m_CategoryTime[(int)category] += seconds;
+	if(outermost)
+	{
+		m_Spent += seconds;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// FFrameBudget::FScope
+
+FFrameBudget::FScope::FScope( EApparanceWorkCategory category )
+	: m_Category( category )
+	, m_StartTime( FPlatformTime::Seconds() )
+{
+	g_ApparanceFrameBudget.m_ScopeDepth++;
+}
+
+FFrameBudget::FScope::~FScope()
+{
+	const bool outermost = --g_ApparanceFrameBudget.m_ScopeDepth == 0;
+	g_ApparanceFrameBudget.Account( m_Category, FPlatformTime::Seconds() - m_StartTime, outermost );
+}
+
+
+#if APPARANCE_DEBUGGING_HELP_FrameBudget
+PRAGMA_ENABLE_OPTIMIZATION_ACTUAL
+#endif
@@ -0,0 +1,84 @@
+//----
+// Apparance Unreal Plugin
+// Written by Sam R. Swain
+// Copyright (c) 2022 Apparance Studios Ltd
+// All rights reserved
+// https://www.apparance.uk
+//----
+
+#pragma once
+
+
+// unreal
+#include "CoreMinimal.h"
+
+
+// kinds of main thread work sharing the frame budget
+//
+enum class EApparanceWorkCategory : uint8
+{
+	GeometryAdd,
+	GeometryRemove,
+	Textures,
+	Materials,
+	Blueprints,
+
+	Count
+};
+
+
+// Game thread time budget for all Apparance main thread work
+// One allowance per frame shared by geometry placement/removal, dynamic texture creation, material and blueprint setup
+// With a target frame rate the allowance adapts to measured frame time, shrinking during spikes and growing while frames have headroom
+// While loading is signalled (e.g. behind a loading screen) most of the frame is given over instead, long frames don't hold it back
+// Adds, removals, and texture creation are deferred once out of time, material and blueprint setup happen within adds and are deferred with them
+// NOTE: game thread only
+//
+class FFrameBudget
+{
+	//config
+	double m_Limit;				//max allowance (s), 0 is unlimited
+	double m_TargetFrameTime;	//(s), 0 is a fixed allowance
+
+	//state
+	double m_Budget;			//this frame's allowance (s)
+	double m_Spent;				//this frame (s)
+	double m_SmoothedFrameTime;	//(s)
+	double m_CategoryTime[(int)EApparanceWorkCategory::Count];
+	int    m_ScopeDepth;
+	bool   m_bLoading;
+
+public:
+	FFrameBudget();
+
+	//setup, budget in ms (0 unlimited), target frame rate (0 for fixed budget)
+	void Init( float budget_ms, float target_frame_rate );
+	void SetLimit( float budget_ms );
+	//raise allowance while content is loading rather than being played
+	void SetLoading( bool loading );
+
+	//per frame adaptation, call before any work
+	void BeginFrame( float delta_seconds );
+
+	//state
+	bool IsLimited() const { return m_Limit > 0; }
+	bool IsLoading() const { return m_bLoading; }
+	bool HasTime() const { return !IsLimited() || m_Spent < m_Budget; }
+	double GetRemaining() const { return IsLimited() ? FMath::Max( m_Budget - m_Spent, 0.0 ) : 0.0; }
+	double GetBudget() const { return m_Budget; }
+
+	//timing of work, nested scopes only count against the budget once
+	struct FScope
+	{
+		FScope( EApparanceWorkCategory category );
+		~FScope();
+	private:
+		EApparanceWorkCategory m_Category;
+		double                 m_StartTime;
+	};
+
+private:
+	void Account( EApparanceWorkCategory category, double seconds, bool outermost );
+};
+
+extern FFrameBudget g_ApparanceFrameBudget;
@@ -27,6 +27,20 @@ enum class EApparanceInstancingMode
 	Never,
 	PerEntity,
 	Always,
+	Auto,		//per entity, once it places enough of a mesh (see Auto Instancing Threshold)
+};
+
+//how generated collision geometry is turned into physics shapes
+UENUM()
+enum class EApparanceCollisionMode
+{
+	Default,		//inherit (entity from project, tier from entity)
+	Complex,		//full triangle mesh
+	Box,			//bounding box per part
+	ConvexHull,		//convex hull per part
+	VoxelHulls,		//coarse voxelised boxes per part
+	Heightfield,	//heightfield for regular height grid parts (e.g. terrain), complex for others
+	None,			//no collision
 };
 
 
@@ -64,6 +78,12 @@ public:
 	
 	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Enable Instanced Rendering", Tooltip = "Whether to allow the use of instanced rendering to display generated content (may need to be enabled per Entity too)."));
 	EApparanceInstancingMode Editor_EnableInstancedRendering = EApparanceInstancingMode::PerEntity;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Auto Instancing Threshold", Tooltip = "In Auto instancing mode, how many placements of a mesh an entity needs before they are switched from separate mesh components to instances.", ClampMin="1"));
+	int Editor_AutoInstancingThreshold = 8;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Auto Instancing Release Threshold", Tooltip = "In Auto instancing mode, instanced placements of a mesh switch back to mesh components when an entity has fewer than this many (below the threshold, so counts hovering around it don't keep switching).", ClampMin="0"));
+	int Editor_AutoInstancingReleaseThreshold = 4;
 	
 	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Missing Material", Tooltip = "Material to place on objects when the material resource requested isn't assigned, doesn't have a Resource List entry, or is missing."));
 	TSoftObjectPtr<UMaterial> Editor_MissingMaterial;
@@ -74,6 +94,66 @@ public:
 	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Missing Object", Tooltip = "Object to place when a mesh or blueprint resource requested isn't assigned, doesn't have a Resource List entry, or is missing."));
 	TSoftObjectPtr<UStaticMesh> Editor_MissingObject;
 
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Prepare Geometry On Synthesis Thread", Tooltip = "Convert generated geometry into Unreal mesh data on the background synthesis thread that produced it, leaving only component setup for the game thread (uses more memory while geometry is pending).", ConfigRestartRequired=true));
+	bool Editor_bPrepareGeometryOnSynthesisThread = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Optimise Geometry", Tooltip = "Weld duplicate vertices and reorder triangles for GPU vertex cache efficiency as geometry is generated (adds some synthesis time).", ConfigRestartRequired=true));
+	bool Editor_bOptimiseGeometry = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Use Apparance Mesh Component", Tooltip = "Display generated geometry with the lightweight render-only Apparance mesh component instead of the procedural mesh component (collision still uses procedural mesh components)."));
+	bool Editor_bUseApparanceMeshComponent = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Deduplicate Geometry", Tooltip = "Share GPU buffers between identical pieces of generated geometry (e.g. repeated modules), across all entities. Requires Use Apparance Mesh Component.", ConfigRestartRequired=true));
+	bool Editor_bDeduplicateGeometry = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Merge Geometry Sections", Tooltip = "Merge generated geometry of an entity that shares a detail tier and material into shared mesh sections, reducing component and draw call counts (uses extra memory to allow incremental rebuilds on removal)."));
+	bool Editor_bMergeGeometrySections = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Swap Content On Rebuild", Tooltip = "Keep an entity's previous content visible while a rebuild is placed, switching over once all the new content is ready. Old content is removed over following frames as the frame budget allows."));
+	bool Editor_bSwapContentOnRebuild = true;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Detail Blend Via Primitive Data", Tooltip = "Drive detail tier blending through custom primitive data (indices 0-3) of the generated geometry components instead of setting a DetailBlend parameter on per-tier material instances, allowing materials to be shared between tiers. Materials must read DetailBlend from custom primitive data (e.g. a vector parameter with Use Custom Primitive Data enabled).", ConfigRestartRequired=true));
+	bool Editor_bDetailBlendPrimitiveData = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Collision Mode", Tooltip = "How generated collision geometry becomes physics shapes: the full triangles (complex), or cheaper simple shapes derived from them. Entities can override this."));
+	EApparanceCollisionMode Editor_CollisionMode = EApparanceCollisionMode::Complex;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Collision Voxel Resolution", Tooltip = "Grid cells along each axis of a part when building voxel hull collision.", ClampMin="1", ClampMax="32"));
+	int Editor_CollisionVoxelResolution = 4;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Cache Cooked Collision", Tooltip = "Keep physics data cooked for generated collision (in the project Saved folder) and reuse it for identical collision instead of cooking again. Collision is cooked synchronously while this is on. New data can only be captured in the editor or uncooked builds.", ConfigRestartRequired=true));
+	bool Editor_bCacheCollision = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Collision Cache Memory Limit", Tooltip = "Cooked collision data to keep in memory (MB), least recently used is dropped first.", ClampMin="0", ConfigRestartRequired=true));
+	int Editor_CollisionCacheMemoryLimit = 64;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Collision Cache Disk Limit", Tooltip = "Cooked collision data to keep on disk (MB), least recently used is deleted first.", ClampMin="0", ConfigRestartRequired=true));
+	int Editor_CollisionCacheDiskLimit = 512;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Geometry Vertex Limit", Tooltip = "Maximum vertices in a generated geometry part, larger parts are split by the engine (0 unlimited).", ClampMin="0", ConfigRestartRequired=true));
+	int Editor_GeometryVertexLimit = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Geometry Index Limit", Tooltip = "Maximum indices in a generated geometry part, larger parts are split by the engine (0 unlimited).", ClampMin="0", ConfigRestartRequired=true));
+	int Editor_GeometryIndexLimit = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Geometry Chunk Size", Tooltip = "Split generated geometry larger than this (in Apparance units) into a grid of separately culled chunks, each with its own component (0 no chunking).", ClampMin="0", ConfigRestartRequired=true));
+	float Editor_GeometryChunkSize = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Frame Budget", Tooltip = "Main thread time per frame (ms) shared by all Apparance content placement/removal, texture, material and blueprint setup, remaining work is carried over to following frames (0 unlimited).", ClampMin="0"));
+	float Editor_FrameBudget = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Target Frame Rate", Tooltip = "Frame rate the frame budget adapts to, shrinking when frames run long and growing when there is headroom (0 fixed budget).", ClampMin="0"));
+	float Editor_TargetFrameRate = 60;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="View Prediction Time", Tooltip = "Also generate content detail for where moving views will be this many seconds from now, based on their recent velocity, so fast cameras don't outrun generation (0 off).", ClampMin="0"));
+	float Editor_ViewPredictionTime = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Share Instanced Meshes", Tooltip = "During play, place instanced meshes of non-movable entities in hierarchical instanced mesh components shared by all entities in the world, instead of components per entity. Reduces component and draw counts when many entities place the same meshes."));
+	bool Editor_bShareInstancedMeshes = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Editor, meta = (DisplayName="Shared Instance Bucket Size", Tooltip = "Size of the spatial cells (in Unreal units) shared instanced meshes are grouped by, each cell having its own components so distant instances can still be culled (0 one cell).", ClampMin="0"));
+	float Editor_InstancePoolBucketSize = 20000;
+
 	//------------------------------------------------------------------------
 	// Standalone setup
 
@@ -88,6 +168,12 @@ public:
 	
 	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Enable Instanced Rendering", Tooltip = "Whether to allow the use of instanced rendering to display generated content (may need to be enabled per Entity too)."));
 	EApparanceInstancingMode Standalone_EnableInstancedRendering = EApparanceInstancingMode::PerEntity;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Auto Instancing Threshold", Tooltip = "In Auto instancing mode, how many placements of a mesh an entity needs before they are switched from separate mesh components to instances.", ClampMin="1"));
+	int Standalone_AutoInstancingThreshold = 8;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Auto Instancing Release Threshold", Tooltip = "In Auto instancing mode, instanced placements of a mesh switch back to mesh components when an entity has fewer than this many (below the threshold, so counts hovering around it don't keep switching).", ClampMin="0"));
+	int Standalone_AutoInstancingReleaseThreshold = 4;
 	
 	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Missing Material", Tooltip = "Material to place on objects when the material resource requested isn't assigned, doesn't have a Resource List entry, or is missing."));
 	TSoftObjectPtr<UMaterial> Standalone_MissingMaterial;
@@ -97,6 +183,66 @@ public:
 	
 	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Missing Object", Tooltip = "Object to place when a mesh or blueprint resource requested isn't assigned, doesn't have a Resource List entry, or is missing."));
 	TSoftObjectPtr<UStaticMesh> Standalone_MissingObject;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Prepare Geometry On Synthesis Thread", Tooltip = "Convert generated geometry into Unreal mesh data on the background synthesis thread that produced it, leaving only component setup for the game thread (uses more memory while geometry is pending).", ConfigRestartRequired=true));
+	bool Standalone_bPrepareGeometryOnSynthesisThread = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Optimise Geometry", Tooltip = "Weld duplicate vertices and reorder triangles for GPU vertex cache efficiency as geometry is generated (adds some synthesis time).", ConfigRestartRequired=true));
+	bool Standalone_bOptimiseGeometry = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Use Apparance Mesh Component", Tooltip = "Display generated geometry with the lightweight render-only Apparance mesh component instead of the procedural mesh component (collision still uses procedural mesh components)."));
+	bool Standalone_bUseApparanceMeshComponent = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Deduplicate Geometry", Tooltip = "Share GPU buffers between identical pieces of generated geometry (e.g. repeated modules), across all entities. Requires Use Apparance Mesh Component.", ConfigRestartRequired=true));
+	bool Standalone_bDeduplicateGeometry = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Merge Geometry Sections", Tooltip = "Merge generated geometry of an entity that shares a detail tier and material into shared mesh sections, reducing component and draw call counts (uses extra memory to allow incremental rebuilds on removal)."));
+	bool Standalone_bMergeGeometrySections = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Swap Content On Rebuild", Tooltip = "Keep an entity's previous content visible while a rebuild is placed, switching over once all the new content is ready. Old content is removed over following frames as the frame budget allows."));
+	bool Standalone_bSwapContentOnRebuild = true;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Detail Blend Via Primitive Data", Tooltip = "Drive detail tier blending through custom primitive data (indices 0-3) of the generated geometry components instead of setting a DetailBlend parameter on per-tier material instances, allowing materials to be shared between tiers. Materials must read DetailBlend from custom primitive data (e.g. a vector parameter with Use Custom Primitive Data enabled).", ConfigRestartRequired=true));
+	bool Standalone_bDetailBlendPrimitiveData = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Collision Mode", Tooltip = "How generated collision geometry becomes physics shapes: the full triangles (complex), or cheaper simple shapes derived from them. Entities can override this."));
+	EApparanceCollisionMode Standalone_CollisionMode = EApparanceCollisionMode::Complex;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Collision Voxel Resolution", Tooltip = "Grid cells along each axis of a part when building voxel hull collision.", ClampMin="1", ClampMax="32"));
+	int Standalone_CollisionVoxelResolution = 4;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Cache Cooked Collision", Tooltip = "Keep physics data cooked for generated collision (in the project Saved folder) and reuse it for identical collision instead of cooking again. Collision is cooked synchronously while this is on. New data can only be captured in the editor or uncooked builds.", ConfigRestartRequired=true));
+	bool Standalone_bCacheCollision = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Collision Cache Memory Limit", Tooltip = "Cooked collision data to keep in memory (MB), least recently used is dropped first.", ClampMin="0", ConfigRestartRequired=true));
+	int Standalone_CollisionCacheMemoryLimit = 64;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Collision Cache Disk Limit", Tooltip = "Cooked collision data to keep on disk (MB), least recently used is deleted first.", ClampMin="0", ConfigRestartRequired=true));
+	int Standalone_CollisionCacheDiskLimit = 512;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Geometry Vertex Limit", Tooltip = "Maximum vertices in a generated geometry part, larger parts are split by the engine (0 unlimited).", ClampMin="0", ConfigRestartRequired=true));
+	int Standalone_GeometryVertexLimit = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Geometry Index Limit", Tooltip = "Maximum indices in a generated geometry part, larger parts are split by the engine (0 unlimited).", ClampMin="0", ConfigRestartRequired=true));
+	int Standalone_GeometryIndexLimit = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Geometry Chunk Size", Tooltip = "Split generated geometry larger than this (in Apparance units) into a grid of separately culled chunks, each with its own component (0 no chunking).", ClampMin="0", ConfigRestartRequired=true));
+	float Standalone_GeometryChunkSize = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Frame Budget", Tooltip = "Main thread time per frame (ms) shared by all Apparance content placement/removal, texture, material and blueprint setup, remaining work is carried over to following frames (0 unlimited).", ClampMin="0"));
+	float Standalone_FrameBudget = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Target Frame Rate", Tooltip = "Frame rate the frame budget adapts to, shrinking when frames run long and growing when there is headroom (0 fixed budget).", ClampMin="0"));
+	float Standalone_TargetFrameRate = 60;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="View Prediction Time", Tooltip = "Also generate content detail for where moving views will be this many seconds from now, based on their recent velocity, so fast cameras don't outrun generation (0 off).", ClampMin="0"));
+	float Standalone_ViewPredictionTime = 0;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Share Instanced Meshes", Tooltip = "During play, place instanced meshes of non-movable entities in hierarchical instanced mesh components shared by all entities in the world, instead of components per entity. Reduces component and draw counts when many entities place the same meshes."));
+	bool Standalone_bShareInstancedMeshes = false;
+
+	UPROPERTY(EditAnywhere, config, Category=Standalone, meta = (DisplayName="Shared Instance Bucket Size", Tooltip = "Size of the spatial cells (in Unreal units) shared instanced meshes are grouped by, each cell having its own components so distant instances can still be culled (0 one cell).", ClampMin="0"));
+	float Standalone_InstancePoolBucketSize = 20000;
 	
 
 	// access
@@ -111,9 +257,31 @@ public:
 	static int GetBufferSize();
 	static bool GetEnableLiveEditing();
 	static EApparanceInstancingMode GetInstancedRenderingMode();
+	static int GetAutoInstancingThreshold();
+	static int GetAutoInstancingReleaseThreshold();
 	static UMaterial* GetMissingMaterial();
 	static UTexture* GetMissingTexture();
 	static UStaticMesh* GetMissingObject();
+	static bool GetPrepareGeometryOnSynthesisThread();
+	static bool GetOptimiseGeometry();
+	static bool GetUseApparanceMeshComponent();
+	static bool GetDeduplicateGeometry();
+	static bool GetMergeGeometrySections();
+	static bool GetSwapContentOnRebuild();
+	static bool GetDetailBlendPrimitiveData();
+	static EApparanceCollisionMode GetCollisionMode();
+	static int GetCollisionVoxelResolution();
+	static bool GetCacheCollision();
+	static int GetCollisionCacheMemoryLimit();
+	static int GetCollisionCacheDiskLimit();
+	static int GetGeometryVertexLimit();
+	static int GetGeometryIndexLimit();
+	static float GetGeometryChunkSize();
+	static float GetFrameBudget();
+	static float GetTargetFrameRate();
+	static float GetViewPredictionTime();
+	static bool GetShareInstancedMeshes();
+	static float GetInstancePoolBucketSize();
 	
 public:
 #if WITH_EDITOR
@@ -18,6 +18,7 @@
 // module
 #include "IProceduralObject.h"
 #include "ApparanceEntityPreset.h"
+#include "ApparanceEngineSetup.h"
 #include "Utility/ApparanceConversion.h"
 
 // auto (last)
@@ -27,6 +28,22 @@
 #define APPARANCE_ENABLE_SPATIAL_MAPPING 0
 
 
+USTRUCT()
+struct FGeometryCacheEntry
+{
+	GENERATED_BODY()
+	UPROPERTY(Transient)
+	TArray<TWeakObjectPtr<class UMeshComponent>> Geometry;	//per spatial chunk
+};
+
+USTRUCT()
+struct FCollisionCacheEntry
+{
+	GENERATED_BODY()
+	UPROPERTY(Transient)
+	TArray<TWeakObjectPtr<class UPrimitiveComponent>> Collision;	//collision mesh, heightfields
+};
+
 USTRUCT()
 struct FMeshCacheEntry
 {
@@ -79,6 +96,17 @@ struct FMeshInstanceCacheEntry
 };
 
 
+// run of instances in an instanced mesh component
+//
+struct FInstanceRange
+{
+	int Start = 0;
+	int Count = 0;
+	bool bHidden = false;
+
+	int End() const { return Start + Count; }
+};
+
 USTRUCT()
 struct FInstancedMeshCacheEntry
 {
@@ -87,7 +115,24 @@ struct FInstancedMeshCacheEntry
 	TWeakObjectPtr<UStaticMesh> Mesh;
 	UPROPERTY( Transient )
 	TWeakObjectPtr<UInstancedStaticMeshComponent> InstancedMeshes;
-	TSharedPtr<TArray<FTransform>> PendingInstances;
+	//added since last update, by geometry id
+	TMap<int, TArray<FTransform>> PendingInstances;
+	//placement of every component instance (hidden and free ones are collapsed in the component)
+	TArray<FTransform> Transforms;
+	//instances of each geometry id, and unused runs to place later ones in
+	TMap<int, FInstanceRange> Ranges;
+	TArray<FInstanceRange> FreeRanges;
+
+	//instance management, only the instances affected are updated
+	void PlaceInstances( int geometry_id, const TArray<FTransform>& transforms );
+	void FreeInstances( int geometry_id );
+	void TakeInstances( int geometry_id, TArray<FTransform>& transforms_out );
+	void SetInstancesVisible( int geometry_id, bool visible );
+
+private:
+	void AddFreeRange( FInstanceRange range );
+	void TrimFreeRanges();
+	void WriteInstances( int start, int count, bool hidden );
 };
 
 
@@ -108,7 +153,7 @@ class APPARANCEUNREAL_API AApparanceEntity
 	bool bPostLoadInitRequired;
 	bool bSuppressTransformUpdates;
 
-	TArray<class UProceduralMeshComponent*> DeferredGeometryRemoval;
+	TArray<class UPrimitiveComponent*> DeferredGeometryRemoval;
 	//cached parameters	
 	mutable TSharedPtr<Apparance::IParameterCollection>	InstanceParameters;
 	TSharedPtr<Apparance::IParameterCollection> OverrideParameters;
@@ -150,6 +195,12 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Instanced, Category = "Apparance", AdvancedDisplay )
 	class UBodySetup* CollisionSetup;
 
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Apparance", AdvancedDisplay, meta = (ToolTip = "How generated collision geometry becomes physics shapes (Default uses the project setting)"))
+	EApparanceCollisionMode CollisionMode = EApparanceCollisionMode::Default;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Apparance", AdvancedDisplay, meta = (ToolTip = "Collision mode override per detail tier, by tier index (Default uses the entity collision mode)"))
+	TArray<EApparanceCollisionMode> DetailTierCollisionModes;
+
 	// generated content management
 	TSharedPtr<class FEntityRendering>					m_pEntityRendering;
 	
@@ -175,11 +226,11 @@ public:
 public:
 	// geometry/component caching (by generated content id)
 	UPROPERTY(Transient)
-	TMap<int, TWeakObjectPtr<class UProceduralMeshComponent>> GeometryCache;
+	TMap<int, FGeometryCacheEntry> GeometryCache;
 	UPROPERTY( Transient )
-	TMap<int, TWeakObjectPtr<class UProceduralMeshComponent>> CollisionCache;
+	TMap<int, FCollisionCacheEntry> CollisionCache;
 	UPROPERTY(Transient)
-	TMap<int, TWeakObjectPtr<class UMaterialInstanceDynamic>> MaterialCache;
+	TMap<uint64, TWeakObjectPtr<class UMaterialInstanceDynamic>> MaterialCache;	//by material id, tier, and variant slot
 	UPROPERTY(Transient)
 	TMap<int, FMeshCacheEntry> MeshCache;
 	UPROPERTY(Transient)
@@ -195,6 +246,9 @@ private:
 	TArray<FInstancedMeshCacheEntry> InstanceMeshCache;
 	UPROPERTY(Transient)
 	TMap<class UStaticMesh*, int> InstancedMeshCacheLookup;
+	// instanced meshes shared with other entities (see UApparanceInstancePool), world space pending placement, and pool handles, by geometry id
+	TMap<int, TMap<TWeakObjectPtr<class UStaticMesh>, TArray<FTransform>>> PooledPendingInstances;
+	TMap<int, TArray<int>> PooledInstances;
 
 	//integrity check to spot actors that should definitely not be persisted
 	//NOTE: specific case - bp based proc placed actors get turned from transient to transactional by a bp compile
@@ -207,6 +261,7 @@ public:
 
 	//access
 	bool UseMeshInstancing() const { return bUseMeshInstancing; }
+	EApparanceCollisionMode GetCollisionMode( int tier_index ) const;
 	bool FindFirstFrame( Apparance::Frame& frame_out, bool& worldspace_out, EApparanceFrameOrigin& frameorigin_out ) const;
 	bool HasComponentOfType(const UClass* pcomponent_class) const;
 
@@ -309,17 +364,23 @@ public:
 	// entity rendering access
 	class FEntityRendering* GetEntityRendering() const { return m_pEntityRendering.Get(); }
 	void BeginGeometryUpdate();
-	void EndGeometryUpdate( int tier_index );
-	class UProceduralMeshComponent* AddGeometry(Apparance::Host::IGeometry* geometry, int tier_index, FVector unreal_offset, UProceduralMeshComponent*& pcollision_mesh_out );
-	void                            RemoveGeometry(class UProceduralMeshComponent* pcomponent);
+	void EndGeometryUpdate( int geometry_id, int tier_index );
+	void                            AddGeometry(Apparance::Host::IGeometry* geometry, int tier_index, FVector unreal_offset, TArray<class UMeshComponent*>& geometry_out, TArray<class UPrimitiveComponent*>& collision_out );
+	void                            RemoveGeometry(class UPrimitiveComponent* pcomponent);
+	class UProceduralMeshComponent* AddMergedGeometry( int tier_index );
 	class UStaticMeshComponent*     AddMesh(class UStaticMesh* psource, FMatrix& local_placement);
 	void                            RemoveMesh(class UStaticMeshComponent* pcomponent);
 	class AActor*					AddBlueprint_Begin(class UBlueprintGeneratedClass* pclasstemplate, FMatrix& local_placement);
 	void                            AddBlueprint_End( AActor* pactor, FMatrix& local_placement, const Apparance::IParameterCollection* placement_parameters );
 	void                            RemoveBlueprint(class AActor* pactor);
-	FMeshInstanceHandle				AddInstancedMesh(class UStaticMesh* psource,FMatrix& local_placement);
-	void							RemoveInstancedMesh(FMeshInstanceHandle mesh_handle);
+	FMeshInstanceHandle				AddInstancedMesh(int geometry_id, class UStaticMesh* psource,FMatrix& local_placement);
+	void							PlaceInstancedMeshes(int geometry_id);
+	void							RemoveInstancedMeshes(int geometry_id);
+	void							TakeInstancedMeshes(int geometry_id, class UStaticMesh* pmesh, TArray<FTransform>& local_placements_out);
+	void							SetInstancedMeshVisibility(int geometry_id, bool visible);
 	void							RemoveAllInstancedMeshes();
+	bool							UseInstancePool() const;
+	class UApparanceInstancePool*	GetInstancePool() const;
 	class UActorComponent*          AddActorComponent(const class UApparanceResourceListEntry_Component* psource, FMatrix& local_placement);
 	void                            RemoveActorComponent(class UActorComponent* pcomponent);
 	
@@ -353,7 +414,7 @@ private:
 	//content management
 	void ClearContent();
 	void DestroyContent();
-	void RemoveGeometryInternal( class UProceduralMeshComponent* pcomponent );
+	void RemoveGeometryInternal( class UPrimitiveComponent* pcomponent );
 	void ClearDeferredRemovals();
 	void TidyCaches();
 
@@ -53,6 +53,9 @@ class APPARANCEUNREAL_API FApparanceUnrealModule
 	//editing
 	TMap<class UWorld* , class USmartEditingState*> m_EditingStates; //all active editing states and the world they are associated with
 
+	//views
+	TArray<TWeakObjectPtr<class USceneComponent>> m_DetailViews; //extra views content detail is needed for, e.g. scene captures
+
 public:
 
 	/** IModuleInterface implementation */
@@ -104,6 +107,11 @@ public:
 	// editing (smart objects/handles)
 	class USmartEditingState* IsEditingEnabled( class UWorld* world ) const;
 	class USmartEditingState* EnableEditing( class UWorld* world, bool enable, bool force=false );
+
+	// views (rendered last frame, plus any registered)
+	void RegisterDetailView( class USceneComponent* pview );
+	void UnregisterDetailView( class USceneComponent* pview );
+	void GetViewLocations( class UWorld* world, TArray<FVector>& locations_out );
 	
 	//helpers
 	static FString MakeWorldIdentifier( AActor* pactor );
@@ -468,6 +468,15 @@ public:
 	UFUNCTION( BlueprintCallable, Category = "Apparance|Engine", meta = (ToolTip = "Control time limit for content placement in a single frame. Set to zero for one-at-a-time. Increase during loading screen for boost.") )
 	static void SetTimeslice( float MaxMilliseconds );
 
+	UFUNCTION( BlueprintCallable, Category = "Apparance|Engine", meta = (ToolTip = "Signal content is loading (e.g. behind a loading screen), content placement gets most of each frame until cleared.") )
+	static void SetLoading( bool Loading );
+
+	UFUNCTION( BlueprintCallable, Category = "Apparance|Engine", meta = (ToolTip = "Generate content detail for an additional view, e.g. a scene capture for a minimap or security camera. Viewports being rendered are included automatically.") )
+	static void RegisterDetailView( class USceneComponent* View );
+
+	UFUNCTION( BlueprintCallable, Category = "Apparance|Engine", meta = (ToolTip = "Stop generating content detail for a view registered with RegisterDetailView.") )
+	static void UnregisterDetailView( class USceneComponent* View );
+
 	UFUNCTION( BlueprintCallable, Category = "Apparance|Engine", meta = (ToolTip = "Prepare for loading progress calculations. Call before loading main level.") )
 	static void ResetGenerationCounter();
 